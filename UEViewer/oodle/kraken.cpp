@@ -18,6 +18,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "stdafx.h"
 
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <math.h>
+
 // Header in front of each 256k block
 typedef struct KrakenHeader {
   // Type of decoder used, 6 means kraken
@@ -146,6 +152,10 @@ typedef struct KrakenDecoder {
   size_t scratch_size;
 
   KrakenHeader hdr;
+
+  // Output before this offset may not be referenced. Zero unless a run is
+  // decoded on its own.
+  size_t window_offset;
 } KrakenDecoder;
 
 typedef struct BitReader {
@@ -2660,14 +2670,19 @@ bool Kraken_ProcessLzRuns_Type1(KrakenLzTable *lzt, byte *dst, byte *dst_end, by
   return true;
 }
 
-bool Kraken_ProcessLzRuns(int mode, byte *dst, int dst_size, int offset, KrakenLzTable *lztable) {
+bool Kraken_ProcessLzRuns(int mode, byte *dst, int dst_size, int offset, byte *window_base, KrakenLzTable *lztable) {
   byte *dst_end = dst + dst_size;
+  byte *dst_cur = dst + (offset == 0 ? 8 : 0);
 
   if (mode == 1)
-    return Kraken_ProcessLzRuns_Type1(lztable, dst + (offset == 0 ? 8 : 0), dst_end, dst - offset);
+    return Kraken_ProcessLzRuns_Type1(lztable, dst_cur, dst_end, window_base);
+
+  // delta literals start out 8 bytes back
+  if (mode == 0 && dst_cur - window_base < 8)
+    return false;
 
   if (mode == 0)
-    return Kraken_ProcessLzRuns_Type0(lztable, dst + (offset == 0 ? 8 : 0), dst_end, dst - offset);
+    return Kraken_ProcessLzRuns_Type0(lztable, dst_cur, dst_end, window_base);
 
 
   return false;
@@ -2675,7 +2690,7 @@ bool Kraken_ProcessLzRuns(int mode, byte *dst, int dst_size, int offset, KrakenL
 
 // Decode one 256kb big quantum block. It's divided into two 128k blocks
 // internally that are compressed separately but with a shared history.
-int Kraken_DecodeQuantum(byte *dst, byte *dst_end, byte *dst_start,
+int Kraken_DecodeQuantum(byte *dst, byte *dst_end, byte *dst_start, byte *window_base,
                          const byte *src, const byte *src_end,
                          byte *scratch, byte *scratch_end) {
   const byte *src_in = src;
@@ -2710,7 +2725,7 @@ int Kraken_DecodeQuantum(byte *dst, byte *dst_end, byte *dst_start,
                                scratch + sizeof(KrakenLzTable), scratch + scratch_usage,
                                (KrakenLzTable*)scratch))
           return -1;
-        if (!Kraken_ProcessLzRuns(mode, dst, dst_count, dst - dst_start, (KrakenLzTable*)scratch))
+        if (!Kraken_ProcessLzRuns(mode, dst, dst_count, dst - dst_start, window_base, (KrakenLzTable*)scratch))
           return -1;
       } else if (src_used > dst_count || mode != 0) {
         return -1;
@@ -3289,42 +3304,45 @@ bool Leviathan_ProcessLz(LeviathanLzTable *lzt, uint8 *dst,
   return true;
 }
 
-bool Leviathan_ProcessLzRuns(int chunk_type, byte *dst, int dst_size, int offset, LeviathanLzTable *lzt) {
+bool Leviathan_ProcessLzRuns(int chunk_type, byte *dst, int dst_size, int offset, byte *window_base, LeviathanLzTable *lzt) {
   uint8 *dst_cur = dst + (offset == 0 ? 8 : 0);
   uint8 *dst_end = dst + dst_size;
-  uint8 *dst_start = dst - offset;
+
+  // all but raw literals look back, delta literals 8 bytes to begin with
+  if (chunk_type != 1 && dst_cur - window_base < 8)
+    return false;
   
   if (lzt->cmd_stream != NULL) {
     // single cmd mode
     switch (chunk_type) {
     case 0:
-      return Leviathan_ProcessLz<LeviathanModeSub, false>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeSub, false>(lzt, dst_cur, dst, dst_end, window_base);
     case 1:
-      return Leviathan_ProcessLz<LeviathanModeRaw, false>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeRaw, false>(lzt, dst_cur, dst, dst_end, window_base);
     case 2:
-      return Leviathan_ProcessLz<LeviathanModeLamSub, false>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeLamSub, false>(lzt, dst_cur, dst, dst_end, window_base);
     case 3:
-      return Leviathan_ProcessLz<LeviathanModeSubAnd3, false>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeSubAnd3, false>(lzt, dst_cur, dst, dst_end, window_base);
     case 4:
-      return Leviathan_ProcessLz<LeviathanModeO1, false>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeO1, false>(lzt, dst_cur, dst, dst_end, window_base);
     case 5:
-      return Leviathan_ProcessLz<LeviathanModeSubAndF, false>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeSubAndF, false>(lzt, dst_cur, dst, dst_end, window_base);
     }
   } else {
     // multi cmd mode
     switch (chunk_type) {
     case 0:
-      return Leviathan_ProcessLz<LeviathanModeSub, true>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeSub, true>(lzt, dst_cur, dst, dst_end, window_base);
     case 1:
-      return Leviathan_ProcessLz<LeviathanModeRaw, true>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeRaw, true>(lzt, dst_cur, dst, dst_end, window_base);
     case 2:
-      return Leviathan_ProcessLz<LeviathanModeLamSub, true>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeLamSub, true>(lzt, dst_cur, dst, dst_end, window_base);
     case 3:
-      return Leviathan_ProcessLz<LeviathanModeSubAnd3, true>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeSubAnd3, true>(lzt, dst_cur, dst, dst_end, window_base);
     case 4:
-      return Leviathan_ProcessLz<LeviathanModeO1, true>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeO1, true>(lzt, dst_cur, dst, dst_end, window_base);
     case 5:
-      return Leviathan_ProcessLz<LeviathanModeSubAndF, true>(lzt, dst_cur, dst, dst_end, dst_start);
+      return Leviathan_ProcessLz<LeviathanModeSubAndF, true>(lzt, dst_cur, dst, dst_end, window_base);
     }
 
   }
@@ -3335,7 +3353,7 @@ bool Leviathan_ProcessLzRuns(int chunk_type, byte *dst, int dst_size, int offset
 
 // Decode one 256kb big quantum block. It's divided into two 128k blocks
 // internally that are compressed separately but with a shared history.
-int Leviathan_DecodeQuantum(byte *dst, byte *dst_end, byte *dst_start,
+int Leviathan_DecodeQuantum(byte *dst, byte *dst_end, byte *dst_start, byte *window_base,
                             const byte *src, const byte *src_end,
                             byte *scratch, byte *scratch_end) {
   const byte *src_in = src;
@@ -3370,7 +3388,7 @@ int Leviathan_DecodeQuantum(byte *dst, byte *dst_end, byte *dst_start,
             scratch + sizeof(LeviathanLzTable), scratch + scratch_usage,
             (LeviathanLzTable*)scratch))
           return -1;
-        if (!Leviathan_ProcessLzRuns(mode, dst, dst_count, dst - dst_start, (LeviathanLzTable*)scratch))
+        if (!Leviathan_ProcessLzRuns(mode, dst, dst_count, dst - dst_start, window_base, (LeviathanLzTable*)scratch))
           return -1;
       } else if (src_used > dst_count || mode != 0) {
         return -1;
@@ -3589,7 +3607,7 @@ bool Mermaid_ReadLzTable(int mode,
   return true;
 }
 
-const byte *Mermaid_Mode0(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *dst_start,
+const byte *Mermaid_Mode0(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *window_base,
                           const byte *src_end, MermaidLzTable *lz, int32 *saved_dist, size_t startoff) {
   const byte *dst_end = dst + dst_size;
   const byte *cmd_stream = lz->cmd_stream;
@@ -3620,6 +3638,8 @@ const byte *Mermaid_Mode0(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
       recent_offs ^= use_distance & (recent_offs ^ -new_dist);
       off16_stream = (uint16*)((uintptr_t)off16_stream + (use_distance & 2));
       match = dst + recent_offs;
+      if (match < window_base)
+        return NULL;
       COPY_64(dst, match);
       COPY_64(dst + 8, match + 8);
       dst += (cmd >> 3) & 0xF;
@@ -3629,6 +3649,8 @@ const byte *Mermaid_Mode0(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
       if (off32_stream == off32_stream_end)
         return NULL;
       match = dst_begin - *off32_stream++;
+      if (match < window_base)
+        return NULL;
       recent_offs = (match - dst);
 
       if (dst_end - dst < length)
@@ -3681,6 +3703,8 @@ const byte *Mermaid_Mode0(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
       if (off16_stream == off16_stream_end)
         return NULL;
       match = dst - *off16_stream++;
+      if (match < window_base)
+        return NULL;
       recent_offs = (match - dst);
       do {
         COPY_64(dst, match);
@@ -3705,6 +3729,8 @@ const byte *Mermaid_Mode0(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
       if (off32_stream == off32_stream_end)
         return NULL;
       match = dst_begin - *off32_stream++;
+      if (match < window_base)
+        return NULL;
       recent_offs = (match - dst);
       do {
         COPY_64(dst, match);
@@ -3741,7 +3767,7 @@ const byte *Mermaid_Mode0(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
   return length_stream;
 }
 
-const byte *Mermaid_Mode1(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *dst_start,
+const byte *Mermaid_Mode1(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *window_base,
                          const byte *src_end, MermaidLzTable *lz, int32 *saved_dist, size_t startoff) {
   const byte *dst_end = dst + dst_size;
   const byte *cmd_stream = lz->cmd_stream;
@@ -3772,6 +3798,8 @@ const byte *Mermaid_Mode1(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
       recent_offs ^= use_distance & (recent_offs ^ -new_dist);
       off16_stream = (uint16*)((uintptr_t)off16_stream + (use_distance & 2));
       match = dst + recent_offs;
+      if (match < window_base)
+        return NULL;
       COPY_64(dst, match);
       COPY_64(dst + 8, match + 8);
       dst += (flag >> 3) & 0xF;
@@ -3781,6 +3809,8 @@ const byte *Mermaid_Mode1(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
       if (off32_stream == off32_stream_end)
         return NULL;
       match = dst_begin - *off32_stream++;
+      if (match < window_base)
+        return NULL;
       recent_offs = (match - dst);
       
       if (dst_end - dst < length)
@@ -3833,6 +3863,8 @@ const byte *Mermaid_Mode1(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
       if (off16_stream == off16_stream_end)
         return NULL;
       match = dst - *off16_stream++;
+      if (match < window_base)
+        return NULL;
       recent_offs = (match - dst);
       do {
         COPY_64(dst, match);
@@ -3858,6 +3890,8 @@ const byte *Mermaid_Mode1(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
       if (off32_stream == off32_stream_end)
         return NULL;
       match = dst_begin - *off32_stream++;
+      if (match < window_base)
+        return NULL;
       recent_offs = (match - dst);
       
       do {
@@ -3898,13 +3932,16 @@ const byte *Mermaid_Mode1(byte *dst, size_t dst_size, byte *dst_ptr_end, byte *d
 bool Mermaid_ProcessLzRuns(int mode,
                            const byte *src, const byte *src_end,
                            byte *dst, size_t dst_size, uint64 offset, byte *dst_end,
-                           MermaidLzTable *lz) {
+                           byte *window_base, MermaidLzTable *lz) {
   
   int iteration = 0;
-  byte *dst_start = dst - offset;
   int32 saved_dist = -8;
   const byte *src_cur;
 
+  // delta literals start out 8 bytes back
+  if (mode == 0 && dst + (offset == 0 ? 8 : 0) - window_base < 8)
+    return false;
+
   for (iteration = 0; iteration != 2; iteration++) {
     size_t dst_size_cur = dst_size;
     if (dst_size_cur > 0x10000) dst_size_cur = 0x10000;
@@ -3921,10 +3958,10 @@ bool Mermaid_ProcessLzRuns(int mode,
     }
 
     if (mode == 0) {
-      src_cur = Mermaid_Mode0(dst, dst_size_cur, dst_end, dst_start, src_end, lz, &saved_dist, 
+      src_cur = Mermaid_Mode0(dst, dst_size_cur, dst_end, window_base, src_end, lz, &saved_dist, 
         (offset == 0) && (iteration == 0) ? 8 : 0);
     } else {
-      src_cur = Mermaid_Mode1(dst, dst_size_cur, dst_end, dst_start, src_end, lz, &saved_dist,
+      src_cur = Mermaid_Mode1(dst, dst_size_cur, dst_end, window_base, src_end, lz, &saved_dist,
         (offset == 0) && (iteration == 0) ? 8 : 0);
     }
     if (src_cur == NULL)
@@ -3943,7 +3980,7 @@ bool Mermaid_ProcessLzRuns(int mode,
 }
 
 
-int Mermaid_DecodeQuantum(byte *dst, byte *dst_end, byte *dst_start,
+int Mermaid_DecodeQuantum(byte *dst, byte *dst_end, byte *dst_start, byte *window_base,
                           const byte *src, const byte *src_end,
                           byte *temp, byte *temp_end) {
   const byte *src_in = src;
@@ -3981,7 +4018,7 @@ int Mermaid_DecodeQuantum(byte *dst, byte *dst_end, byte *dst_start,
                                    src, src + src_used,
                                    dst, dst_count,
                                    dst - dst_start, dst_end,
-                                   (MermaidLzTable*)temp))
+                                   window_base, (MermaidLzTable*)temp))
           return -1;
       } else if (src_used > dst_count || mode != 0) {
         return -1;
@@ -4022,6 +4059,7 @@ bool Kraken_DecodeStep(struct KrakenDecoder *dec,
                        const byte *src, size_t src_bytes_left) {
   const byte *src_in = src;
   const byte *src_end = src + src_bytes_left;
+  byte *window_base = dst_start + dec->window_offset;
   KrakenQuantumHeader qhdr;
   int n;
 
@@ -4066,7 +4104,7 @@ bool Kraken_DecodeStep(struct KrakenDecoder *dec,
 
   if (qhdr.compressed_size == 0) {
     if (qhdr.whole_match_distance != 0) {
-      if (qhdr.whole_match_distance > (uint32)offset)
+      if (qhdr.whole_match_distance > (uint32)(dst_start + offset - window_base))
         return false;
       Kraken_CopyWholeMatch(dst_start + offset, qhdr.whole_match_distance, dst_bytes_left);
     } else {
@@ -4089,7 +4127,7 @@ bool Kraken_DecodeStep(struct KrakenDecoder *dec,
   }
 
   if (dec->hdr.decoder_type == 6) {
-    n = Kraken_DecodeQuantum(dst_start + offset, dst_start + offset + dst_bytes_left, dst_start,
+    n = Kraken_DecodeQuantum(dst_start + offset, dst_start + offset + dst_bytes_left, dst_start, window_base,
                          src, src + qhdr.compressed_size,
                          dec->scratch, dec->scratch + dec->scratch_size);
   } else if (dec->hdr.decoder_type == 5) {
@@ -4108,11 +4146,11 @@ bool Kraken_DecodeStep(struct KrakenDecoder *dec,
     n = (int)Bitknit_Decode(src, src + qhdr.compressed_size, dst_start + offset, dst_start + offset + dst_bytes_left, dst_start, (struct BitknitState*)dec->scratch);
 
   } else if (dec->hdr.decoder_type == 10) {
-    n = Mermaid_DecodeQuantum(dst_start + offset, dst_start + offset + dst_bytes_left, dst_start,
+    n = Mermaid_DecodeQuantum(dst_start + offset, dst_start + offset + dst_bytes_left, dst_start, window_base,
                               src, src + qhdr.compressed_size,
                               dec->scratch, dec->scratch + dec->scratch_size);
   } else if (dec->hdr.decoder_type == 12) {
-    n = Leviathan_DecodeQuantum(dst_start + offset, dst_start + offset + dst_bytes_left, dst_start,
+    n = Leviathan_DecodeQuantum(dst_start + offset, dst_start + offset + dst_bytes_left, dst_start, window_base,
                                 src, src + qhdr.compressed_size,
                                 dec->scratch, dec->scratch + dec->scratch_size);
   } else {
@@ -4127,7 +4165,7 @@ bool Kraken_DecodeStep(struct KrakenDecoder *dec,
   return true;
 }
   
-int Kraken_Decompress(const byte *src, size_t src_len, byte *dst, size_t dst_len) {
+static int Kraken_DecompressSerial(const byte *src, size_t src_len, byte *dst, size_t dst_len) {
   KrakenDecoder *dec = Kraken_Create();
   int offset = 0;
   while (dst_len != 0) {
@@ -4149,6 +4187,1485 @@ FAIL:
   return -1;
 }
 
+// A block that restarts the decoder and the blocks up to the next restart.
+struct KrakenRun {
+  size_t src_offset, src_end;
+  size_t dst_offset, dst_end;
+};
+
+// Walk the block and quantum headers without decoding to find the runs.
+// Fails for decoders that keep state across quanta and for whole matches
+// that reach back past the start of their run.
+static bool Kraken_FindRuns(const byte *src, size_t src_len, size_t dst_len, std::vector<KrakenRun> *runs) {
+  const byte *src_in = src, *src_end = src + src_len;
+  KrakenHeader hdr;
+  KrakenQuantumHeader qhdr;
+  size_t offset = 0;
+
+  while (offset < dst_len) {
+    if ((offset & 0x3FFFF) == 0) {
+      if (src_end - src < 2)
+        return false;
+      const byte *p = Kraken_ParseHeader(&hdr, src);
+      if (!p)
+        return false;
+      if (hdr.decoder_type != 6 && hdr.decoder_type != 10 && hdr.decoder_type != 12)
+        return false;
+      if (hdr.restart_decoder || offset == 0) {
+        if (!runs->empty()) {
+          runs->back().src_end = src - src_in;
+          runs->back().dst_end = offset;
+        }
+        KrakenRun run = { (size_t)(src - src_in), 0, offset, 0 };
+        runs->push_back(run);
+      }
+      src = p;
+    }
+
+    size_t dst_count = Min(0x40000, dst_len - offset);
+
+    if (hdr.uncompressed) {
+      src += dst_count;
+    } else {
+      if (src_end - src < 6)
+        return false;
+      src = Kraken_ParseQuantumHeader(&qhdr, src, hdr.use_checksums);
+      if (!src || (size_t)(src_end - src) < qhdr.compressed_size)
+        return false;
+      if (qhdr.compressed_size == 0 && qhdr.whole_match_distance > offset - runs->back().dst_offset)
+        return false;
+      src += qhdr.compressed_size;
+    }
+    if (src > src_end)
+      return false;
+    offset += dst_count;
+  }
+
+  if (src != src_end)
+    return false;
+  runs->back().src_end = src_len;
+  runs->back().dst_end = dst_len;
+  return true;
+}
+
+// Decodes a run with the window starting at the run, so it fails on a
+// reference to the output of the runs before it.
+static bool Kraken_DecodeRun(KrakenDecoder *dec, const KrakenRun &run, const byte *src, byte *dst) {
+  const byte *src_cur = src + run.src_offset, *src_end = src + run.src_end;
+  size_t offset = run.dst_offset;
+
+  dec->window_offset = run.dst_offset;
+  while (offset < run.dst_end) {
+    if (!Kraken_DecodeStep(dec, dst, (int)offset, run.dst_end - offset, src_cur, src_end - src_cur))
+      return false;
+    if (dec->src_used == 0)
+      return false;
+    src_cur += dec->src_used;
+    offset += dec->dst_used;
+  }
+  return src_cur == src_end;
+}
+
+// Quanta may write up to this many bytes past their end.
+#define RUN_SAFE_SPACE 64
+
+// Decode runs on num_threads threads (0 for all hardware threads). Runs
+// that reference each other's output, which Kraken_Compress never writes
+// but Oodle may, fail to decode on their own and the stream is decoded
+// serially instead.
+// Even runs are decoded first, then odd runs. Writes past the end of a run
+// then only land in runs that haven't started yet, or in the first bytes of
+// even runs that are saved before the odd pass and restored after it.
+int Kraken_DecompressThreaded(const byte *src, size_t src_len, byte *dst, size_t dst_len, int num_threads) {
+  std::vector<KrakenRun> runs;
+
+  if (num_threads <= 0)
+    num_threads = (int)std::thread::hardware_concurrency();
+  if (num_threads <= 1 || dst_len <= 0x40000 ||
+      !Kraken_FindRuns(src, src_len, dst_len, &runs) || runs.size() < 2)
+    return Kraken_DecompressSerial(src, src_len, dst, dst_len);
+
+  std::atomic<bool> failed(false);
+  std::vector<byte> saved(runs.size() * RUN_SAFE_SPACE);
+
+  for (size_t pass = 0; pass < 2 && !failed; pass++) {
+    std::atomic<size_t> next_run(pass);
+    std::vector<std::thread> threads;
+    size_t run_count = (runs.size() - pass + 1) / 2;
+
+    auto decode_runs = [&]() {
+      KrakenDecoder *dec = Kraken_Create();
+      for (size_t i; !failed && (i = next_run.fetch_add(2)) < runs.size(); ) {
+        if (!Kraken_DecodeRun(dec, runs[i], src, dst))
+          failed = true;
+      }
+      Kraken_Destroy(dec);
+    };
+
+    if (pass == 1) {
+      for (size_t i = 2; i < runs.size(); i += 2)
+        memcpy(&saved[i * RUN_SAFE_SPACE], dst + runs[i].dst_offset, Min(RUN_SAFE_SPACE, runs[i].dst_end - runs[i].dst_offset));
+    }
+
+    for (size_t i = 1; i < Min(num_threads, run_count); i++)
+      threads.push_back(std::thread(decode_runs));
+    decode_runs();
+    for (std::thread &thread : threads)
+      thread.join();
+
+    if (pass == 1) {
+      for (size_t i = 2; i < runs.size(); i += 2)
+        memcpy(dst + runs[i].dst_offset, &saved[i * RUN_SAFE_SPACE], Min(RUN_SAFE_SPACE, runs[i].dst_end - runs[i].dst_offset));
+    }
+  }
+
+  if (failed)
+    return Kraken_DecompressSerial(src, src_len, dst, dst_len);
+  return (int)dst_len;
+}
+
+int Kraken_Decompress(const byte *src, size_t src_len, byte *dst, size_t dst_len) {
+  return Kraken_DecompressThreaded(src, src_len, dst, dst_len, 0);
+}
+
+enum {
+  kCompressor_Kraken = 8,
+  kCompressor_Mermaid = 9,
+  kCompressor_Selkie = 11,
+  kCompressor_Hydra = 12,
+  kCompressor_Leviathan = 13,
+};
+
+// Writes bits MSB first, the order BitReader reads them in.
+struct BitWriter {
+  byte *p;
+  uint64 bits;
+  int bitpos;
+};
+
+static void BitWriter_Init(BitWriter *bw, byte *p) {
+  bw->p = p;
+  bw->bits = 0;
+  bw->bitpos = 0;
+}
+
+// Write the low |n| bits of |v|, n <= 32.
+static void BitWriter_Write(BitWriter *bw, uint32 v, int n) {
+  bw->bits = (bw->bits << n) | v;
+  bw->bitpos += n;
+  while (bw->bitpos >= 8) {
+    bw->bitpos -= 8;
+    *bw->p++ = (byte)(bw->bits >> bw->bitpos);
+  }
+}
+
+static byte *BitWriter_Flush(BitWriter *bw) {
+  if (bw->bitpos > 0)
+    *bw->p++ = (byte)(bw->bits << (8 - bw->bitpos));
+  bw->bitpos = 0;
+  return bw->p;
+}
+
+// Writes bits LSB first, the order the huffman streams are read in.
+struct BitWriterLsb {
+  byte *p;
+  uint64 bits;
+  int bitpos;
+};
+
+static void BitWriterLsb_Write(BitWriterLsb *bw, uint32 v, int n) {
+  bw->bits |= (uint64)v << bw->bitpos;
+  bw->bitpos += n;
+  while (bw->bitpos >= 8) {
+    *bw->p++ = (byte)bw->bits;
+    bw->bits >>= 8;
+    bw->bitpos -= 8;
+  }
+}
+
+static byte *BitWriterLsb_Flush(BitWriterLsb *bw) {
+  if (bw->bitpos > 0)
+    *bw->p++ = (byte)bw->bits;
+  bw->bitpos = 0;
+  return bw->p;
+}
+
+// Builds huffman code lengths of at most 11 bits, the longest the decoder
+// supports. Unused symbols get length 0.
+static void Huff_BuildCodeLengths(const uint32 *histo, uint8 *codelen) {
+  int syms[256], parent[512], depth[512];
+  uint32 freq[512];
+  int n = 0, i;
+
+  memset(codelen, 0, 256);
+  for (i = 0; i < 256; i++)
+    if (histo[i])
+      syms[n++] = i;
+  if (n == 0)
+    return;
+  if (n == 1) {
+    // A complete code needs two symbols, pair it with an unused one.
+    codelen[syms[0]] = codelen[syms[0] ^ 1] = 1;
+    return;
+  }
+  std::sort(syms, syms + n, [histo](int a, int b) { return histo[a] < histo[b]; });
+
+  // Leaves are sorted and internal nodes are created in increasing order,
+  // so the two smallest nodes are always at the front of either queue.
+  int leaf = 0, node = n, next = n;
+  for (i = 0; i < n; i++)
+    freq[i] = histo[syms[i]];
+  for (i = 0; i < n - 1; i++) {
+    int a = (leaf < n && (node >= next || freq[leaf] <= freq[node])) ? leaf++ : node++;
+    int b = (leaf < n && (node >= next || freq[leaf] <= freq[node])) ? leaf++ : node++;
+    freq[next] = freq[a] + freq[b];
+    parent[a] = parent[b] = next++;
+  }
+  depth[next - 1] = 0;
+  for (i = next - 2; i >= 0; i--)
+    depth[i] = depth[parent[i]] + 1;
+
+  int kraft = 0;
+  for (i = 0; i < n; i++) {
+    int len = depth[i] > 11 ? 11 : depth[i];
+    codelen[syms[i]] = len;
+    kraft += 2048 >> len;
+  }
+  // Lengthen the rarest codes until the code fits in 11 bits, then shorten
+  // the most frequent ones where that leaves room.
+  for (i = 0; kraft > 2048; i = (i + 1) % n) {
+    uint8 *len = &codelen[syms[i]];
+    if (*len < 11) {
+      (*len)++;
+      kraft -= 2048 >> *len;
+    }
+  }
+  while (kraft < 2048) {
+    for (i = n - 1; i >= 0; i--) {
+      uint8 *len = &codelen[syms[i]];
+      while (*len > 1 && kraft + (2048 >> *len) <= 2048) {
+        kraft += 2048 >> *len;
+        (*len)--;
+      }
+    }
+  }
+}
+
+// Canonical codes in the order Huff_MakeLut assigns them, bit reversed so
+// they can be written LSB first.
+static void Huff_MakeCodes(const uint8 *codelen, uint16 *code) {
+  uint32 slot = 0;
+  for (int len = 1; len <= 11; len++) {
+    for (int i = 0; i < 256; i++) {
+      if (codelen[i] != len)
+        continue;
+      uint32 c = slot >> (11 - len), r = 0;
+      for (int j = 0; j < len; j++)
+        r |= ((c >> j) & 1) << (len - 1 - j);
+      code[i] = r;
+      slot += 2048 >> len;
+    }
+  }
+}
+
+// Writes |v| >= 2 as the gamma code Huff_ReadCodeLengthsOld reads runs with.
+static int Huff_WriteGamma(BitWriter *bw, uint32 v) {
+  int n = BSR(v) + 1;
+  if (bw)
+    BitWriter_Write(bw, v, 2 * n - 2);
+  return 2 * n - 2;
+}
+
+// Writes the code lengths in the dense format of Huff_ReadCodeLengthsOld.
+// Returns the number of bits, -1 if |forced_bits| can't code the lengths.
+// Only counts the bits if |bw| is NULL.
+static int Huff_WriteCodeLengthsDense(BitWriter *bw, const uint8 *codelen, int forced_bits) {
+  int bits = 4, sym = 0, avg_bits_x4 = 32;
+  int max_zeros = 20 >> forced_bits;
+
+  // Old format, dense
+  if (bw) {
+    BitWriter_Write(bw, 1, 2);
+    BitWriter_Write(bw, forced_bits, 2);
+  }
+  bits++;
+  if (bw)
+    BitWriter_Write(bw, codelen[0] != 0, 1);
+  while (sym < 256) {
+    int n = 0;
+    if (!codelen[sym]) {
+      while (sym + n < 256 && !codelen[sym + n])
+        n++;
+      bits += Huff_WriteGamma(bw, n + 1);
+      sym += n;
+      continue;
+    }
+    while (sym + n < 256 && codelen[sym + n])
+      n++;
+    bits += Huff_WriteGamma(bw, n + 1);
+    for (; n; n--, sym++) {
+      int delta = codelen[sym] - ((avg_bits_x4 + 2) >> 2);
+      uint32 v = delta >= 0 ? 2 * delta : -2 * delta - 1;
+      int zeros = v >> forced_bits;
+      if (zeros > max_zeros)
+        return -1;
+      if (bw)
+        BitWriter_Write(bw, (1 << forced_bits) | (v & ((1 << forced_bits) - 1)), zeros + forced_bits + 1);
+      bits += zeros + forced_bits + 1;
+      avg_bits_x4 = codelen[sym] + ((3 * avg_bits_x4 + 2) >> 2);
+    }
+  }
+  return bits;
+}
+
+// Sparse format: a list of (symbol, length) pairs.
+static int Huff_WriteCodeLengthsSparse(BitWriter *bw, const uint8 *codelen) {
+  int num_symbols = 0, max_len = 0, i;
+  for (i = 0; i < 256; i++) {
+    if (codelen[i]) {
+      num_symbols++;
+      if (codelen[i] > max_len)
+        max_len = codelen[i];
+    }
+  }
+  if (num_symbols > 255)
+    return -1;
+  int codelen_bits = max_len > 1 ? BSR(max_len - 1) + 1 : 0;
+  // Old format, sparse
+  if (bw) {
+    BitWriter_Write(bw, 0, 2);
+    BitWriter_Write(bw, num_symbols, 8);
+    BitWriter_Write(bw, codelen_bits, 3);
+    for (i = 0; i < 256; i++) {
+      if (codelen[i]) {
+        BitWriter_Write(bw, i, 8);
+        BitWriter_Write(bw, codelen[i] - 1, codelen_bits);
+      }
+    }
+  }
+  return 13 + num_symbols * (8 + codelen_bits);
+}
+
+static void Huff_WriteCodeLengths(BitWriter *bw, const uint8 *codelen) {
+  int best_bits = Huff_WriteCodeLengthsSparse(NULL, codelen), best = -1;
+  for (int forced_bits = 0; forced_bits < 4; forced_bits++) {
+    int bits = Huff_WriteCodeLengthsDense(NULL, codelen, forced_bits);
+    if (bits >= 0 && (best_bits < 0 || bits < best_bits)) {
+      best_bits = bits;
+      best = forced_bits;
+    }
+  }
+  if (best < 0)
+    Huff_WriteCodeLengthsSparse(bw, codelen);
+  else
+    Huff_WriteCodeLengthsDense(bw, codelen, best);
+}
+
+// Huffman codes |src| as the payload of a type 2 block, three interleaved
+// streams the way Kraken_DecodeBytes_Type12 reads them. Returns the payload
+// size, or -1 if it's not smaller than |dst_capacity|.
+static int Huff_EncodeBytes(byte *dst, int dst_capacity, const byte *src, int src_size, const uint32 *histo) {
+  uint8 codelen[256];
+  uint16 code[256];
+  uint32 stream_bits[3] = { 0, 0, 0 };
+  BitWriter bw;
+  int i;
+
+  Huff_BuildCodeLengths(histo, codelen);
+  Huff_MakeCodes(codelen, code);
+
+  byte hdr[1024];
+  BitWriter_Init(&bw, hdr);
+  Huff_WriteCodeLengths(&bw, codelen);
+  int hdr_size = BitWriter_Flush(&bw) - hdr;
+  if (hdr_size >= dst_capacity)
+    return -1;
+  memcpy(dst, hdr, hdr_size);
+  byte *p = dst + hdr_size;
+
+  // Symbols alternate between the first, the backwards and the middle stream
+  for (i = 0; i < src_size; i++)
+    stream_bits[i % 3] += codelen[src[i]];
+  int size1 = (stream_bits[0] + 7) >> 3, size2 = (stream_bits[2] + 7) >> 3, size3 = (stream_bits[1] + 7) >> 3;
+  if (size1 > 0xFFFF || (p - dst) + 2 + size1 + size2 + size3 >= dst_capacity)
+    return -1;
+  p[0] = (byte)size1;
+  p[1] = (byte)(size1 >> 8);
+  p += 2;
+
+  BitWriterLsb s1 = { p, 0, 0 }, s2 = { p + size1, 0, 0 }, s3 = { p + size1 + size2, 0, 0 };
+  for (i = 0; i + 3 <= src_size; i += 3) {
+    BitWriterLsb_Write(&s1, code[src[i + 0]], codelen[src[i + 0]]);
+    BitWriterLsb_Write(&s3, code[src[i + 1]], codelen[src[i + 1]]);
+    BitWriterLsb_Write(&s2, code[src[i + 2]], codelen[src[i + 2]]);
+  }
+  if (i < src_size)
+    BitWriterLsb_Write(&s1, code[src[i]], codelen[src[i]]);
+  if (i + 1 < src_size)
+    BitWriterLsb_Write(&s3, code[src[i + 1]], codelen[src[i + 1]]);
+  BitWriterLsb_Flush(&s1);
+  BitWriterLsb_Flush(&s2);
+  BitWriterLsb_Flush(&s3);
+  // The third stream is read backwards from the end
+  std::reverse(p + size1 + size2, p + size1 + size2 + size3);
+  p += size1 + size2 + size3;
+  return p - dst;
+}
+
+enum {
+  kEncodeBytes_LongHeader = 1,  // header byte must not have the top bit set
+  kEncodeBytes_Stored = 2,      // don't huffman code
+};
+
+// Writes |src| as a block Kraken_DecodeBytes reads, huffman coded if that's
+// smaller than storing it. |dst| needs room for src_size + 5 bytes. Returns
+// the number of bytes written.
+static int Kraken_EncodeBytes(byte *dst, const byte *src, int src_size, int flags) {
+  int stored_hdr = (!(flags & kEncodeBytes_LongHeader) && src_size <= 0xFFF) ? 2 : 3;
+
+  if (!(flags & kEncodeBytes_Stored) && src_size >= 32) {
+    uint32 histo[256] = { 0 };
+    for (int i = 0; i < src_size; i++)
+      histo[src[i]]++;
+    int n = Huff_EncodeBytes(dst + 5, src_size - 1, src, src_size, histo);
+    if (n > 0) {
+      uint32 extra = src_size - n - 1;
+      if (!(flags & kEncodeBytes_LongHeader) && n < 0x400 && extra < 0x400) {
+        if (n + 3 < stored_hdr + src_size) {
+          uint32 bits = 0x800000 | (2 << 20) | (extra << 10) | n;
+          memmove(dst + 3, dst + 5, n);
+          dst[0] = (byte)(bits >> 16);
+          dst[1] = (byte)(bits >> 8);
+          dst[2] = (byte)bits;
+          return n + 3;
+        }
+      } else if (n + 5 < stored_hdr + src_size) {
+        uint32 bits = ((uint32)(src_size - 1) << 18) | n;
+        dst[0] = (byte)((2 << 4) | ((src_size - 1) >> 14));
+        dst[1] = (byte)(bits >> 24);
+        dst[2] = (byte)(bits >> 16);
+        dst[3] = (byte)(bits >> 8);
+        dst[4] = (byte)bits;
+        return n + 5;
+      }
+    }
+  }
+
+  if (stored_hdr == 2) {
+    dst[0] = (byte)(0x80 | (src_size >> 8));
+    dst[1] = (byte)src_size;
+  } else {
+    dst[0] = (byte)(src_size >> 16);
+    dst[1] = (byte)(src_size >> 8);
+    dst[2] = (byte)src_size;
+  }
+  memcpy(dst + stored_hdr, src, src_size);
+  return stored_hdr + src_size;
+}
+
+// Settings of a compression level
+struct KrakenCompressLevel {
+  // 0 greedy, 1 and 2 lazy with that many steps, 3 optimal
+  int parser;
+  // Price passes of the optimal parser
+  int passes;
+  int hash_bits;
+  int max_chain;
+  // Quanta are compressed in runs this long that start by restarting the
+  // decoder. Matches don't reach outside their run, so threads compress
+  // runs at once and Kraken_Decompress can decode them at once.
+  int run_size;
+  // Take matches at least this long without looking further
+  int nice_len;
+};
+
+enum {
+  kParser_Greedy = 0,
+  kParser_Lazy1 = 1,
+  kParser_Lazy2 = 2,
+  kParser_Optimal = 3,
+};
+
+static const KrakenCompressLevel kCompressLevels[9] = {
+  { kParser_Greedy,  0, 16,   1, 0x80000,  32 },
+  { kParser_Greedy,  0, 17,   4, 0x100000, 48 },
+  { kParser_Lazy1,   0, 17,   8, 0x100000, 64 },
+  { kParser_Lazy1,   0, 18,  16, 0x200000, 96 },
+  { kParser_Lazy2,   0, 18,  32, 0x200000, 128 },
+  { kParser_Lazy2,   0, 19,  64, 0x400000, 192 },
+  { kParser_Optimal, 2, 19,  32, 0x400000, 256 },
+  { kParser_Optimal, 2, 20, 128, 0x800000, 384 },
+  { kParser_Optimal, 3, 20, 256, 0x800000, 1024 },
+};
+
+struct LzMatch {
+  int len, dist;
+};
+
+// A match preceded by |lit_len| literals
+struct LzToken {
+  int lit_len, match_len, dist;
+};
+
+// Hash chains over a run of quanta.
+struct LzMatchFinder {
+  const byte *src;
+  int src_size;
+  // Positions before this are in the chains
+  int next_pos;
+  int hash_bits, max_chain, nice_len;
+  std::vector<int> head, chain;
+};
+
+static inline uint32 Lz_Hash4(const byte *p, int bits) {
+  return (*(uint32*)p * 0x9E3779B1) >> (32 - bits);
+}
+
+static int Lz_MatchLen(const byte *a, const byte *b, const byte *a_end) {
+  const byte *a_org = a;
+  while (a_end - a >= 4) {
+    uint32 x = *(uint32*)a ^ *(uint32*)b;
+    if (x)
+      return (a - a_org) + (BSF(x) >> 3);
+    a += 4, b += 4;
+  }
+  while (a < a_end && *a == *b)
+    a++, b++;
+  return a - a_org;
+}
+
+static void LzMatchFinder_Init(LzMatchFinder *mf, const byte *src, int src_size, const KrakenCompressLevel *lv) {
+  mf->src = src;
+  mf->src_size = src_size;
+  mf->next_pos = 0;
+  mf->hash_bits = lv->hash_bits;
+  mf->max_chain = lv->max_chain;
+  mf->nice_len = lv->nice_len;
+  mf->head.assign((size_t)1 << lv->hash_bits, -1);
+  mf->chain.resize(src_size);
+}
+
+// Insert the positions up to |pos_end|.
+static void LzMatchFinder_Insert(LzMatchFinder *mf, int pos_end) {
+  int last = mf->src_size - 4, pos;
+  for (pos = mf->next_pos; pos < pos_end && pos <= last; pos++) {
+    uint32 h = Lz_Hash4(mf->src + pos, mf->hash_bits);
+    mf->chain[pos] = mf->head[h];
+    mf->head[h] = pos;
+  }
+  if (pos_end > mf->next_pos)
+    mf->next_pos = pos_end;
+}
+
+// Find matches of at least 4 bytes at |pos| that end before |limit|, each
+// longer than the one before. Returns the number of matches.
+static int LzMatchFinder_Find(LzMatchFinder *mf, int pos, int limit, LzMatch *matches) {
+  int count = 0, best_len = 3;
+
+  LzMatchFinder_Insert(mf, pos + 1);
+  if (limit - pos < 4 || pos > mf->src_size - 4)
+    return 0;
+  const byte *p = mf->src + pos, *p_end = mf->src + limit;
+  int cand = mf->chain[pos];
+  for (int steps = mf->max_chain; cand >= 0 && steps > 0; cand = mf->chain[cand], steps--) {
+    // The decoder copies 8 bytes at a time, so matches can't overlap closer
+    if (pos - cand < 8)
+      continue;
+    const byte *q = mf->src + cand;
+    if (q[best_len] != p[best_len])
+      continue;
+    int len = Lz_MatchLen(p, q, p_end);
+    if (len > best_len) {
+      best_len = len;
+      matches[count].len = len;
+      matches[count].dist = pos - cand;
+      count++;
+      if (len >= mf->nice_len || p + len == p_end)
+        break;
+    }
+  }
+  return count;
+}
+
+// Move |dist| to the front of the recent offsets, the way the decoder does.
+static void Lz_UpdateRecent(int *recent, int num_recent, int dist) {
+  int i;
+  for (i = 0; i < num_recent - 1 && recent[i] != dist; i++) {}
+  for (; i > 0; i--)
+    recent[i] = recent[i - 1];
+  recent[0] = dist;
+}
+
+// Prices in 1/16 bits for the optimal parser, from the streams of the
+// previous pass.
+struct LzPrices {
+  uint32 lit[256];
+  uint32 cmd[256];
+  uint32 offs[256];
+  uint32 cmd_avg;
+  uint32 len_byte;
+  uint32 off16, off32;
+};
+
+struct LzOptNode {
+  uint32 cost;
+  // Edge into this node, a literal if len is 0
+  int prev, len, dist;
+  // Literals since the last match
+  int lit_run;
+  int recent[3];
+};
+
+struct KrakenLzStreams {
+  std::vector<byte> lits, sub_lits, cmds, lens;
+  std::vector<uint32> dists, u32_lens;
+};
+
+struct MermaidLzStreams {
+  std::vector<byte> lits, sub_lits, cmds, lengths;
+  std::vector<uint16> off16;
+  std::vector<uint32> off32[2];
+  // Commands of the first 64k
+  int cmd_split;
+};
+
+// State of one compression thread
+struct KrakenEncoder {
+  const byte *src;
+  int src_size;
+  // Offset of |src| in the whole stream. The decoder copies the first 8
+  // bytes of the stream as is and codes Mermaid far offsets by position.
+  int src_base;
+  bool mermaid;
+  // Selkie writes the mermaid format without entropy coding
+  bool no_entropy;
+  const KrakenCompressLevel *lv;
+
+  LzMatchFinder mf;
+  std::vector<LzToken> tokens;
+  std::vector<LzMatch> matches;
+  std::vector<int> match_first;
+  std::vector<LzOptNode> nodes;
+  LzPrices prices;
+  bool have_prices;
+
+  KrakenLzStreams kraken;
+  MermaidLzStreams mermaid_streams, mermaid_price_streams;
+  std::vector<byte> chunk_buf, tmp, tmp2, bits_a, bits_b;
+};
+
+static int Lz_NumRecent(const KrakenEncoder *enc) {
+  return enc->mermaid ? 1 : 3;
+}
+
+// Shortest new match worth coding for the greedy and lazy parsers. Mermaid
+// can only code far offsets for matches of 8 bytes or more.
+static int Lz_MinMatchLen(const KrakenEncoder *enc, int dist) {
+  if (enc->mermaid)
+    return dist >= 0x10000 ? 8 : 4;
+  return dist >= 0x100000 ? 6 : dist >= 0x10000 ? 5 : 4;
+}
+
+static int Lz_Gain(int len, int dist, bool is_recent) {
+  return len * 4 - (is_recent ? 0 : BSR(dist));
+}
+
+// Best match at |pos| among the recent offsets and the hash chains, for the
+// greedy and lazy parsers. Returns its gain, or -1 if there's no match.
+static int Lz_FindBest(KrakenEncoder *enc, int pos, int end, const int *recent, LzMatch *best) {
+  LzMatch matches[256];
+  int best_gain = -1, i;
+
+  best->len = 0;
+  if (end - pos < 2)
+    return -1;
+  for (i = 0; i < Lz_NumRecent(enc); i++) {
+    if (recent[i] > pos)
+      continue;
+    int len = Lz_MatchLen(enc->src + pos, enc->src + pos - recent[i], enc->src + end);
+    if (len >= 2 && len > best->len) {
+      best->len = len;
+      best->dist = recent[i];
+      best_gain = Lz_Gain(len, 0, true);
+    }
+  }
+  int n = LzMatchFinder_Find(&enc->mf, pos, end, matches);
+  while (--n >= 0) {
+    if (matches[n].len >= Lz_MinMatchLen(enc, matches[n].dist)) {
+      int gain = Lz_Gain(matches[n].len, matches[n].dist, false);
+      if (gain > best_gain) {
+        *best = matches[n];
+        best_gain = gain;
+      }
+      break;
+    }
+  }
+  return best_gain;
+}
+
+static void Lz_ParseLazy(KrakenEncoder *enc, int start, int end, int *recent, std::vector<LzToken> *tokens) {
+  int pos = start, lit_start = start;
+  LzMatch m, m2;
+
+  while (end - pos >= 2) {
+    int gain = Lz_FindBest(enc, pos, end, recent, &m);
+    if (gain < 0) {
+      pos++;
+      continue;
+    }
+    // See if a match starting a byte or two later is better
+    while (m.len < enc->lv->nice_len) {
+      int gain2;
+      if (enc->lv->parser >= kParser_Lazy1 &&
+          (gain2 = Lz_FindBest(enc, pos + 1, end, recent, &m2)) > gain + 4) {
+        pos += 1, m = m2, gain = gain2;
+        continue;
+      }
+      if (enc->lv->parser >= kParser_Lazy2 &&
+          (gain2 = Lz_FindBest(enc, pos + 2, end, recent, &m2)) > gain + 8) {
+        pos += 2, m = m2, gain = gain2;
+        continue;
+      }
+      break;
+    }
+    LzToken t = { pos - lit_start, m.len, m.dist };
+    tokens->push_back(t);
+    Lz_UpdateRecent(recent, Lz_NumRecent(enc), m.dist);
+    pos += m.len;
+    lit_start = pos;
+  }
+}
+
+static uint32 Lz_Price(uint32 count, uint32 total) {
+  // Unseen symbols cost a bit more than the rarest seen one
+  double bits = count ? log2((double)total / count) : log2((double)total + 1) + 2;
+  if (bits < 1)
+    bits = 1;
+  if (bits > 16)
+    bits = 16;
+  return (uint32)(bits * 16);
+}
+
+static void Lz_HistoPrices(const byte *p, size_t n, uint32 *prices, uint32 *avg) {
+  uint32 histo[256] = { 0 };
+  uint64 sum = 0;
+  for (size_t i = 0; i < n; i++)
+    histo[p[i]]++;
+  for (int i = 0; i < 256; i++) {
+    prices[i] = Lz_Price(histo[i], (uint32)n);
+    sum += (uint64)histo[i] * prices[i];
+  }
+  if (avg)
+    *avg = n ? (uint32)(sum / n) : 8 * 16;
+}
+
+// Returns the number of extra bits of a Kraken offset and its code byte.
+static int Kraken_GetDistanceCode(uint32 dist, byte *code) {
+  if (dist < 8388360) {
+    uint32 t = dist + 248, n = BSR(t >> 4);
+    *code = (byte)(((n - 4) << 4) | (t & 15));
+    return n;
+  } else {
+    uint32 t = dist - 8322816, n = BSR(t >> 12);
+    *code = (byte)(0xF0 + n - 4);
+    return n + 12;
+  }
+}
+
+static uint32 Kraken_MatchPrice(const LzPrices *pr, int lit_run, int len, int dist, int recent_index) {
+  uint32 price = pr->cmd[(lit_run < 3 ? lit_run : 3) | ((len < 17 ? len - 2 : 15) << 2) | (recent_index << 6)];
+  if (lit_run >= 3)
+    price += pr->len_byte;
+  if (len >= 17)
+    price += pr->len_byte;
+  if (recent_index == 3) {
+    byte code;
+    int bits = Kraken_GetDistanceCode(dist, &code);
+    price += pr->offs[code] + bits * 16;
+  }
+  return price;
+}
+
+// Price of the literal commands in front of a match that can take |keep|
+// of them itself.
+static uint32 Mermaid_LiteralsPrice(const LzPrices *pr, int lit_run, int keep) {
+  if (lit_run >= 64)
+    return pr->cmd_avg + pr->len_byte;
+  return lit_run > keep ? (lit_run - keep + 6) / 7 * pr->cmd_avg : 0;
+}
+
+static uint32 Mermaid_MatchPrice(const LzPrices *pr, int lit_run, int len, int dist, bool is_recent) {
+  if (dist >= 0x10000 && (!is_recent || len >= 29))
+    return Mermaid_LiteralsPrice(pr, lit_run, 0) + pr->cmd_avg + pr->off32 + (len >= 29 ? pr->len_byte : 0);
+  if (len >= 91)
+    return Mermaid_LiteralsPrice(pr, lit_run, 0) + pr->cmd_avg + pr->off16 + pr->len_byte;
+  return Mermaid_LiteralsPrice(pr, lit_run, 7) + (len + 14) / 15 * pr->cmd_avg + (is_recent ? 0 : pr->off16);
+}
+
+static void Kraken_BuildStreams(const byte *src, int start, int end, const LzToken *tokens, size_t num_tokens, KrakenLzStreams *s);
+static void Mermaid_BuildHalf(const byte *src, int start, int end, int half_start, int half,
+                              const LzToken *tokens, size_t num_tokens, int *recent, MermaidLzStreams *s);
+
+// Prices of a block coded as |tokens|, or defaults from the literals if
+// there are none yet.
+static void Lz_UpdatePrices(KrakenEncoder *enc, int start, int end, const int *recent, const std::vector<LzToken> *tokens) {
+  LzPrices *pr = &enc->prices;
+  int i;
+
+  if (!tokens) {
+    Lz_HistoPrices(enc->src + start, end - start, pr->lit, NULL);
+    for (i = 0; i < 256; i++) {
+      pr->cmd[i] = 6 * 16;
+      pr->offs[i] = 6 * 16;
+    }
+    pr->cmd_avg = 5 * 16;
+    pr->len_byte = 8 * 16;
+    pr->off16 = 16 * 16;
+    pr->off32 = 24 * 16;
+  } else if (!enc->mermaid) {
+    KrakenLzStreams *s = &enc->kraken;
+    Kraken_BuildStreams(enc->src, start, end, tokens->data(), tokens->size(), s);
+    std::vector<byte> &offs = enc->tmp2;
+    offs.resize(s->dists.size());
+    for (i = 0; i < (int)s->dists.size(); i++)
+      Kraken_GetDistanceCode(s->dists[i], &offs[i]);
+    Lz_HistoPrices(s->lits.data(), s->lits.size(), pr->lit, NULL);
+    Lz_HistoPrices(s->cmds.data(), s->cmds.size(), pr->cmd, &pr->cmd_avg);
+    Lz_HistoPrices(offs.data(), offs.size(), pr->offs, NULL);
+  } else {
+    MermaidLzStreams *s = &enc->mermaid_price_streams;
+    int r = recent[0];
+    s->lits.clear(), s->sub_lits.clear(), s->cmds.clear(), s->lengths.clear(), s->off16.clear();
+    s->off32[0].clear(), s->off32[1].clear();
+    Mermaid_BuildHalf(enc->src, start, end, start, 0, tokens->data(), tokens->size(), &r, s);
+    if (enc->no_entropy) {
+      for (i = 0; i < 256; i++)
+        pr->lit[i] = 8 * 16;
+      pr->cmd_avg = 8 * 16;
+    } else {
+      Lz_HistoPrices(s->lits.data(), s->lits.size(), pr->lit, NULL);
+      Lz_HistoPrices(s->cmds.data(), s->cmds.size(), pr->cmd, &pr->cmd_avg);
+    }
+  }
+}
+
+// Optimal parse of [start, end) over the prices of the previous pass.
+static void Lz_ParseOptimal(KrakenEncoder *enc, int start, int end, int *recent, std::vector<LzToken> *tokens) {
+  const KrakenCompressLevel *lv = enc->lv;
+  const byte *src = enc->src;
+  int n = end - start, num_recent = Lz_NumRecent(enc), i, j, k;
+  LzMatch found[256];
+
+  // The matches don't depend on the prices, so find them once for all passes
+  enc->matches.clear();
+  enc->match_first.resize(n + 1);
+  for (i = 0; i < n; ) {
+    enc->match_first[i] = (int)enc->matches.size();
+    int count = LzMatchFinder_Find(&enc->mf, start + i, end, found);
+    enc->matches.insert(enc->matches.end(), found, found + count);
+    if (count && found[count - 1].len >= lv->nice_len) {
+      // Skip ahead over long matches, recent offsets find their tails
+      for (j = found[count - 1].len; --j > 0 && ++i < n; )
+        enc->match_first[i] = (int)enc->matches.size();
+    }
+    i++;
+  }
+  enc->match_first[n] = (int)enc->matches.size();
+
+  std::vector<LzOptNode> &nodes = enc->nodes;
+  nodes.resize(n + 1);
+  int recent_org[3];
+  memcpy(recent_org, recent, sizeof(recent_org));
+
+  // Without prices from a previous block, the first pass only gets them
+  int passes = enc->have_prices ? lv->passes : Max(lv->passes, 2);
+  for (int pass = 0; pass < passes; pass++) {
+    if (pass == 0 && !enc->have_prices)
+      Lz_UpdatePrices(enc, start, end, recent_org, NULL);
+    else if (pass > 0)
+      Lz_UpdatePrices(enc, start, end, recent_org, tokens);
+    const LzPrices *pr = &enc->prices;
+
+    for (i = 1; i <= n; i++)
+      nodes[i].cost = 0xFFFFFFFF;
+    nodes[0].cost = 0;
+    nodes[0].prev = -1;
+    nodes[0].len = 0;
+    nodes[0].lit_run = 0;
+    memcpy(nodes[0].recent, recent_org, sizeof(recent_org));
+
+    for (i = 0; i < n; i++) {
+      const LzOptNode *cur = &nodes[i];
+      int pos = start + i, max_len = n - i;
+      const byte *p = src + pos;
+
+      uint32 cost = cur->cost + pr->lit[*p];
+      if (cost < nodes[i + 1].cost) {
+        LzOptNode *next = &nodes[i + 1];
+        next->cost = cost;
+        next->prev = i;
+        next->len = 0;
+        next->lit_run = cur->lit_run + 1;
+        memcpy(next->recent, cur->recent, sizeof(cur->recent));
+      }
+
+      // Relax an edge of every length up to 32, longer ones only at their
+      // full length
+      #define LZ_RELAX(len_, dist_, price_) { \
+        uint32 c = cur->cost + (price_); \
+        LzOptNode *next = &nodes[i + (len_)]; \
+        if (c < next->cost) { \
+          next->cost = c; \
+          next->prev = i; \
+          next->len = (len_); \
+          next->dist = (dist_); \
+          next->lit_run = 0; \
+          memcpy(next->recent, cur->recent, sizeof(cur->recent)); \
+          Lz_UpdateRecent(next->recent, num_recent, (dist_)); \
+        } \
+      }
+
+      for (k = 0; k < num_recent; k++) {
+        int dist = cur->recent[k];
+        if (dist > pos || (k > 0 && dist == cur->recent[0]) || (k > 1 && dist == cur->recent[1]))
+          continue;
+        int len = Lz_MatchLen(p, p - dist, p + max_len);
+        for (j = 2; j <= len; j = (j < 32 || j == len) ? j + 1 : len) {
+          uint32 price = enc->mermaid ? Mermaid_MatchPrice(pr, cur->lit_run, j, dist, true)
+                                      : Kraken_MatchPrice(pr, cur->lit_run, j, dist, k);
+          LZ_RELAX(j, dist, price);
+        }
+      }
+
+      int prev_len = 3;
+      for (k = enc->match_first[i]; k < enc->match_first[i + 1]; k++) {
+        const LzMatch *m = &enc->matches[k];
+        int min_len = enc->mermaid && m->dist >= 0x10000 ? 8 : 4;
+        j = Max(prev_len + 1, min_len);
+        for (; j <= m->len; j = (j < 32 || j == m->len) ? j + 1 : m->len) {
+          uint32 price = enc->mermaid ? Mermaid_MatchPrice(pr, cur->lit_run, j, m->dist, false)
+                                      : Kraken_MatchPrice(pr, cur->lit_run, j, m->dist, 3);
+          LZ_RELAX(j, m->dist, price);
+        }
+        prev_len = m->len;
+      }
+      #undef LZ_RELAX
+    }
+
+    // Walk back from the end. Literals go to the match after them, the ones
+    // after the last match are implicit.
+    tokens->clear();
+    for (i = n; i > 0; i = nodes[i].prev) {
+      if (nodes[i].len) {
+        LzToken t = { 0, nodes[i].len, nodes[i].dist };
+        tokens->push_back(t);
+      } else if (!tokens->empty()) {
+        tokens->back().lit_len++;
+      }
+    }
+    std::reverse(tokens->begin(), tokens->end());
+    memcpy(recent, nodes[n].recent, sizeof(nodes[n].recent));
+  }
+
+  // The next block starts with the prices of this one
+  Lz_UpdatePrices(enc, start, end, recent_org, tokens);
+  enc->have_prices = true;
+}
+
+static void Lz_ParseBlock(KrakenEncoder *enc, int start, int end, int *recent, std::vector<LzToken> *tokens) {
+  tokens->clear();
+  if (enc->lv->parser == kParser_Optimal)
+    Lz_ParseOptimal(enc, start, end, recent, tokens);
+  else
+    Lz_ParseLazy(enc, start, end, recent, tokens);
+}
+
+// Splits |tokens| over [start, end) into the streams of a Kraken chunk.
+// Literals are also stored subtracted from the byte at the last offset,
+// for the delta literal mode.
+static void Kraken_BuildStreams(const byte *src, int start, int end, const LzToken *tokens, size_t num_tokens, KrakenLzStreams *s) {
+  int recent[3] = { 8, 8, 8 };
+  int pos = start, i;
+
+  s->lits.clear(), s->sub_lits.clear(), s->cmds.clear(), s->lens.clear();
+  s->dists.clear(), s->u32_lens.clear();
+  for (size_t t = 0; t != num_tokens; t++) {
+    const LzToken *tok = &tokens[t];
+    for (i = 0; i < tok->lit_len; i++, pos++) {
+      s->lits.push_back(src[pos]);
+      s->sub_lits.push_back(src[pos] - src[pos - recent[0]]);
+    }
+    int idx;
+    for (idx = 0; idx < 3 && recent[idx] != tok->dist; idx++) {}
+    if (idx == 3)
+      s->dists.push_back(tok->dist);
+    Lz_UpdateRecent(recent, 3, tok->dist);
+
+    int lit_field = tok->lit_len < 3 ? tok->lit_len : 3;
+    int len_field = tok->match_len < 17 ? tok->match_len - 2 : 15;
+    s->cmds.push_back((byte)(lit_field | len_field << 2 | idx << 6));
+    // Lengths that don't fit the command go to the length stream, 255 and
+    // up continue in the bit streams
+    if (lit_field == 3) {
+      uint32 v = tok->lit_len - 3;
+      s->lens.push_back(v < 255 ? v : 255);
+      if (v >= 255)
+        s->u32_lens.push_back(v - 255);
+    }
+    if (len_field == 15) {
+      uint32 v = tok->match_len - 17;
+      s->lens.push_back(v < 255 ? v : 255);
+      if (v >= 255)
+        s->u32_lens.push_back(v - 255);
+    }
+    pos += tok->match_len;
+  }
+  for (; pos < end; pos++) {
+    s->lits.push_back(src[pos]);
+    s->sub_lits.push_back(src[pos] - src[pos - recent[0]]);
+  }
+}
+
+static void Kraken_WriteDistance(BitWriter *bw, uint32 dist) {
+  byte code;
+  int bits = Kraken_GetDistanceCode(dist, &code);
+  if (dist < 8388360) {
+    BitWriter_Write(bw, ((dist + 248) >> 4) & ((1 << bits) - 1), bits);
+  } else {
+    uint32 t = dist - 8322816;
+    BitWriter_Write(bw, (t >> 12) & ((1 << (bits - 12)) - 1), bits - 12);
+    BitWriter_Write(bw, t & 0xFFF, 12);
+  }
+}
+
+static void Kraken_WriteLength(BitWriter *bw, uint32 v) {
+  v += 64;
+  int n = BSR(v) + 1;
+  BitWriter_Write(bw, 0, n - 7);
+  BitWriter_Write(bw, v, n);
+}
+
+// Picks the literal mode whose literals code smaller. Returns 1 for raw
+// literals, 0 for delta literals.
+static int Lz_ChooseLiteralMode(KrakenEncoder *enc, int chunk_start, const std::vector<byte> &lits,
+                                const std::vector<byte> &sub_lits, int flags, int *size) {
+  enc->tmp.resize(lits.size() + 5);
+  enc->tmp2.resize(sub_lits.size() + 5);
+  int raw_size = Kraken_EncodeBytes(enc->tmp.data(), lits.data(), (int)lits.size(), flags);
+  // Delta literals at the start of a run take bytes from the run before it
+  if ((flags & kEncodeBytes_Stored) || (chunk_start == 0 && enc->src_base != 0)) {
+    *size = raw_size;
+    return 1;
+  }
+  int sub_size = Kraken_EncodeBytes(enc->tmp2.data(), sub_lits.data(), (int)sub_lits.size(), flags);
+  if (sub_size < raw_size) {
+    enc->tmp.swap(enc->tmp2);
+    *size = sub_size;
+    return 0;
+  }
+  *size = raw_size;
+  return 1;
+}
+
+// Writes the LZ table of the chunk [chunk_start, chunk_start + n) coded as
+// |tokens|. Returns the size and sets |mode|, or returns -1 if the decoder
+// can't take it.
+static int Kraken_WriteLzTable(KrakenEncoder *enc, int chunk_start, int n, const std::vector<LzToken> &tokens,
+                               byte *dst, int *mode) {
+  KrakenLzStreams *s = &enc->kraken;
+  const byte *src = enc->src;
+  byte *p = dst;
+  int start = chunk_start, size;
+  size_t i;
+
+  if (enc->src_base + chunk_start == 0) {
+    memcpy(p, src, 8);
+    p += 8;
+    start = 8;
+  }
+  Kraken_BuildStreams(src, start, chunk_start + n, tokens.data(), tokens.size(), s);
+  if ((int)s->lens.size() > (n >> 2) || s->u32_lens.size() > 512)
+    return -1;
+  size_t scratch = sizeof(KrakenLzTable) + s->lits.size() + s->cmds.size() + s->dists.size() + s->lens.size() +
+                   4 * (s->dists.size() + s->lens.size()) + 96;
+  if (scratch > Min(3 * n + 32 + 0xd000, 0x6C000))
+    return -1;
+
+  *mode = Lz_ChooseLiteralMode(enc, chunk_start, s->lits, s->sub_lits, kEncodeBytes_LongHeader, &size);
+  memcpy(p, enc->tmp.data(), size);
+  p += size;
+  p += Kraken_EncodeBytes(p, s->cmds.data(), (int)s->cmds.size(), 0);
+
+  std::vector<byte> &offs = enc->tmp2;
+  offs.resize(s->dists.size());
+  for (i = 0; i != s->dists.size(); i++)
+    Kraken_GetDistanceCode(s->dists[i], &offs[i]);
+  p += Kraken_EncodeBytes(p, offs.data(), (int)offs.size(), kEncodeBytes_LongHeader);
+  p += Kraken_EncodeBytes(p, s->lens.data(), (int)s->lens.size(), 0);
+
+  // Offsets and long lengths alternate between a forward bit stream and one
+  // read backwards from the end of the chunk.
+  BitWriter a, b;
+  enc->bits_a.resize(s->dists.size() * 5 + s->u32_lens.size() * 5 + 16);
+  enc->bits_b.resize(enc->bits_a.size());
+  BitWriter_Init(&a, enc->bits_a.data());
+  BitWriter_Init(&b, enc->bits_b.data());
+  uint32 count = (uint32)s->u32_lens.size() + 1;
+  BitWriter_Write(&b, 0, BSR(count));
+  BitWriter_Write(&b, count, BSR(count) + 1);
+  for (i = 0; i != s->dists.size(); i++)
+    Kraken_WriteDistance((i & 1) ? &b : &a, s->dists[i]);
+  for (i = 0; i != s->u32_lens.size(); i++)
+    Kraken_WriteLength((i & 1) ? &b : &a, s->u32_lens[i]);
+  int size_a = BitWriter_Flush(&a) - enc->bits_a.data();
+  int size_b = BitWriter_Flush(&b) - enc->bits_b.data();
+  memcpy(p, enc->bits_a.data(), size_a);
+  p += size_a;
+  std::reverse_copy(enc->bits_b.data(), enc->bits_b.data() + size_b, p);
+  p += size_b;
+
+  if (p - dst < 13)
+    return -1;
+  return p - dst;
+}
+
+static void Mermaid_PutLength(std::vector<byte> *s, uint32 v) {
+  if (v <= 251) {
+    s->push_back((byte)v);
+  } else {
+    uint32 b = 252 + ((v - 252) & 3), w = (v - b) >> 2;
+    s->push_back((byte)b);
+    s->push_back((byte)w);
+    s->push_back((byte)(w >> 8));
+  }
+}
+
+// Code literals ahead of a match as literal commands, till |keep| of them
+// are left for the match command. Returns how many are left.
+static int Mermaid_PutLiterals(MermaidLzStreams *s, int lit_len, int keep) {
+  if (lit_len >= 64) {
+    s->cmds.push_back(0);
+    Mermaid_PutLength(&s->lengths, lit_len - 64);
+    return 0;
+  }
+  while (lit_len > keep) {
+    int k = lit_len < 7 ? lit_len : 7;
+    s->cmds.push_back((byte)(0x80 | k));
+    lit_len -= k;
+  }
+  return lit_len;
+}
+
+// Appends |tokens| over [start, end) in the 64k half that begins at
+// |half_start| to the streams of a Mermaid chunk.
+static void Mermaid_BuildHalf(const byte *src, int start, int end, int half_start, int half,
+                              const LzToken *tokens, size_t num_tokens, int *recent, MermaidLzStreams *s) {
+  int pos = start, i;
+
+  for (size_t t = 0; t != num_tokens; t++) {
+    const LzToken *tok = &tokens[t];
+    for (i = 0; i < tok->lit_len; i++, pos++) {
+      s->lits.push_back(src[pos]);
+      s->sub_lits.push_back(src[pos] - src[pos - *recent]);
+    }
+    int len = tok->match_len, dist = tok->dist;
+    bool is_recent = dist == *recent;
+    if (dist >= 0x10000 && (!is_recent || len >= 29)) {
+      Mermaid_PutLiterals(s, tok->lit_len, 0);
+      if (len >= 29) {
+        s->cmds.push_back(2);
+        Mermaid_PutLength(&s->lengths, len - 29);
+      } else {
+        s->cmds.push_back((byte)(len - 5));
+      }
+      s->off32[half].push_back(half_start - (pos - dist));
+    } else if (len >= 91) {
+      Mermaid_PutLiterals(s, tok->lit_len, 0);
+      s->cmds.push_back(1);
+      Mermaid_PutLength(&s->lengths, len - 91);
+      s->off16.push_back((uint16)dist);
+    } else {
+      // Short commands take up to 7 literals and 15 bytes of match, the
+      // rest of the match continues at the recent offset
+      int lits = Mermaid_PutLiterals(s, tok->lit_len, 7);
+      int k = len < 15 ? len : 15;
+      s->cmds.push_back((byte)((is_recent ? 0x80 : 0) | k << 3 | lits));
+      if (!is_recent)
+        s->off16.push_back((uint16)dist);
+      for (len -= k; len > 0; len -= k) {
+        k = len < 15 ? len : 15;
+        s->cmds.push_back((byte)(0x80 | k << 3));
+      }
+    }
+    *recent = dist;
+    pos += tok->match_len;
+  }
+  for (; pos < end; pos++) {
+    s->lits.push_back(src[pos]);
+    s->sub_lits.push_back(src[pos] - src[pos - *recent]);
+  }
+}
+
+static void Mermaid_PutFarOffsets(byte *&p, const std::vector<uint32> &offs, int base) {
+  for (size_t i = 0; i != offs.size(); i++) {
+    uint32 v = offs[i];
+    // Past 12MB offsets that don't fit 3 bytes take a fourth
+    if (base >= 0xC00000 - 1 && v >= 0xC00000) {
+      uint32 b = (v - 0xC00000) >> 22;
+      v -= b << 22;
+      p[3] = (byte)b;
+      p[0] = (byte)v, p[1] = (byte)(v >> 8), p[2] = (byte)(v >> 16);
+      p += 4;
+    } else {
+      p[0] = (byte)v, p[1] = (byte)(v >> 8), p[2] = (byte)(v >> 16);
+      p += 3;
+    }
+  }
+}
+
+// Parses and writes the LZ table of a Mermaid chunk. Returns the size and
+// sets |mode|, or returns -1 if the decoder can't take it.
+static int Mermaid_WriteLzTable(KrakenEncoder *enc, int chunk_start, int n, byte *dst, int *mode) {
+  MermaidLzStreams *s = &enc->mermaid_streams;
+  const byte *src = enc->src;
+  int recent[3] = { 8, 8, 8 }, size;
+  int flags = enc->no_entropy ? kEncodeBytes_Stored : 0;
+  byte *p = dst;
+
+  s->lits.clear(), s->sub_lits.clear(), s->cmds.clear(), s->lengths.clear(), s->off16.clear();
+  s->off32[0].clear(), s->off32[1].clear();
+  s->cmd_split = 0;
+  for (int half = 0; half < 2 && half * 0x10000 < n; half++) {
+    int half_start = chunk_start + half * 0x10000;
+    int half_end = Min(half_start + 0x10000, chunk_start + n);
+    int start = enc->src_base + half_start == 0 ? 8 : half_start;
+    int build_recent = recent[0];
+    Lz_ParseBlock(enc, start, half_end, recent, &enc->tokens);
+    Mermaid_BuildHalf(src, start, half_end, half_start, half, enc->tokens.data(), enc->tokens.size(),
+                      &build_recent, s);
+    if (half == 0)
+      s->cmd_split = (int)s->cmds.size();
+  }
+  if (s->off16.size() >= 0xFFFF || s->off32[0].size() > 0xFFFF || s->off32[1].size() > 0xFFFF)
+    return -1;
+
+  if (enc->src_base + chunk_start == 0) {
+    memcpy(p, src, 8);
+    p += 8;
+  }
+  *mode = Lz_ChooseLiteralMode(enc, chunk_start, s->lits, s->sub_lits, flags, &size);
+  memcpy(p, enc->tmp.data(), size);
+  p += size;
+  p += Kraken_EncodeBytes(p, s->cmds.data(), (int)s->cmds.size(), flags);
+  if (n > 0x10000) {
+    p[0] = (byte)s->cmd_split, p[1] = (byte)(s->cmd_split >> 8);
+    p += 2;
+  }
+
+  // Offsets of 16 bits go either raw, or as entropy coded high and low bytes
+  size_t off16_count = s->off16.size(), off16_scratch = 0;
+  int off16_size = 2 + 2 * (int)off16_count;
+  if (!enc->no_entropy && off16_count >= 32) {
+    std::vector<byte> &hilo = enc->tmp2;
+    hilo.resize(off16_count * 2);
+    for (size_t j = 0; j != off16_count; j++) {
+      hilo[j] = (byte)(s->off16[j] >> 8);
+      hilo[off16_count + j] = (byte)s->off16[j];
+    }
+    enc->tmp.resize(off16_count * 2 + 16);
+    int hi_size = Kraken_EncodeBytes(enc->tmp.data(), hilo.data(), (int)off16_count, 0);
+    int lo_size = Kraken_EncodeBytes(enc->tmp.data() + hi_size, hilo.data() + off16_count, (int)off16_count, 0);
+    if (2 + hi_size + lo_size < off16_size) {
+      p[0] = p[1] = 0xFF;
+      memcpy(p + 2, enc->tmp.data(), hi_size + lo_size);
+      p += 2 + hi_size + lo_size;
+      off16_scratch = 4 * off16_count + 2;
+      off16_size = -1;
+    }
+  }
+  if (off16_size > 0) {
+    p[0] = (byte)off16_count, p[1] = (byte)(off16_count >> 8);
+    p += 2;
+    for (size_t j = 0; j != off16_count; j++) {
+      p[0] = (byte)s->off16[j], p[1] = (byte)(s->off16[j] >> 8);
+      p += 2;
+    }
+  }
+
+  uint32 n1 = (uint32)s->off32[0].size(), n2 = (uint32)s->off32[1].size();
+  uint32 hdr = Min(n1, 4095) << 12 | Min(n2, 4095);
+  p[0] = (byte)hdr, p[1] = (byte)(hdr >> 8), p[2] = (byte)(hdr >> 16);
+  p += 3;
+  if (n1 >= 4095) {
+    p[0] = (byte)n1, p[1] = (byte)(n1 >> 8);
+    p += 2;
+  }
+  if (n2 >= 4095) {
+    p[0] = (byte)n2, p[1] = (byte)(n2 >> 8);
+    p += 2;
+  }
+  Mermaid_PutFarOffsets(p, s->off32[0], enc->src_base + chunk_start);
+  Mermaid_PutFarOffsets(p, s->off32[1], enc->src_base + chunk_start + 0x10000);
+  memcpy(p, s->lengths.data(), s->lengths.size());
+  p += s->lengths.size();
+
+  size_t scratch = sizeof(MermaidLzTable) + s->lits.size() + s->cmds.size() + off16_scratch + 4 * (n1 + n2) + 72;
+  if (scratch > Min(2 * n + 32, 0x40000) || p - dst < 10)
+    return -1;
+  return p - dst;
+}
+
+// Writes the chunk [chunk_start, chunk_start + n) with its header, as LZ,
+// as entropy coded bytes or stored, whichever is smallest. Returns the size.
+static int Kraken_EncodeChunk(KrakenEncoder *enc, int chunk_start, int n, byte *dst) {
+  const byte *src = enc->src + chunk_start;
+  int mode = 0, lz_size = -1;
+
+  // Chunks of a few bytes can't hold an LZ table
+  if (n >= 32) {
+    enc->chunk_buf.resize(3 * n + 4096);
+    byte *out = enc->chunk_buf.data();
+    if (enc->mermaid) {
+      lz_size = Mermaid_WriteLzTable(enc, chunk_start, n, out, &mode);
+    } else {
+      int recent[3] = { 8, 8, 8 };
+      Lz_ParseBlock(enc, enc->src_base + chunk_start == 0 ? 8 : chunk_start, chunk_start + n, recent, &enc->tokens);
+      lz_size = Kraken_WriteLzTable(enc, chunk_start, n, enc->tokens, out, &mode);
+    }
+    if (lz_size >= n)
+      lz_size = -1;
+  }
+  int best = lz_size >= 0 ? lz_size + 3 : n + 3;
+
+  // Only the literals, entropy coded. Stored bytes use the header below,
+  // the decoder would point at them rather than copy.
+  if (!enc->no_entropy && n >= 32) {
+    std::vector<byte> &ent = enc->tmp2;
+    ent.resize(n + 5);
+    int size = Kraken_EncodeBytes(ent.data(), src, n, kEncodeBytes_LongHeader);
+    if (size < best) {
+      memcpy(dst, ent.data(), size);
+      return size;
+    }
+  }
+  if (lz_size >= 0) {
+    uint32 hdr = 0x800000 | mode << 19 | lz_size;
+    dst[0] = (byte)(hdr >> 16), dst[1] = (byte)(hdr >> 8), dst[2] = (byte)hdr;
+    memcpy(dst + 3, enc->chunk_buf.data(), lz_size);
+    return lz_size + 3;
+  }
+
+  uint32 hdr = 0x800000 | n;
+  dst[0] = (byte)(hdr >> 16), dst[1] = (byte)(hdr >> 8), dst[2] = (byte)hdr;
+  memcpy(dst + 3, src, n);
+  return n + 3;
+}
+
+// Compresses the quantum [q_start, q_start + n) with its block header into
+// |out|.
+static void Kraken_EncodeQuantum(KrakenEncoder *enc, int q_start, int n, int decoder_type, bool restart,
+                                 std::vector<byte> *out) {
+  const byte *src = enc->src + q_start;
+  int i;
+
+  out->resize(2 + 3 + n + 3 * ((n + 0x1FFFF) >> 17) + 4096);
+  byte *dst = out->data();
+  dst[0] = 0x0C | (restart ? 0x80 : 0);
+  dst[1] = (byte)decoder_type;
+
+  for (i = 1; i < n && src[i] == src[0]; i++) {}
+  if (i == n && n > 4) {
+    // Same byte all through, shorter than storing past 4 bytes
+    dst[2] = 0x07, dst[3] = 0xFF, dst[4] = 0xFF, dst[5] = src[0];
+    out->resize(6);
+    return;
+  }
+
+  int size = 0;
+  if (enc->lv) {
+    for (i = 0; i < n && size < n; i += 0x20000)
+      size += Kraken_EncodeChunk(enc, q_start + i, Min(n - i, 0x20000), dst + 5 + size);
+  }
+  // Not worth it, store the quantum in an uncompressed block. That costs
+  // 2 + n bytes, the bound Kraken_GetCompressBound allows.
+  if (!enc->lv || 5 + size >= 2 + n) {
+    dst[0] |= 0x40;
+    memcpy(dst + 2, src, n);
+    out->resize(2 + n);
+    return;
+  }
+  uint32 v = size - 1;
+  dst[2] = (byte)(v >> 16), dst[3] = (byte)(v >> 8), dst[4] = (byte)v;
+  out->resize(5 + size);
+}
+
+// Compresses |src| into a stream Kraken_Decompress reads. |level| goes from
+// 0, which stores, to 9, which is slowest. |dst| needs room for
+// Kraken_GetCompressBound(src_len) bytes. Returns the compressed size, or
+// -1 if the compressor isn't supported.
+int Kraken_Compress(int codec, const byte *src, size_t src_len, byte *dst, int level, int num_threads) {
+  int decoder_type;
+  if (codec == kCompressor_Kraken || codec == kCompressor_Hydra)
+    decoder_type = 6;
+  else if (codec == kCompressor_Mermaid || codec == kCompressor_Selkie)
+    decoder_type = 10;
+  else
+    return -1;
+  if (src_len > 0x7FFFFFFF)
+    return -1;
+
+  const KrakenCompressLevel *lv = level <= 0 ? NULL : &kCompressLevels[Min(level, 9) - 1];
+  int run_size = lv ? lv->run_size : 0x40000;
+  int num_runs = (int)((src_len + run_size - 1) / run_size);
+  std::vector<std::vector<std::vector<byte> > > outs(num_runs);
+  std::atomic<int> next_run(0);
+
+  auto worker = [&]() {
+    KrakenEncoder enc;
+    enc.mermaid = decoder_type == 10;
+    enc.no_entropy = codec == kCompressor_Selkie;
+    enc.lv = lv;
+    for (int run; (run = next_run++) < num_runs; ) {
+      size_t run_start = (size_t)run * run_size;
+      int run_len = (int)Min(src_len - run_start, run_size);
+      enc.src = src + run_start;
+      enc.src_size = run_len;
+      enc.src_base = (int)run_start;
+      enc.have_prices = false;
+      if (lv)
+        LzMatchFinder_Init(&enc.mf, enc.src, run_len, lv);
+      outs[run].resize((run_len + 0x3FFFF) >> 18);
+      for (int q = 0; q * 0x40000 < run_len; q++)
+        Kraken_EncodeQuantum(&enc, q * 0x40000, Min(run_len - q * 0x40000, 0x40000), decoder_type, q == 0,
+                             &outs[run][q]);
+    }
+  };
+
+  if (num_threads <= 0)
+    num_threads = (int)std::thread::hardware_concurrency();
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < Min(num_threads, num_runs); i++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (std::thread &thread : threads)
+    thread.join();
+
+  byte *p = dst;
+  for (int run = 0; run < num_runs; run++) {
+    for (size_t q = 0; q < outs[run].size(); q++) {
+      memcpy(p, outs[run][q].data(), outs[run][q].size());
+      p += outs[run][q].size();
+    }
+  }
+  return p - dst;
+}
+
+// Every quantum is stored if compressing doesn't make it smaller, so the
+// output is at most the input plus a block header per quantum.
+size_t Kraken_GetCompressBound(size_t src_len) {
+  return src_len + 2 * ((src_len + 0x3FFFF) >> 18);
+}
+
 #if 0
 
 // The decompressor will write outside of the target buffer.
@@ -4176,16 +5693,8 @@ byte *load_file(const char *filename, int *size) {
   return input;
 }
 
-enum {
-  kCompressor_Kraken = 8,
-  kCompressor_Mermaid = 9,
-  kCompressor_Selkie = 11,
-  kCompressor_Hydra = 12,
-  kCompressor_Leviathan = 13,
-};
-
 bool arg_stdout, arg_force, arg_quiet, arg_dll;
-int arg_compressor = kCompressor_Kraken, arg_level = 4;
+int arg_compressor = kCompressor_Kraken, arg_level = 4, arg_threads = 1;
 char arg_direction;
 char *verifyfolder;
 
@@ -4214,6 +5723,11 @@ int ParseCmdLine(int argc, char *argv[]) {
       } else if (!strcmp(s, "dll")) {
         arg_dll = true;
         continue;
+      } else if (!strcmp(s, "bench")) {
+        if (arg_direction)
+          return -1;
+        arg_direction = 'B';
+        continue;
       } else if (!strcmp(s, "kraken")) s = "mk";
       else if (!strcmp(s, "mermaid")) s = "mm";
       else if (!strcmp(s, "selkie")) s = "ms";
@@ -4222,6 +5736,9 @@ int ParseCmdLine(int argc, char *argv[]) {
       else if (!strncmp(s, "level=", 6)) {
         arg_level = atoi(s + 6);
         continue;
+      } else if (!strncmp(s, "threads=", 8)) {
+        arg_threads = atoi(s + 8);
+        continue;
       } else {
         return -1;
       }
@@ -4245,7 +5762,7 @@ int ParseCmdLine(int argc, char *argv[]) {
       case 'q':
         arg_quiet = true;
         break;
-      case '1': case '2': case '3': case '4':
+      case '0': case '1': case '2': case '3': case '4':
       case '5': case '6': case '7': case '8': case '9':
         arg_level = c - '0';
         break;
@@ -4287,6 +5804,45 @@ bool Verify(const char *filename, uint8 *output, int outbytes, const char *curfi
   return true;
 }
 
+struct BenchTotals {
+  int64 unpacked_size, packed_size;
+  double compress_seconds, decompress_seconds;
+};
+
+// Compresses |input| at levels 1 to 9, checks that it decompresses back and
+// prints the ratio and speeds of each level.
+void Benchmark(const char *curfile, byte *input, int input_size, BenchTotals *totals) {
+  __int64 start, mid, end, freq;
+  byte *packed = new byte[Kraken_GetCompressBound(input_size)];
+  byte *unpacked = new byte[input_size + SAFE_SPACE];
+  if (!packed || !unpacked) error("memory error", curfile);
+  QueryPerformanceFrequency((LARGE_INTEGER*)&freq);
+
+  for (int level = 1; level <= 9; level++) {
+    QueryPerformanceCounter((LARGE_INTEGER*)&start);
+    int packed_size = Kraken_Compress(arg_compressor, input, input_size, packed, level, arg_threads);
+    if (packed_size < 0) error("compressor not supported, use --dll", curfile);
+    QueryPerformanceCounter((LARGE_INTEGER*)&mid);
+    int outbytes = Kraken_DecompressThreaded(packed, packed_size, unpacked, input_size, arg_threads);
+    QueryPerformanceCounter((LARGE_INTEGER*)&end);
+    if (outbytes != input_size || memcmp(unpacked, input, input_size))
+      error("benchmark verify error", curfile);
+
+    double compress_seconds = (double)(mid - start) / freq, decompress_seconds = (double)(end - mid) / freq;
+    BenchTotals *t = &totals[level - 1];
+    t->unpacked_size += input_size;
+    t->packed_size += packed_size;
+    t->compress_seconds += compress_seconds;
+    t->decompress_seconds += decompress_seconds;
+    if (!arg_quiet)
+      fprintf(stderr, "%-20s -%d: %8d => %8d (%6.2f%%), compress %7.2f MB/s, decompress %7.2f MB/s\n", curfile, level,
+              input_size, packed_size, packed_size * 100.0 / Max(input_size, 1),
+              input_size * 1e-6 / compress_seconds, input_size * 1e-6 / decompress_seconds);
+  }
+  delete[] packed;
+  delete[] unpacked;
+}
+
 typedef int WINAPI OodLZ_CompressFunc(
   int codec, uint8 *src_buf, size_t src_len, uint8 *dst_buf, int level,
   void *opts, size_t offs, size_t unused, void *scratch, size_t scratch_size);
@@ -4326,27 +5882,29 @@ int main(int argc, char *argv[]) {
   if (argc < 2 || 
       (argi = ParseCmdLine(argc, argv)) < 0 || 
       argi >= argc ||  // no files
-      arg_direction != 'b' && (argc - argi) > 2 ||  // too many files
+      arg_direction != 'b' && arg_direction != 'B' && (argc - argi) > 2 ||  // too many files
       arg_direction == 't' && (argc - argi) != 2     // missing argument for verify
       ) {
     fprintf(stderr, "ooz v7.0\n\n"
       "Usage: ooz [options] input [output]\n"
       " -c --stdout              write to stdout\n"
       " -d --decompress          decompress (default)\n"
-      " -z --compress            compress (requires oo2core_7_win64.dll)\n"
+      " -z --compress            compress\n"
       " -b                       just benchmark, don't overwrite anything\n"
+      " --bench                  compress at levels 1-9, decompress and time both\n"
       " -f                       force overwrite existing file\n"
-      " --dll                    decompress with the dll\n"
+      " --dll                    use oo2core_7_win64.dll (needed for leviathan)\n"
       " --verify                 decompress and verify that it matches output\n"
       " --verify=<folder>        verify with files in this folder\n"
-      " -<1-9> --level=<-4..10>  compression level\n"
+      " --threads=<n>            use n threads, 0 for all (default: 1)\n"
+      " -<0-9> --level=<0..9>    compression level (--dll: -4..10)\n"
       " -m<k>                    [k|m|s|l|h] compressor selection\n"
       " --kraken --mermaid --selkie --leviathan --hydra    compressor selection\n\n"
       "(Warning! not fuzz safe, so please trust the input)\n"
       );
     return 1;
   }
-  bool write_mode = (argi + 1 < argc) && (arg_direction != 't' && arg_direction != 'b');
+  bool write_mode = (argi + 1 < argc) && (arg_direction != 't' && arg_direction != 'b' && arg_direction != 'B');
 
   if (!arg_force && write_mode) {
     struct stat sb;
@@ -4357,6 +5915,7 @@ int main(int argc, char *argv[]) {
   }
 
   int nverify = 0;
+  BenchTotals bench_totals[9] = {};
 
   for (; argi < argc; argi++) {
     const char *curfile = argv[argi];
@@ -4367,14 +5926,25 @@ int main(int argc, char *argv[]) {
     byte *output = NULL;
     int outbytes = 0;
 
+    if (arg_direction == 'B') {
+      Benchmark(curfile, input, input_size, bench_totals);
+      delete[] input;
+      continue;
+    }
+
     if (arg_direction == 'z') {
-      // compress using the dll
-      LoadLib();
-      output = new byte[input_size + 65536];
+      if (arg_dll)
+        LoadLib();
+      output = new byte[Kraken_GetCompressBound(input_size) + 65536];
       if (!output) error("memory error", curfile);
       *(uint64*)output = input_size;
       QueryPerformanceCounter((LARGE_INTEGER*)&start);
-      outbytes = OodLZ_Compress(arg_compressor, input, input_size, output + 8, arg_level, 0, 0, 0, 0, 0);
+      if (arg_dll) {
+        outbytes = OodLZ_Compress(arg_compressor, input, input_size, output + 8, arg_level, 0, 0, 0, 0, 0);
+      } else {
+        outbytes = Kraken_Compress(arg_compressor, input, input_size, output + 8, arg_level, arg_threads);
+        if (outbytes < 0) error("compressor not supported, use --dll", curfile);
+      }
       if (outbytes < 0) error("compress failed", curfile);
       outbytes += 8;
       QueryPerformanceCounter((LARGE_INTEGER*)&end);
@@ -4401,7 +5971,7 @@ int main(int argc, char *argv[]) {
       if (arg_dll) {
         outbytes = OodLZ_Decompress(input + hdrsize, input_size - hdrsize, output, unpacked_size, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
       } else {
-        outbytes = Kraken_Decompress(input + hdrsize, input_size - hdrsize, output, unpacked_size);
+        outbytes = Kraken_DecompressThreaded(input + hdrsize, input_size - hdrsize, output, unpacked_size, arg_threads);
       }
       if (outbytes != unpacked_size)
         error("decompress error", curfile);
@@ -4449,6 +6019,14 @@ int main(int argc, char *argv[]) {
 
   if (nverify)
     fprintf(stderr, "%d files verified OK!\n", nverify);
+  if (arg_direction == 'B') {
+    for (int level = 1; level <= 9; level++) {
+      BenchTotals *t = &bench_totals[level - 1];
+      fprintf(stderr, "total -%d: %10lld => %10lld (%6.2f%%), compress %7.2f MB/s, decompress %7.2f MB/s\n", level,
+              t->unpacked_size, t->packed_size, t->packed_size * 100.0 / Max(t->unpacked_size, 1),
+              t->unpacked_size * 1e-6 / t->compress_seconds, t->unpacked_size * 1e-6 / t->decompress_seconds);
+    }
+  }
   return 0;
 }
 
@@ -0,0 +1,169 @@
+// Round trip and bound checks for the Kraken and Mermaid compressor, and
+// checks of the threaded decoder. Not part of the UModel build, compile it
+// with the decoders:
+//   g++ -O2 -msse4.1 -pthread kraken_test.cpp kraken.cpp lzna.cpp bitknit.cpp -o kraken_test
+
+#include "stdafx.h"
+
+#include <stdarg.h>
+#include <vector>
+
+enum {
+  kCompressor_Kraken = 8,
+  kCompressor_Mermaid = 9,
+  kCompressor_Selkie = 11,
+};
+
+int Kraken_Decompress(const byte *src, size_t src_len, byte *dst, size_t dst_len);
+int Kraken_DecompressThreaded(const byte *src, size_t src_len, byte *dst, size_t dst_len, int num_threads);
+int Kraken_Compress(int codec, const byte *src, size_t src_len, byte *dst, int level, int num_threads);
+size_t Kraken_GetCompressBound(size_t src_len);
+
+void appError(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  exit(1);
+}
+
+static uint32 rand_state = 1;
+
+static uint32 Rand() {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+// Random quanta with a few short matches in each. They compress to a couple
+// of bytes less than the quantum, which the quantum header more than eats.
+static void FillNearRandom(byte *p, size_t n, int match_len) {
+  for (size_t i = 0; i < n; i++)
+    p[i] = (byte)Rand();
+  for (size_t q = 0; q + 0x40000 <= n; q += 0x40000) {
+    for (int j = 0; j < 4; j++)
+      memcpy(p + q + 4096 + j * 0xCCCC, p + q + 3096 + j * 0xCCCC, match_len);
+  }
+}
+
+static int fails;
+
+static void Check(const char *what, int codec, int level, const byte *src, size_t n) {
+  size_t bound = Kraken_GetCompressBound(n);
+  // Room for the worst overrun, so it's reported instead of corrupting the heap
+  byte *packed = new byte[bound + 64 * ((n + 0x3FFFF) >> 18) + 64];
+  byte *unpacked = new byte[n + 64];
+
+  int size = Kraken_Compress(codec, src, n, packed, level, 1);
+  if (size < 0 || (size_t)size > bound) {
+    printf("%s codec %d level %d size %d: compressed to %d, bound %d\n", what, codec, level, (int)n, size, (int)bound);
+    fails++;
+  } else if (Kraken_Decompress(packed, size, unpacked, n) != (int)n || memcmp(src, unpacked, n)) {
+    printf("%s codec %d level %d size %d: round trip failed\n", what, codec, level, (int)n);
+    fails++;
+  }
+  delete[] packed;
+  delete[] unpacked;
+}
+
+// Random quanta that end in a short match, so decoding a quantum writes past
+// its end into the start of the next one. Those bytes of even runs have to
+// be restored after the odd runs are decoded.
+static void FillMatchAtEnd(byte *p, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    p[i] = (byte)Rand();
+  for (size_t q = 0x40000; q <= n; q += 0x40000)
+    memcpy(p + q - 37, p + q - 0x100, 37);
+}
+
+static void CheckThreaded(const char *what, int codec, int level, const byte *src, size_t n,
+                          const byte *packed, int size) {
+  static const int thread_counts[] = { 2, 3, 8 };
+  byte *unpacked = new byte[n + 64];
+
+  for (int t = 0; t < 3; t++) {
+    memset(unpacked, 0xCD, n);
+    if (Kraken_DecompressThreaded(packed, size, unpacked, n, thread_counts[t]) != (int)n || memcmp(src, unpacked, n)) {
+      printf("%s codec %d level %d size %d: %d threads failed\n", what, codec, level, (int)n, thread_counts[t]);
+      fails++;
+    }
+  }
+  delete[] unpacked;
+}
+
+// Level 1 restarts the decoder every two quanta. Odd and even numbers of
+// runs end on an even or odd run.
+static void CheckRuns(int codec, int num_runs) {
+  size_t n = (size_t)num_runs * 0x80000 - 0x1000;
+  std::vector<byte> src(n), packed(Kraken_GetCompressBound(n) + 64 * 2 * num_runs);
+  FillMatchAtEnd(src.data(), n);
+  int size = Kraken_Compress(codec, src.data(), n, packed.data(), 1, 1);
+  CheckThreaded("runs", codec, 1, src.data(), n, packed.data(), size);
+}
+
+// Three quanta compressed as one run, the last a copy of the middle one.
+// Setting the restart flag on the last two makes runs that reference the
+// run before them, which must be decoded serially.
+static void CheckDependentRuns(int codec) {
+  size_t n = 3 * 0x40000;
+  std::vector<byte> src(n), packed(Kraken_GetCompressBound(n) + 64 * 3);
+  for (size_t i = 0; i < 0x80000; i++)
+    src[i] = (byte)Rand();
+  memcpy(&src[0x80000], &src[0x40000], 0x40000);
+
+  int size = Kraken_Compress(codec, src.data(), n, packed.data(), 3, 1);
+  // Block header, then a stored quantum or a quantum header without
+  // checksum and the compressed quantum, or a memset quantum
+  byte *p = packed.data();
+  for (int q = 0; q < 3; q++) {
+    if (q > 0)
+      p[0] |= 0x80;
+    bool stored = (p[0] >> 6) & 1;
+    p += 2;
+    if (stored) {
+      p += 0x40000;
+    } else {
+      uint32 v = (p[0] << 16) | (p[1] << 8) | p[2];
+      p += (v & 0x3FFFF) == 0x3FFFF ? 4 : 3 + (v & 0x3FFFF) + 1;
+    }
+  }
+  if (p != packed.data() + size) {
+    printf("dependent runs codec %d: quanta not found\n", codec);
+    fails++;
+    return;
+  }
+  CheckThreaded("dependent runs", codec, 3, src.data(), n, packed.data(), size);
+}
+
+int main() {
+  static const int codecs[] = { kCompressor_Kraken, kCompressor_Mermaid, kCompressor_Selkie };
+  // Match lengths that leave each quantum a couple of bytes short of stored
+  static const int match_lens[] = { 15, 16, 16 };
+  static const int levels[] = { 0, 1, 4, 7 };
+
+  for (int c = 0; c < 3; c++) {
+    std::vector<byte> near_random(12 * 0x40000);
+    FillNearRandom(near_random.data(), near_random.size(), match_lens[c]);
+    for (int l = 0; l < 4; l++) {
+      Check("near random", codecs[c], levels[l], near_random.data(), near_random.size());
+      // Quanta of a few bytes, the same byte all through, alone and after
+      // a full quantum
+      for (size_t n = 1; n <= 8; n++) {
+        std::vector<byte> tail(near_random.begin(), near_random.begin() + 0x40000 + n);
+        memset(&tail[0x40000], 0, n);
+        Check("same byte", codecs[c], levels[l], &tail[0x40000], n);
+        Check("same byte tail", codecs[c], levels[l], tail.data(), tail.size());
+      }
+    }
+  }
+
+  for (int c = 0; c < 3; c++) {
+    for (int r = 2; r <= 5; r++)
+      CheckRuns(codecs[c], r);
+    CheckDependentRuns(codecs[c]);
+  }
+
+  printf(fails ? "%d checks failed\n" : "all checks passed\n", fails);
+  return fails ? 1 : 0;
+}
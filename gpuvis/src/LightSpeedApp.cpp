@@ -1,4 +1,5 @@
 #include "LightSpeedApp.h"
+#include "gpuvis_batch.h"
 #include "AssetManager.h"
 #include "MiniConfigImgui.h"
 #include "implot/implot.h"
@@ -170,6 +171,11 @@ void LightSpeedApp::setup()
 
 CINDER_APP( LightSpeedApp, RendererGl, []( App::Settings *settings ) {
     readConfig();
+
+    // Headless batch analysis exits before a window is created
+    if ( batch_requested( settings->getCommandLineArgs() ) )
+        exit( batch_main( settings->getCommandLineArgs() ) );
+
     settings->setWindowSize( WIN_W, WIN_H);
     settings->setMultiTouchEnabled( false );
 } )
@@ -13,6 +13,7 @@
 #include "gpuvis_macros.h"
 #include "gpuvis.h"
 #include "gpuvis_utils.h"
+#include "gpuvis_tail.h"
 
 using namespace rapidjson;
 
@@ -119,6 +120,10 @@ struct LightSpeedApp : public ci::app::App
     void render_color_picker();
 
     void update();
+    void update_tail();
+    // Stop tailing and finish a trim job. Call before m_trace_win is deleted or loaded into.
+    void stop_tail();
+    void finish_tail_trim();
 
     void parse_cmdline( int argc, char **argv );
 
@@ -164,6 +169,12 @@ struct LightSpeedApp : public ci::app::App
         std::vector< std::string > inputfiles;
 
         bool last;
+
+        // Loading one trace file into an empty window: its initialized events
+        //  can be restored from and saved to its trace cache
+        bool use_cache = false;
+        // Events were restored from the trace cache and are already initialized
+        bool from_cache = false;
     };
     loading_info_t m_loading_info;
 
@@ -182,6 +193,21 @@ struct LightSpeedApp : public ci::app::App
 
     TraceWin *m_trace_win = nullptr;
 
+    // Tail mode: append newer trace files to m_trace_win as they show up
+    struct tail_info_t
+    {
+        TraceTail tail;
+        // TraceWin being tailed
+        TraceWin *win = nullptr;
+
+        // Background job trimming the oldest trim_count events. The trace shows
+        //  as initializing, so the UI leaves it alone until the job is done.
+        AsyncJob *trim_job = nullptr;
+        uint32_t trim_count = 0;
+        util_time_t trim_t0;
+    };
+    tail_info_t m_tail;
+
     trace_type_t m_trace_type = trace_type_invalid;
 
     ImGuiTextFilter m_filter;
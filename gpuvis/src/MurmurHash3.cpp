@@ -348,4 +348,15 @@ uint32_t hashstr32( const std::string &str, uint32_t hval )
     return MurmurHash3_x86_32( str.c_str(), ( int )str.length(), hval );
 }
 
+uint64_t hashstr64( const char *str, size_t len, uint32_t hval )
+{
+    uint64_t hash[ 2 ];
+
+    if ( len == (size_t)-1 )
+        len = strlen( str );
+
+    MurmurHash3_x64_128( str, ( int )len, hval, hash );
+    return hash[ 0 ];
+}
+
 //-----------------------------------------------------------------------------
@@ -131,7 +131,7 @@ bool TraceLocationsRingCtxSeq::add_location( const trace_event_t &event )
 
     if ( key )
     {
-        std::vector< uint32_t > *plocs = m_locs.get_val_create( key );
+        EventLocs *plocs = m_locs.get_val_create( key );
 
         plocs->push_back( event.id );
         return true;
@@ -140,14 +140,14 @@ bool TraceLocationsRingCtxSeq::add_location( const trace_event_t &event )
     return false;
 }
 
-std::vector< uint32_t > *TraceLocationsRingCtxSeq::get_locations( const trace_event_t &event )
+EventLocs *TraceLocationsRingCtxSeq::get_locations( const trace_event_t &event )
 {
     uint64_t key = db_key( event );
 
     return m_locs.get_val( key );
 }
 
-std::vector< uint32_t > *TraceLocationsRingCtxSeq::get_locations( uint32_t ringno, uint32_t seqno, const char *ctxstr )
+EventLocs *TraceLocationsRingCtxSeq::get_locations( uint32_t ringno, uint32_t seqno, const char *ctxstr )
 {
     uint64_t key = db_key( ringno, seqno, ctxstr );
 
@@ -181,7 +181,7 @@ static bool is_drm_sched_timeline_event( const trace_event_t &event )
 void add_sched_switch_pid_comm( trace_info_t &trace_info, const trace_event_t &event,
                                        const char *pidstr, const char *commstr )
 {
-    int pid = atoi( get_event_field_val( event, pidstr ) );
+    int pid = get_event_field_int( event, pidstr );
 
     if ( pid )
     {
@@ -209,6 +209,13 @@ static bool is_msm_timeline_event( const char *name )
 
 TraceEvents::~TraceEvents()
 {
+    cancel_tdopexpr_jobs();
+    stop_tdopexpr_append();
+    stop_text_index();
+
+    for ( auto &it : m_tdopexpr_exprs.m_map )
+        tdopexpr_delete( it.second );
+
     for ( trace_event_t &event : m_events )
     {
         if ( event.fields )
@@ -220,9 +227,7 @@ TraceEvents::~TraceEvents()
     }
 }
 
-// Callback from trace_read.cpp. We mostly just store the events in our array
-//  and then init_new_event() does the real work of initializing them later.
-int TraceEvents::new_event_cb( const trace_event_t &event )
+void TraceEvents::add_new_event( const trace_event_t &event )
 {
     // Add event to our m_events array
     m_events.push_back( event );
@@ -232,6 +237,13 @@ int TraceEvents::new_event_cb( const trace_event_t &event )
 
     // 1+ means loading events
     m_eventsloaded.fetch_add( 1 );
+}
+
+// Callback from trace_read.cpp. We mostly just store the events in our array
+//  and then init_new_event() does the real work of initializing them later.
+int TraceEvents::new_event_cb( const trace_event_t &event )
+{
+    add_new_event( event );
 
     // Return 1 to cancel loading
     return ( s_app().get_state() == LightSpeedApp::State_CancelLoading );
@@ -358,87 +370,573 @@ const char *filter_get_keyval_func( trace_info_t *trace_info, const trace_event_
 
         // We can compare pointers since they're from same string pool
         if ( name == field.key )
-            return field.value;
+            return field.get_str( buf );
     }
 
     return "";
 }
 
-const std::vector< uint32_t > *TraceEvents::get_tdopexpr_locs( const char *name, std::string *err )
+// Evaluates a compiled tdop expression on events. Builtin variables ($name, $pid, etc.)
+//  are resolved once and event field variables are looked up by field index, which
+//  is resolved once per event format. Numeric variables are compared against
+//  numbers in the expression without being formatted.
+class tdop_event_filter_t
+{
+public:
+    tdop_event_filter_t( class TdopExpr *tdop_expr, const trace_info_t *trace_info );
+    ~tdop_event_filter_t() { tdopexpr_delete( m_tdop_expr ); }
+
+    tdop_event_filter_t( const tdop_event_filter_t & ) = delete;
+    tdop_event_filter_t &operator=( const tdop_event_filter_t & ) = delete;
+
+    bool matches( const trace_event_t &event )
+    {
+        m_event = &event;
+        if ( event.name != m_format )
+            set_format( event );
+
+        return !!tdopexpr_exec_vars( m_tdop_expr, m_get_var_func, &m_get_var_num_func )[ 0 ];
+    }
+
+protected:
+    void set_format( const trace_event_t &event );
+    const event_field_t *get_field( uint32_t var );
+    const char *get_var( uint32_t var, char ( &buf )[ 64 ] );
+    bool get_var_num( uint32_t var, tdop_num_t &num );
+
+protected:
+    enum var_type_t
+    {
+        VAR_name, VAR_comm, VAR_user_comm, VAR_id, VAR_pid,
+        VAR_tgid, VAR_ts, VAR_cpu, VAR_duration, VAR_field
+    };
+    struct var_t
+    {
+        var_type_t type;
+        const char *key;
+    };
+
+    class TdopExpr *m_tdop_expr;
+    const trace_info_t *m_trace_info;
+    const trace_event_t *m_event = nullptr;
+
+    std::vector< var_t > m_vars;
+    tdop_get_var_func m_get_var_func;
+    tdop_get_var_num_func m_get_var_num_func;
+
+    // Field index of each var for the current event format, and for all formats seen
+    const char *m_format = nullptr;
+    const uint32_t *m_field_idxs = nullptr;
+    util_umap< const char *, std::vector< uint32_t > > m_format_field_idxs;
+};
+
+tdop_event_filter_t::tdop_event_filter_t( class TdopExpr *tdop_expr, const trace_info_t *trace_info ) :
+    m_tdop_expr( tdopexpr_clone( tdop_expr ) ), m_trace_info( trace_info )
+{
+    static const char *s_builtins[] =
+    {
+        "name", "comm", "user_comm", "id", "pid", "tgid", "ts", "cpu", "duration"
+    };
+
+    for ( const char *key : tdopexpr_get_variables( m_tdop_expr ) )
+    {
+        var_t var;
+
+        var.type = VAR_field;
+        var.key = key;
+
+        for ( size_t i = 0; i < ARRAY_SIZE( s_builtins ); i++ )
+        {
+            if ( !strcasecmp( key, s_builtins[ i ] ) )
+            {
+                var.type = ( var_type_t )i;
+                break;
+            }
+        }
+
+        m_vars.push_back( var );
+    }
+
+    m_get_var_func = std::bind( &tdop_event_filter_t::get_var, this, _1, _2 );
+    m_get_var_num_func = std::bind( &tdop_event_filter_t::get_var_num, this, _1, _2 );
+}
+
+void tdop_event_filter_t::set_format( const trace_event_t &event )
+{
+    std::vector< uint32_t > *idxs = m_format_field_idxs.get_val( event.name );
+
+    if ( !idxs )
+    {
+        std::vector< uint32_t > field_idxs( m_vars.size(), UINT32_MAX );
+
+        for ( size_t var = 0; var < m_vars.size(); var++ )
+        {
+            // We can compare pointers since they're from same string pool
+            for ( uint32_t i = 0; i < event.numfields; i++ )
+            {
+                if ( event.fields[ i ].key == m_vars[ var ].key )
+                {
+                    field_idxs[ var ] = i;
+                    break;
+                }
+            }
+        }
+
+        idxs = m_format_field_idxs.get_val( event.name, field_idxs );
+    }
+
+    m_format = event.name;
+    m_field_idxs = idxs->data();
+}
+
+const event_field_t *tdop_event_filter_t::get_field( uint32_t var )
+{
+    const trace_event_t &event = *m_event;
+    const char *key = m_vars[ var ].key;
+    uint32_t idx = m_field_idxs[ var ];
+
+    if ( ( idx < event.numfields ) && ( event.fields[ idx ].key == key ) )
+        return &event.fields[ idx ];
+
+    // Format doesn't match layout of the first event with this name - search
+    for ( uint32_t i = 0; i < event.numfields; i++ )
+    {
+        if ( event.fields[ i ].key == key )
+            return &event.fields[ i ];
+    }
+
+    return NULL;
+}
+
+const char *tdop_event_filter_t::get_var( uint32_t var, char ( &buf )[ 64 ] )
+{
+    const trace_event_t &event = *m_event;
+
+    switch ( m_vars[ var ].type )
+    {
+    case VAR_name:
+        return event.name;
+    case VAR_comm:
+        return event.comm;
+    case VAR_user_comm:
+        return event.user_comm;
+    case VAR_id:
+        snprintf_safe( buf, "%u", event.id );
+        return buf;
+    case VAR_pid:
+        snprintf_safe( buf, "%d", event.pid );
+        return buf;
+    case VAR_tgid:
+    {
+        const int *tgid = m_trace_info->pid_tgid_map.get_val( event.pid );
+
+        snprintf_safe( buf, "%d", tgid ? *tgid : 0 );
+        return buf;
+    }
+    case VAR_ts:
+        snprintf_safe( buf, "%.6f", event.ts * ( 1.0 / NSECS_PER_MSEC ) );
+        return buf;
+    case VAR_cpu:
+        snprintf_safe( buf, "%u", event.cpu );
+        return buf;
+    case VAR_duration:
+        if ( !event.has_duration() )
+            buf[ 0 ] = 0;
+        else
+            snprintf_safe( buf, "%.6f", event.duration * ( 1.0 / NSECS_PER_MSEC ) );
+        return buf;
+    case VAR_field:
+        break;
+    }
+
+    const event_field_t *field = get_field( var );
+
+    return field ? field->get_str( buf ) : "";
+}
+
+// Number for var, matching how get_var() formats it
+bool tdop_event_filter_t::get_var_num( uint32_t var, tdop_num_t &num )
+{
+    const trace_event_t &event = *m_event;
+
+    num.decimal = true;
+
+    switch ( m_vars[ var ].type )
+    {
+    case VAR_name:
+    case VAR_comm:
+    case VAR_user_comm:
+        return false;
+    case VAR_id:
+        num.type = tdop_num_t::TDOP_NUM_UINT;
+        num.u = event.id;
+        return true;
+    case VAR_pid:
+        num.type = tdop_num_t::TDOP_NUM_INT;
+        num.i = event.pid;
+        return true;
+    case VAR_tgid:
+    {
+        const int *tgid = m_trace_info->pid_tgid_map.get_val( event.pid );
+
+        num.type = tdop_num_t::TDOP_NUM_INT;
+        num.i = tgid ? *tgid : 0;
+        return true;
+    }
+    case VAR_ts:
+        // Printed with %.6f, so ns / 1e6 is the value the string parses back to
+        num.type = tdop_num_t::TDOP_NUM_FLOAT;
+        num.decimal = false;
+        num.d = ( double )event.ts / NSECS_PER_MSEC;
+        return true;
+    case VAR_cpu:
+        num.type = tdop_num_t::TDOP_NUM_UINT;
+        num.u = event.cpu;
+        return true;
+    case VAR_duration:
+        if ( !event.has_duration() )
+            return false;
+        num.type = tdop_num_t::TDOP_NUM_FLOAT;
+        num.decimal = false;
+        num.d = ( double )event.duration / NSECS_PER_MSEC;
+        return true;
+    case VAR_field:
+        break;
+    }
+
+    const event_field_t *field = get_field( var );
+
+    if ( !field )
+        return false;
+
+    switch ( field->type )
+    {
+    case EVENT_FIELD_UINT:
+        num.type = tdop_num_t::TDOP_NUM_UINT;
+        num.u = field->val;
+        return true;
+    case EVENT_FIELD_INT:
+    case EVENT_FIELD_INT16:
+        // %2d pads with a space, so only %lld strings can be compared with ==
+        num.type = tdop_num_t::TDOP_NUM_INT;
+        num.decimal = ( field->type == EVENT_FIELD_INT );
+        num.i = ( field->type == EVENT_FIELD_INT ) ? ( int64_t )field->val : ( int )( int64_t )field->val;
+        return true;
+    case EVENT_FIELD_HEX:
+    case EVENT_FIELD_HEX32:
+        num.type = tdop_num_t::TDOP_NUM_UINT;
+        num.decimal = false;
+        num.u = ( field->type == EVENT_FIELD_HEX ) ? field->val : ( uint32_t )field->val;
+        return true;
+    }
+
+    return false;
+}
+
+void TraceEvents::get_tdopexpr_events( class TdopExpr *tdop_expr, std::vector< uint32_t > &locs,
+                                       uint32_t first_id, uint32_t last_id, uint32_t thread_count,
+                                       AsyncJob *job, bool use_text_index )
+{
+    const size_t chunk_size = 64 * 1024;
+    std::vector< uint32_t > candidates;
+
+    last_id = std::min< size_t >( last_id, m_events.size() );
+    if ( first_id >= last_id )
+        return;
+
+    // Test only the text index candidates for the events it covers
+    size_t indexed = use_text_index ? get_text_index_candidates( tdop_expr, candidates ) : 0;
+    if ( indexed > first_id )
+    {
+        tdop_event_filter_t filter( tdop_expr, &m_trace_info );
+        auto it = std::lower_bound( candidates.begin(), candidates.end(), first_id );
+
+        for ( ; ( it != candidates.end() ) && ( *it < last_id ); it++ )
+        {
+            if ( filter.matches( m_events[ *it ] ) )
+                locs.push_back( *it );
+        }
+
+        first_id = std::min< size_t >( indexed, last_id );
+        if ( first_id >= last_id )
+            return;
+    }
+
+    if ( !thread_count )
+        thread_count = FilterThreads ? FilterThreads : std::thread::hardware_concurrency();
+
+    // Filter chunks of events on worker threads, then append chunk results in order
+    size_t count = last_id - first_id;
+    std::vector< std::vector< uint32_t > > chunk_locs( ( count + chunk_size - 1 ) / chunk_size );
+
+    std::atomic< size_t > chunks_done( 0 );
+
+    util_parallel_for( chunk_locs.size(), std::max( 1u, thread_count ), [ & ]( size_t chunk )
+    {
+        if ( job && job->is_cancelled() )
+            return;
+
+        tdop_event_filter_t filter( tdop_expr, &m_trace_info );
+        size_t first = first_id + chunk * chunk_size;
+        size_t last = std::min< size_t >( first + chunk_size, last_id );
+
+        for ( size_t i = first; i < last; i++ )
+        {
+            // Push the index like the text index path above. trim_events keeps ids equal to it.
+            if ( filter.matches( m_events[ i ] ) )
+                chunk_locs[ chunk ].push_back( i );
+        }
+
+        if ( job )
+            job->set_progress( ( float )++chunks_done / chunk_locs.size() );
+    } );
+
+    for ( const std::vector< uint32_t > &vec : chunk_locs )
+        locs.insert( locs.end(), vec.begin(), vec.end() );
+}
+
+// Time filter expressions with the per-event keyval evaluator and the compiled
+//  event filter on 1 and all hardware threads. Results are logged.
+void TraceEvents::benchmark_filters()
+{
+    static const char *s_filters[] =
+    {
+        "$name = sched_switch",
+        "$pid > 1000",
+        "$buf =~ \"vblank\"",
+    };
+    uint32_t thread_counts[] = { 1, std::max( 1u, std::thread::hardware_concurrency() ) };
+
+    if ( m_text_index.job )
+        m_text_index.job->wait();
+
+    for ( const char *filter : s_filters )
+    {
+        std::string errstr;
+        tdop_get_key_func get_key_func = std::bind( filter_get_key_func, &m_strpool, _1, _2 );
+        class TdopExpr *tdop_expr = tdopexpr_compile( filter, get_key_func, errstr );
+
+        if ( !tdop_expr )
+        {
+            logf( "[Error] compiling '%s': %s", filter, errstr.c_str() );
+            continue;
+        }
+
+        size_t count = 0;
+        util_time_t t0 = util_get_time();
+
+        for ( trace_event_t &event : m_events )
+        {
+            tdop_get_keyval_func get_keyval_func = std::bind( filter_get_keyval_func, &m_trace_info, &event, _1, _2 );
+
+            if ( tdopexpr_exec( tdop_expr, get_keyval_func )[ 0 ] )
+                count++;
+        }
+
+        std::string str = string_format( "Filter benchmark: '%s': %lu/%lu events: keyval %.2fms",
+                                         filter, count, m_events.size(), util_time_to_ms( t0, util_get_time() ) );
+
+        for ( uint32_t threads : thread_counts )
+        {
+            std::vector< uint32_t > locs;
+
+            t0 = util_get_time();
+            get_tdopexpr_events( tdop_expr, locs, 0, UINT32_MAX, threads );
+
+            str += string_format( ", %u threads %.2fms%s", threads, util_time_to_ms( t0, util_get_time() ),
+                                  ( locs.size() != count ) ? " (mismatch)" : "" );
+        }
+
+        if ( m_text_index.ready )
+        {
+            std::vector< uint32_t > locs;
+
+            t0 = util_get_time();
+            get_tdopexpr_events( tdop_expr, locs, 0, UINT32_MAX, 0, nullptr, false );
+            str += string_format( ", no text index %.2fms", util_time_to_ms( t0, util_get_time() ) );
+        }
+
+        tdopexpr_delete( tdop_expr );
+
+        logf( "%s", str.c_str() );
+    }
+}
+
+void TraceEvents::add_tdopexpr( uint32_t nameid, class TdopExpr *tdop_expr )
+{
+    // Keep the copy we've got, the append job may be using it
+    if ( *m_tdopexpr_exprs.get_val( nameid, tdop_expr ) != tdop_expr )
+        tdopexpr_delete( tdop_expr );
+}
+
+const EventLocs *TraceEvents::get_tdopexpr_locs( const char *name, std::string *err, bool *pending )
 {
-    std::vector< uint32_t > *plocs;
-    uint32_t hashval = hashstr32( name );
+    EventLocs *plocs;
+    uint32_t nameid;
+    // Names are only interned once they compile, so filter strings being
+    //  typed in don't pile up in the pool. Nothing is cached for the rest.
+    bool interned = m_strpool.lookupid( name, &nameid );
 
     if ( err )
         err->clear();
+    if ( pending )
+        *pending = false;
 
-    // Try to find whatever our name hashed to. Name should be something like:
+    // Try to find whatever our name maps to. Name should be something like:
     //   $name=drm_vblank_event
-    plocs = m_tdopexpr_locs.get_locations_u32( hashval );
+    plocs = interned ? m_tdopexpr_locs.get_locations_u32( nameid ) : NULL;
     if ( plocs )
         return plocs;
 
-    // Not found - check if we've tried and failed with this name before.
-    if ( m_failed_commands.find( hashval ) != m_failed_commands.end() )
-        return NULL;
-
-    // If the name has a tdop expression variable prefix, try compiling it
-    if ( strchr( name, '$' ) )
+    // Check for a background job evaluating this expression
+    tdopexpr_job_t **pjob = interned ? m_tdopexpr_jobs.get_val( nameid ) : NULL;
+    if ( pjob )
     {
-        std::string errstr;
-        tdop_get_key_func get_key_func = std::bind( filter_get_key_func, &m_strpool, _1, _2 );
-        class TdopExpr *tdop_expr = tdopexpr_compile( name, get_key_func, errstr );
+        tdopexpr_job_t *job = *pjob;
 
-        if ( !tdop_expr )
+        if ( pending && !job->job.is_done() && !job->job.is_cancelled() )
         {
-            if ( err )
-                *err = errstr;
-            else
-                logf( "[Error] compiling '%s': %s", name, errstr.c_str() );
+            *pending = true;
+            return NULL;
+        }
+
+        job->job.wait();
+
+        bool cancelled = job->job.is_cancelled();
+        if ( !cancelled )
+        {
+            if ( !job->locs.empty() )
+                m_tdopexpr_locs.m_locs.get_val_create( nameid )->assign( job->locs );
+            add_tdopexpr( nameid, job->expr );
         }
         else
         {
-            for ( trace_event_t &event : m_events )
-            {
-                const char *ret;
-                tdop_get_keyval_func get_keyval_func = std::bind( filter_get_keyval_func, &m_trace_info, &event, _1, _2 );
+            tdopexpr_delete( job->expr );
+        }
 
-                ret = tdopexpr_exec( tdop_expr, get_keyval_func );
-                if ( ret[ 0 ] )
-                    m_tdopexpr_locs.add_location_u32( hashval, event.id );
-            }
+        delete job;
+        m_tdopexpr_jobs.erase_key( nameid );
 
-            tdopexpr_delete( tdop_expr );
+        // Cancelled jobs are restarted below
+        if ( !cancelled )
+        {
+            plocs = m_tdopexpr_locs.get_locations_u32( nameid );
+            if ( !plocs )
+                m_failed_commands.insert( nameid );
+            return plocs;
         }
     }
 
+    // Not found - check if we've tried and failed with this name before.
+    if ( interned && ( m_failed_commands.find( nameid ) != m_failed_commands.end() ) )
+        return NULL;
+
+    // Only tdop expressions (names with a variable prefix) can match anything
+    if ( !strchr( name, '$' ) )
+        return NULL;
+
+    std::string errstr;
+    tdop_get_key_func get_key_func = std::bind( filter_get_key_func, &m_strpool, _1, _2 );
+    class TdopExpr *tdop_expr = tdopexpr_compile( name, get_key_func, errstr );
+
+    if ( !tdop_expr )
+    {
+        if ( err )
+            *err = errstr;
+        else
+            logf( "[Error] compiling '%s': %s", name, errstr.c_str() );
+        return NULL;
+    }
+
+    nameid = m_strpool.getid( name );
+
+    if ( pending )
+    {
+        // Evaluate on background job. Strings were interned by compile above.
+        tdopexpr_job_t *job = new tdopexpr_job_t;
+
+        job->expr = tdop_expr;
+        job->job.start( [ this, job ]()
+        {
+            get_tdopexpr_events( job->expr, job->locs, 0, UINT32_MAX, 0, &job->job );
+        } );
+        m_tdopexpr_jobs.set_val( nameid, job );
+
+        *pending = true;
+        return NULL;
+    }
+    else
+    {
+        std::vector< uint32_t > locs;
+
+        get_tdopexpr_events( tdop_expr, locs );
+        if ( !locs.empty() )
+            m_tdopexpr_locs.m_locs.get_val_create( nameid )->assign( locs );
+
+        add_tdopexpr( nameid, tdop_expr );
+    }
+
     // Try to find this name/expression again and add to failed list if we miss again
-    plocs = m_tdopexpr_locs.get_locations_u32( hashval );
+    plocs = m_tdopexpr_locs.get_locations_u32( nameid );
     if ( !plocs )
-        m_failed_commands.insert( hashval );
+        m_failed_commands.insert( nameid );
 
     return plocs;
 }
 
-const std::vector< uint32_t > *TraceEvents::get_comm_locs( const char *name )
+float TraceEvents::get_tdopexpr_progress( const char *name )
+{
+    uint32_t nameid;
+    tdopexpr_job_t **pjob = m_strpool.lookupid( name, &nameid ) ? m_tdopexpr_jobs.get_val( nameid ) : NULL;
+
+    return pjob ? ( *pjob )->job.get_progress() : 1.0f;
+}
+
+void TraceEvents::cancel_tdopexpr_job( const char *name )
 {
-    return m_comm_locs.get_locations_str( name );
+    uint32_t nameid;
+    tdopexpr_job_t **pjob = m_strpool.lookupid( name, &nameid ) ? m_tdopexpr_jobs.get_val( nameid ) : NULL;
+
+    // Job is cleaned up (without results) when it's next queried
+    if ( pjob )
+        ( *pjob )->job.cancel();
 }
 
-const std::vector< uint32_t > *TraceEvents::get_sched_switch_locs( int pid, switch_t switch_type )
+void TraceEvents::cancel_tdopexpr_jobs()
+{
+    for ( auto &it : m_tdopexpr_jobs.m_map )
+    {
+        tdopexpr_job_t *job = it.second;
+
+        job->job.cancel();
+        job->job.wait();
+
+        tdopexpr_delete( job->expr );
+        delete job;
+    }
+
+    m_tdopexpr_jobs.m_map.clear();
+}
+
+const EventLocs *TraceEvents::get_comm_locs( const char *name )
+{
+    return m_comm_locs.get_locations_str( m_strpool, name );
+}
+
+const EventLocs *TraceEvents::get_sched_switch_locs( int pid, switch_t switch_type )
 {
     return ( switch_type == SCHED_SWITCH_PREV ) ?
                 m_sched_switch_prev_locs.get_locations_u32( pid ) :
                 m_sched_switch_next_locs.get_locations_u32( pid );
 }
 
-const std::vector< uint32_t > *TraceEvents::get_timeline_locs( const char *name )
+const EventLocs *TraceEvents::get_timeline_locs( const char *name )
 {
-    return m_amd_timeline_locs.get_locations_str( name );
+    return m_amd_timeline_locs.get_locations_str( m_strpool, name );
 }
 
 // Pass a string like "gfx_249_91446"
-const std::vector< uint32_t > *TraceEvents::get_gfxcontext_locs( uint32_t gfxcontext_hash )
+const EventLocs *TraceEvents::get_gfxcontext_locs( uint32_t gfxcontext_hash )
 {
     return m_gfxcontext_locs.get_locations_u32( gfxcontext_hash );
 }
@@ -494,14 +992,30 @@ uint32_t row_pos_t::get_row( int64_t min_ts, int64_t max_ts )
     return row;
 }
 
+void row_pos_t::trim( int64_t ts )
+{
+    for ( auto &rpos : m_row_pos )
+    {
+        for ( auto it = rpos.begin(); ( it != rpos.end() ) && ( it->first < ts ); )
+        {
+            if ( it->second < ts )
+                it = rpos.erase( it );
+            else
+                it++;
+        }
+    }
+}
+
 void TraceEvents::update_fence_signaled_timeline_colors()
 {
+    m_color_gen++;
+
     float label_sat = s_clrs().getalpha( col_Graph_TimelineLabelSat );
     float label_alpha = s_clrs().getalpha( col_Graph_TimelineLabelAlpha );
 
     for ( auto &timeline_locs : m_amd_timeline_locs.m_locs.m_map )
     {
-        std::vector< uint32_t > &locs = timeline_locs.second;
+        EventLocs &locs = timeline_locs.second;
 
         for ( uint32_t index : locs )
         {
@@ -520,8 +1034,10 @@ void TraceEvents::update_fence_signaled_timeline_colors()
     }
 }
 
-void TraceEvents::update_tgid_colors()
+void TraceEvents::update_tgid_colors( uint32_t first_eventid )
 {
+    m_color_gen++;
+
     float label_sat = s_clrs().getalpha( col_Graph_PrintLabelSat );
     float label_alpha = s_clrs().getalpha( col_Graph_PrintLabelAlpha );
 
@@ -542,10 +1058,11 @@ void TraceEvents::update_tgid_colors()
 
     for ( const auto &cpu_locs : m_sched_switch_cpu_locs.m_locs.m_map )
     {
-        const std::vector< uint32_t > &locs = cpu_locs.second;
+        const EventLocs &locs = cpu_locs.second;
 
-        for ( uint32_t idx : locs )
+        for ( size_t i = vec_find_eventid( locs, first_eventid ); i < locs.size(); i++ )
         {
+            uint32_t idx = locs[ i ];
             uint32_t hashval;
             float alpha = label_alpha;
             size_t len = ( size_t )-1;
@@ -583,6 +1100,21 @@ void TraceEvents::update_tgid_colors()
     }
 }
 
+int64_t TraceEvents::get_vblank_ts( const trace_event_t &event, bool want_high_prec ) const
+{
+    if ( want_high_prec && m_trace_info.mono_trace_clock &&
+         event.is_vblank() && get_event_field_int( event, "high_prec" ) )
+    {
+        int64_t time = get_event_field_int( event, "time", INT64_MAX );
+
+        // Appended chunks are offset to our min_file_ts, so this works for them too
+        if ( time != INT64_MAX )
+            return time - m_trace_info.min_file_ts;
+    }
+
+    return event.ts;
+}
+
 const char *TraceEvents::comm_from_pid( int pid, const char *def )
 {
     const char *const *comm = m_trace_info.pid_comm_map.get_val( pid );
@@ -654,7 +1186,7 @@ uint32_t TraceEvents::get_event_gfxcontext_hash( const trace_event_t &event )
 {
     if ( is_msm_timeline_event( event.name ) )
     {
-        return atoi( get_event_field_val( event, "seqno", "0" ) );
+        return get_event_field_int( event, "seqno" );
     }
 
     if ( is_drm_sched_timeline_event( event ) )
@@ -692,14 +1224,14 @@ std::string TraceEvents::get_ftrace_ctx_str( const trace_event_t &event )
 
 void TraceEvents::init_sched_switch_event( trace_event_t &event )
 {
-    const char *prev_pid_str = get_event_field_val( event, "prev_pid" );
-    const char *next_pid_str = get_event_field_val( event, "next_pid" );
+    const event_field_t *prev_pid_field = get_event_field( event, "prev_pid" );
+    const event_field_t *next_pid_field = get_event_field( event, "next_pid" );
 
-    if ( *prev_pid_str && *next_pid_str )
+    if ( prev_pid_field && next_pid_field )
     {
-        int prev_pid = atoi( prev_pid_str );
-        int next_pid = atoi( next_pid_str );
-        const std::vector< uint32_t > *plocs;
+        int prev_pid = prev_pid_field->get_int();
+        int next_pid = next_pid_field->get_int();
+        const EventLocs *plocs;
 
         // Seems that sched_switch event.pid is equal to the event prev_pid field.
         // We're running with this in several bits of code in gpuvis_graph, so assert it's true.
@@ -717,7 +1249,7 @@ void TraceEvents::init_sched_switch_event( trace_event_t &event )
             // TASK_STOPPED (4): Stopped process by job control signal or ptrace
             // TASK_TRACED (8): Task is being monitored by other process (such as debugger)
             // TASK_ZOMBIE (32): Finished but waiting for parent to call wait() to cleanup
-            int prev_state = atoi( get_event_field_val( event, "prev_state" ) );
+            int prev_state = get_event_field_int( event, "prev_state" );
             int task_state = prev_state & ( TASK_REPORT_MAX - 1 );
 
             if ( task_state == 0 )
@@ -740,13 +1272,13 @@ void TraceEvents::init_sched_switch_event( trace_event_t &event )
         {
             const char *comm = comm_from_pid( prev_pid );
             if ( comm )
-                m_comm_locs.add_location_str( comm, event.id );
+                m_comm_locs.add_location_str( m_strpool, comm, event.id );
         }
         if ( next_pid != event.pid )
         {
             const char *comm = comm_from_pid( next_pid );
             if ( comm )
-                m_comm_locs.add_location_str( comm, event.id );
+                m_comm_locs.add_location_str( m_strpool, comm, event.id );
         }
     }
 }
@@ -754,8 +1286,8 @@ void TraceEvents::init_sched_switch_event( trace_event_t &event )
 void TraceEvents::init_sched_process_fork( trace_event_t &event )
 {
     // parent_comm=glxgears parent_pid=23543 child_comm=glxgears child_pid=23544
-    int tgid = atoi( get_event_field_val( event, "parent_pid", "0" ) );
-    int pid = atoi( get_event_field_val( event, "child_pid", "0" ) );
+    int tgid = get_event_field_int( event, "parent_pid" );
+    int pid = get_event_field_int( event, "child_pid" );
     const char *tgid_comm = get_event_field_val( event, "parent_comm", NULL );
     const char *child_comm = get_event_field_val( event, "child_comm", NULL );
 
@@ -787,13 +1319,13 @@ void TraceEvents::init_amd_timeline_event( trace_event_t &event )
     const char *timeline = get_event_field_val( event, "timeline" );
 
     // Add this event under the "gfx", "sdma0", etc timeline map
-    m_amd_timeline_locs.add_location_str( timeline, event.id );
+    m_amd_timeline_locs.add_location_str( m_strpool, timeline, event.id );
 
     // Add this event under our "gfx_ctx_seq" or "sdma0_ctx_seq", etc. map
     m_gfxcontext_locs.add_location_u32( gfxcontext_hash, event.id );
 
     // Grab the event locations for this event context
-    const std::vector< uint32_t > *plocs = get_gfxcontext_locs( gfxcontext_hash );
+    const EventLocs *plocs = get_gfxcontext_locs( gfxcontext_hash );
     if ( plocs->size() > 1 )
     {
         // First event.
@@ -824,10 +1356,10 @@ void TraceEvents::init_msm_timeline_event( trace_event_t &event )
 {
     uint32_t gfxcontext_hash = get_event_gfxcontext_hash( event );
 
-    int ringid = atoi( get_event_field_val( event, "ringid", "0" ) );
+    int ringid = get_event_field_int( event, "ringid" );
     std::string str = string_format( "msm ring%d", ringid );
 
-    m_amd_timeline_locs.add_location_str( str.c_str(), event.id );
+    m_amd_timeline_locs.add_location_str( m_strpool, str.c_str(), event.id );
 
     m_gfxcontext_locs.add_location_u32( gfxcontext_hash, event.id );
 
@@ -844,7 +1376,7 @@ void TraceEvents::init_msm_timeline_event( trace_event_t &event )
         event.flags |= TRACE_FLAG_HW_QUEUE;
     }
 
-    const std::vector< uint32_t > *plocs = m_gfxcontext_locs.get_locations_u32( gfxcontext_hash );
+    const EventLocs *plocs = m_gfxcontext_locs.get_locations_u32( gfxcontext_hash );
     if ( plocs->size() > 1 )
     {
         // First event.
@@ -864,21 +1396,21 @@ void TraceEvents::init_drm_sched_timeline_event( trace_event_t &event )
     const char *ring;
     uint32_t fence;
 
-    fence = strtoul( get_event_field_val( event, "fence", "0" ), nullptr, 0 );
+    fence = get_event_field_int( event, "fence" );
     event.flags |= TRACE_FLAG_TIMELINE;
 
     if ( !strcmp( event.name, "drm_sched_job" ) )
     {
         event.flags |= TRACE_FLAG_SW_QUEUE;
         event.id_start = INVALID_ID;
-        event.graph_row_id = atoi( get_event_field_val( event, "job_count", "0" ) ) +
-                             atoi( get_event_field_val( event, "hw_job_count", "0" ) );
-        event.seqno = strtoul( get_event_field_val( event, "id", "0" ), nullptr, 0 );
+        event.graph_row_id = get_event_field_int( event, "job_count" ) +
+                             get_event_field_int( event, "hw_job_count" );
+        event.seqno = get_event_field_int( event, "id" );
         m_drm_sched.outstanding_jobs[fence] = event.seqno;
         ring = get_event_field_val( event, "name", "<unknown>" );
         str = string_format( "drm sched %s", ring );
         m_drm_sched.rings.insert(str);
-        m_amd_timeline_locs.add_location_str( str.c_str(), event.id );
+        m_amd_timeline_locs.add_location_str( m_strpool, str.c_str(), event.id );
         m_gfxcontext_locs.add_location_u32( event.seqno, event.id );
         return;
     }
@@ -889,7 +1421,7 @@ void TraceEvents::init_drm_sched_timeline_event( trace_event_t &event )
         return;
     }
 
-    const std::vector< uint32_t > *plocs = get_gfxcontext_locs( job->second );
+    const EventLocs *plocs = get_gfxcontext_locs( job->second );
     if ( plocs->size()  < 1 )
     {
         // no previous start event. This event will be dropped
@@ -913,7 +1445,7 @@ void TraceEvents::init_drm_sched_timeline_event( trace_event_t &event )
                 ring = get_event_field_val( e, "name", "<unknown>" );
                 str = string_format( "drm sched %s", ring );
                 m_drm_sched.rings.insert( str );
-                m_amd_timeline_locs.add_location_str( str.c_str(), event.id );
+                m_amd_timeline_locs.add_location_str( m_strpool, str.c_str(), event.id );
                 event.user_comm = e.comm;
                 event.id_start = e.id;
                 event.flags |= TRACE_FLAG_HW_QUEUE;
@@ -944,7 +1476,7 @@ void TraceEvents::init_drm_sched_timeline_event( trace_event_t &event )
                 ring = get_event_field_val( e, "name", "<unknown>" );
                 str = string_format( "drm sched %s", ring );
                 m_drm_sched.rings.insert( str );
-                m_amd_timeline_locs.add_location_str( str.c_str(), event.id );
+                m_amd_timeline_locs.add_location_str( m_strpool, str.c_str(), event.id );
                 event.user_comm = e.comm;
                 event.id_start = e.id;
                 event.flags |= TRACE_FLAG_FENCE_SIGNALED;
@@ -988,7 +1520,7 @@ static int64_t normalize_vblank_diff( int64_t diff )
 void TraceEvents::init_new_event_vblank( trace_event_t &event )
 {
     // See if we have a drm_vblank_event_queued with the same seq number
-    uint32_t seqno = strtoul( get_event_field_val( event, "seq" ), NULL, 10 );
+    uint32_t seqno = get_event_field_int( event, "seq" );
     uint32_t *vblank_queued_id = m_drm_vblank_event_queued.get_val( seqno );
 
     if ( vblank_queued_id )
@@ -996,17 +1528,17 @@ void TraceEvents::init_new_event_vblank( trace_event_t &event )
         trace_event_t &event_vblank_queued = m_events[ *vblank_queued_id ];
 
         // If so, set the vblank queued time
-        event_vblank_queued.duration = event.get_vblank_ts( VBlankHighPrecTimestamps ) - event_vblank_queued.ts;
+        event_vblank_queued.duration = get_vblank_ts( event, VBlankHighPrecTimestamps ) - event_vblank_queued.ts;
     }
 
-    m_tdopexpr_locs.add_location_str( "$name=drm_vblank_event", event.id );
+    m_tdopexpr_locs.add_location_str( m_strpool, "$name=drm_vblank_event", event.id );
 
     /*
      * vblank interval calculations
      */
     if ( m_vblank_info[ event.crtc ].last_vblank_ts )
     {
-        int64_t diff = event.get_vblank_ts( VBlankHighPrecTimestamps ) - m_vblank_info[ event.crtc ].last_vblank_ts;
+        int64_t diff = get_vblank_ts( event, VBlankHighPrecTimestamps ) - m_vblank_info[ event.crtc ].last_vblank_ts;
 
         // Normalize ts diff to known frequencies
         diff = normalize_vblank_diff( diff );
@@ -1016,7 +1548,7 @@ void TraceEvents::init_new_event_vblank( trace_event_t &event )
         m_vblank_info[ event.crtc ].count++;
     }
 
-    m_vblank_info[ event.crtc ].last_vblank_ts = event.get_vblank_ts( VBlankHighPrecTimestamps );
+    m_vblank_info[ event.crtc ].last_vblank_ts = get_vblank_ts( event, VBlankHighPrecTimestamps );
 }
 
 // new_event_cb adds all events to array, this function initializes them.
@@ -1036,7 +1568,7 @@ void TraceEvents::init_new_event( trace_event_t &event )
     }
     else if ( !strcmp( event.name, "drm_vblank_event_queued" ) )
     {
-        uint32_t seqno = strtoul( get_event_field_val( event, "seq" ), NULL, 10 );
+        uint32_t seqno = get_event_field_int( event, "seq" );
 
         if ( seqno )
             m_drm_vblank_event_queued.set_val( seqno, event.id );
@@ -1046,13 +1578,13 @@ void TraceEvents::init_new_event( trace_event_t &event )
     if ( event.is_vblank() )
     {
         // Add vblanks as "drm_vblank_event1", etc
-        uint32_t hashval = m_strpool.getu32f( "%s%d", event.name, event.crtc );
+        uint32_t nameid = m_strpool.getidf( "%s%d", event.name, event.crtc );
 
-        m_eventnames_locs.add_location_u32( hashval, event.id );
+        m_eventnames_locs.add_location_u32( nameid, event.id );
     }
     else
     {
-        m_eventnames_locs.add_location_str( event.name, event.id );
+        m_eventnames_locs.add_location_str( m_strpool, event.name, event.id );
     }
 
     if ( !strcmp( event.name, "sched_process_exec" ) )
@@ -1112,114 +1644,556 @@ void TraceEvents::init_new_event( trace_event_t &event )
             m_gfxcontext_msg_locs.add_location_u32( gfxcontext_hash, event.id );
     }
 
-    // 1+ means loading events
-    m_eventsloaded.fetch_add( 1 );
+    // 1+ means loading events
+    m_eventsloaded.fetch_add( 1 );
+}
+
+TraceEvents::tracestatus_t TraceEvents::get_load_status( uint32_t *count )
+{
+    int eventsloaded = m_eventsloaded.load();
+
+    if ( eventsloaded > 0 )
+    {
+        if ( count )
+            *count = eventsloaded & ~0x40000000;
+
+        return ( eventsloaded & 0x40000000 ) ?
+                    Trace_Initializing : Trace_Loading;
+    }
+    else if ( !eventsloaded )
+    {
+        if ( count )
+            *count = m_events.size();
+        return Trace_Loaded;
+    }
+
+    if ( count )
+        *count = 0;
+    return Trace_Error;
+}
+
+void TraceEvents::calculate_vblank_info()
+{
+    // Go through all the vblank crtcs
+    for ( uint32_t i = 0; i < m_vblank_info.size(); i++ )
+    {
+        if ( !m_vblank_info[ i ].count )
+            continue;
+
+        uint32_t median = m_vblank_info[ i ].count / 2;
+
+        for ( const auto &x : m_vblank_info[ i ].diff_ts_count )
+        {
+            if ( x.second >= median )
+            {
+                // This is the median tsdiff
+                int64_t diff = x.first * 1000;
+
+                m_vblank_info[ i ].median_diff_ts = diff;
+
+                std::string str = ts_to_timestr( diff, 2 );
+                const std::string desc = string_format( "Show vblank crtc%u markers (~%s)", i, str.c_str() );
+
+                // s_opts().setdesc( OPT_RenderCrtc0 + i, desc );
+                break;
+            }
+
+            median -= x.second;
+        }
+    }
+}
+
+// Merge the runs of events from each loaded file into ts order
+static void merge_event_runs( std::vector< trace_event_t > &events, std::vector< size_t > &runs )
+{
+    auto ts_cmp = []( const trace_event_t &lx, const trace_event_t &rx ) { return lx.ts < rx.ts; };
+
+    runs.push_back( events.size() );
+
+    // Readers hand us events in ts order, except for binary marker events which
+    //  land ahead of the raw_data event that carried them. Sort any run that isn't.
+    for ( size_t i = 0; i + 1 < runs.size(); i++ )
+    {
+        auto begin = events.begin() + runs[ i ];
+        auto end = events.begin() + runs[ i + 1 ];
+
+        if ( !std::is_sorted( begin, end, ts_cmp ) )
+            std::stable_sort( begin, end, ts_cmp );
+    }
+
+    if ( runs.size() > 2 )
+    {
+        uint32_t count = runs.size() - 1;
+        std::vector< size_t > idx( runs.begin(), runs.end() - 1 );
+        std::vector< trace_event_t > merged;
+        util_merge_tree< int64_t > tree( count );
+
+        merged.reserve( events.size() );
+
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            if ( idx[ i ] < runs[ i + 1 ] )
+                tree.set_key( i, events[ idx[ i ] ].ts );
+        }
+        tree.build();
+
+        while ( !tree.empty() )
+        {
+            uint32_t i = tree.top();
+
+            merged.push_back( events[ idx[ i ] ] );
+
+            if ( ++idx[ i ] < runs[ i + 1 ] )
+                tree.replace_top( events[ idx[ i ] ].ts );
+            else
+                tree.pop_top();
+        }
+
+        events.swap( merged );
+    }
+
+    runs.clear();
+}
+
+// Called on the loading thread after all files are read, before init()
+void TraceEvents::prepare_events()
+{
+    // With multiple files, events are added out of order
+    merge_event_runs( m_events, m_event_runs );
+
+    // Assign event ids
+    for ( uint32_t i = 0; i < m_events.size(); i++ )
+    {
+        trace_event_t &event = m_events[ i ];
+
+        event.id = i;
+
+        // If this is a sched_switch event, see if it has comm info we don't know about.
+        // This is the reason we're initializing events in two passes to collect all this data.
+        if ( event.is_sched_switch() )
+        {
+            add_sched_switch_pid_comm( m_trace_info, event, "prev_pid", "prev_comm" );
+            add_sched_switch_pid_comm( m_trace_info, event, "next_pid", "next_comm" );
+        }
+        else if ( event.is_ftrace_print() )
+        {
+            new_event_ftrace_print( event );
+        }
+    }
+}
+
+void TraceEvents::init()
+{
+    // Set m_eventsloaded initializing bit
+    m_eventsloaded.store(0x40000000 );
+
+    m_vblank_info.resize( m_crtc_max + 1 );
+
+    //s_opts().set_crtc_max( m_crtc_max );
+
+    {
+        // Initialize events...
+        GPUVIS_TRACE_BLOCKF( "init_new_events: %lu events", m_events.size() );
+
+        for ( trace_event_t &event : m_events )
+            init_new_event( event );
+    }
+
+    // Figure out median vblank intervals
+    calculate_vblank_info();
+
+    // Init amd event durations
+    calculate_amd_event_durations();
+
+    // Index sched_switch run times for range queries
+    calculate_sched_runtimes();
+
+    // Init print column information
+    calculate_event_print_info();
+
+    // Remove tgid groups with single threads
+    remove_single_tgids();
+
+    // Update tgid colors
+    update_tgid_colors();
+
+    // Index strings for =~ filters in the background
+    start_text_index();
+
+#if 0
+    std::vector< INIEntry > entries = s_ini().GetSectionEntries( "$imgui_eventcolors$" );
+
+    // Restore event colors
+    for ( const INIEntry &entry : entries )
+    {
+        const std::string &eventname = entry.first;
+        const std::string &val = entry.second;
+
+        if ( !val.empty() )
+        {
+            uint32_t color = std::stoull( val, NULL, 0 );
+
+            set_event_color( eventname.c_str(), color );
+        }
+    }
+#endif
+}
+
+size_t TraceEvents::append_events( const trace_info_t &trace_info, std::vector< trace_event_t > &events )
+{
+    GPUVIS_TRACE_BLOCKF( "%s: %lu events", __func__, events.size() );
+
+    // Background jobs read m_events. Pollers restart the filter jobs and the
+    //  append job is restarted below with the events it hadn't added yet.
+    cancel_tdopexpr_jobs();
+    stop_text_index();
+    uint32_t append_id = stop_tdopexpr_append();
+
+    // Chunk timestamps are relative to the first event in their own file
+    int64_t ts_offset = trace_info.min_file_ts - m_trace_info.min_file_ts;
+    int64_t last_ts = m_events.empty() ? INT64_MIN : m_events.back().ts;
+    uint32_t first_id = m_events.size();
+    uint32_t late_events = 0;
+
+    // Add pids, tgids, and comms for new processes
+    for ( const auto &it : trace_info.pid_comm_map.m_map )
+    {
+        m_trace_info.pid_comm_map.get_val( it.first, it.second );
+    }
+    for ( const auto &it : trace_info.pid_tgid_map.m_map )
+    {
+        m_trace_info.pid_tgid_map.get_val( it.first, it.second );
+    }
+    for ( const auto &it : trace_info.tgid_pids.m_map )
+    {
+        tgid_info_t *tgid_info = m_trace_info.tgid_pids.get_val_create( it.first );
+
+        if ( !tgid_info->tgid )
+        {
+            tgid_info->tgid = it.second.tgid;
+            tgid_info->hashval = it.second.hashval;
+        }
+        for ( int pid : it.second.pids )
+            tgid_info->add_pid( pid );
+    }
+
+    // Chunks only hold records past where the last read of each cpu stopped,
+    //  but a cpu can hand us records older than another cpu's last one. Move
+    //  those up to our last ts so m_events stays sorted and ids stay indexes.
+    for ( trace_event_t &event : events )
+    {
+        event.id = m_events.size();
+        event.ts += ts_offset;
+
+        if ( event.ts < last_ts )
+        {
+            event.ts = last_ts;
+            late_events++;
+        }
+        last_ts = event.ts;
+
+        m_crtc_max = std::max< int >( m_crtc_max, event.crtc );
+        m_events.push_back( event );
+    }
+    events.clear();
+
+    if ( late_events )
+        logf( "Tail: %u events older than ones already added were moved up to them", late_events );
+
+    if ( first_id == m_events.size() )
+    {
+        start_tdopexpr_append( append_id );
+        start_text_index();
+        return 0;
+    }
+
+    // Same two passes as loading: collect comm and print info, then init events
+    for ( uint32_t i = first_id; i < m_events.size(); i++ )
+    {
+        trace_event_t &event = m_events[ i ];
+
+        if ( event.is_sched_switch() )
+        {
+            add_sched_switch_pid_comm( m_trace_info, event, "prev_pid", "prev_comm" );
+            add_sched_switch_pid_comm( m_trace_info, event, "next_pid", "next_comm" );
+        }
+        else if ( event.is_ftrace_print() )
+        {
+            new_event_ftrace_print( event );
+        }
+    }
+
+    m_vblank_info.resize( m_crtc_max + 1 );
+
+    for ( uint32_t i = first_id; i < m_events.size(); i++ )
+        init_new_event( m_events[ i ] );
+
+    calculate_vblank_info();
+    calculate_amd_event_durations( false, first_id );
+    calculate_sched_runtimes( first_id );
+    calculate_event_print_info();
+    remove_single_tgids();
+    update_tgid_colors( first_id );
+
+    // Match new events against compiled tdop expressions in the background.
+    //  Expressions with no matches are in m_tdopexpr_exprs too, so they pick up
+    //  new matches. Keep m_failed_commands so they aren't rescanned in full.
+    start_tdopexpr_append( std::min( append_id, first_id ) );
+
+    // Index the new events
+    start_text_index();
+
+    // Add samples from the new events to plots
+    for ( auto &it : m_graph_plots.m_map )
+        it.second.add_events( *this, first_id );
+
+    return m_events.size() - first_id;
+}
+
+void TraceEvents::start_tdopexpr_append( uint32_t first_id )
+{
+    if ( ( first_id >= m_events.size() ) || m_tdopexpr_exprs.m_map.empty() )
+        return;
+
+    tdopexpr_append_t *append = new tdopexpr_append_t;
+    std::vector< class TdopExpr * > exprs;
+
+    append->first_id = first_id;
+    append->last_id = m_events.size();
+
+    // Expressions are only deleted with us, so the job can hold on to them
+    for ( const auto &it : m_tdopexpr_exprs.m_map )
+    {
+        append->nameids.push_back( it.first );
+        exprs.push_back( it.second );
+    }
+    append->locs.resize( exprs.size() );
+
+    // The text index is rebuilt alongside us, so test every new event
+    append->job.start( [ this, append, exprs ]()
+    {
+        for ( size_t i = 0; ( i < exprs.size() ) && !append->job.is_cancelled(); i++ )
+        {
+            get_tdopexpr_events( exprs[ i ], append->locs[ i ], append->first_id, append->last_id,
+                                 0, &append->job, false );
+        }
+    } );
+
+    m_tdopexpr_append = append;
 }
 
-TraceEvents::tracestatus_t TraceEvents::get_load_status( uint32_t *count )
+uint32_t TraceEvents::stop_tdopexpr_append()
 {
-    int eventsloaded = m_eventsloaded.load();
+    // Keep the results of a finished job
+    update_tdopexpr_append();
+    if ( !m_tdopexpr_append )
+        return INVALID_ID;
 
-    if ( eventsloaded > 0 )
-    {
-        if ( count )
-            *count = eventsloaded & ~0x40000000;
+    uint32_t first_id = m_tdopexpr_append->first_id;
 
-        return ( eventsloaded & 0x40000000 ) ?
-                    Trace_Initializing : Trace_Loading;
-    }
-    else if ( !eventsloaded )
-    {
-        if ( count )
-            *count = m_events.size();
-        return Trace_Loaded;
-    }
+    // AsyncJob destructor cancels and waits
+    delete m_tdopexpr_append;
+    m_tdopexpr_append = nullptr;
 
-    if ( count )
-        *count = 0;
-    return Trace_Error;
+    return first_id;
 }
 
-void TraceEvents::calculate_vblank_info()
+bool TraceEvents::update_tdopexpr_append( bool wait )
 {
-    // Go through all the vblank crtcs
-    for ( uint32_t i = 0; i < m_vblank_info.size(); i++ )
-    {
-        if ( !m_vblank_info[ i ].count )
-            continue;
+    tdopexpr_append_t *append = m_tdopexpr_append;
 
-        uint32_t median = m_vblank_info[ i ].count / 2;
+    if ( !append )
+        return false;
+    if ( wait )
+        append->job.wait();
+    else if ( !append->job.is_done() )
+        return false;
 
-        for ( const auto &x : m_vblank_info[ i ].diff_ts_count )
+    bool added = false;
+
+    for ( size_t i = 0; i < append->nameids.size(); i++ )
+    {
+        if ( !append->locs[ i ].empty() )
         {
-            if ( x.second >= median )
-            {
-                // This is the median tsdiff
-                int64_t diff = x.first * 1000;
+            m_tdopexpr_locs.m_locs.get_val_create( append->nameids[ i ] )->append( append->locs[ i ] );
+            added = true;
+        }
+    }
 
-                m_vblank_info[ i ].median_diff_ts = diff;
+    delete append;
+    m_tdopexpr_append = nullptr;
 
-                std::string str = ts_to_timestr( diff, 2 );
-                const std::string desc = string_format( "Show vblank crtc%u markers (~%s)", i, str.c_str() );
+    return added;
+}
 
-                // s_opts().setdesc( OPT_RenderCrtc0 + i, desc );
-                break;
-            }
+// Shift an event id we're holding for trimmed events (or INVALID_ID if it was trimmed)
+static uint32_t trim_eventid( uint32_t id, uint32_t count )
+{
+    return ( is_valid_id( id ) && ( id >= count ) ) ? ( id - count ) : INVALID_ID;
+}
 
-            median -= x.second;
+// Shift event id values of a map, removing the trimmed ones
+template < typename K >
+static void trim_eventid_map( util_umap< K, uint32_t > &map, uint32_t count )
+{
+    for ( auto it = map.m_map.begin(); it != map.m_map.end(); )
+    {
+        if ( it->second < count )
+        {
+            it = map.m_map.erase( it );
+        }
+        else
+        {
+            it->second -= count;
+            it++;
         }
     }
 }
 
-void TraceEvents::init()
+void TraceEvents::trim_events( uint32_t count )
 {
-    // Set m_eventsloaded initializing bit
-    m_eventsloaded.store(0x40000000 );
+    GPUVIS_TRACE_BLOCKF( "%s: %u events", __func__, count );
 
-    m_vblank_info.resize( m_crtc_max + 1 );
+    count = std::min< size_t >( count, m_events.size() );
+    if ( !count || ( count == m_events.size() ) )
+        return;
 
-    //s_opts().set_crtc_max( m_crtc_max );
+    // Background filter jobs read m_events. Pollers restart them.
+    cancel_tdopexpr_jobs();
+    stop_text_index();
+    uint32_t append_id = stop_tdopexpr_append();
 
+    for ( uint32_t i = 0; i < count; i++ )
     {
-        // Initialize events...
-        GPUVIS_TRACE_BLOCKF( "init_new_events: %lu events", m_events.size() );
+        const trace_event_t &event = m_events[ i ];
 
-        for ( trace_event_t &event : m_events )
-            init_new_event( event );
-    }
-
-    // Figure out median vblank intervals
-    calculate_vblank_info();
+        // Take trimmed sched_switch runs out of the totals init_sched_switch_event() added them to
+        if ( event.is_sched_switch() && event.has_duration() )
+        {
+            int64_t *val = m_sched_switch_time_pid.get_val( event.pid );
 
-    // Init amd event durations
-    calculate_amd_event_durations();
+            m_sched_switch_time_total -= event.duration;
+            if ( val && ( ( *val -= event.duration ) <= 0 ) )
+                m_sched_switch_time_pid.erase_key( event.pid );
+        }
 
-    // Init print column information
-    calculate_event_print_info();
+        delete [] event.fields;
+    }
+    m_events.erase( m_events.begin(), m_events.begin() + count );
 
-    // Remove tgid groups with single threads
-    remove_single_tgids();
+    for ( trace_event_t &event : m_events )
+    {
+        event.id -= count;
+        event.id_start = trim_eventid( event.id_start, count );
+    }
 
-    // Update tgid colors
-    update_tgid_colors();
+    // Time based state is trimmed to our first event
+    int64_t ts = m_events[ 0 ].ts;
 
-#if 0
-    std::vector< INIEntry > entries = s_ini().GetSectionEntries( "$imgui_eventcolors$" );
+    m_comm_locs.trim( count );
+    m_eventnames_locs.trim( count );
+    m_gfxcontext_locs.trim( count );
+    m_gfxcontext_msg_locs.trim( count );
+    m_sched_switch_prev_locs.trim( count );
+    m_sched_switch_next_locs.trim( count );
+    m_sched_switch_cpu_locs.trim( count );
+    m_tdopexpr_locs.trim( count );
 
-    // Restore event colors
-    for ( const INIEntry &entry : entries )
+    // Timeline indexes are keyed on their location lists
+    for ( auto it = m_amd_timeline_locs.m_locs.m_map.begin(); it != m_amd_timeline_locs.m_locs.m_map.end(); )
     {
-        const std::string &eventname = entry.first;
-        const std::string &val = entry.second;
+        EventLocs *plocs = &it->second;
+        timeline_index_t *tindex = m_amd_timeline_index.get_val( plocs );
 
-        if ( !val.empty() )
+        plocs->trim( count );
+
+        if ( plocs->empty() )
         {
-            uint32_t color = std::stoull( val, NULL, 0 );
+            m_amd_timeline_index.m_map.erase( plocs );
+            it = m_amd_timeline_locs.m_locs.m_map.erase( it );
+            continue;
+        }
 
-            set_event_color( eventname.c_str(), color );
+        if ( tindex )
+        {
+            tindex->user.trim( count );
+            tindex->hw.trim( count );
         }
+        it++;
     }
-#endif
+
+    for ( auto &it : m_sched_cpu_runtime.m_map )
+        it.second.trim( ts );
+    for ( auto &it : m_sched_pid_runtime.m_map )
+        it.second.trim( ts );
+
+    for ( auto &it : m_graph_plots.m_map )
+        it.second.trim( count );
+
+    m_i915.reqwait_begin_locs.trim( count );
+    m_i915.reqwait_end_locs.trim( count );
+    m_i915.gem_req_locs.trim( count );
+    m_i915.req_locs.trim( count );
+    m_i915.req_queue_locs.trim( count );
+
+    std::vector< uint32_t > perf_locs;
+    for ( uint32_t id : m_i915.perf_locs )
+    {
+        if ( id >= count )
+            perf_locs.push_back( id - count );
+    }
+    m_i915.perf_locs.swap( perf_locs );
+
+    util_umap< uint32_t, uint32_t > perf_to_req_in;
+    for ( const auto &it : m_i915.perf_to_req_in.m_map )
+    {
+        if ( ( it.first >= count ) && ( it.second >= count ) )
+            perf_to_req_in.set_val( it.first - count, it.second - count );
+    }
+    m_i915.perf_to_req_in.m_map.swap( perf_to_req_in.m_map );
+
+    // Placed print events are at the start of print_locs
+    size_t print_locs_placed = 0;
+    for ( size_t i = 0; i < m_ftrace.print_locs_placed; i++ )
+    {
+        if ( m_ftrace.print_locs[ i ] >= count )
+            print_locs_placed++;
+    }
+    m_ftrace.print_locs.trim( count );
+    m_ftrace.print_locs_placed = print_locs_placed;
+
+    util_umap< uint32_t, print_info_t > print_info;
+    for ( const auto &it : m_ftrace.print_info.m_map )
+    {
+        if ( it.first >= count )
+            print_info.set_val( it.first - count, it.second );
+    }
+    m_ftrace.print_info.m_map.swap( print_info.m_map );
+
+    trim_eventid_map( m_ftrace.begin_ctx, count );
+    trim_eventid_map( m_ftrace.end_ctx, count );
+    trim_eventid_map( m_ftrace.pairs_ctx, count );
+
+    m_ftrace.row_pos.trim( ts );
+    for ( auto &it : m_ftrace.row_pos_pid.m_map )
+        it.second.trim( ts );
+    for ( auto &it : m_ftrace.row_pos_tgid.m_map )
+        it.second.trim( ts );
+
+    ftrace_row_info_t *row_info = get_ftrace_row_info_pid( -1 );
+    if ( row_info )
+        row_info->count = m_ftrace.print_locs.size();
+
+    trim_eventid_map( m_drm_vblank_event_queued, count );
+
+    // Index strings of the events left
+    m_text_index.comm.clear();
+    m_text_index.buf.clear();
+    start_text_index();
+
+    // Restart the append job on the events it hadn't added that are left
+    if ( is_valid_id( append_id ) )
+        start_tdopexpr_append( ( append_id > count ) ? ( append_id - count ) : 0 );
 }
 
 void TraceEvents::remove_single_tgids()
@@ -1240,8 +2214,10 @@ void TraceEvents::remove_single_tgids()
 
 void TraceEvents::set_event_color( const std::string &eventname, ImU32 color )
 {
-    const std::vector< uint32_t > *plocs =
-            m_eventnames_locs.get_locations_str( eventname.c_str() );
+    m_color_gen++;
+
+    const EventLocs *plocs =
+            m_eventnames_locs.get_locations_str( m_strpool, eventname.c_str() );
 
     if ( plocs )
     {
@@ -1305,34 +2281,52 @@ void TraceEvents::set_event_color( const std::string &eventname, ImU32 color )
   ; job completed
          <idle>-0    475.1690: fence_signaled:       driver=amd_sched timeline=gfx context=249 seqno=91446
  */
-void TraceEvents::calculate_amd_event_durations()
+// erase_unmatched is false when appending events in tail mode, so events waiting
+//  on a fence_signaled from a later chunk stay in their timeline.
+void TraceEvents::calculate_amd_event_durations( bool erase_unmatched, uint32_t first_eventid )
 {
-    std::vector< uint32_t > erase_list;
     std::vector< trace_event_t > &events = m_events;
     float label_sat = s_clrs().getalpha( col_Graph_TimelineLabelSat );
     float label_alpha = s_clrs().getalpha( col_Graph_TimelineLabelAlpha );
+    std::vector< std::pair< EventLocs *, timeline_index_t * > > timelines;
 
-    // Go through gfx, sdma0, sdma1, etc. timelines and calculate event durations
+    // Create index entries up front, timelines are then independent of each other
     for ( auto &timeline_locs : m_amd_timeline_locs.m_locs.m_map )
     {
-        uint32_t graph_row_id = 0;
-        int64_t last_fence_signaled_ts = 0;
-        std::vector< uint32_t > &locs = timeline_locs.second;
-        // const char *name = m_strpool.findstr( timeline_locs.first );
+        EventLocs *plocs = &timeline_locs.second;
+
+        timelines.push_back( { plocs, m_amd_timeline_index.get_val_create( plocs ) } );
+    }
+
+    // Go through gfx, sdma0, sdma1, etc. timelines and calculate event durations
+    uint32_t thread_count = FilterThreads ? FilterThreads : std::thread::hardware_concurrency();
+
+    util_parallel_for( timelines.size(), thread_count, [ & ]( size_t i )
+    {
+        EventLocs &locs = *timelines[ i ].first;
+        timeline_index_t &tindex = *timelines[ i ].second;
+        uint32_t &graph_row_id = tindex.graph_row_id;
+        int64_t &last_fence_signaled_ts = tindex.last_fence_signaled_ts;
 
         // Erase all timeline events with single entries or no fence_signaled
-        locs.erase( std::remove_if( locs.begin(), locs.end(),
-                                    [&events]( const uint32_t index )
-                                        { return !events[ index ].is_timeline(); }
-                                  ),
-                    locs.end() );
+        if ( erase_unmatched )
+        {
+            locs.erase_if( [&events]( const uint32_t index )
+                               { return !events[ index ].is_timeline(); } );
+        }
 
-        if ( locs.empty() )
-            erase_list.push_back( timeline_locs.first );
+        if ( !first_eventid )
+        {
+            tindex.user.clear();
+            tindex.hw.clear();
+            graph_row_id = 0;
+            last_fence_signaled_ts = 0;
+        }
 
-        for ( uint32_t index : locs )
+        // Appended events: earlier fences in this timeline were done last time
+        for ( size_t idx = vec_find_eventid( locs, first_eventid ); idx < locs.size(); idx++ )
         {
-            trace_event_t &fence_signaled = events[ index ];
+            trace_event_t &fence_signaled = events[ locs[ idx ] ];
 
             if ( fence_signaled.is_fence_signaled() &&
                  is_valid_id( fence_signaled.id_start ) )
@@ -1379,22 +2373,179 @@ void TraceEvents::calculate_amd_event_durations()
                 // Mark this event as autogen'd color so it doesn't get overwritten
                 fence_signaled.flags |= TRACE_FLAG_AUTOGEN_COLOR;
                 fence_signaled.color = imgui_col_from_hashval( hashval, label_sat, label_alpha );
+
+                tindex.user.push_back( start_ts, fence_signaled.ts, fence_signaled.id );
+                tindex.hw.push_back( hw_start_ts, fence_signaled.ts, fence_signaled.id );
+            }
+        }
+
+        tindex.user.init();
+        tindex.hw.init();
+    } );
+
+    // Completely erase timeline rows with zero entries.
+    for ( auto it = m_amd_timeline_locs.m_locs.m_map.begin(); it != m_amd_timeline_locs.m_locs.m_map.end(); )
+    {
+        if ( it->second.empty() )
+        {
+            m_amd_timeline_index.m_map.erase( &it->second );
+            it = m_amd_timeline_locs.m_locs.m_map.erase( it );
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void IntervalIndex::clear()
+{
+    m_intervals.clear();
+    m_min_ts0.clear();
+    m_max_ts1.clear();
+    m_leaves = 0;
+    m_count = 0;
+}
+
+void IntervalIndex::init()
+{
+    if ( m_leaves && ( m_intervals.size() <= m_leaves ) )
+    {
+        // New intervals fit in the tree: set their leaves and widen their parents
+        for ( size_t i = m_count; i < m_intervals.size(); i++ )
+        {
+            const interval_t &interval = m_intervals[ i ];
+
+            for ( size_t node = m_leaves + i; node >= 1; node /= 2 )
+            {
+                m_min_ts0[ node ] = std::min< int64_t >( m_min_ts0[ node ], interval.ts0 );
+                m_max_ts1[ node ] = std::max< int64_t >( m_max_ts1[ node ], interval.ts1 );
             }
         }
+
+        m_count = m_intervals.size();
+        return;
+    }
+
+    m_leaves = 1;
+    while ( m_leaves < m_intervals.size() )
+        m_leaves *= 2;
+
+    m_min_ts0.assign( 2 * m_leaves, INT64_MAX );
+    m_max_ts1.assign( 2 * m_leaves, INT64_MIN );
+
+    for ( size_t i = 0; i < m_intervals.size(); i++ )
+    {
+        m_min_ts0[ m_leaves + i ] = m_intervals[ i ].ts0;
+        m_max_ts1[ m_leaves + i ] = m_intervals[ i ].ts1;
+    }
+
+    for ( size_t node = m_leaves - 1; node >= 1; node-- )
+    {
+        m_min_ts0[ node ] = std::min< int64_t >( m_min_ts0[ 2 * node ], m_min_ts0[ 2 * node + 1 ] );
+        m_max_ts1[ node ] = std::max< int64_t >( m_max_ts1[ 2 * node ], m_max_ts1[ 2 * node + 1 ] );
+    }
+
+    m_count = m_intervals.size();
+}
+
+void IntervalIndex::trim( uint32_t count )
+{
+    std::vector< interval_t > intervals;
+
+    for ( const interval_t &interval : m_intervals )
+    {
+        if ( interval.eventid >= count )
+            intervals.push_back( { interval.ts0, interval.ts1, interval.eventid - count } );
+    }
+
+    clear();
+    m_intervals.swap( intervals );
+    init();
+}
+
+int64_t RunTimeIndex::get_runtime( int64_t ts0, int64_t ts1, uint32_t *count ) const
+{
+    // Runs [lo, hi) overlap [ts0, ts1]: first run ending after ts0 up to first starting at ts1
+    size_t lo = std::upper_bound( m_ts1.begin(), m_ts1.end(), ts0 ) - m_ts1.begin();
+    size_t hi = std::lower_bound( m_ts0.begin(), m_ts0.end(), ts1 ) - m_ts0.begin();
+
+    if ( count )
+        *count = ( hi > lo ) ? ( hi - lo ) : 0;
+    if ( hi <= lo )
+        return 0;
+
+    int64_t runtime = m_sum[ hi - 1 ] - ( lo ? m_sum[ lo - 1 ] : 0 );
+
+    // Clip partial runs at either end
+    runtime -= std::max< int64_t >( 0, ts0 - m_ts0[ lo ] );
+    runtime -= std::max< int64_t >( 0, m_ts1[ hi - 1 ] - ts1 );
+    return runtime;
+}
+
+void TraceEvents::calculate_sched_runtimes( uint32_t first_eventid )
+{
+    for ( uint32_t i = first_eventid; i < m_events.size(); i++ )
+    {
+        const trace_event_t &event = m_events[ i ];
+
+        // sched_switch durations are set when we saw the task get switched in
+        if ( event.is_sched_switch() && event.has_duration() && event.pid )
+        {
+            int64_t ts0 = event.ts - event.duration;
+
+            m_sched_cpu_runtime.m_map[ event.cpu ].add( ts0, event.ts );
+            m_sched_pid_runtime.m_map[ event.pid ].add( ts0, event.ts );
+        }
+    }
+}
+
+int64_t TraceEvents::get_cpu_runtime( uint32_t cpu, int64_t ts0, int64_t ts1, uint32_t *count )
+{
+    const RunTimeIndex *index = m_sched_cpu_runtime.get_val( cpu );
+
+    if ( !index )
+    {
+        if ( count )
+            *count = 0;
+        return 0;
     }
 
-    for ( uint32_t hashval : erase_list )
+    return index->get_runtime( ts0, ts1, count );
+}
+
+void TraceEvents::get_top_pid_runtimes( int64_t ts0, int64_t ts1, size_t max_count, std::vector< pid_runtime_t > &pids )
+{
+    pids.clear();
+
+    for ( const auto &it : m_sched_pid_runtime.m_map )
     {
-        // Completely erase timeline rows with zero entries.
-        m_amd_timeline_locs.m_locs.m_map.erase( hashval );
+        pid_runtime_t val;
+
+        val.pid = it.first;
+        val.runtime = it.second.get_runtime( ts0, ts1, &val.count );
+        if ( val.runtime > 0 )
+            pids.push_back( val );
     }
+
+    size_t count = std::min< size_t >( max_count, pids.size() );
+
+    // Ties go to the lower pid so the list doesn't depend on hash map order
+    std::partial_sort( pids.begin(), pids.begin() + count, pids.end(),
+                       []( const pid_runtime_t &lhs, const pid_runtime_t &rhs )
+                       {
+                           if ( lhs.runtime != rhs.runtime )
+                               return lhs.runtime > rhs.runtime;
+                           return lhs.pid < rhs.pid;
+                       } );
+    pids.resize( count );
 }
 
-const std::vector< uint32_t > *TraceEvents::get_locs( const char *name,
+const EventLocs *TraceEvents::get_locs( const char *name,
         loc_type_t *ptype, std::string *errstr )
 {
     loc_type_t type = LOC_TYPE_Max;
-    const std::vector< uint32_t > *plocs = NULL;
+    const EventLocs *plocs = NULL;
 
     if ( errstr )
         errstr->clear();
@@ -1440,12 +2591,12 @@ const std::vector< uint32_t > *TraceEvents::get_locs( const char *name,
         {
             type = LOC_TYPE_AMDTimeline;
         }
-        plocs = m_amd_timeline_locs.get_locations_str( timeline_name.c_str() );
+        plocs = m_amd_timeline_locs.get_locations_str( m_strpool, timeline_name.c_str() );
     }
     else if ( !strncmp( name, "drm sched", 9 ) )
     {
         type = LOC_TYPE_AMDTimeline;
-        plocs = m_amd_timeline_locs.get_locations_str( name );
+        plocs = m_amd_timeline_locs.get_locations_str( m_strpool, name );
     }
     else
     {
@@ -1454,10 +2605,11 @@ const std::vector< uint32_t > *TraceEvents::get_locs( const char *name,
         if ( ( len > 3 ) && !strcmp( name + len - 3, " hw" ) )
         {
             // Check for "gfx hw", "comp_1.1.1 hw", etc.
-            uint32_t hashval = hashstr32( name, len - 3 );
+            uint32_t nameid;
 
             type = LOC_TYPE_AMDTimeline_hw;
-            plocs = m_amd_timeline_locs.get_locations_u32( hashval );
+            if ( m_strpool.lookupid( name, &nameid, len - 3 ) )
+                plocs = m_amd_timeline_locs.get_locations_u32( nameid );
         }
 
         if ( !plocs )
@@ -1614,6 +2766,92 @@ TraceWin::~TraceWin()
     //s_opts().set_crtc_max( -1 );
 }
 
+size_t TraceWin::append_events( const trace_info_t &trace_info, std::vector< trace_event_t > &events )
+{
+    const std::vector< trace_event_t > &trace_events = m_trace_events.m_events;
+    int64_t last_ts = trace_events.empty() ? 0 : trace_events.back().ts;
+    size_t count = m_trace_events.append_events( trace_info, events );
+
+    if ( !count || !m_inited )
+        return count;
+
+    m_graph.rows.update( m_trace_events );
+    m_ts_to_eventid_cache.m_map.clear();
+
+    // Re-run event list filter to pick up new events
+    if ( m_filter.buf[ 0 ] )
+        m_filter.enabled = true;
+
+    // If the graph was showing the end of the trace, keep following it
+    if ( m_graph.start_ts + m_graph.length_ts >= last_ts )
+    {
+        m_graph.start_ts = trace_events.back().ts - m_graph.length_ts;
+        m_graph.recalc_timebufs = true;
+    }
+
+    return count;
+}
+
+void TraceWin::update_tdopexpr_append( bool wait )
+{
+    // New matches change what filters built from tdop expression locations show
+    if ( m_trace_events.update_tdopexpr_append( wait ) )
+        refilter_events();
+}
+
+void TraceWin::refilter_events()
+{
+    if ( m_filter.buf[ 0 ] )
+        m_filter.enabled = true;
+
+    // Rebuild row filter bitmasks from the filter locations
+    for ( auto &it : m_graph_row_filters.m_map )
+    {
+        if ( !it.second.filters.empty() )
+            it.second.pending = true;
+    }
+}
+
+void TraceWin::events_trimmed( uint32_t count )
+{
+    m_ts_to_eventid_cache.m_map.clear();
+    m_graph.row_lods.m_map.clear();
+
+    m_create_plot_eventid = trim_eventid( m_create_plot_eventid, count );
+    m_create_graph_row_eventid = trim_eventid( m_create_graph_row_eventid, count );
+    m_create_filter_eventid = trim_eventid( m_create_filter_eventid, count );
+
+    m_eventlist.goto_eventid = ( m_eventlist.goto_eventid >= count ) ? ( m_eventlist.goto_eventid - count ) : 0;
+    m_eventlist.start_eventid = trim_eventid( m_eventlist.start_eventid, count );
+    m_eventlist.end_eventid = trim_eventid( m_eventlist.end_eventid, count );
+    m_eventlist.popup_eventid = trim_eventid( m_eventlist.popup_eventid, count );
+    m_eventlist.selected_eventid = trim_eventid( m_eventlist.selected_eventid, count );
+    m_eventlist.hovered_eventid = trim_eventid( m_eventlist.hovered_eventid, count );
+    m_eventlist.highlight_ids.clear();
+    m_graph.last_hovered_eventid = trim_eventid( m_graph.last_hovered_eventid, count );
+
+    // Keep showing the filtered events that are left until the filter is re-run
+    std::vector< uint32_t > filter_events;
+    for ( uint32_t id : m_filter.events )
+    {
+        if ( id >= count )
+            filter_events.push_back( id - count );
+    }
+    m_filter.events.swap( filter_events );
+    refilter_events();
+
+    // Frames and checked filter locations point at trimmed events: set them again
+    m_frame_markers.clear_frames();
+    m_frame_markers.m_frame_marker_left = -1;
+    m_frame_markers.m_frame_marker_right = -1;
+    m_frame_markers.m_frame_marker_selected = -1;
+    m_frame_markers.dlg.m_checked = false;
+    m_frame_markers.dlg.m_left_plocs = NULL;
+    m_frame_markers.dlg.m_right_plocs = NULL;
+
+    m_graph.rows.update( m_trace_events );
+}
+
 void TraceWin::render()
 {
     GPUVIS_TRACE_BLOCK( __func__ );
@@ -1634,6 +2872,8 @@ void TraceWin::render()
     {
         if ( count )
         {
+            update_tdopexpr_append();
+
             if ( !m_inited )
             {
                 int64_t last_ts = m_trace_events.m_events.back().ts;
@@ -1823,10 +3063,10 @@ void TraceWin::trace_render_info()
             ImGui::SetColumnWidth( 1, imgui_scale( 75.0f ) );
         }
 
-        for ( auto item : m_trace_events.m_eventnames_locs.m_locs.m_map )
+        for ( const auto &item : m_trace_events.m_eventnames_locs.m_locs.m_map )
         {
-            const char *eventname = m_trace_events.m_strpool.findstr( item.first );
-            const std::vector< uint32_t > &locs = item.second;
+            const char *eventname = m_trace_events.m_strpool.findid( item.first );
+            const EventLocs &locs = item.second;
 
             ImGui::Text( "%s", eventname );
             ImGui::NextColumn();
@@ -2059,8 +3299,7 @@ bool TraceWin::eventlist_render_popupmenu( uint32_t eventid )
     if ( m_frame_markers.m_left_frames.size() &&
          ImGui::MenuItem( "Clear Frame Markers" ) )
     {
-        m_frame_markers.m_left_frames.clear();
-        m_frame_markers.m_right_frames.clear();
+        m_frame_markers.clear_frames();
     }
 
     if ( s_actions().get( action_escape ) )
@@ -2080,8 +3319,9 @@ static std::string get_event_fields_str( const trace_event_t &event, const char
     for ( uint32_t i = 0; i < event.numfields; i++ )
     {
         std::string buf;
+        char valbuf[ 64 ];
         const char *key = event.fields[ i ].key;
-        const char *value = event.fields[ i ].value;
+        const char *value = event.fields[ i ].get_str( valbuf );
 
         if ( event.is_ftrace_print() && !strcmp( key, "buf" ) )
         {
@@ -2265,48 +3505,56 @@ void TraceWin::eventlist_render_options()
          imgui_input_text2( "Event Filter:", m_filter.buf, 500.0f,
                             ImGuiInputTextFlags_EnterReturnsTrue | ImGuiInputText2FlagsLeft_LabelIsButton ) )
     {
-        m_filter.events.clear();
-        m_filter.pid_eventcount.m_map.clear();
+        // Cancel superseded filter job
+        if ( !m_filter.pending.empty() && ( m_filter.pending != m_filter.buf ) )
+            m_trace_events.cancel_tdopexpr_job( m_filter.pending.c_str() );
+
+        m_filter.pending = m_filter.buf;
         m_filter.errstr.clear();
         m_filter.enabled = false;
 
-        if ( m_filter.buf[ 0 ] )
+        if ( !m_filter.buf[ 0 ] )
         {
-            tdop_get_key_func get_key_func = std::bind( filter_get_key_func, &m_trace_events.m_strpool, _1, _2 );
-            class TdopExpr *tdop_expr = tdopexpr_compile( m_filter.buf, get_key_func, m_filter.errstr );
+            m_filter.events.clear();
+            m_filter.pid_eventcount.m_map.clear();
+        }
+    }
+
+    // Poll background filter job. Previous results are shown until it's done.
+    if ( !m_filter.pending.empty() )
+    {
+        bool pending;
+        const EventLocs *plocs = m_trace_events.get_tdopexpr_locs(
+                    m_filter.pending.c_str(), &m_filter.errstr, &pending );
 
-            util_time_t t0 = util_get_time();
+        if ( !pending )
+        {
+            m_filter.events.clear();
+            m_filter.pid_eventcount.m_map.clear();
 
-            if ( tdop_expr )
+            if ( m_filter.errstr.empty() )
             {
                 for ( trace_event_t &event : m_trace_events.m_events )
-                {
-                    tdop_get_keyval_func get_keyval_func = std::bind( filter_get_keyval_func,
-                                                                      &m_trace_events.m_trace_info, &event, _1, _2 );
-
-                    const char *ret = tdopexpr_exec( tdop_expr, get_keyval_func );
+                    event.is_filtered_out = true;
 
-                    event.is_filtered_out = !ret[ 0 ];
-                    if ( !event.is_filtered_out )
-                    {
-                        m_filter.events.push_back( event.id );
+                if ( plocs )
+                    m_filter.events = plocs->to_vector();
+                else
+                    m_filter.errstr = "WARNING: No events found.";
 
-                        // Bump up count of !filtered events for this pid
-                        uint32_t *count = m_filter.pid_eventcount.get_val( event.pid, 0 );
-                        (*count)++;
-                    }
-                }
+                for ( uint32_t eventid : m_filter.events )
+                {
+                    trace_event_t &event = m_trace_events.m_events[ eventid ];
 
-                if ( m_filter.events.empty() )
-                    m_filter.errstr = "WARNING: No events found.";
+                    event.is_filtered_out = false;
 
-                tdopexpr_delete( tdop_expr );
-                tdop_expr = NULL;
+                    // Bump up count of !filtered events for this pid
+                    uint32_t *count = m_filter.pid_eventcount.get_val( event.pid, 0 );
+                    (*count)++;
+                }
             }
 
-            float time = util_time_to_ms( t0, util_get_time() );
-            if ( time > 1000.0f )
-                logf( "tdopexpr_compile(\"%s\"): %.2fms\n", m_filter.buf, time );
+            m_filter.pending.clear();
         }
     }
 
@@ -2338,13 +3586,22 @@ void TraceWin::eventlist_render_options()
     ImGui::SameLine();
     if ( ImGui::Button( "Clear Filter" ) )
     {
+        if ( !m_filter.pending.empty() )
+            m_trace_events.cancel_tdopexpr_job( m_filter.pending.c_str() );
+
+        m_filter.pending.clear();
         m_filter.events.clear();
         m_filter.pid_eventcount.m_map.clear();
         m_filter.errstr.clear();
         m_filter.buf[ 0 ] = 0;
     }
 
-    if ( !m_filter.errstr.empty() )
+    if ( !m_filter.pending.empty() )
+    {
+        ImGui::SameLine();
+        ImGui::Text( "Filtering... %.0f%%", 100.0f * m_trace_events.get_tdopexpr_progress( m_filter.pending.c_str() ) );
+    }
+    else if ( !m_filter.errstr.empty() )
     {
         ImGui::SameLine();
         ImGui::TextColored( ImVec4( 1, 0, 0, 1 ), "%s", m_filter.errstr.c_str() );
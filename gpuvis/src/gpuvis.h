@@ -48,6 +48,21 @@ enum loc_type_t
     LOC_TYPE_Max
 };
 
+// Trim all lists in a locations map (see EventLocs::trim) and remove emptied ones
+template < typename K >
+void trim_locs_map( util_umap< K, EventLocs > &locs, uint32_t count )
+{
+    for ( auto it = locs.m_map.begin(); it != locs.m_map.end(); )
+    {
+        it->second.trim( count );
+
+        if ( it->second.empty() )
+            it = locs.m_map.erase( it );
+        else
+            it++;
+    }
+}
+
 class TraceLocations
 {
 public:
@@ -56,29 +71,47 @@ public:
 
     void add_location_u32( uint32_t hashval, uint32_t loc )
     {
-        std::vector< uint32_t > *plocs = m_locs.get_val_create( hashval );
+        EventLocs *plocs = m_locs.get_val_create( hashval );
 
         plocs->push_back( loc );
     }
 
-    std::vector< uint32_t > *get_locations_u32( uint32_t hashval )
+    EventLocs *get_locations_u32( uint32_t hashval )
     {
         return m_locs.get_val( hashval );
     }
 
-    void add_location_str( const char *name, uint32_t loc )
+    // Names are keyed on their StrPool id so different names never share locations
+    void add_location_str( StrPool &strpool, const char *name, uint32_t loc )
     {
-        add_location_u32( hashstr32( name ), loc );
+        add_location_u32( strpool.getid( name ), loc );
     }
 
-    std::vector< uint32_t > *get_locations_str( const char *name )
+    EventLocs *get_locations_str( StrPool &strpool, const char *name )
     {
-        return get_locations_u32( hashstr32( name ) );
+        uint32_t id;
+
+        return strpool.lookupid( name, &id ) ? get_locations_u32( id ) : NULL;
+    }
+
+    void trim( uint32_t count )
+    {
+        trim_locs_map( m_locs, count );
+    }
+
+    // Bytes allocated by all location lists
+    size_t mem_size() const
+    {
+        size_t size = 0;
+
+        for ( const auto &item : m_locs.m_map )
+            size += item.second.mem_size();
+        return size;
     }
 
 public:
-    // Map of name hashval to array of event locations.
-    util_umap< uint32_t, std::vector< uint32_t > > m_locs;
+    // Map of name id (or pid, cpu, etc.) to array of event locations.
+    util_umap< uint32_t, EventLocs > m_locs;
 };
 
 class TraceLocationsRingCtxSeq
@@ -88,15 +121,20 @@ public:
     ~TraceLocationsRingCtxSeq() {}
 
     bool add_location( const trace_event_t &event );
-    std::vector< uint32_t > *get_locations( const trace_event_t &event );
-    std::vector< uint32_t > *get_locations( uint32_t ringno, uint32_t seqno, const char *ctxstr );
+    EventLocs *get_locations( const trace_event_t &event );
+    EventLocs *get_locations( uint32_t ringno, uint32_t seqno, const char *ctxstr );
 
     static uint64_t db_key( const trace_event_t &event );
     static uint64_t db_key( uint32_t ringno, uint32_t seqno, const char *ctxstr );
 
+    void trim( uint32_t count )
+    {
+        trim_locs_map( m_locs, count );
+    }
+
 public:
     // Map of db_key to array of event locations.
-    util_umap< uint64_t, std::vector< uint32_t > > m_locs;
+    util_umap< uint64_t, EventLocs > m_locs;
 };
 
 // Given a sorted array (like from TraceLocations), binary search for eventid
@@ -107,6 +145,52 @@ inline size_t vec_find_eventid( const std::vector< uint32_t > &vec, uint32_t eve
 
     return i - vec.begin();
 }
+inline size_t vec_find_eventid( const EventLocs &locs, uint32_t eventid )
+{
+    return locs.lower_bound( eventid );
+}
+
+// Trigram index of the distinct strings one event variable takes ($comm, $buf).
+//  A substring query intersects the posting lists of its trigrams, checks the
+//  candidate strings and returns the events using the ones that match.
+class TextIndex
+{
+public:
+    TextIndex() {}
+    ~TextIndex() {}
+
+    // Index events [m_event_count, events.size()). Returns false if job was cancelled.
+    bool add_events( const std::vector< trace_event_t > &events, const AsyncJob *job = nullptr );
+
+    // Set locs to sorted ids of indexed events whose string contains substr,
+    //  ignoring case. Returns false if substr is too short to look up.
+    bool find( const char *substr, std::vector< uint32_t > &locs ) const;
+
+    // Drop everything indexed. m_key is kept.
+    void clear();
+
+    size_t mem_size() const;
+
+protected:
+    const char *get_str( const trace_event_t &event ) const;
+    void add_str_trigrams( const char *str, uint32_t stridx );
+
+public:
+    // Field key (StrPool string) or NULL for $comm
+    const char *m_key = nullptr;
+    // Events [0, m_event_count) are indexed
+    size_t m_event_count = 0;
+    // False if some events have non string values we can't index
+    bool m_complete = true;
+
+    // Distinct strings and the ids of events using each one
+    std::vector< const char * > m_strs;
+    std::vector< EventLocs > m_str_events;
+    util_umap< const char *, uint32_t > m_str_idx;
+
+    // Lowercase trigram -> m_strs indices
+    util_umap< uint32_t, EventLocs > m_trigrams;
+};
 
 /*
    [Compositor] NewFrame idx=2776
@@ -127,9 +211,34 @@ public:
 
     bool init( TraceEvents &trace_events, const std::string &name,
                const std::string &filter_str, const std::string scanf_str );
+    // Add samples from filter locations of events first_eventid and up (tail mode)
+    void add_events( TraceEvents &trace_events, uint32_t first_eventid );
+    // Remove samples of events below count and shift the rest (see EventLocs::trim)
+    void trim( uint32_t count );
 
     uint32_t find_ts_index( int64_t ts0 );
 
+    static const uint32_t s_level0_shift = 14;
+
+    struct plotbucket_t
+    {
+        int64_t ts;        // ts of first sample in bucket
+        uint32_t minidx;   // m_plotdata indices of min and max samples in bucket
+        uint32_t maxidx;
+    };
+    struct plotlevel_t
+    {
+        int64_t bucket_ts;
+        std::vector< plotbucket_t > buckets;
+    };
+
+    // Coarsest envelope level with buckets no wider than a pixel, or NULL to draw all samples
+    const plotlevel_t *get_level( double ts_per_pixel ) const;
+
+protected:
+    // Add m_plotdata samples first_idx and up to the envelope levels
+    void init_levels( uint32_t first_idx );
+
 public:
     struct plotdata_t
     {
@@ -139,6 +248,11 @@ public:
     };
     std::vector< plotdata_t > m_plotdata;
 
+    // Min/max envelope of m_plotdata used to draw zoomed out plots in O(pixels).
+    //  Level k groups samples into time buckets of 2^(14+2k) ns. Keeping the min
+    //  and max sample of each bucket means peaks are never dropped.
+    std::vector< plotlevel_t > m_levels;
+
     float m_minval = FLT_MAX;
     float m_maxval = FLT_MIN;
 
@@ -189,6 +303,8 @@ public:
 
     std::string m_plot_buf;
     std::string m_plot_err_str;
+    // Filter being evaluated on a background job
+    std::string m_plot_pending;
     bool m_interpolation;
     char m_plot_name_buf[ 128 ];
     char m_plot_filter_buf[ 512 ];
@@ -249,6 +365,174 @@ struct row_filter_t
 {
     BitVec *bitvec = nullptr;
     std::vector< std::string > filters;
+    // Waiting on background filter jobs to build bitvec
+    bool pending = false;
+};
+
+// Multi-resolution summary of a graph row's events used to draw zoomed out rows
+//  in O(pixels). Level k groups events into time buckets of 2^(14+2k) ns.
+class EventLOD
+{
+public:
+    EventLOD() {}
+    ~EventLOD() {}
+
+    static const uint32_t s_level0_shift = 14;
+
+    struct bucket_t
+    {
+        int64_t ts0;       // First and last event start in bucket
+        int64_t ts1;
+        uint32_t count;
+        ImU32 color;       // Color of last event (drawn on top)
+    };
+    struct level_t
+    {
+        int64_t bucket_ts;
+        std::vector< bucket_t > buckets;
+        // Events with durations too long to merge at this level
+        std::vector< uint32_t > long_events;
+    };
+
+    // skip_func returns true for events not drawn in row. If durations is set, events
+    //  start at ts - duration. key identifies skip_func settings, color_gen the
+    //  TraceEvents::m_color_gen the bucket colors were taken at.
+    void init( const std::vector< trace_event_t > &events, const EventLocs &locs,
+               uint32_t key, uint32_t color_gen, bool durations,
+               const std::function< bool ( const trace_event_t &event ) > &skip_func );
+    bool is_valid( const EventLocs &locs, uint32_t key, uint32_t color_gen ) const
+    {
+        return ( m_locs_size == locs.size() ) && ( m_key == key ) && ( m_color_gen == color_gen );
+    }
+
+    // Coarsest level with buckets no wider than a pixel, or NULL to draw all events
+    const level_t *get_level( double ts_per_pixel ) const;
+
+public:
+    size_t m_locs_size = ( size_t )-1;
+    uint32_t m_key = 0;
+    uint32_t m_color_gen = 0;
+    std::vector< level_t > m_levels;
+};
+
+// Intervals with a tree of min start / max end ts over them, in the order they
+//  were added. Finds intervals overlapping a time range in O(log n + k) for
+//  rows like timelines where intervals are close to sorted, without walking
+//  every event in the row.
+class IntervalIndex
+{
+public:
+    IntervalIndex() {}
+    ~IntervalIndex() {}
+
+    struct interval_t
+    {
+        int64_t ts0;
+        int64_t ts1;
+        uint32_t eventid;
+    };
+
+    void clear();
+    void push_back( int64_t ts0, int64_t ts1, uint32_t eventid )
+    {
+        m_intervals.push_back( { ts0, ts1, eventid } );
+    }
+    // Add intervals pushed since the last call to the tree. Only the new leaves
+    //  and their parents are updated until they outgrow the tree.
+    void init();
+    // Remove intervals of events below count and shift the rest (see EventLocs::trim)
+    void trim( uint32_t count );
+
+    // Call func for each interval overlapping [ts0, ts1] in the order they were
+    //  added. Stops if func returns false.
+    template < typename F >
+    void find( int64_t ts0, int64_t ts1, F func ) const
+    {
+        size_t depth = 0;
+        size_t stack[ 64 ];
+
+        if ( m_intervals.empty() )
+            return;
+
+        stack[ depth++ ] = 1;
+        while ( depth )
+        {
+            size_t node = stack[ --depth ];
+
+            if ( ( m_min_ts0[ node ] > ts1 ) || ( m_max_ts1[ node ] < ts0 ) )
+                continue;
+
+            if ( node >= m_leaves )
+            {
+                if ( !func( m_intervals[ node - m_leaves ] ) )
+                    return;
+            }
+            else
+            {
+                stack[ depth++ ] = 2 * node + 1;
+                stack[ depth++ ] = 2 * node;
+            }
+        }
+    }
+
+public:
+    std::vector< interval_t > m_intervals;
+
+    // Implicit binary tree: leaves start at m_leaves, node n has children 2n and 2n+1
+    size_t m_leaves = 0;
+    // Count of intervals in the tree
+    size_t m_count = 0;
+    std::vector< int64_t > m_min_ts0;
+    std::vector< int64_t > m_max_ts1;
+};
+
+// Cumulative run times of non-overlapping [ts0, ts1] runs added in time order.
+//  Total run time and count of runs in any range are found with binary searches.
+class RunTimeIndex
+{
+public:
+    RunTimeIndex() {}
+    ~RunTimeIndex() {}
+
+    void add( int64_t ts0, int64_t ts1 )
+    {
+        // Clip overlap with the previous run so ts0 and ts1 stay sorted
+        if ( !m_ts1.empty() )
+            ts0 = std::max< int64_t >( ts0, m_ts1.back() );
+        if ( ts1 <= ts0 )
+            return;
+
+        m_sum.push_back( get_total() + ( ts1 - ts0 ) );
+        m_ts0.push_back( ts0 );
+        m_ts1.push_back( ts1 );
+    }
+    int64_t get_total() const { return m_sum.empty() ? 0 : m_sum.back(); }
+
+    // Remove runs that ended before ts
+    void trim( int64_t ts )
+    {
+        size_t count = std::lower_bound( m_ts1.begin(), m_ts1.end(), ts ) - m_ts1.begin();
+
+        if ( count )
+        {
+            int64_t sum = m_sum[ count - 1 ];
+
+            m_ts0.erase( m_ts0.begin(), m_ts0.begin() + count );
+            m_ts1.erase( m_ts1.begin(), m_ts1.begin() + count );
+            m_sum.erase( m_sum.begin(), m_sum.begin() + count );
+            for ( int64_t &val : m_sum )
+                val -= sum;
+        }
+    }
+
+    // Run time clipped to [ts0, ts1]. Sets count to number of runs overlapping it.
+    int64_t get_runtime( int64_t ts0, int64_t ts1, uint32_t *count = NULL ) const;
+
+public:
+    std::vector< int64_t > m_ts0;
+    std::vector< int64_t > m_ts1;
+    // m_sum[ i ] is total run time of runs [0, i]
+    std::vector< int64_t > m_sum;
 };
 
 class RowFilters
@@ -264,6 +548,7 @@ public:
 
     size_t find_filter( const std::string &filter );
     void toggle_filter( TraceEvents &trace_events, size_t idx, const std::string &filter );
+    static void update_bitvec( TraceEvents &trace_events, row_filter_t *row_filters );
 
 public:
     uint32_t m_rowname_hash = 0;
@@ -271,6 +556,70 @@ public:
     util_umap< uint32_t, row_filter_t > &m_graph_row_filters;
 };
 
+// Log-linear histogram of non-negative values: 32 sub-buckets per power of two
+//  keeps values within ~3% of their bucket. Histograms can be merged.
+class HdrHistogram
+{
+public:
+    HdrHistogram() {}
+    ~HdrHistogram() {}
+
+    void clear();
+    void add( int64_t val );
+    void merge( const HdrHistogram &hist );
+
+    // Value at percentile pct [0..100]
+    int64_t get_percentile( double pct ) const;
+
+    static uint32_t get_bucket( int64_t val );
+    static int64_t get_bucket_val( uint32_t bucket );
+
+public:
+    static const uint32_t s_sub_bits = 5;
+
+    uint64_t m_count = 0;
+    int64_t m_total = 0;
+    int64_t m_min = INT64_MAX;
+    int64_t m_max = INT64_MIN;
+    std::vector< uint32_t > m_buckets;
+};
+
+// Frame lengths with histograms of each block of s_block_size frames, so
+//  percentiles of any frame range merge at most a block's worth of single frames.
+class FrameStats
+{
+public:
+    FrameStats() {}
+    ~FrameStats() {}
+
+    void clear();
+    // Frame start and end timestamps, in start order
+    void init( const std::vector< int64_t > &ts0, const std::vector< int64_t > &ts1 );
+
+    size_t size() const { return m_frame_len.size(); }
+
+    // Set frame0, frame1 to range of frames starting in [ts0, ts1)
+    void get_frames( int64_t ts0, int64_t ts1, size_t &frame0, size_t &frame1 ) const;
+    // Set hist to histogram of frame lengths in [frame0, frame1)
+    void get_histogram( size_t frame0, size_t frame1, HdrHistogram &hist ) const;
+    // Count of stutter frames in [frame0, frame1)
+    size_t get_stutter_count( size_t frame0, size_t frame1 ) const;
+
+public:
+    static const size_t s_block_size = 1024;
+
+    std::vector< int64_t > m_frame_ts;
+    std::vector< int64_t > m_frame_len;
+    std::vector< HdrHistogram > m_blocks;
+
+    // All frames
+    HdrHistogram m_hist;
+
+    // Frames longer than 1.5x the median frame length
+    int64_t m_stutter_len = INT64_MAX;
+    std::vector< uint32_t > m_stutter_frames;
+};
+
 class FrameMarkers
 {
 public:
@@ -288,11 +637,24 @@ public:
     bool render_dlg( TraceEvents &trace_events );
 
     int64_t get_frame_len( TraceEvents &trace_events, int frame );
+    // Get start and end timestamps of frame. Returns false if frame is invalid.
+    bool get_frame_range( TraceEvents &trace_events, int frame, int64_t &ts0, int64_t &ts1 );
+
+    // Clear set frame markers and their stats
+    void clear_frames();
+
+    // Set frames from marker filters without the dialog. An empty right filter
+    //  uses the left one. Returns false with errstr set if a filter has no events.
+    bool set_frames( TraceEvents &trace_events, const char *left_filter,
+                     const char *right_filter, std::string &errstr );
 
 protected:
-    void clear_dlg();
+    void clear_dlg( TraceEvents &trace_events );
     void set_tooltip();
     void setup_frames( TraceEvents &trace_events, bool set_frames );
+    // Pair left and right marker events into frames
+    void find_frames( TraceEvents &trace_events, bool set_frames,
+                      std::vector< int64_t > &ts0, std::vector< int64_t > &ts1 );
 
 public:
     // Variables use in Frame Marker dialog
@@ -302,10 +664,7 @@ public:
         bool m_checked = false;
 
         // Stats after checking frame marker filters
-        uint32_t m_count = 0;
-        int64_t m_tot_ts = 0;
-        int64_t m_min_ts = 0;
-        int64_t m_max_ts = 0;
+        FrameStats m_stats;
 
         // Left/Right marker filters
         char m_left_marker_buf[ 512 ];
@@ -316,13 +675,18 @@ public:
         std::string m_right_filter_err_str;
 
         // Left/Right event locations
-        const std::vector< uint32_t > *m_left_plocs = nullptr;
-        const std::vector< uint32_t > *m_right_plocs = nullptr;
+        const EventLocs *m_left_plocs = nullptr;
+        const EventLocs *m_right_plocs = nullptr;
+
+        // Filters being evaluated on background jobs
+        std::vector< std::string > m_pending_filters;
     } dlg;
 
     // Variables used to show & select set frame markers
     std::vector< uint32_t > m_left_frames;
     std::vector< uint32_t > m_right_frames;
+    // Stats of set frame markers
+    FrameStats m_stats;
 
     // Which frame is left, right, and selected in graph
     int m_frame_marker_left = -1;
@@ -342,6 +706,7 @@ struct print_info_t
     uint32_t graph_row_id_tgid;
 
     const char *buf;
+    // Rendered text size, measured on first draw. x < 0 when not yet measured.
     ImVec2 size;
 };
 
@@ -356,6 +721,24 @@ struct ftrace_row_info_t
     uint32_t count = 0;
 };
 
+class row_pos_t
+{
+public:
+    row_pos_t() {}
+    ~row_pos_t() {}
+
+    // Given a start and end time, return a row index with an open spot
+    uint32_t get_row( int64_t min_ts, int64_t max_ts );
+    // Remove blocks that ended before ts
+    void trim( int64_t ts );
+
+public:
+    // Count of total rows used
+    uint32_t m_rows = 0;
+    // Map of min_ts -> max_ts blocks used for for each row
+    std::array< std::map< int64_t, int64_t >, Opts::MAX_ROW_SIZE > m_row_pos = {};
+};
+
 class TraceEvents
 {
 public:
@@ -373,19 +756,49 @@ public:
     tracestatus_t get_load_status( uint32_t *count = NULL );
 
     // Return vec of locations for a tdop expression. Ie: "$name=drm_handle_vblank"
-    const std::vector< uint32_t > *get_tdopexpr_locs( const char *name, std::string *err = nullptr );
+    //  If pending is set, uncached expressions are evaluated on a background job and
+    //  this returns NULL with *pending = true until the job is done. Call again to poll.
+    const EventLocs *get_tdopexpr_locs( const char *name, std::string *err = nullptr,
+                                        bool *pending = nullptr );
+    // Progress [0..1] of background job for a tdop expression
+    float get_tdopexpr_progress( const char *name );
+    // Cancel background job for a superseded tdop expression
+    void cancel_tdopexpr_job( const char *name );
+    // Cancel and wait for all background tdop expression jobs
+    void cancel_tdopexpr_jobs();
+    // Keep a compiled expression in m_tdopexpr_exprs (takes ownership)
+    void add_tdopexpr( uint32_t nameid, class TdopExpr *tdop_expr );
+    // Append ids of events in [first_id, last_id) matching a compiled tdop expression.
+    //  thread_count 0 uses FilterThreads. Stops early if job is cancelled. Events
+    //  covered by the text index are only tested if they pass its =~ prefilter.
+    void get_tdopexpr_events( class TdopExpr *tdop_expr, std::vector< uint32_t > &locs,
+                              uint32_t first_id = 0, uint32_t last_id = UINT32_MAX, uint32_t thread_count = 0,
+                              AsyncJob *job = nullptr, bool use_text_index = true );
+    // Index $comm and $buf strings of new events on a background job
+    void start_text_index();
+    // Cancel and wait for the text index job
+    void stop_text_index();
+    // Set locs to candidate ids for the expression's required =~ terms. Returns the
+    //  number of events the candidates cover, or 0 if the index can't be used.
+    size_t get_text_index_candidates( class TdopExpr *tdop_expr, std::vector< uint32_t > &locs );
+    // Log timings of some common filter expressions
+    void benchmark_filters();
     // Return vec of locations for a cmdline. Ie: "SkinningApp-1536"
-    const std::vector< uint32_t > *get_comm_locs( const char *name );
+    const EventLocs *get_comm_locs( const char *name );
     // "gfx", "sdma0", etc.
-    const std::vector< uint32_t > *get_timeline_locs( const char *name );
+    const EventLocs *get_timeline_locs( const char *name );
     // Hash a string like "gfx_249_91446"
     uint32_t get_event_gfxcontext_hash( const trace_event_t &event );
-    const std::vector< uint32_t > *get_gfxcontext_locs( uint32_t gfxcontext_hash );
+    const EventLocs *get_gfxcontext_locs( uint32_t gfxcontext_hash );
     // Return vec of locations for sched_switch events.
     enum switch_t { SCHED_SWITCH_PREV, SCHED_SWITCH_NEXT };
-    const std::vector< uint32_t > *get_sched_switch_locs( int pid, switch_t switch_type );
+    const EventLocs *get_sched_switch_locs( int pid, switch_t switch_type );
 
-    void calculate_amd_event_durations();
+    // Set durations and graph rows of timeline events. With first_eventid, only events
+    //  from it on are added and existing timeline rows are continued.
+    void calculate_amd_event_durations( bool erase_unmatched = true, uint32_t first_eventid = 0 );
+    // Add sched_switch runs of events starting at first_eventid to runtime indexes
+    void calculate_sched_runtimes( uint32_t first_eventid = 0 );
     void calculate_event_print_info();
     void calculate_vblank_info();
 
@@ -393,11 +806,23 @@ public:
     void update_ftraceprint_colors();
 
     void update_fence_signaled_timeline_colors();
-    void update_tgid_colors();
+    // Updates tgid colors and colors of sched_switch events starting at first_eventid
+    void update_tgid_colors( uint32_t first_eventid = 0 );
 
     void remove_single_tgids();
 
-    const std::vector< uint32_t > *get_locs( const char *name, loc_type_t *type = nullptr, std::string *errstr = nullptr );
+    const EventLocs *get_locs( const char *name, loc_type_t *type = nullptr, std::string *errstr = nullptr );
+
+    // Non-idle run time on cpu in [ts0, ts1]. Sets count to number of runs.
+    int64_t get_cpu_runtime( uint32_t cpu, int64_t ts0, int64_t ts1, uint32_t *count = NULL );
+    // Set pids to the max_count pids with the most run time in [ts0, ts1]
+    struct pid_runtime_t
+    {
+        int pid;
+        uint32_t count;
+        int64_t runtime;
+    };
+    void get_top_pid_runtimes( int64_t ts0, int64_t ts1, size_t max_count, std::vector< pid_runtime_t > &pids );
 
     GraphPlot *get_plot_ptr( const char *plot_name )
     {
@@ -408,6 +833,10 @@ public:
         return m_graph_plots.m_map[ hashstr32( plot_name ) ];
     }
 
+    // Hardware vblank time for a drm_vblank_event if want_high_prec is set and
+    //  the event has a high precision "time" field, otherwise event.ts
+    int64_t get_vblank_ts( const trace_event_t &event, bool want_high_prec ) const;
+
     // Return "foorbarapp-1234" comm string for specified pid
     const char *comm_from_pid( int pid, const char *def = NULL );
 
@@ -429,12 +858,31 @@ public:
     {
         return m_ftrace.print_info.get_val( id );
     }
-    uint32_t ts_to_ftrace_print_info_idx( const std::vector< uint32_t > &locs, int64_t ts );
+    uint32_t ts_to_ftrace_print_info_idx( const EventLocs &locs, int64_t ts );
 
 public:
+    // Merge loaded file runs, assign event ids and collect sched_switch comm
+    //  and ftrace print info. Called once on background thread before init().
+    void prepare_events();
     // Called once on background thread after all events loaded.
     void init();
 
+    // Append newer events from another trace file (tail mode). Called on main thread.
+    //  Takes ownership of event fields. Strings must be from m_strpool.
+    //  Returns count of events added.
+    size_t append_events( const trace_info_t &trace_info, std::vector< trace_event_t > &events );
+    // Remove the oldest count events (tail mode). Ids stored in event locations,
+    //  indexes, and plots are shifted down by count to match. Runs on a background
+    //  job while the UI sees the trace as initializing.
+    void trim_events( uint32_t count );
+
+    // Match events from first_id on against compiled tdop expressions on a background job
+    void start_tdopexpr_append( uint32_t first_id );
+    // Cancel the append job. Returns the first id it hadn't added or INVALID_ID.
+    uint32_t stop_tdopexpr_append();
+    // Add matches of a finished append job to m_tdopexpr_locs. Returns true if any were added.
+    bool update_tdopexpr_append( bool wait = false );
+
     void init_new_event( trace_event_t &event );
     void init_new_event_vblank( trace_event_t &event );
     void init_sched_switch_event( trace_event_t &event );
@@ -443,7 +891,10 @@ public:
     void init_msm_timeline_event( trace_event_t &event );
     void init_drm_sched_timeline_event( trace_event_t &event );
 
+    // Callback for read_trace_file(). Returns 1 if app is cancelling the load.
     int new_event_cb( const trace_event_t &event );
+    // Add a loaded event to m_events
+    void add_new_event( const trace_event_t &event );
     void new_event_ftrace_print( trace_event_t &event );
 
     ftrace_row_info_t *get_ftrace_row_info_pid( int pid, bool add = false );
@@ -458,6 +909,10 @@ public:
     StrPool m_strpool;
     trace_info_t m_trace_info;
     std::vector< trace_event_t > m_events;
+    // Bumped whenever event colors are changed so cached row summaries get rebuilt
+    uint32_t m_color_gen = 0;
+    // Start of each loaded file's events in m_events
+    std::vector< size_t > m_event_runs;
 
     // Max drm_vblank_event crc value we've seen
     int m_crtc_max = -1;
@@ -465,6 +920,37 @@ public:
     // Map of tdop expression string hashval to array of event locations.
     TraceLocations m_tdopexpr_locs;
     std::unordered_set< uint32_t > m_failed_commands;
+    // Compiled tdop expressions in m_tdopexpr_locs. Used to add appended events to them.
+    util_umap< uint32_t, class TdopExpr * > m_tdopexpr_exprs;
+
+    // Trigram indexes for =~ filters on $comm and $buf. Only read once ready is set.
+    struct
+    {
+        TextIndex comm;
+        TextIndex buf;
+        AsyncJob *job = nullptr;
+        std::atomic< bool > ready = { false };
+    } m_text_index;
+
+    // Background tdop expression jobs, keyed by expression hashval
+    struct tdopexpr_job_t
+    {
+        class TdopExpr *expr = nullptr;
+        std::vector< uint32_t > locs;
+        AsyncJob job;
+    };
+    util_umap< uint32_t, tdopexpr_job_t * > m_tdopexpr_jobs;
+
+    // Background job matching appended events [first_id, last_id) against m_tdopexpr_exprs
+    struct tdopexpr_append_t
+    {
+        uint32_t first_id = 0;
+        uint32_t last_id = 0;
+        std::vector< uint32_t > nameids;
+        std::vector< std::vector< uint32_t > > locs;
+        AsyncJob job;
+    };
+    tdopexpr_append_t *m_tdopexpr_append = nullptr;
 
     // Map of comm hashval to array of event locations.
     TraceLocations m_comm_locs;
@@ -478,6 +964,17 @@ public:
 
     // Map of timeline (gfx, sdma0, etc) event locations.
     TraceLocations m_amd_timeline_locs;
+    // Interval indexes of fence_signaled events for each m_amd_timeline_locs row.
+    //  user: amdgpu_cs_ioctl (or sched_run_job) to fence. hw: hw start to fence.
+    struct timeline_index_t
+    {
+        IntervalIndex user;
+        IntervalIndex hw;
+        // Where calculate_amd_event_durations() left off in this timeline
+        uint32_t graph_row_id = 0;
+        int64_t last_fence_signaled_ts = 0;
+    };
+    util_umap< const EventLocs *, timeline_index_t > m_amd_timeline_index;
 
     // Map of pid to sched_switch event locations.
     TraceLocations m_sched_switch_prev_locs;
@@ -486,6 +983,9 @@ public:
     TraceLocations m_sched_switch_cpu_locs;
     util_umap< int, int64_t > m_sched_switch_time_pid;
     int64_t m_sched_switch_time_total = 0;
+    // sched_switch run time indexes. Idle (pid 0) runs aren't added.
+    util_umap< uint32_t, RunTimeIndex > m_sched_cpu_runtime;
+    util_umap< int, RunTimeIndex > m_sched_pid_runtime;
 
     // plot name to GraphPlot
     util_umap< uint32_t, GraphPlot > m_graph_plots;
@@ -530,13 +1030,15 @@ public:
     struct
     {
         // ftrace print event IDs sorted by timestamp
-        std::vector< uint32_t > print_locs;
+        EventLocs print_locs;
 
         // event id to ftrace print event info map
         util_umap< uint32_t, print_info_t > print_info;
 
-        // Max ftrace print rendering x size value
+        // Max ftrace print rendering x size value (upper bound from print_buf_len_max)
         float text_size_max = -1.0f;
+        // Max ftrace print buf length in bytes
+        size_t print_buf_len_max = 0;
 
         // Max ftrace print ts duration value
         int64_t print_ts_max = 0;
@@ -544,6 +1046,13 @@ public:
         // Row info for each pid / tgid row
         util_umap< uint32_t, ftrace_row_info_t > row_info;
 
+        // Count of print_locs with rows assigned by calculate_event_print_info()
+        size_t print_locs_placed = 0;
+        // Global, pid, and tgid row positions of placed print events
+        row_pos_t row_pos;
+        util_umap< int, row_pos_t > row_pos_pid;
+        util_umap< int, row_pos_t > row_pos_tgid;
+
         // Map of ftrace print begin/end ctx to event ids
         util_umap< uint64_t, uint32_t > begin_ctx;
         util_umap< uint64_t, uint32_t > end_ctx;
@@ -573,7 +1082,7 @@ public:
     util_umap< uint32_t, uint32_t > m_drm_vblank_event_queued;
 
     // 0: events loaded, 1+: loading events, -1: error
-    std::atomic_int8_t m_eventsloaded = { 1 };
+    std::atomic_int m_eventsloaded = { 1 };
 
     struct {
         // set of rings discovered during event parsing
@@ -606,6 +1115,9 @@ public:
     void init( TraceEvents &trace_events );
     void shutdown();
 
+    // Refresh row event counts and add rows for new comms after events are appended
+    void update( TraceEvents &trace_events );
+
     void add_row( const std::string &name, const std::string &filter_expr, float scale = 1.0f );
     void move_row( const std::string &name_src, const std::string &name_dest );
 
@@ -662,6 +1174,15 @@ public:
     void render();
     void trace_render_info();
 
+    // Append events from a tail mode trace chunk and update graph / event list state
+    size_t append_events( const trace_info_t &trace_info, std::vector< trace_event_t > &events );
+    // Shift the event ids we're holding on to after m_trace_events.trim_events( count )
+    void events_trimmed( uint32_t count );
+    // Pick up appended events matched by the background tdop append job
+    void update_tdopexpr_append( bool wait = false );
+    // Re-run the event list filter and row filters over the current events
+    void refilter_events();
+
     trace_event_t &get_event( uint32_t id )
     {
         return m_trace_events.m_events[ id ];
@@ -736,6 +1257,8 @@ protected:
     void graph_mouse_tooltip_rowinfo( std::string &ttip, graph_info_t &gi, int64_t mouse_ts );
     void graph_mouse_tooltip_vblanks( std::string &ttip, graph_info_t &gi, int64_t mouse_ts );
     void graph_mouse_tooltip_markers( std::string &ttip, graph_info_t &gi, int64_t mouse_ts );
+    void graph_mouse_tooltip_frame_stats( std::string &ttip, graph_info_t &gi );
+    void graph_mouse_tooltip_frame_cpu( std::string &ttip, graph_info_t &gi );
     void graph_mouse_tooltip_sched_switch( std::string &ttip, graph_info_t &gi, int64_t mouse_ts );
     void graph_mouse_tooltip_hovered_items( std::string &ttip, graph_info_t &gi, int64_t mouse_ts );
     void graph_mouse_tooltip_hovered_amd_fence_signaled( std::string &ttip, graph_info_t &gi, int64_t mouse_ts );
@@ -809,6 +1332,8 @@ public:
         // Filter string
         char buf[ 512 ] = { 0 };
         std::string errstr;
+        // Filter string being evaluated on a background job
+        std::string pending;
         // List of filtered event ids
         std::vector< uint32_t > events;
         // pid -> count of !filtered events for that pid
@@ -904,6 +1429,9 @@ public:
         int cpu_filter_tgid = 0;
         std::unordered_set< int > cpu_timeline_pids;
 
+        // Row event summaries, keyed by row locations
+        util_umap< const EventLocs *, EventLOD > row_lods;
+
         bool cpu_hide_system_events = false;
 
         const int64_t s_min_length = 100;
@@ -928,19 +1456,3 @@ public:
 void add_sched_switch_pid_comm( trace_info_t &trace_info, const trace_event_t &event,
                                 const char *pidstr, const char *commstr );
 
-class row_pos_t
-{
-public:
-    row_pos_t() {}
-    ~row_pos_t() {}
-
-    // Given a start and end time, return a row index with an open spot
-    uint32_t get_row( int64_t min_ts, int64_t max_ts );
-
-public:
-    // Count of total rows used
-    uint32_t m_rows = 0;
-    // Map of min_ts -> max_ts blocks used for for each row
-    std::array< std::map< int64_t, int64_t >, Opts::MAX_ROW_SIZE > m_row_pos = {};
-};
-
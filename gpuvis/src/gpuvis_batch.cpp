@@ -0,0 +1,815 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <array>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <thread>
+#include <filesystem>
+
+#include <cinder/app/App.h>
+
+#include "imgui/imgui.h"
+#include "gpuvis_macros.h"
+#include "trace-cmd/trace-read.h"
+#include "gpuvis_utils.h"
+#include "gpuvis.h"
+#include "gpuvis_etl.h"
+#include "gpuvis_cache.h"
+#include "gpuvis_batch.h"
+#include "gpuvis_export.h"
+#include "ya_getopt.h"
+
+#include "../../blocks/rapidjson/rapidjson.h"
+#include "../../blocks/rapidjson/stringbuffer.h"
+#include "../../blocks/rapidjson/prettywriter.h"
+
+#include "MiniConfig.h"
+
+namespace fs = std::filesystem;
+
+struct batch_opts_t
+{
+    // Trace files and directories of trace files
+    std::vector< std::string > inputs;
+    // Output file, or empty for stdout
+    std::string outfile;
+    // "json" or "csv"
+    std::string format;
+    // Count of traces analyzed at once. 0 uses hardware threads.
+    uint32_t threads = 0;
+    // Frame marker filters. Empty right filter uses the left one.
+    std::string frame_left = "$name = drm_vblank_event && $crtc = 0";
+    std::string frame_right;
+    // ftrace print scanf strings to plot. Ie: "[Compositor] TimeSinceLastVSync: %f("
+    std::vector< std::string > plots;
+    // Directory to export each trace to, or empty for none
+    std::string export_dir;
+    // "perfetto" or "json"
+    std::string export_format = "perfetto";
+};
+
+struct batch_stats_t
+{
+    uint32_t count = 0;
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p90 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double p999 = 0.0;
+    double max = 0.0;
+};
+
+struct batch_metric_t
+{
+    // "frame", "frame_cpu", "vblank", "amdgpu_job", or "plot"
+    std::string section;
+    std::string name;
+    // Times are in ms, cpu busy stats are percents, plot stats are plot values
+    batch_stats_t stats;
+    // Missed vblanks for vblank metrics, stutters for frame metrics, otherwise -1
+    int64_t missed = -1;
+};
+
+struct batch_result_t
+{
+    std::string filename;
+    std::string errstr;
+    size_t filesize = 0;
+    size_t events = 0;
+
+    float time_load = 0.0f;
+    float time_init = 0.0f;
+    float time_analyze = 0.0f;
+
+    std::vector< batch_metric_t > metrics;
+};
+
+static void batch_usage( const char *exe )
+{
+    fprintf( stderr,
+             "Usage: %s --batch [options] <trace files or directories>\n"
+             "  --batch-out <file>             Write summary to file (default: stdout)\n"
+             "  --batch-format <json|csv>      Output format (default: from --batch-out extension, or json)\n"
+             "  --batch-threads <count>        Traces analyzed at once (default: hardware threads)\n"
+             "  --frame-marker <filter>        Frame start filter (default: \"$name = drm_vblank_event && $crtc = 0\")\n"
+             "  --frame-marker-right <filter>  Frame end filter (default: frame start filter)\n"
+             "  --plot <scanf str>             Stats for ftrace print values. Ie: \"[Compositor] TimeSinceLastVSync: %%f(\"\n"
+             "  --batch-export-dir <dir>       Export each trace to dir for Perfetto or chrome://tracing\n"
+             "  --batch-export-format <fmt>    Export format: perfetto or json (default: perfetto)\n",
+             exe );
+}
+
+bool batch_requested( const std::vector< std::string > &args )
+{
+    return std::find( args.begin(), args.end(), "--batch" ) != args.end();
+}
+
+static bool batch_parse_cmdline( const std::vector< std::string > &args, batch_opts_t &opts )
+{
+    static struct option long_opts[] = {
+        { "batch", ya_no_argument, 0, 0 },
+        { "batch-out", ya_required_argument, 0, 0 },
+        { "batch-format", ya_required_argument, 0, 0 },
+        { "batch-threads", ya_required_argument, 0, 0 },
+        { "frame-marker", ya_required_argument, 0, 0 },
+        { "frame-marker-right", ya_required_argument, 0, 0 },
+        { "plot", ya_required_argument, 0, 0 },
+        { "batch-export-dir", ya_required_argument, 0, 0 },
+        { "batch-export-format", ya_required_argument, 0, 0 },
+        { 0, 0, 0, 0 }
+    };
+    std::vector< char * > argv;
+
+    for ( const std::string &arg : args )
+        argv.push_back( const_cast< char * >( arg.c_str() ) );
+    argv.push_back( NULL );
+
+    int c;
+    int opt_ind = 0;
+    int argc = args.size();
+    const char *exe = argc ? argv[ 0 ] : "gpuvis";
+
+    while ( ( c = ya_getopt_long( argc, argv.data(), "",
+                                  long_opts, &opt_ind ) ) != -1 )
+    {
+        if ( c != 0 )
+        {
+            batch_usage( exe );
+            return false;
+        }
+
+        const char *name = long_opts[ opt_ind ].name;
+
+        if ( !strcasecmp( "batch-out", name ) )
+            opts.outfile = ya_optarg;
+        else if ( !strcasecmp( "batch-format", name ) )
+            opts.format = ya_optarg;
+        else if ( !strcasecmp( "batch-threads", name ) )
+            opts.threads = atoi( ya_optarg );
+        else if ( !strcasecmp( "frame-marker", name ) )
+            opts.frame_left = ya_optarg;
+        else if ( !strcasecmp( "frame-marker-right", name ) )
+            opts.frame_right = ya_optarg;
+        else if ( !strcasecmp( "plot", name ) )
+            opts.plots.push_back( ya_optarg );
+        else if ( !strcasecmp( "batch-export-dir", name ) )
+            opts.export_dir = ya_optarg;
+        else if ( !strcasecmp( "batch-export-format", name ) )
+            opts.export_format = ya_optarg;
+    }
+
+    for ( ; ya_optind < argc; ya_optind++ )
+        opts.inputs.push_back( argv[ ya_optind ] );
+
+    if ( opts.format.empty() )
+    {
+        const char *ext = strrchr( opts.outfile.c_str(), '.' );
+
+        opts.format = ( ext && !strcasecmp( ext, ".csv" ) ) ? "csv" : "json";
+    }
+
+    if ( opts.inputs.empty() || ( opts.format != "json" && opts.format != "csv" ) ||
+         ( opts.export_format != "perfetto" && opts.export_format != "json" ) )
+    {
+        batch_usage( exe );
+        return false;
+    }
+
+    return true;
+}
+
+// Expand directories to the trace files they contain
+static std::vector< std::string > batch_get_files( const std::vector< std::string > &inputs )
+{
+    std::vector< std::string > files;
+
+    for ( const std::string &input : inputs )
+    {
+        std::error_code ec;
+
+        if ( !fs::is_directory( input, ec ) )
+        {
+            files.push_back( input );
+            continue;
+        }
+
+        std::vector< std::string > dir_files;
+
+        for ( const fs::directory_entry &entry : fs::directory_iterator( input, ec ) )
+        {
+            const std::string ext = entry.path().extension().string();
+
+            if ( entry.is_regular_file( ec ) &&
+                 ( ext == ".dat" || ext == ".trace" || ext == ".etl" ||
+                   ext == ".zip" || ext == ".gz" || ext == ".zst" ) )
+            {
+                dir_files.push_back( entry.path().string() );
+            }
+        }
+
+        // Directory order isn't defined - sort so output is the same from run to run
+        std::sort( dir_files.begin(), dir_files.end() );
+        files.insert( files.end(), dir_files.begin(), dir_files.end() );
+    }
+
+    return files;
+}
+
+// Sorts vals and returns count, mean, nearest rank percentiles and max
+static batch_stats_t batch_get_stats( std::vector< double > &vals )
+{
+    batch_stats_t stats;
+
+    if ( vals.empty() )
+        return stats;
+
+    std::sort( vals.begin(), vals.end() );
+
+    auto percentile = [ &vals ]( double p )
+    {
+        size_t rank = ( size_t )ceil( p * vals.size() );
+
+        return vals[ rank ? ( rank - 1 ) : 0 ];
+    };
+
+    double total = 0.0;
+    for ( double val : vals )
+        total += val;
+
+    stats.count = vals.size();
+    stats.mean = total / vals.size();
+    stats.p50 = percentile( 0.50 );
+    stats.p90 = percentile( 0.90 );
+    stats.p95 = percentile( 0.95 );
+    stats.p99 = percentile( 0.99 );
+    stats.p999 = percentile( 0.999 );
+    stats.max = vals.back();
+    return stats;
+}
+
+static void batch_add_metric( batch_result_t &result, const char *section,
+                              const std::string &name, std::vector< double > &vals, int64_t missed = -1 )
+{
+    batch_metric_t metric;
+
+    metric.section = section;
+    metric.name = name;
+    metric.stats = batch_get_stats( vals );
+    metric.missed = missed;
+
+    result.metrics.push_back( metric );
+}
+
+// Read trace and initialize events the same way the app's loading thread does.
+//  Sets initialized if events were restored from the trace cache and don't need init().
+static bool batch_load_trace( const std::string &filename, TraceEvents &trace_events,
+                              uint32_t load_threads, bool &initialized, std::string &errstr )
+{
+    const char *file = filename.c_str();
+    const char *ext = strrchr( file, '.' );
+    EventCallback trace_cb = [ &trace_events ]( const trace_event_t &event )
+    {
+        trace_events.add_new_event( event );
+        return 0;
+    };
+
+    trace_events.m_filename = filename;
+    trace_events.m_filesize = get_file_size( file );
+    if ( !trace_events.m_filesize )
+    {
+        errstr = string_format( "%s", strerror( errno ) );
+        return false;
+    }
+
+    trace_events.m_trace_info.trim_trace = TrimTrace;
+    trace_events.m_trace_info.m_load_threads = load_threads;
+    trace_events.m_trace_info.m_map_cpu_data = MapTraceData;
+    trace_events.m_event_runs.push_back( 0 );
+
+    int ret = -1;
+    initialized = false;
+    if ( ext && !strcmp( ext, ".etl" ) )
+    {
+        ret = read_etl_file( file, trace_events.m_strpool, trace_events.m_trace_info, trace_cb );
+    }
+    else
+    {
+        // Use existing trace caches, but leave writing them to the app
+        if ( UseTraceCache )
+            initialized = ( read_trace_cache( file, trace_events ) >= 0 );
+        ret = initialized ? 0 : read_trace_file( file, trace_events.m_strpool, trace_events.m_trace_info, trace_cb );
+    }
+
+    if ( ret < 0 )
+    {
+        errstr = "Reading trace failed";
+        return false;
+    }
+    if ( trace_events.m_events.empty() )
+    {
+        errstr = "No events found";
+        return false;
+    }
+
+    if ( !initialized )
+        trace_events.prepare_events();
+    return true;
+}
+
+// Per frame cpu busy percentages and run times of the busiest pids
+static void batch_analyze_frame_cpu( TraceEvents &trace_events, FrameMarkers &frame_markers, batch_result_t &result )
+{
+    int64_t ts0, ts1;
+    size_t frame_count = frame_markers.m_left_frames.size();
+    std::vector< TraceEvents::pid_runtime_t > pids;
+
+    if ( !frame_count || trace_events.m_sched_cpu_runtime.m_map.empty() )
+        return;
+
+    std::vector< uint32_t > cpus;
+    for ( const auto &it : trace_events.m_sched_cpu_runtime.m_map )
+        cpus.push_back( it.first );
+    std::sort( cpus.begin(), cpus.end() );
+
+    std::vector< double > total;
+    std::vector< std::vector< double > > busy( cpus.size() );
+
+    for ( size_t i = 0; i < frame_count; i++ )
+    {
+        int64_t runtime = 0;
+
+        if ( !frame_markers.get_frame_range( trace_events, i, ts0, ts1 ) || ( ts1 <= ts0 ) )
+            continue;
+
+        for ( size_t cpu = 0; cpu < cpus.size(); cpu++ )
+        {
+            int64_t val = trace_events.get_cpu_runtime( cpus[ cpu ], ts0, ts1 );
+
+            busy[ cpu ].push_back( val * 100.0 / ( ts1 - ts0 ) );
+            runtime += val;
+        }
+
+        total.push_back( runtime * 100.0 / ( ( ts1 - ts0 ) * cpus.size() ) );
+    }
+
+    batch_add_metric( result, "frame_cpu", "all busy", total );
+    for ( size_t cpu = 0; cpu < cpus.size(); cpu++ )
+        batch_add_metric( result, "frame_cpu", string_format( "cpu%u busy", cpus[ cpu ] ), busy[ cpu ] );
+
+    // Busiest pids over all frames, then their run time in each frame
+    int64_t first_ts, last_ts;
+
+    frame_markers.get_frame_range( trace_events, 0, first_ts, ts1 );
+    frame_markers.get_frame_range( trace_events, frame_count - 1, ts0, last_ts );
+    trace_events.get_top_pid_runtimes( first_ts, last_ts, 5, pids );
+
+    for ( const TraceEvents::pid_runtime_t &val : pids )
+    {
+        std::vector< double > runtimes;
+
+        for ( size_t i = 0; i < frame_count; i++ )
+        {
+            if ( frame_markers.get_frame_range( trace_events, i, ts0, ts1 ) && ( ts1 > ts0 ) )
+            {
+                int64_t runtime = trace_events.m_sched_pid_runtime.get_val( val.pid )->get_runtime( ts0, ts1 );
+
+                runtimes.push_back( runtime * ( 1.0 / NSECS_PER_MSEC ) );
+            }
+        }
+
+        batch_add_metric( result, "frame_cpu", trace_events.comm_from_pid( val.pid, "<...>" ), runtimes );
+    }
+}
+
+static void batch_analyze_frames( const batch_opts_t &opts, TraceEvents &trace_events, batch_result_t &result )
+{
+    FrameMarkers frame_markers;
+    std::string errstr;
+    std::vector< double > vals;
+    std::string name = opts.frame_left;
+
+    if ( !opts.frame_right.empty() )
+        name += " -> " + opts.frame_right;
+
+    if ( frame_markers.set_frames( trace_events, opts.frame_left.c_str(), opts.frame_right.c_str(), errstr ) )
+    {
+        for ( size_t i = 0; i < frame_markers.m_left_frames.size(); i++ )
+            vals.push_back( frame_markers.get_frame_len( trace_events, i ) * ( 1.0 / NSECS_PER_MSEC ) );
+    }
+
+    batch_add_metric( result, "frame", name, vals, frame_markers.m_stats.m_stutter_frames.size() );
+
+    batch_analyze_frame_cpu( trace_events, frame_markers, result );
+}
+
+static void batch_analyze_vblanks( TraceEvents &trace_events, batch_result_t &result )
+{
+    const EventLocs *plocs = trace_events.get_tdopexpr_locs( "$name=drm_vblank_event" );
+    size_t crtc_count = trace_events.m_vblank_info.size();
+
+    if ( !plocs )
+        return;
+
+    std::vector< std::vector< double > > intervals( crtc_count );
+    std::vector< int64_t > last_ts( crtc_count, 0 );
+    std::vector< int64_t > missed( crtc_count, 0 );
+
+    for ( uint32_t idx : *plocs )
+    {
+        const trace_event_t &event = trace_events.m_events[ idx ];
+        int64_t ts = trace_events.get_vblank_ts( event, VBlankHighPrecTimestamps );
+        int crtc = event.crtc;
+
+        if ( ( crtc < 0 ) || ( ( size_t )crtc >= crtc_count ) )
+            continue;
+
+        if ( last_ts[ crtc ] )
+        {
+            int64_t diff = ts - last_ts[ crtc ];
+            int64_t median = trace_events.m_vblank_info[ crtc ].median_diff_ts;
+
+            intervals[ crtc ].push_back( diff * ( 1.0 / NSECS_PER_MSEC ) );
+
+            // Intervals of two or more median intervals skipped vblanks
+            if ( median && ( diff > median * 3 / 2 ) )
+                missed[ crtc ] += ( diff + median / 2 ) / median - 1;
+        }
+        last_ts[ crtc ] = ts;
+    }
+
+    for ( size_t crtc = 0; crtc < crtc_count; crtc++ )
+    {
+        if ( !intervals[ crtc ].empty() )
+            batch_add_metric( result, "vblank", string_format( "crtc%lu", crtc ), intervals[ crtc ], missed[ crtc ] );
+    }
+}
+
+// Job durations set up by TraceEvents::calculate_amd_event_durations()
+static void batch_analyze_amdgpu_jobs( TraceEvents &trace_events, batch_result_t &result )
+{
+    std::vector< std::pair< std::string, const EventLocs * > > timelines;
+
+    for ( const auto &it : trace_events.m_amd_timeline_locs.m_locs.m_map )
+    {
+        if ( !it.second.empty() )
+        {
+            const trace_event_t &event = trace_events.m_events[ it.second.front() ];
+
+            timelines.push_back( { get_event_field_val( event, "timeline" ), &it.second } );
+        }
+    }
+    std::sort( timelines.begin(), timelines.end() );
+
+    for ( const auto &timeline : timelines )
+    {
+        std::vector< double > hw;
+        std::vector< double > latency;
+
+        for ( uint32_t idx : *timeline.second )
+        {
+            const trace_event_t &fence_signaled = trace_events.m_events[ idx ];
+
+            if ( !fence_signaled.is_fence_signaled() || !is_valid_id( fence_signaled.id_start ) )
+                continue;
+
+            // amdgpu_cs_ioctl -> amdgpu_sched_run_job -> fence_signaled
+            const trace_event_t &sched_run_job = trace_events.m_events[ fence_signaled.id_start ];
+            int64_t start_ts = is_valid_id( sched_run_job.id_start ) ?
+                        trace_events.m_events[ sched_run_job.id_start ].ts : sched_run_job.ts;
+
+            hw.push_back( fence_signaled.duration * ( 1.0 / NSECS_PER_MSEC ) );
+            latency.push_back( ( fence_signaled.ts - start_ts ) * ( 1.0 / NSECS_PER_MSEC ) );
+        }
+
+        batch_add_metric( result, "amdgpu_job", timeline.first + " hw", hw );
+        batch_add_metric( result, "amdgpu_job", timeline.first + " latency", latency );
+    }
+}
+
+static void batch_analyze_plots( const batch_opts_t &opts, TraceEvents &trace_events, batch_result_t &result )
+{
+    for ( const std::string &scanf_str : opts.plots )
+    {
+        std::vector< double > vals;
+
+        // Filter on text before the value, same as the Create Plot dialog
+        std::string prefix = string_ltrimmed( scanf_str.substr( 0, scanf_str.find( '%' ) ) );
+
+        if ( !prefix.empty() )
+        {
+            std::string plot_name = "plot:" + string_trimmed( string_remove_punct( prefix ) );
+            std::string filter_str = string_format( "$buf =~ \"%s\"", prefix.c_str() );
+            GraphPlot &plot = trace_events.get_plot( plot_name.c_str() );
+
+            if ( plot.init( trace_events, plot_name, filter_str, scanf_str ) )
+            {
+                for ( const GraphPlot::plotdata_t &data : plot.m_plotdata )
+                    vals.push_back( data.valf );
+            }
+        }
+
+        batch_add_metric( result, "plot", scanf_str, vals );
+    }
+}
+
+static batch_result_t batch_analyze_trace( const batch_opts_t &opts, const std::string &filename, uint32_t load_threads )
+{
+    batch_result_t result;
+    TraceEvents trace_events;
+    bool initialized;
+    util_time_t t0 = util_get_time();
+
+    result.filename = filename;
+
+    if ( !batch_load_trace( filename, trace_events, load_threads, initialized, result.errstr ) )
+        return result;
+
+    util_time_t t1 = util_get_time();
+    if ( initialized )
+        trace_events.start_text_index();
+    else
+        trace_events.init();
+    util_time_t t2 = util_get_time();
+
+    batch_analyze_frames( opts, trace_events, result );
+    batch_analyze_vblanks( trace_events, result );
+    batch_analyze_amdgpu_jobs( trace_events, result );
+    batch_analyze_plots( opts, trace_events, result );
+
+    // Export after analysis so --plot series are written as counters
+    if ( !opts.export_dir.empty() )
+    {
+        bool json = ( opts.export_format == "json" );
+        fs::path path = fs::path( opts.export_dir ) / fs::path( filename ).filename();
+
+        path.replace_extension( json ? ".json" : ".perfetto-trace" );
+        if ( !export_trace( trace_events, path.string().c_str(),
+                            json ? Export_ChromeJson : Export_Perfetto, result.errstr ) )
+        {
+            return result;
+        }
+    }
+
+    result.filesize = trace_events.m_filesize;
+    result.events = trace_events.m_events.size();
+    result.time_load = util_time_to_ms( t0, t1 );
+    result.time_init = util_time_to_ms( t1, t2 );
+    result.time_analyze = util_time_to_ms( t2, util_get_time() );
+    return result;
+}
+
+static double batch_mb_per_sec( size_t bytes, float ms )
+{
+    return ms ? ( bytes / ( 1024.0 * 1024.0 ) ) / ( ms / 1000.0 ) : 0.0;
+}
+
+static std::string batch_write_json( const std::vector< batch_result_t > &results, uint32_t threads, float time_total )
+{
+    rapidjson::StringBuffer buf;
+    rapidjson::PrettyWriter< rapidjson::StringBuffer > writer( buf );
+
+    writer.StartObject();
+    writer.Key( "threads" );
+    writer.Uint( threads );
+    writer.Key( "total_ms" );
+    writer.Double( time_total );
+    writer.Key( "traces" );
+    writer.StartArray();
+
+    for ( const batch_result_t &result : results )
+    {
+        float time_read = result.time_load + result.time_init;
+
+        writer.StartObject();
+        writer.Key( "file" );
+        writer.String( result.filename.c_str() );
+
+        if ( !result.errstr.empty() )
+        {
+            writer.Key( "error" );
+            writer.String( result.errstr.c_str() );
+            writer.EndObject();
+            continue;
+        }
+
+        writer.Key( "size" );
+        writer.Uint64( result.filesize );
+        writer.Key( "events" );
+        writer.Uint64( result.events );
+        writer.Key( "load_ms" );
+        writer.Double( result.time_load );
+        writer.Key( "init_ms" );
+        writer.Double( result.time_init );
+        writer.Key( "analyze_ms" );
+        writer.Double( result.time_analyze );
+        writer.Key( "mb_per_sec" );
+        writer.Double( batch_mb_per_sec( result.filesize, time_read ) );
+        writer.Key( "events_per_sec" );
+        writer.Double( time_read ? result.events / ( time_read / 1000.0 ) : 0.0 );
+
+        writer.Key( "metrics" );
+        writer.StartArray();
+        for ( const batch_metric_t &metric : result.metrics )
+        {
+            writer.StartObject();
+            writer.Key( "section" );
+            writer.String( metric.section.c_str() );
+            writer.Key( "name" );
+            writer.String( metric.name.c_str() );
+            writer.Key( "count" );
+            writer.Uint( metric.stats.count );
+            writer.Key( "mean" );
+            writer.Double( metric.stats.mean );
+            writer.Key( "p50" );
+            writer.Double( metric.stats.p50 );
+            writer.Key( "p90" );
+            writer.Double( metric.stats.p90 );
+            writer.Key( "p95" );
+            writer.Double( metric.stats.p95 );
+            writer.Key( "p99" );
+            writer.Double( metric.stats.p99 );
+            writer.Key( "p999" );
+            writer.Double( metric.stats.p999 );
+            writer.Key( "max" );
+            writer.Double( metric.stats.max );
+            if ( metric.missed >= 0 )
+            {
+                writer.Key( "missed" );
+                writer.Int64( metric.missed );
+            }
+            writer.EndObject();
+        }
+        writer.EndArray();
+
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    return std::string( buf.GetString(), buf.GetSize() ) + "\n";
+}
+
+static std::string batch_csv_str( const std::string &str )
+{
+    std::string ret = "\"";
+
+    for ( char c : str )
+    {
+        if ( c == '"' )
+            ret += '"';
+        ret += c;
+    }
+    return ret + "\"";
+}
+
+// One row per metric, with the trace columns repeated on each row
+static std::string batch_write_csv( const std::vector< batch_result_t > &results )
+{
+    std::string str = "file,error,size,events,load_ms,init_ms,analyze_ms,mb_per_sec,"
+                      "section,name,count,mean,p50,p90,p95,p99,p999,max,missed\n";
+
+    for ( const batch_result_t &result : results )
+    {
+        const std::string file = batch_csv_str( result.filename );
+
+        if ( !result.errstr.empty() )
+        {
+            str += file + "," + batch_csv_str( result.errstr ) + ",,,,,,,,,,,,,,,,,\n";
+            continue;
+        }
+
+        const std::string trace = string_format( "%s,,%lu,%lu,%.3f,%.3f,%.3f,%.3f",
+                file.c_str(), result.filesize, result.events,
+                result.time_load, result.time_init, result.time_analyze,
+                batch_mb_per_sec( result.filesize, result.time_load + result.time_init ) );
+
+        for ( const batch_metric_t &metric : result.metrics )
+        {
+            const batch_stats_t &stats = metric.stats;
+
+            str += string_format( "%s,%s,%s,%u,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%s\n",
+                    trace.c_str(), metric.section.c_str(), batch_csv_str( metric.name ).c_str(),
+                    stats.count, stats.mean, stats.p50, stats.p90, stats.p95, stats.p99, stats.p999, stats.max,
+                    ( metric.missed >= 0 ) ? std::to_string( metric.missed ).c_str() : "" );
+        }
+    }
+
+    return str;
+}
+
+int batch_main( const std::vector< std::string > &args )
+{
+    batch_opts_t opts;
+
+    if ( !batch_parse_cmdline( args, opts ) )
+        return 1;
+
+    std::vector< std::string > files = batch_get_files( opts.inputs );
+    if ( files.empty() )
+    {
+        fprintf( stderr, "No trace files found.\n" );
+        return 1;
+    }
+
+    if ( !opts.export_dir.empty() )
+    {
+        std::error_code ec;
+
+        fs::create_directories( opts.export_dir, ec );
+    }
+
+    // The =~ text index is only worth building for interactive filtering
+    BuildTextIndex = false;
+
+    // Split hardware threads between the traces being read at once
+    uint32_t hw_threads = std::max( 1u, std::thread::hardware_concurrency() );
+    uint32_t threads = opts.threads ? opts.threads : hw_threads;
+    threads = std::min< size_t >( threads, files.size() );
+    uint32_t load_threads = std::max( 1u, hw_threads / threads );
+
+    std::vector< batch_result_t > results( files.size() );
+    util_time_t t0 = util_get_time();
+
+    util_parallel_for( files.size(), threads, [ & ]( size_t i )
+    {
+        batch_result_t &result = results[ i ];
+
+        result = batch_analyze_trace( opts, files[ i ], load_threads );
+
+        if ( !result.errstr.empty() )
+        {
+            fprintf( stderr, "%s: [Error] %s\n", result.filename.c_str(), result.errstr.c_str() );
+        }
+        else
+        {
+            float time_read = result.time_load + result.time_init;
+
+            fprintf( stderr, "%s: %lu events, load %.2fms init %.2fms analyze %.2fms (%.1f MB/s)\n",
+                     result.filename.c_str(), result.events, result.time_load, result.time_init,
+                     result.time_analyze, batch_mb_per_sec( result.filesize, time_read ) );
+        }
+    } );
+
+    float time_total = util_time_to_ms( t0, util_get_time() );
+
+    size_t failed = 0;
+    size_t total_size = 0;
+    size_t total_events = 0;
+    for ( const batch_result_t &result : results )
+    {
+        failed += !result.errstr.empty();
+        total_size += result.filesize;
+        total_events += result.events;
+    }
+
+    fprintf( stderr, "%lu traces (%lu failed), %lu events in %.2fms: %.1f MB/s with %u threads\n",
+             results.size(), failed, total_events, time_total,
+             batch_mb_per_sec( total_size, time_total ), threads );
+
+    const std::string str = ( opts.format == "csv" ) ?
+                batch_write_csv( results ) : batch_write_json( results, threads, time_total );
+
+    FILE *fp = opts.outfile.empty() ? stdout : fopen( opts.outfile.c_str(), "wb" );
+    if ( !fp )
+    {
+        fprintf( stderr, "[Error] Opening %s failed: %s\n", opts.outfile.c_str(), strerror( errno ) );
+        return 1;
+    }
+
+    fwrite( str.c_str(), 1, str.size(), fp );
+    if ( fp != stdout )
+        fclose( fp );
+
+    return failed ? 1 : 0;
+}
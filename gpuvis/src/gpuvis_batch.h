@@ -0,0 +1,42 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef GPUVIS_BATCH_H_
+#define GPUVIS_BATCH_H_
+
+#include <string>
+#include <vector>
+
+// Headless batch analysis: "gpuvis --batch [options] <trace files or directories>"
+//  loads each trace without creating a window and writes frame time, vblank and
+//  amdgpu job summaries as JSON or CSV. Traces can also be exported for
+//  Perfetto or chrome://tracing with --batch-export-dir.
+
+// Returns true if args request batch mode
+bool batch_requested( const std::vector< std::string > &args );
+
+// Run batch analysis. Returns process exit code.
+int batch_main( const std::vector< std::string > &args );
+
+#endif // GPUVIS_BATCH_H_
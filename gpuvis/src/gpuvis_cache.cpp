@@ -0,0 +1,1209 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <array>
+#include <map>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+
+#include <cinder/app/App.h>
+
+#include "imgui/imgui.h"
+#include "gpuvis_macros.h"
+#include "trace-cmd/trace-read.h"
+#include "gpuvis_utils.h"
+#include "gpuvis.h"
+#include "gpuvis_cache.h"
+#include "MiniConfig.h"
+
+// Bump this whenever what's stored in the cache or how it's restored changes.
+//  Rev 2: narrower trace_event_t flags, crtc and cpu; decoded binary trace markers.
+//  Rev 3: vblank timestamps come from event fields, trace_info has mono_trace_clock.
+//  Rev 4: snapshot of events, locations and strings after TraceEvents::init().
+#define GVCACHE_REVISION 4
+
+// Amount of data hashed from the start and end of the trace file
+#define GVCACHE_HASH_SIZE ( 1024 * 1024 )
+
+// Sections start on this boundary so events can be read in place from the mapping
+#define GVCACHE_ALIGN 64
+
+enum cache_section_type_t
+{
+    CACHE_SECTION_Strings,      // StrPool::save()
+    CACHE_SECTION_Events,       // cache_event_t array
+    CACHE_SECTION_Fields,       // cache_field_t array, in event order
+    CACHE_SECTION_Locs,         // table, key, EventLocs::save() for each location list
+    CACHE_SECTION_State,        // trace_info and everything else init() sets up
+    CACHE_SECTION_Max
+};
+
+struct cache_section_t
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct cache_header_t
+{
+    char magic[ 8 ];            // "GVCACHE"
+    uint32_t revision;          // GVCACHE_REVISION
+
+    // Sizes of what's stored as is. Checked on their own, so a layout change
+    //  invalidates old caches even if nobody bumps the revision.
+    uint32_t header_size;
+    uint32_t event_size;
+    uint32_t field_size;
+    uint32_t cpu_info_size;
+    uint32_t row_pos_size;      // Opts::MAX_ROW_SIZE
+
+    // Source trace file info
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint32_t file_hash;
+
+    // Settings events were loaded and initialized with
+    uint32_t trim_trace;
+    uint64_t tracestart;
+    uint64_t tracelen;
+    uint32_t vblank_high_prec;
+    float print_label_sat;
+    float print_label_alpha;
+    float timeline_label_sat;
+    float timeline_label_alpha;
+
+    uint64_t num_events;
+    uint64_t num_fields;
+    cache_section_t sections[ CACHE_SECTION_Max ];
+};
+
+struct cache_event_t
+{
+    int64_t ts;
+    int64_t duration;
+
+    // StrPool ids
+    uint32_t comm;
+    uint32_t system;
+    uint32_t name;
+    uint32_t user_comm;
+
+    int32_t pid;
+    uint32_t seqno;
+    uint32_t id_start;
+    uint32_t graph_row_id;
+    uint32_t color;
+    uint32_t color_index;
+    uint32_t flags;
+    int32_t crtc;
+    uint16_t cpu;
+    uint16_t numfields;
+    uint32_t is_filtered_out;
+};
+
+struct cache_field_t
+{
+    uint64_t val;               // StrPool id for EVENT_FIELD_STR
+    uint32_t key;
+    uint32_t type;
+};
+
+class cache_writer_t
+{
+public:
+    cache_writer_t( StrPool &strpool, util_umap< const char *, uint32_t > &ids ) :
+        m_strpool( strpool ), m_ids( ids ) {}
+
+    template < typename T >
+    void put( const T &val )
+    {
+        put_data( &val, sizeof( val ) );
+    }
+
+    void put_data( const void *data, size_t size )
+    {
+        const char *ptr = ( const char * )data;
+
+        m_buf.insert( m_buf.end(), ptr, ptr + size );
+    }
+
+    void put_string( const std::string &str )
+    {
+        put< uint32_t >( str.size() );
+        put_data( str.c_str(), str.size() );
+    }
+
+    template < typename T >
+    void put_vec( const std::vector< T > &vec )
+    {
+        put< uint32_t >( vec.size() );
+        put_data( vec.data(), vec.size() * sizeof( T ) );
+    }
+
+    // Map with plain keys and values
+    template < typename M >
+    void put_map( const M &map )
+    {
+        put< uint32_t >( map.size() );
+        for ( const auto &it : map )
+        {
+            put( it.first );
+            put( it.second );
+        }
+    }
+
+    // Strings are stored as StrPool ids. Pool strings are looked up once per
+    //  pointer, anything else (like a "<...>" default) is added to the pool.
+    uint32_t get_str_id( const char *str )
+    {
+        if ( !str )
+            return INVALID_ID;
+
+        uint32_t *id = m_ids.get_val( str );
+        if ( id )
+            return *id;
+
+        return *m_ids.get_val( str, m_strpool.getid( str ) );
+    }
+
+    void put_str( const char *str )
+    {
+        put( get_str_id( str ) );
+    }
+
+public:
+    StrPool &m_strpool;
+    util_umap< const char *, uint32_t > &m_ids;
+
+    std::vector< char > m_buf;
+};
+
+class cache_reader_t
+{
+public:
+    cache_reader_t( StrPool &strpool, const char *data, size_t size ) :
+        m_strpool( strpool ), m_ptr( data ), m_end( data + size ) {}
+
+    template < typename T >
+    bool get( T &val )
+    {
+        return get_data( &val, sizeof( val ) );
+    }
+
+    bool get_data( void *data, size_t size )
+    {
+        if ( ( size_t )( m_end - m_ptr ) < size )
+            return false;
+
+        memcpy( data, m_ptr, size );
+        m_ptr += size;
+        return true;
+    }
+
+    bool get_string( std::string &str )
+    {
+        uint32_t len;
+
+        if ( !get( len ) || ( ( size_t )( m_end - m_ptr ) < len ) )
+            return false;
+
+        str.assign( m_ptr, len );
+        m_ptr += len;
+        return true;
+    }
+
+    template < typename T >
+    bool get_vec( std::vector< T > &vec )
+    {
+        uint32_t count;
+
+        if ( !get( count ) || ( ( size_t )( m_end - m_ptr ) / sizeof( T ) < count ) )
+            return false;
+
+        vec.resize( count );
+        return get_data( vec.data(), count * sizeof( T ) );
+    }
+
+    template < typename M >
+    bool get_map( M &map )
+    {
+        uint32_t count;
+
+        if ( !get( count ) )
+            return false;
+
+        for ( uint32_t i = 0; i < count; i++ )
+        {
+            typename M::key_type key;
+            typename M::mapped_type val;
+
+            if ( !get( key ) || !get( val ) )
+                return false;
+            map[ key ] = val;
+        }
+        return true;
+    }
+
+    bool get_str( const char *&str )
+    {
+        uint32_t id;
+
+        if ( !get( id ) )
+            return false;
+
+        str = is_valid_id( id ) ? m_strpool.findid( id ) : NULL;
+        return str || !is_valid_id( id );
+    }
+
+    bool get_locs( EventLocs &locs )
+    {
+        return locs.load( m_ptr, m_end );
+    }
+
+    bool empty() const
+    {
+        return m_ptr == m_end;
+    }
+
+public:
+    StrPool &m_strpool;
+
+    const char *m_ptr;
+    const char *m_end;
+};
+
+// Hash the beginning and end of the trace file. Catches traces rewritten
+//  in place with the same size and mtime without reading the whole file.
+static bool get_trace_file_hash( const char *file, uint64_t file_size, uint32_t &hash )
+{
+    FILE *fp = fopen( file, "rb" );
+
+    if ( !fp )
+        return false;
+
+    std::vector< char > buf( std::min< uint64_t >( file_size, GVCACHE_HASH_SIZE ) );
+    bool ret = ( fread( buf.data(), 1, buf.size(), fp ) == buf.size() );
+
+    hash = hashstr32( buf.data(), buf.size() );
+
+    if ( ret && ( file_size > buf.size() ) )
+    {
+        ret = !fseek( fp, ( long )-( int64_t )buf.size(), SEEK_END ) &&
+              ( fread( buf.data(), 1, buf.size(), fp ) == buf.size() );
+
+        hash = hashstr32( buf.data(), buf.size(), hash );
+    }
+
+    fclose( fp );
+    return ret;
+}
+
+static bool init_cache_header( cache_header_t &header, const char *file, const trace_info_t &trace_info )
+{
+    struct stat st;
+
+    memset( &header, 0, sizeof( header ) );
+
+    if ( stat( file, &st ) )
+        return false;
+
+    strcpy( header.magic, "GVCACHE" );
+    header.revision = GVCACHE_REVISION;
+
+    header.header_size = sizeof( cache_header_t );
+    header.event_size = sizeof( cache_event_t );
+    header.field_size = sizeof( cache_field_t );
+    header.cpu_info_size = sizeof( cpu_info_t );
+    header.row_pos_size = Opts::MAX_ROW_SIZE;
+
+    header.file_size = st.st_size;
+    header.file_mtime = st.st_mtime;
+    if ( !get_trace_file_hash( file, header.file_size, header.file_hash ) )
+        return false;
+
+    header.trim_trace = trace_info.trim_trace;
+    header.tracestart = trace_info.m_tracestart;
+    header.tracelen = trace_info.m_tracelen;
+
+    // Vblank durations and the tgid, sched_switch and timeline colors init() sets
+    header.vblank_high_prec = VBlankHighPrecTimestamps;
+    header.print_label_sat = s_clrs().getalpha( col_Graph_PrintLabelSat );
+    header.print_label_alpha = s_clrs().getalpha( col_Graph_PrintLabelAlpha );
+    header.timeline_label_sat = s_clrs().getalpha( col_Graph_TimelineLabelSat );
+    header.timeline_label_alpha = s_clrs().getalpha( col_Graph_TimelineLabelAlpha );
+    return true;
+}
+
+// Read only view of the cache file. Sections are used in place from the mapping
+//  and the string pool keeps it for its strings. Read into memory where we can't mmap.
+static std::shared_ptr< void > map_cache_file( const char *filename, const char **data, size_t *size )
+{
+#if defined( WIN32 )
+    size_t filesize = get_file_size( filename );
+    FILE *fp = filesize ? fopen( filename, "rb" ) : NULL;
+
+    if ( !fp )
+        return nullptr;
+
+    std::shared_ptr< void > buf( malloc( filesize ), free );
+    bool read_ok = buf && ( fread( buf.get(), 1, filesize, fp ) == filesize );
+
+    fclose( fp );
+    if ( !read_ok )
+        return nullptr;
+#else
+    struct stat st;
+    int fd = open( filename, O_RDONLY );
+
+    if ( fd < 0 )
+        return nullptr;
+
+    if ( fstat( fd, &st ) || !st.st_size )
+    {
+        close( fd );
+        return nullptr;
+    }
+
+    size_t filesize = st.st_size;
+    void *map = mmap( NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+    close( fd );
+    if ( map == MAP_FAILED )
+        return nullptr;
+
+    madvise( map, filesize, MADV_WILLNEED );
+
+    std::shared_ptr< void > buf( map, [ filesize ]( void *ptr ) { munmap( ptr, filesize ); } );
+#endif
+
+    *data = ( const char * )buf.get();
+    *size = filesize;
+    return buf;
+}
+
+// Location tables in the order they're stored. init() doesn't fill the i915 tables.
+static std::vector< TraceLocations * > get_locs_tables( TraceEvents &trace_events )
+{
+    return { &trace_events.m_tdopexpr_locs, &trace_events.m_comm_locs,
+             &trace_events.m_eventnames_locs, &trace_events.m_gfxcontext_locs,
+             &trace_events.m_gfxcontext_msg_locs, &trace_events.m_amd_timeline_locs,
+             &trace_events.m_sched_switch_prev_locs, &trace_events.m_sched_switch_next_locs,
+             &trace_events.m_sched_switch_cpu_locs };
+}
+
+// Undo a partly restored cache so the trace can be read from the trace file instead
+static void clear_trace_events( TraceEvents &trace_events )
+{
+    for ( trace_event_t &event : trace_events.m_events )
+        delete [] event.fields;
+    trace_events.m_events.clear();
+
+    for ( TraceLocations *table : get_locs_tables( trace_events ) )
+        table->m_locs.m_map.clear();
+    trace_events.m_amd_timeline_index.m_map.clear();
+
+    trace_events.m_crtc_max = -1;
+    trace_events.m_failed_commands.clear();
+    trace_events.m_sched_switch_time_pid.m_map.clear();
+    trace_events.m_sched_switch_time_total = 0;
+    trace_events.m_sched_cpu_runtime.m_map.clear();
+    trace_events.m_sched_pid_runtime.m_map.clear();
+
+    trace_events.m_ftrace.print_locs.clear();
+    trace_events.m_ftrace.print_info.m_map.clear();
+    trace_events.m_ftrace.print_buf_len_max = 0;
+    trace_events.m_ftrace.print_ts_max = 0;
+    trace_events.m_ftrace.row_info.m_map.clear();
+    trace_events.m_ftrace.print_locs_placed = 0;
+    trace_events.m_ftrace.row_pos = row_pos_t();
+    trace_events.m_ftrace.row_pos_pid.m_map.clear();
+    trace_events.m_ftrace.row_pos_tgid.m_map.clear();
+    trace_events.m_ftrace.begin_ctx.m_map.clear();
+    trace_events.m_ftrace.end_ctx.m_map.clear();
+    trace_events.m_ftrace.pairs_ctx.m_map.clear();
+
+    trace_events.m_vblank_info.clear();
+    trace_events.m_drm_vblank_event_queued.m_map.clear();
+    trace_events.m_drm_sched.rings.clear();
+    trace_events.m_drm_sched.outstanding_jobs.clear();
+}
+
+static void write_intervals( cache_writer_t &writer, const IntervalIndex &index )
+{
+    writer.put< uint32_t >( index.m_intervals.size() );
+    for ( const IntervalIndex::interval_t &interval : index.m_intervals )
+    {
+        writer.put( interval.ts0 );
+        writer.put( interval.ts1 );
+        writer.put( interval.eventid );
+    }
+}
+
+static bool read_intervals( cache_reader_t &reader, IntervalIndex &index )
+{
+    uint32_t count;
+
+    if ( !reader.get( count ) )
+        return false;
+
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        IntervalIndex::interval_t interval;
+
+        if ( !reader.get( interval.ts0 ) || !reader.get( interval.ts1 ) || !reader.get( interval.eventid ) )
+            return false;
+        index.push_back( interval.ts0, interval.ts1, interval.eventid );
+    }
+
+    // The tree is cheap to build from the intervals
+    index.init();
+    return true;
+}
+
+template < typename K >
+static void write_runtimes( cache_writer_t &writer, const util_umap< K, RunTimeIndex > &runtimes )
+{
+    writer.put< uint32_t >( runtimes.m_map.size() );
+    for ( const auto &it : runtimes.m_map )
+    {
+        writer.put( it.first );
+        writer.put_vec( it.second.m_ts0 );
+        writer.put_vec( it.second.m_ts1 );
+        writer.put_vec( it.second.m_sum );
+    }
+}
+
+template < typename K >
+static bool read_runtimes( cache_reader_t &reader, util_umap< K, RunTimeIndex > &runtimes )
+{
+    uint32_t count;
+
+    if ( !reader.get( count ) )
+        return false;
+
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        K key;
+
+        if ( !reader.get( key ) )
+            return false;
+
+        RunTimeIndex &runtime = runtimes.m_map[ key ];
+
+        if ( !reader.get_vec( runtime.m_ts0 ) || !reader.get_vec( runtime.m_ts1 ) ||
+             !reader.get_vec( runtime.m_sum ) ||
+             ( runtime.m_ts1.size() != runtime.m_ts0.size() ) ||
+             ( runtime.m_sum.size() != runtime.m_ts0.size() ) )
+            return false;
+    }
+    return true;
+}
+
+static void write_row_pos( cache_writer_t &writer, const row_pos_t &row_pos )
+{
+    writer.put( row_pos.m_rows );
+    for ( const auto &blocks : row_pos.m_row_pos )
+        writer.put_map( blocks );
+}
+
+static bool read_row_pos( cache_reader_t &reader, row_pos_t &row_pos )
+{
+    if ( !reader.get( row_pos.m_rows ) )
+        return false;
+
+    for ( auto &blocks : row_pos.m_row_pos )
+    {
+        if ( !reader.get_map( blocks ) )
+            return false;
+    }
+    return true;
+}
+
+template < typename K >
+static void write_row_pos_map( cache_writer_t &writer, const util_umap< K, row_pos_t > &map )
+{
+    writer.put< uint32_t >( map.m_map.size() );
+    for ( const auto &it : map.m_map )
+    {
+        writer.put( it.first );
+        write_row_pos( writer, it.second );
+    }
+}
+
+template < typename K >
+static bool read_row_pos_map( cache_reader_t &reader, util_umap< K, row_pos_t > &map )
+{
+    uint32_t count;
+
+    if ( !reader.get( count ) )
+        return false;
+
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        K key;
+
+        if ( !reader.get( key ) || !read_row_pos( reader, map.m_map[ key ] ) )
+            return false;
+    }
+    return true;
+}
+
+static void write_pid_comm_map( cache_writer_t &writer, const util_umap< int, const char * > &map )
+{
+    writer.put< uint32_t >( map.m_map.size() );
+    for ( const auto &it : map.m_map )
+    {
+        writer.put( it.first );
+        writer.put_str( it.second );
+    }
+}
+
+static bool read_pid_comm_map( cache_reader_t &reader, util_umap< int, const char * > &map )
+{
+    uint32_t count;
+
+    if ( !reader.get( count ) )
+        return false;
+
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        int pid;
+        const char *comm;
+
+        if ( !reader.get( pid ) || !reader.get_str( comm ) )
+            return false;
+        map.set_val( pid, comm );
+    }
+    return true;
+}
+
+static void write_trace_info( cache_writer_t &writer, const trace_info_t &trace_info )
+{
+    writer.put( trace_info.cpus );
+    writer.put_string( trace_info.file );
+    writer.put_string( trace_info.uname );
+    writer.put_string( trace_info.opt_version );
+    writer.put< uint32_t >( trace_info.timestamp_in_us );
+    writer.put_vec( trace_info.cpu_info );
+
+    writer.put( trace_info.min_file_ts );
+    writer.put( trace_info.trimmed_ts );
+    writer.put< uint32_t >( trace_info.mono_trace_clock );
+
+    writer.put< uint32_t >( trace_info.m_resume.size() );
+    for ( const cpu_resume_t &resume : trace_info.m_resume )
+    {
+        writer.put< uint64_t >( resume.ts );
+        writer.put( resume.ts_count );
+    }
+
+    writer.put< uint32_t >( trace_info.tgid_pids.m_map.size() );
+    for ( const auto &it : trace_info.tgid_pids.m_map )
+    {
+        const tgid_info_t &tgid_info = it.second;
+
+        writer.put( it.first );
+        writer.put( tgid_info.tgid );
+        writer.put( tgid_info.hashval );
+        writer.put( tgid_info.color );
+        writer.put_str( tgid_info.commstr_clr );
+        writer.put_str( tgid_info.commstr );
+        writer.put_vec( tgid_info.pids );
+    }
+
+    writer.put_map( trace_info.pid_tgid_map.m_map );
+    write_pid_comm_map( writer, trace_info.pid_comm_map );
+    write_pid_comm_map( writer, trace_info.sched_switch_pid_comm_map );
+}
+
+static bool read_trace_info( cache_reader_t &reader, trace_info_t &trace_info )
+{
+    uint32_t count;
+    uint32_t timestamp_in_us;
+    uint32_t mono_trace_clock;
+
+    if ( !reader.get( trace_info.cpus ) ||
+         !reader.get_string( trace_info.file ) ||
+         !reader.get_string( trace_info.uname ) ||
+         !reader.get_string( trace_info.opt_version ) ||
+         !reader.get( timestamp_in_us ) ||
+         !reader.get_vec( trace_info.cpu_info ) )
+        return false;
+    trace_info.timestamp_in_us = !!timestamp_in_us;
+
+    if ( !reader.get( trace_info.min_file_ts ) ||
+         !reader.get( trace_info.trimmed_ts ) ||
+         !reader.get( mono_trace_clock ) )
+        return false;
+    trace_info.mono_trace_clock = !!mono_trace_clock;
+
+    if ( !reader.get( count ) )
+        return false;
+    trace_info.m_resume.resize( count );
+    for ( cpu_resume_t &resume : trace_info.m_resume )
+    {
+        uint64_t ts;
+
+        if ( !reader.get( ts ) || !reader.get( resume.ts_count ) )
+            return false;
+        resume.ts = ts;
+    }
+
+    if ( !reader.get( count ) )
+        return false;
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        int key;
+
+        if ( !reader.get( key ) )
+            return false;
+
+        tgid_info_t *tgid_info = trace_info.tgid_pids.get_val_create( key );
+
+        if ( !reader.get( tgid_info->tgid ) ||
+             !reader.get( tgid_info->hashval ) ||
+             !reader.get( tgid_info->color ) ||
+             !reader.get_str( tgid_info->commstr_clr ) ||
+             !reader.get_str( tgid_info->commstr ) ||
+             !reader.get_vec( tgid_info->pids ) )
+            return false;
+    }
+
+    return reader.get_map( trace_info.pid_tgid_map.m_map ) &&
+           read_pid_comm_map( reader, trace_info.pid_comm_map ) &&
+           read_pid_comm_map( reader, trace_info.sched_switch_pid_comm_map );
+}
+
+// Everything init() leaves behind that isn't an event or a location table
+static void write_state( cache_writer_t &writer, TraceEvents &trace_events )
+{
+    write_trace_info( writer, trace_events.m_trace_info );
+
+    writer.put( trace_events.m_crtc_max );
+    writer.put( trace_events.m_sched_switch_time_total );
+    writer.put_map( trace_events.m_sched_switch_time_pid.m_map );
+
+    writer.put< uint32_t >( trace_events.m_failed_commands.size() );
+    for ( uint32_t hashval : trace_events.m_failed_commands )
+        writer.put( hashval );
+
+    // Timeline interval indexes, keyed on their m_amd_timeline_locs key
+    std::vector< std::pair< uint32_t, const TraceEvents::timeline_index_t * > > timelines;
+
+    for ( const auto &it : trace_events.m_amd_timeline_locs.m_locs.m_map )
+    {
+        const TraceEvents::timeline_index_t *tindex = trace_events.m_amd_timeline_index.get_val( &it.second );
+
+        if ( tindex )
+            timelines.push_back( { it.first, tindex } );
+    }
+
+    writer.put< uint32_t >( timelines.size() );
+    for ( const auto &it : timelines )
+    {
+        writer.put( it.first );
+        writer.put( it.second->graph_row_id );
+        writer.put( it.second->last_fence_signaled_ts );
+        write_intervals( writer, it.second->user );
+        write_intervals( writer, it.second->hw );
+    }
+
+    write_runtimes( writer, trace_events.m_sched_cpu_runtime );
+    write_runtimes( writer, trace_events.m_sched_pid_runtime );
+
+    // ftrace print info. Text sizes are measured again on first draw
+    //  and ftrace_pairs are set up again when the next print event is added.
+    trace_events.m_ftrace.print_locs.save( writer.m_buf );
+
+    writer.put< uint32_t >( trace_events.m_ftrace.print_info.m_map.size() );
+    for ( const auto &it : trace_events.m_ftrace.print_info.m_map )
+    {
+        const print_info_t &print_info = it.second;
+
+        writer.put( it.first );
+        writer.put( print_info.ts );
+        writer.put( print_info.tgid );
+        writer.put( print_info.graph_row_id_pid );
+        writer.put( print_info.graph_row_id_tgid );
+        writer.put_str( print_info.buf );
+    }
+
+    writer.put< uint64_t >( trace_events.m_ftrace.print_buf_len_max );
+    writer.put( trace_events.m_ftrace.print_ts_max );
+
+    writer.put< uint32_t >( trace_events.m_ftrace.row_info.m_map.size() );
+    for ( const auto &it : trace_events.m_ftrace.row_info.m_map )
+    {
+        writer.put( it.first );
+        writer.put( it.second.pid );
+        writer.put( it.second.tgid );
+        writer.put( it.second.rows );
+        writer.put( it.second.count );
+    }
+
+    writer.put< uint64_t >( trace_events.m_ftrace.print_locs_placed );
+    write_row_pos( writer, trace_events.m_ftrace.row_pos );
+    write_row_pos_map( writer, trace_events.m_ftrace.row_pos_pid );
+    write_row_pos_map( writer, trace_events.m_ftrace.row_pos_tgid );
+    writer.put_map( trace_events.m_ftrace.begin_ctx.m_map );
+    writer.put_map( trace_events.m_ftrace.end_ctx.m_map );
+    writer.put_map( trace_events.m_ftrace.pairs_ctx.m_map );
+
+    writer.put< uint32_t >( trace_events.m_vblank_info.size() );
+    for ( const TraceEvents::vblank_info_t &vblank_info : trace_events.m_vblank_info )
+    {
+        writer.put( vblank_info.last_vblank_ts );
+        writer.put( vblank_info.median_diff_ts );
+        writer.put( vblank_info.count );
+        writer.put_map( vblank_info.diff_ts_count );
+    }
+    writer.put_map( trace_events.m_drm_vblank_event_queued.m_map );
+
+    writer.put< uint32_t >( trace_events.m_drm_sched.rings.size() );
+    for ( const std::string &ring : trace_events.m_drm_sched.rings )
+        writer.put_string( ring );
+    writer.put_map( trace_events.m_drm_sched.outstanding_jobs );
+}
+
+// Location tables have to be read first, timeline indexes are keyed on them
+static bool read_state( cache_reader_t &reader, TraceEvents &trace_events )
+{
+    uint32_t count;
+    uint64_t val;
+
+    if ( !read_trace_info( reader, trace_events.m_trace_info ) ||
+         !reader.get( trace_events.m_crtc_max ) ||
+         !reader.get( trace_events.m_sched_switch_time_total ) ||
+         !reader.get_map( trace_events.m_sched_switch_time_pid.m_map ) )
+        return false;
+
+    if ( !reader.get( count ) )
+        return false;
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        uint32_t hashval;
+
+        if ( !reader.get( hashval ) )
+            return false;
+        trace_events.m_failed_commands.insert( hashval );
+    }
+
+    if ( !reader.get( count ) )
+        return false;
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        uint32_t key;
+
+        if ( !reader.get( key ) )
+            return false;
+
+        const EventLocs *plocs = trace_events.m_amd_timeline_locs.get_locations_u32( key );
+        if ( !plocs )
+            return false;
+
+        TraceEvents::timeline_index_t *tindex = trace_events.m_amd_timeline_index.get_val_create( plocs );
+
+        if ( !reader.get( tindex->graph_row_id ) ||
+             !reader.get( tindex->last_fence_signaled_ts ) ||
+             !read_intervals( reader, tindex->user ) ||
+             !read_intervals( reader, tindex->hw ) )
+            return false;
+    }
+
+    if ( !read_runtimes( reader, trace_events.m_sched_cpu_runtime ) ||
+         !read_runtimes( reader, trace_events.m_sched_pid_runtime ) ||
+         !reader.get_locs( trace_events.m_ftrace.print_locs ) )
+        return false;
+
+    if ( !reader.get( count ) )
+        return false;
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        uint32_t id;
+        print_info_t print_info;
+
+        if ( !reader.get( id ) ||
+             !reader.get( print_info.ts ) ||
+             !reader.get( print_info.tgid ) ||
+             !reader.get( print_info.graph_row_id_pid ) ||
+             !reader.get( print_info.graph_row_id_tgid ) ||
+             !reader.get_str( print_info.buf ) )
+            return false;
+
+        print_info.size = ImVec2( -1.0f, -1.0f );
+        trace_events.m_ftrace.print_info.set_val( id, print_info );
+    }
+
+    if ( !reader.get( val ) || !reader.get( trace_events.m_ftrace.print_ts_max ) )
+        return false;
+    trace_events.m_ftrace.print_buf_len_max = val;
+
+    if ( !reader.get( count ) )
+        return false;
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        uint32_t key;
+        ftrace_row_info_t row_info;
+
+        if ( !reader.get( key ) ||
+             !reader.get( row_info.pid ) ||
+             !reader.get( row_info.tgid ) ||
+             !reader.get( row_info.rows ) ||
+             !reader.get( row_info.count ) )
+            return false;
+        trace_events.m_ftrace.row_info.set_val( key, row_info );
+    }
+
+    if ( !reader.get( val ) ||
+         !read_row_pos( reader, trace_events.m_ftrace.row_pos ) ||
+         !read_row_pos_map( reader, trace_events.m_ftrace.row_pos_pid ) ||
+         !read_row_pos_map( reader, trace_events.m_ftrace.row_pos_tgid ) ||
+         !reader.get_map( trace_events.m_ftrace.begin_ctx.m_map ) ||
+         !reader.get_map( trace_events.m_ftrace.end_ctx.m_map ) ||
+         !reader.get_map( trace_events.m_ftrace.pairs_ctx.m_map ) )
+        return false;
+    trace_events.m_ftrace.print_locs_placed = val;
+
+    // Vblank events index m_vblank_info with their crtc
+    if ( !reader.get( count ) || ( ( int )count != trace_events.m_crtc_max + 1 ) )
+        return false;
+    trace_events.m_vblank_info.resize( count );
+    for ( TraceEvents::vblank_info_t &vblank_info : trace_events.m_vblank_info )
+    {
+        if ( !reader.get( vblank_info.last_vblank_ts ) ||
+             !reader.get( vblank_info.median_diff_ts ) ||
+             !reader.get( vblank_info.count ) ||
+             !reader.get_map( vblank_info.diff_ts_count ) )
+            return false;
+    }
+    if ( !reader.get_map( trace_events.m_drm_vblank_event_queued.m_map ) )
+        return false;
+
+    if ( !reader.get( count ) )
+        return false;
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        std::string ring;
+
+        if ( !reader.get_string( ring ) )
+            return false;
+        trace_events.m_drm_sched.rings.insert( ring );
+    }
+
+    return reader.get_map( trace_events.m_drm_sched.outstanding_jobs ) && reader.empty();
+}
+
+static void write_locs( cache_writer_t &writer, TraceEvents &trace_events )
+{
+    std::vector< TraceLocations * > tables = get_locs_tables( trace_events );
+
+    for ( uint32_t table = 0; table < tables.size(); table++ )
+    {
+        for ( const auto &it : tables[ table ]->m_locs.m_map )
+        {
+            writer.put( table );
+            writer.put( it.first );
+            it.second.save( writer.m_buf );
+        }
+    }
+}
+
+static bool read_locs( cache_reader_t &reader, TraceEvents &trace_events )
+{
+    std::vector< TraceLocations * > tables = get_locs_tables( trace_events );
+
+    while ( !reader.empty() )
+    {
+        uint32_t table;
+        uint32_t key;
+
+        if ( !reader.get( table ) || ( table >= tables.size() ) || !reader.get( key ) ||
+             !reader.get_locs( *tables[ table ]->m_locs.get_val_create( key ) ) )
+            return false;
+    }
+    return true;
+}
+
+static void write_events( cache_writer_t &events_writer, cache_writer_t &fields_writer,
+                          const std::vector< trace_event_t > &events )
+{
+    events_writer.m_buf.reserve( events.size() * sizeof( cache_event_t ) );
+
+    for ( const trace_event_t &event : events )
+    {
+        cache_event_t cache_event;
+
+        memset( &cache_event, 0, sizeof( cache_event ) );
+        cache_event.ts = event.ts;
+        cache_event.duration = event.duration;
+        cache_event.comm = events_writer.get_str_id( event.comm );
+        cache_event.system = events_writer.get_str_id( event.system );
+        cache_event.name = events_writer.get_str_id( event.name );
+        cache_event.user_comm = events_writer.get_str_id( event.user_comm );
+        cache_event.pid = event.pid;
+        cache_event.seqno = event.seqno;
+        cache_event.id_start = event.id_start;
+        cache_event.graph_row_id = event.graph_row_id;
+        cache_event.color = event.color;
+        cache_event.color_index = event.color_index;
+        cache_event.flags = event.flags;
+        cache_event.crtc = event.crtc;
+        cache_event.cpu = event.cpu;
+        cache_event.numfields = event.numfields;
+        cache_event.is_filtered_out = event.is_filtered_out;
+        events_writer.put( cache_event );
+
+        for ( uint32_t i = 0; i < event.numfields; i++ )
+        {
+            const event_field_t &field = event.fields[ i ];
+            cache_field_t cache_field;
+
+            cache_field.key = fields_writer.get_str_id( field.key );
+            cache_field.type = field.type;
+            cache_field.val = field.is_str() ? fields_writer.get_str_id( field.value ) : field.val;
+            fields_writer.put( cache_field );
+        }
+    }
+}
+
+// Events and fields are used in place from the mapped cache file
+static bool read_events( TraceEvents &trace_events, const cache_event_t *cache_events, size_t num_events,
+                         const cache_field_t *cache_fields, size_t num_fields )
+{
+    StrPool &strpool = trace_events.m_strpool;
+    auto getstr = [ &strpool ]( uint32_t id, const char *&str )
+    {
+        str = is_valid_id( id ) ? strpool.findid( id ) : NULL;
+        return str || !is_valid_id( id );
+    };
+
+    trace_events.m_events.resize( num_events );
+
+    for ( size_t i = 0; i < num_events; i++ )
+    {
+        const cache_event_t &cache_event = cache_events[ i ];
+        trace_event_t &event = trace_events.m_events[ i ];
+
+        // Fail on a short fields section instead of leaving events without fields
+        if ( cache_event.numfields > num_fields )
+            return false;
+
+        if ( !getstr( cache_event.comm, event.comm ) ||
+             !getstr( cache_event.system, event.system ) ||
+             !getstr( cache_event.name, event.name ) ||
+             !getstr( cache_event.user_comm, event.user_comm ) )
+            return false;
+
+        event.ts = cache_event.ts;
+        event.duration = cache_event.duration;
+        event.pid = cache_event.pid;
+        event.id = i;
+        event.seqno = cache_event.seqno;
+        event.id_start = cache_event.id_start;
+        event.graph_row_id = cache_event.graph_row_id;
+        event.color = cache_event.color;
+        event.color_index = cache_event.color_index;
+        event.flags = cache_event.flags;
+        event.crtc = cache_event.crtc;
+        event.cpu = cache_event.cpu;
+        event.is_filtered_out = !!cache_event.is_filtered_out;
+
+        event.fields = new event_field_t[ cache_event.numfields ];
+        event.numfields = cache_event.numfields;
+
+        for ( uint32_t j = 0; j < cache_event.numfields; j++ )
+        {
+            const cache_field_t &cache_field = *cache_fields++;
+            event_field_t &field = event.fields[ j ];
+
+            field.type = cache_field.type;
+            if ( ( field.type > EVENT_FIELD_HEX32 ) || !getstr( cache_field.key, field.key ) )
+                return false;
+
+            if ( !field.is_str() )
+                field.val = cache_field.val;
+            else if ( ( cache_field.val > UINT32_MAX ) || !getstr( cache_field.val, field.value ) )
+                return false;
+        }
+        num_fields -= cache_event.numfields;
+    }
+
+    return !num_fields;
+}
+
+std::string get_trace_cache_filename( const char *file )
+{
+    return std::string( file ) + ".gvcache";
+}
+
+bool write_trace_cache( const char *file, TraceEvents &trace_events )
+{
+    GPUVIS_TRACE_BLOCK( __func__ );
+
+    cache_header_t header;
+    util_umap< const char *, uint32_t > ids;
+    StrPool &strpool = trace_events.m_strpool;
+    cache_writer_t writers[ CACHE_SECTION_Max ] =
+    {
+        { strpool, ids }, { strpool, ids }, { strpool, ids }, { strpool, ids }, { strpool, ids }
+    };
+
+    if ( !init_cache_header( header, file, trace_events.m_trace_info ) )
+        return false;
+
+    write_events( writers[ CACHE_SECTION_Events ], writers[ CACHE_SECTION_Fields ], trace_events.m_events );
+    write_locs( writers[ CACHE_SECTION_Locs ], trace_events );
+    write_state( writers[ CACHE_SECTION_State ], trace_events );
+
+    // Last, after everything else has added its strings
+    if ( !strpool.save( writers[ CACHE_SECTION_Strings ].m_buf ) )
+        return false;
+
+    header.num_events = trace_events.m_events.size();
+    header.num_fields = writers[ CACHE_SECTION_Fields ].m_buf.size() / sizeof( cache_field_t );
+
+    uint64_t offset = sizeof( header );
+    for ( uint32_t i = 0; i < CACHE_SECTION_Max; i++ )
+    {
+        offset = ( offset + GVCACHE_ALIGN - 1 ) & ~( uint64_t )( GVCACHE_ALIGN - 1 );
+
+        header.sections[ i ].offset = offset;
+        header.sections[ i ].size = writers[ i ].m_buf.size();
+        offset += header.sections[ i ].size;
+    }
+
+    // Write to a temp file and rename so readers never see a partial cache
+    std::string cachefile = get_trace_cache_filename( file );
+    std::string tmpfile = cachefile + ".tmp";
+    FILE *fp = fopen( tmpfile.c_str(), "wb" );
+
+    if ( !fp )
+        return false;
+
+    static const char s_zeros[ GVCACHE_ALIGN ] = { 0 };
+    bool ret = ( fwrite( &header, sizeof( header ), 1, fp ) == 1 );
+
+    offset = sizeof( header );
+    for ( uint32_t i = 0; i < CACHE_SECTION_Max; i++ )
+    {
+        size_t pad = header.sections[ i ].offset - offset;
+        size_t size = writers[ i ].m_buf.size();
+
+        ret = ret && ( fwrite( s_zeros, 1, pad, fp ) == pad );
+        ret = ret && ( fwrite( writers[ i ].m_buf.data(), 1, size, fp ) == size );
+        offset = header.sections[ i ].offset + size;
+    }
+
+    ret = !fclose( fp ) && ret;
+
+    remove( cachefile.c_str() );
+    if ( !ret || rename( tmpfile.c_str(), cachefile.c_str() ) )
+    {
+        remove( tmpfile.c_str() );
+        return false;
+    }
+
+    return true;
+}
+
+int read_trace_cache( const char *file, TraceEvents &trace_events )
+{
+    GPUVIS_TRACE_BLOCK( __func__ );
+
+    cache_header_t header;
+    cache_header_t file_header;
+    const char *data = NULL;
+    size_t size = 0;
+
+    if ( !trace_events.m_events.empty() || !init_cache_header( header, file, trace_events.m_trace_info ) )
+        return -1;
+
+    std::string cachefile = get_trace_cache_filename( file );
+    std::shared_ptr< void > mapping = map_cache_file( cachefile.c_str(), &data, &size );
+
+    if ( !mapping || ( size < sizeof( file_header ) ) )
+        return -1;
+    memcpy( &file_header, data, sizeof( file_header ) );
+
+    // Revision, record sizes, source file and load settings all have to match
+    if ( memcmp( &header, &file_header, offsetof( cache_header_t, num_events ) ) )
+        return -1;
+
+    for ( const cache_section_t &section : file_header.sections )
+    {
+        if ( ( section.offset % GVCACHE_ALIGN ) || ( section.offset > size ) ||
+             ( section.size > size - section.offset ) )
+            return -1;
+    }
+
+    const cache_section_t &strings = file_header.sections[ CACHE_SECTION_Strings ];
+    const cache_section_t &events = file_header.sections[ CACHE_SECTION_Events ];
+    const cache_section_t &fields = file_header.sections[ CACHE_SECTION_Fields ];
+    const cache_section_t &locs = file_header.sections[ CACHE_SECTION_Locs ];
+    const cache_section_t &state = file_header.sections[ CACHE_SECTION_State ];
+
+    if ( ( file_header.num_events != events.size / sizeof( cache_event_t ) ) ||
+         ( events.size % sizeof( cache_event_t ) ) ||
+         ( file_header.num_fields != fields.size / sizeof( cache_field_t ) ) ||
+         ( fields.size % sizeof( cache_field_t ) ) )
+        return -1;
+
+    // Pool strings point into the mapping, which it keeps around
+    if ( !trace_events.m_strpool.load( data + strings.offset, strings.size, mapping ) )
+        return -1;
+
+    cache_reader_t locs_reader( trace_events.m_strpool, data + locs.offset, locs.size );
+    cache_reader_t state_reader( trace_events.m_strpool, data + state.offset, state.size );
+    trace_info_t trace_info = trace_events.m_trace_info;
+
+    if ( !read_locs( locs_reader, trace_events ) ||
+         !read_state( state_reader, trace_events ) ||
+         !read_events( trace_events,
+                       ( const cache_event_t * )( data + events.offset ), file_header.num_events,
+                       ( const cache_field_t * )( data + fields.offset ), file_header.num_fields ) )
+    {
+        clear_trace_events( trace_events );
+        trace_events.m_trace_info = trace_info;
+        return -1;
+    }
+
+    // Runs are merged and events have ids, like after prepare_events()
+    trace_events.m_event_runs.clear();
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef GPUVIS_CACHE_H_
+#define GPUVIS_CACHE_H_
+
+class TraceEvents;
+
+// Sidecar cache of initialized trace events, stored next to the trace as "<file>.gvcache".
+//  Only valid if the trace file size, mtime, content hash and load settings all match.
+std::string get_trace_cache_filename( const char *file );
+
+// Restore trace_events to the state init() left it in when the cache was written.
+//  trace_events has to be empty. Returns -1 if the cache file is missing, stale, or corrupt.
+int read_trace_cache( const char *file, TraceEvents &trace_events );
+// Write trace_events of a single file after init()
+bool write_trace_cache( const char *file, TraceEvents &trace_events );
+
+#endif // GPUVIS_CACHE_H_
@@ -0,0 +1,875 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <inttypes.h>
+
+#include <array>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+
+#include <cinder/app/App.h>
+
+#include "imgui/imgui.h"
+#include "gpuvis_macros.h"
+#include "trace-cmd/trace-read.h"
+#include "gpuvis_utils.h"
+#include "gpuvis.h"
+#include "gpuvis_export.h"
+
+#include "MiniConfig.h"
+
+// Flush output every 1MB
+static const size_t s_flush_size = 1024 * 1024;
+
+// Buffered output file
+class export_file_t
+{
+public:
+    export_file_t() {}
+    ~export_file_t() { close(); }
+
+    bool open( const char *filename )
+    {
+        m_fp = fopen( filename, "wb" );
+        m_buf.reserve( s_flush_size + 4096 );
+        return !!m_fp;
+    }
+
+    bool close()
+    {
+        if ( m_fp )
+        {
+            flush();
+            m_failed |= !!fclose( m_fp );
+            m_fp = NULL;
+        }
+        return !m_failed;
+    }
+
+    void write( const void *data, size_t len )
+    {
+        m_buf.append( ( const char * )data, len );
+        if ( m_buf.size() >= s_flush_size )
+            flush();
+    }
+    void write( const std::string &str )
+    {
+        write( str.data(), str.size() );
+    }
+
+    void flush()
+    {
+        if ( !m_buf.empty() )
+        {
+            m_failed |= ( fwrite( m_buf.data(), 1, m_buf.size(), m_fp ) != m_buf.size() );
+            m_buf.clear();
+        }
+    }
+
+public:
+    FILE *m_fp = NULL;
+    std::string m_buf;
+    bool m_failed = false;
+};
+
+// Receives tracks and events from TraceExporter and writes them in some format
+class ExportWriter
+{
+public:
+    ExportWriter( export_file_t &file ) : m_file( file ) {}
+    virtual ~ExportWriter() {}
+
+    virtual void begin() {}
+    virtual void end() {}
+
+    // Groups are processes (pid > 0) or named collections of tracks (pid 0)
+    virtual void add_group( uint32_t group, int pid, const char *name ) = 0;
+    virtual void add_track( uint32_t track, uint32_t group, const char *name, bool counter ) = 0;
+
+    virtual void slice( uint32_t track, uint64_t ts, uint64_t duration, const char *cat, const char *name ) = 0;
+    virtual void instant( uint32_t track, uint64_t ts, const char *cat, const char *name ) = 0;
+    virtual void counter( uint32_t track, uint64_t ts, double val ) = 0;
+
+protected:
+    export_file_t &m_file;
+};
+
+/*
+ * Perfetto
+ */
+
+// Minimal protobuf encoder for the few Perfetto messages we write
+class pb_msg_t
+{
+public:
+    void clear()                    { m_buf.clear(); }
+    bool empty() const              { return m_buf.empty(); }
+
+    void varint( uint32_t field, uint64_t val )
+    {
+        put_varint( field << 3 );
+        put_varint( val );
+    }
+    void fixed_double( uint32_t field, double val )
+    {
+        put_varint( ( field << 3 ) | 1 );
+        m_buf.append( ( const char * )&val, sizeof( val ) );
+    }
+    void bytes( uint32_t field, const void *data, size_t len )
+    {
+        put_varint( ( field << 3 ) | 2 );
+        put_varint( len );
+        m_buf.append( ( const char * )data, len );
+    }
+    void str( uint32_t field, const char *str )
+    {
+        bytes( field, str, strlen( str ) );
+    }
+    void msg( uint32_t field, const pb_msg_t &msg )
+    {
+        bytes( field, msg.m_buf.data(), msg.m_buf.size() );
+    }
+
+    void put_varint( uint64_t val )
+    {
+        char buf[ 10 ];
+        size_t len = 0;
+
+        while ( val >= 0x80 )
+        {
+            buf[ len++ ] = ( char )( val | 0x80 );
+            val >>= 7;
+        }
+        buf[ len++ ] = ( char )val;
+
+        m_buf.append( buf, len );
+    }
+
+public:
+    std::string m_buf;
+};
+
+// Field numbers from perfetto/protos/perfetto/trace/trace_packet.proto, etc.
+enum
+{
+    pb_Trace_packet = 1,
+
+    pb_TracePacket_timestamp = 8,
+    pb_TracePacket_trusted_packet_sequence_id = 10,
+    pb_TracePacket_track_event = 11,
+    pb_TracePacket_interned_data = 12,
+    pb_TracePacket_sequence_flags = 13,
+    pb_TracePacket_track_descriptor = 60,
+
+    pb_TrackDescriptor_uuid = 1,
+    pb_TrackDescriptor_name = 2,
+    pb_TrackDescriptor_process = 3,
+    pb_TrackDescriptor_parent_uuid = 5,
+    pb_TrackDescriptor_counter = 8,
+
+    pb_ProcessDescriptor_pid = 1,
+    pb_ProcessDescriptor_process_name = 6,
+
+    pb_TrackEvent_category_iids = 3,
+    pb_TrackEvent_type = 9,
+    pb_TrackEvent_name_iid = 10,
+    pb_TrackEvent_track_uuid = 11,
+    pb_TrackEvent_double_counter_value = 44,
+
+    pb_InternedData_event_categories = 1,
+    pb_InternedData_event_names = 2,
+
+    pb_InternedString_iid = 1,
+    pb_InternedString_name = 2,
+};
+
+enum
+{
+    pb_TYPE_SLICE_BEGIN = 1,
+    pb_TYPE_SLICE_END = 2,
+    pb_TYPE_INSTANT = 3,
+    pb_TYPE_COUNTER = 4,
+
+    pb_SEQ_INCREMENTAL_STATE_CLEARED = 1,
+    pb_SEQ_NEEDS_INCREMENTAL_STATE = 2,
+};
+
+class PerfettoWriter : public ExportWriter
+{
+public:
+    PerfettoWriter( export_file_t &file, StrPool &strpool ) : ExportWriter( file ), m_strpool( strpool ) {}
+    virtual ~PerfettoWriter() {}
+
+    virtual void add_group( uint32_t group, int pid, const char *name ) override
+    {
+        m_track.clear();
+        m_track.varint( pb_TrackDescriptor_uuid, group_uuid( group ) );
+        if ( pid > 0 )
+        {
+            m_sub.clear();
+            m_sub.varint( pb_ProcessDescriptor_pid, pid );
+            m_sub.str( pb_ProcessDescriptor_process_name, name );
+            m_track.msg( pb_TrackDescriptor_process, m_sub );
+        }
+        else
+        {
+            m_track.str( pb_TrackDescriptor_name, name );
+        }
+
+        write_track_packet();
+    }
+
+    virtual void add_track( uint32_t track, uint32_t group, const char *name, bool counter ) override
+    {
+        m_track.clear();
+        m_track.varint( pb_TrackDescriptor_uuid, track_uuid( track ) );
+        m_track.varint( pb_TrackDescriptor_parent_uuid, group_uuid( group ) );
+        m_track.str( pb_TrackDescriptor_name, name );
+        if ( counter )
+        {
+            m_sub.clear();
+            m_track.msg( pb_TrackDescriptor_counter, m_sub );
+        }
+
+        write_track_packet();
+    }
+
+    virtual void slice( uint32_t track, uint64_t ts, uint64_t duration, const char *cat, const char *name ) override
+    {
+        write_event( pb_TYPE_SLICE_BEGIN, track, ts, cat, name );
+        write_event( pb_TYPE_SLICE_END, track, ts + duration, NULL, NULL );
+    }
+
+    virtual void instant( uint32_t track, uint64_t ts, const char *cat, const char *name ) override
+    {
+        write_event( pb_TYPE_INSTANT, track, ts, cat, name );
+    }
+
+    virtual void counter( uint32_t track, uint64_t ts, double val ) override
+    {
+        m_event.clear();
+        m_event.varint( pb_TrackEvent_type, pb_TYPE_COUNTER );
+        m_event.varint( pb_TrackEvent_track_uuid, track_uuid( track ) );
+        m_event.fixed_double( pb_TrackEvent_double_counter_value, val );
+
+        write_event_packet( ts );
+    }
+
+protected:
+    // Groups and tracks share the uuid space. 0 isn't a valid uuid.
+    static uint64_t group_uuid( uint32_t group )    { return ( ( uint64_t )1 << 32 ) + group; }
+    static uint64_t track_uuid( uint32_t track )    { return ( ( uint64_t )2 << 32 ) + track; }
+
+    // Interned strings are written once in the packet that first uses them
+    uint64_t intern( uint32_t field, std::vector< bool > &written, const char *str )
+    {
+        uint32_t id = m_strpool.getid( str );
+
+        if ( id >= written.size() )
+            written.resize( id + 1024 );
+
+        if ( !written[ id ] )
+        {
+            written[ id ] = true;
+
+            m_sub.clear();
+            m_sub.varint( pb_InternedString_iid, id + 1 );
+            m_sub.str( pb_InternedString_name, str );
+            m_interned.msg( field, m_sub );
+        }
+
+        return id + 1;
+    }
+
+    void write_event( uint32_t type, uint32_t track, uint64_t ts, const char *cat, const char *name )
+    {
+        m_event.clear();
+        m_event.varint( pb_TrackEvent_type, type );
+        m_event.varint( pb_TrackEvent_track_uuid, track_uuid( track ) );
+        if ( cat )
+            m_event.varint( pb_TrackEvent_category_iids, intern( pb_InternedData_event_categories, m_cats_written, cat ) );
+        if ( name )
+            m_event.varint( pb_TrackEvent_name_iid, intern( pb_InternedData_event_names, m_names_written, name ) );
+
+        write_event_packet( ts );
+    }
+
+    void write_event_packet( uint64_t ts )
+    {
+        m_packet.clear();
+        m_packet.varint( pb_TracePacket_timestamp, ts );
+        m_packet.msg( pb_TracePacket_track_event, m_event );
+        if ( !m_interned.empty() )
+        {
+            m_packet.msg( pb_TracePacket_interned_data, m_interned );
+            m_interned.clear();
+        }
+        m_packet.varint( pb_TracePacket_trusted_packet_sequence_id, s_sequence_id );
+        m_packet.varint( pb_TracePacket_sequence_flags, pb_SEQ_NEEDS_INCREMENTAL_STATE );
+
+        write_packet();
+    }
+
+    void write_track_packet()
+    {
+        m_packet.clear();
+        m_packet.msg( pb_TracePacket_track_descriptor, m_track );
+        m_packet.varint( pb_TracePacket_trusted_packet_sequence_id, s_sequence_id );
+
+        // First packet on our sequence starts with empty interned data
+        if ( m_first_packet )
+        {
+            m_packet.varint( pb_TracePacket_sequence_flags, pb_SEQ_INCREMENTAL_STATE_CLEARED );
+            m_first_packet = false;
+        }
+
+        write_packet();
+    }
+
+    void write_packet()
+    {
+        m_header.clear();
+        m_header.put_varint( ( pb_Trace_packet << 3 ) | 2 );
+        m_header.put_varint( m_packet.m_buf.size() );
+
+        m_file.write( m_header.m_buf );
+        m_file.write( m_packet.m_buf );
+    }
+
+protected:
+    static const uint32_t s_sequence_id = 1;
+
+    StrPool &m_strpool;
+    bool m_first_packet = true;
+
+    // Reused so writing packets doesn't allocate
+    pb_msg_t m_header;
+    pb_msg_t m_packet;
+    pb_msg_t m_track;
+    pb_msg_t m_event;
+    pb_msg_t m_interned;
+    pb_msg_t m_sub;
+
+    // StrPool ids of interned strings we've written
+    std::vector< bool > m_cats_written;
+    std::vector< bool > m_names_written;
+};
+
+/*
+ * Chrome trace event JSON
+ */
+class ChromeJsonWriter : public ExportWriter
+{
+public:
+    ChromeJsonWriter( export_file_t &file ) : ExportWriter( file ) {}
+    virtual ~ChromeJsonWriter() {}
+
+    virtual void begin() override
+    {
+        m_file.write( "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 39 );
+    }
+
+    virtual void end() override
+    {
+        m_file.write( "\n]}\n", 4 );
+    }
+
+    virtual void add_group( uint32_t group, int pid, const char *name ) override
+    {
+        // Named groups get pids past the range of real ones
+        int json_pid = ( pid > 0 ) ? pid : ( int )( s_group_pid_base + group );
+
+        if ( group >= m_group_pids.size() )
+            m_group_pids.resize( group + 1 );
+        m_group_pids[ group ] = json_pid;
+
+        m_str = string_format( "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":", json_pid );
+        append_str( name );
+        m_str += "}}";
+        write_event();
+    }
+
+    virtual void add_track( uint32_t track, uint32_t group, const char *name, bool counter ) override
+    {
+        if ( track >= m_tracks.size() )
+            m_tracks.resize( track + 1 );
+        m_tracks[ track ] = { m_group_pids[ group ], name };
+
+        // Counters are keyed on pid + name and don't need a thread
+        if ( !counter )
+        {
+            m_str = string_format( "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":",
+                                   m_group_pids[ group ], json_tid( track ) );
+            append_str( name );
+            m_str += "}}";
+            write_event();
+
+            // Keep tracks in the order we added them
+            m_str = string_format( "{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":%d,\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+                                   m_group_pids[ group ], json_tid( track ), track );
+            write_event();
+        }
+    }
+
+    virtual void slice( uint32_t track, uint64_t ts, uint64_t duration, const char *cat, const char *name ) override
+    {
+        m_str = string_format( "{\"ph\":\"X\",\"pid\":%d,\"tid\":%u,", m_tracks[ track ].pid, json_tid( track ) );
+        append_ts( "ts", ts );
+        m_str += ",";
+        append_ts( "dur", duration );
+        m_str += ",\"cat\":";
+        append_str( cat );
+        m_str += ",\"name\":";
+        append_str( name );
+        m_str += "}";
+        write_event();
+    }
+
+    virtual void instant( uint32_t track, uint64_t ts, const char *cat, const char *name ) override
+    {
+        m_str = string_format( "{\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%u,", m_tracks[ track ].pid, json_tid( track ) );
+        append_ts( "ts", ts );
+        m_str += ",\"cat\":";
+        append_str( cat );
+        m_str += ",\"name\":";
+        append_str( name );
+        m_str += "}";
+        write_event();
+    }
+
+    virtual void counter( uint32_t track, uint64_t ts, double val ) override
+    {
+        m_str = string_format( "{\"ph\":\"C\",\"pid\":%d,\"name\":", m_tracks[ track ].pid );
+        append_str( m_tracks[ track ].name );
+        m_str += ",";
+        append_ts( "ts", ts );
+        m_str += string_format( ",\"args\":{\"value\":%.9g}}", val );
+        write_event();
+    }
+
+protected:
+    // tid 0 holds the process metadata
+    static uint32_t json_tid( uint32_t track )      { return track + 1; }
+
+    // Append "key":ts with ts in microseconds
+    void append_ts( const char *key, uint64_t ts )
+    {
+        char buf[ 64 ];
+        int len = snprintf( buf, sizeof( buf ), "\"%s\":%" PRIu64 ".%03u",
+                            key, ts / 1000, ( uint32_t )( ts % 1000 ) );
+
+        m_str.append( buf, len );
+    }
+
+    // Append quoted and escaped JSON string
+    void append_str( const char *str )
+    {
+        m_str += '"';
+        for ( ; *str; str++ )
+        {
+            unsigned char c = *str;
+
+            if ( c == '"' || c == '\\' )
+            {
+                m_str += '\\';
+                m_str += c;
+            }
+            else if ( c < 0x20 )
+            {
+                char buf[ 8 ];
+
+                snprintf( buf, sizeof( buf ), "\\u%04x", c );
+                m_str += buf;
+            }
+            else
+            {
+                m_str += c;
+            }
+        }
+        m_str += '"';
+    }
+
+    void write_event()
+    {
+        m_file.write( m_first_event ? "\n" : ",\n", m_first_event ? 1 : 2 );
+        m_file.write( m_str );
+        m_first_event = false;
+    }
+
+protected:
+    static const uint32_t s_group_pid_base = 0x40000000;
+
+    struct track_t
+    {
+        int pid;
+        const char *name;
+    };
+    std::vector< track_t > m_tracks;
+    std::vector< int > m_group_pids;
+
+    std::string m_str;
+    bool m_first_event = true;
+};
+
+/*
+ * Walk TraceEvents and send tracks and events to an ExportWriter
+ */
+class TraceExporter
+{
+public:
+    TraceExporter( TraceEvents &trace_events, ExportWriter &writer ) :
+        m_trace_events( trace_events ), m_writer( writer ) {}
+    ~TraceExporter() {}
+
+    void export_events()
+    {
+        // Export absolute timestamps so traces line up with other captures
+        const trace_info_t &trace_info = m_trace_events.m_trace_info;
+
+        if ( trace_info.min_file_ts != INT64_MAX )
+            m_ts_offset = trace_info.min_file_ts;
+
+        m_writer.begin();
+
+        export_sched();
+        export_timelines();
+        export_vblanks();
+        export_prints();
+        export_plots();
+
+        m_writer.end();
+    }
+
+protected:
+    // Slices on a track have to nest, so overlapping slices go on extra tracks
+    struct lanes_t
+    {
+        uint32_t group = 0;
+        const char *name = nullptr;
+
+        // Track id and end ts of last slice on each lane
+        std::vector< std::pair< uint32_t, int64_t > > lanes;
+    };
+
+    uint64_t export_ts( int64_t ts )
+    {
+        ts += m_ts_offset;
+        return ( ts > 0 ) ? ts : 0;
+    }
+
+    uint32_t add_group( int pid, const char *name )
+    {
+        uint32_t group = m_groups++;
+
+        m_writer.add_group( group, pid, name );
+        return group;
+    }
+
+    uint32_t add_track( uint32_t group, const char *name, bool counter = false )
+    {
+        uint32_t track = m_tracks++;
+
+        m_writer.add_track( track, group, name, counter );
+        return track;
+    }
+
+    uint32_t get_lane( lanes_t &lanes, int64_t ts, int64_t duration )
+    {
+        // First lane that is free when this slice starts
+        for ( auto &lane : lanes.lanes )
+        {
+            if ( ts >= lane.second )
+            {
+                lane.second = ts + duration;
+                return lane.first;
+            }
+        }
+
+        uint32_t track = add_track( lanes.group, lanes.name );
+
+        lanes.lanes.push_back( { track, ts + duration } );
+        return track;
+    }
+
+    void slice( uint32_t track, int64_t ts, int64_t duration, const char *cat, const char *name )
+    {
+        m_writer.slice( track, export_ts( ts ), std::max< int64_t >( duration, 0 ), cat, name );
+    }
+
+    // sched_switch durations are how long the previous task ran on that cpu
+    void export_sched()
+    {
+        std::vector< uint32_t > cpus;
+
+        for ( const auto &it : m_trace_events.m_sched_switch_cpu_locs.m_locs.m_map )
+            cpus.push_back( it.first );
+        if ( cpus.empty() )
+            return;
+
+        std::sort( cpus.begin(), cpus.end() );
+
+        uint32_t group = add_group( 0, "CPU" );
+
+        for ( uint32_t cpu : cpus )
+        {
+            const EventLocs *plocs = m_trace_events.m_sched_switch_cpu_locs.get_locations_u32( cpu );
+            uint32_t track = add_track( group, m_trace_events.m_strpool.getstrf( "cpu %u", cpu ) );
+
+            for ( uint32_t idx : *plocs )
+            {
+                const trace_event_t &event = m_trace_events.m_events[ idx ];
+
+                if ( event.has_duration() )
+                {
+                    const char *comm = m_trace_events.comm_from_pid( event.pid, event.comm );
+
+                    slice( track, event.ts - event.duration, event.duration, "sched", comm );
+                }
+            }
+        }
+    }
+
+    // Timeline jobs set up by TraceEvents::calculate_amd_event_durations()
+    void export_timelines()
+    {
+        std::vector< std::pair< std::string, const EventLocs * > > timelines;
+
+        for ( const auto &it : m_trace_events.m_amd_timeline_locs.m_locs.m_map )
+        {
+            const char *name = m_trace_events.m_strpool.findid( it.first );
+
+            if ( name && !it.second.empty() )
+                timelines.push_back( { name, &it.second } );
+        }
+        if ( timelines.empty() )
+            return;
+
+        std::sort( timelines.begin(), timelines.end() );
+
+        uint32_t group = add_group( 0, "GPU" );
+
+        for ( const auto &timeline : timelines )
+        {
+            lanes_t hw_lanes;
+            lanes_t queue_lanes;
+
+            hw_lanes.group = group;
+            hw_lanes.name = m_trace_events.m_strpool.getstr( timeline.first.c_str() );
+            queue_lanes.group = group;
+            queue_lanes.name = m_trace_events.m_strpool.getstrf( "%s queue", timeline.first.c_str() );
+
+            for ( uint32_t idx : *timeline.second )
+            {
+                const trace_event_t &fence_signaled = m_trace_events.m_events[ idx ];
+
+                if ( !fence_signaled.is_fence_signaled() ||
+                     !fence_signaled.has_duration() ||
+                     !is_valid_id( fence_signaled.id_start ) )
+                {
+                    continue;
+                }
+
+                // amdgpu_cs_ioctl -> amdgpu_sched_run_job -> fence_signaled
+                const trace_event_t &sched_run_job = m_trace_events.m_events[ fence_signaled.id_start ];
+                int64_t start_ts = is_valid_id( sched_run_job.id_start ) ?
+                            m_trace_events.m_events[ sched_run_job.id_start ].ts : sched_run_job.ts;
+                int64_t hw_start_ts = fence_signaled.ts - fence_signaled.duration;
+                const char *name = fence_signaled.user_comm ? fence_signaled.user_comm : fence_signaled.comm;
+
+                slice( get_lane( hw_lanes, hw_start_ts, fence_signaled.duration ),
+                       hw_start_ts, fence_signaled.duration, "gpu", name );
+
+                if ( hw_start_ts > start_ts )
+                {
+                    slice( get_lane( queue_lanes, start_ts, hw_start_ts - start_ts ),
+                           start_ts, hw_start_ts - start_ts, "gpu", name );
+                }
+            }
+        }
+    }
+
+    void export_vblanks()
+    {
+        const EventLocs *plocs = m_trace_events.get_tdopexpr_locs( "$name=drm_vblank_event" );
+
+        if ( !plocs || plocs->empty() )
+            return;
+
+        uint32_t group = add_group( 0, "VBlank" );
+        std::vector< uint32_t > tracks( m_trace_events.m_crtc_max + 1, INVALID_ID );
+
+        for ( uint32_t idx : *plocs )
+        {
+            const trace_event_t &event = m_trace_events.m_events[ idx ];
+            int crtc = event.crtc;
+
+            if ( ( crtc < 0 ) || ( ( size_t )crtc >= tracks.size() ) )
+                continue;
+
+            if ( tracks[ crtc ] == INVALID_ID )
+                tracks[ crtc ] = add_track( group, m_trace_events.m_strpool.getstrf( "crtc%d", crtc ) );
+
+            m_writer.instant( tracks[ crtc ], export_ts( m_trace_events.get_vblank_ts( event, VBlankHighPrecTimestamps ) ),
+                              "vblank", event.name );
+        }
+    }
+
+    // ftrace print events go on their thread's rows, grouped by process
+    void export_prints()
+    {
+        util_umap< int, uint32_t > groups;
+        util_umap< int, lanes_t > pid_lanes;
+        const trace_info_t &trace_info = m_trace_events.m_trace_info;
+
+        for ( uint32_t idx : m_trace_events.m_ftrace.print_locs )
+        {
+            const trace_event_t &event = m_trace_events.m_events[ idx ];
+            const print_info_t *print_info = m_trace_events.get_print_info( idx );
+
+            if ( !print_info )
+                continue;
+
+            lanes_t *lanes = pid_lanes.get_val( event.pid );
+            if ( !lanes )
+            {
+                const int *ptgid = trace_info.pid_tgid_map.get_val( event.pid );
+                int tgid = ptgid ? *ptgid : event.pid;
+                uint32_t *pgroup = groups.get_val( tgid );
+
+                if ( !pgroup )
+                {
+                    const tgid_info_t *tgid_info = m_trace_events.tgid_from_pid( tgid );
+                    const char *name = tgid_info ? tgid_info->commstr :
+                                m_trace_events.comm_from_pid( tgid, "<unknown>" );
+
+                    pgroup = groups.get_val( tgid, add_group( tgid, name ) );
+                }
+
+                lanes = pid_lanes.get_val_create( event.pid );
+                lanes->group = *pgroup;
+                lanes->name = m_trace_events.comm_from_pid( event.pid, event.comm );
+            }
+
+            if ( event.has_duration() )
+            {
+                slice( get_lane( *lanes, print_info->ts, event.duration ),
+                       print_info->ts, event.duration, "print", print_info->buf );
+            }
+            else
+            {
+                // Instants don't need to nest, so put them on the first lane
+                uint32_t track = lanes->lanes.empty() ?
+                            get_lane( *lanes, print_info->ts, 0 ) : lanes->lanes[ 0 ].first;
+
+                m_writer.instant( track, export_ts( print_info->ts ), "print", print_info->buf );
+            }
+        }
+    }
+
+    void export_plots()
+    {
+        std::vector< const GraphPlot * > plots;
+
+        for ( const auto &it : m_trace_events.m_graph_plots.m_map )
+        {
+            if ( !it.second.m_plotdata.empty() )
+                plots.push_back( &it.second );
+        }
+        if ( plots.empty() )
+            return;
+
+        std::sort( plots.begin(), plots.end(),
+                   []( const GraphPlot *lx, const GraphPlot *rx ) { return lx->m_name < rx->m_name; } );
+
+        uint32_t group = add_group( 0, "Plots" );
+
+        for ( const GraphPlot *plot : plots )
+        {
+            uint32_t track = add_track( group, m_trace_events.m_strpool.getstr( plot->m_name.c_str() ), true );
+
+            for ( const GraphPlot::plotdata_t &data : plot->m_plotdata )
+                m_writer.counter( track, export_ts( data.ts ), data.valf );
+        }
+    }
+
+protected:
+    TraceEvents &m_trace_events;
+    ExportWriter &m_writer;
+
+    int64_t m_ts_offset = 0;
+    uint32_t m_groups = 0;
+    uint32_t m_tracks = 0;
+};
+
+export_format_t export_format_from_filename( const char *filename )
+{
+    const char *ext = strrchr( filename, '.' );
+
+    return ( ext && !strcasecmp( ext, ".json" ) ) ? Export_ChromeJson : Export_Perfetto;
+}
+
+bool export_trace( TraceEvents &trace_events, const char *filename,
+                   export_format_t format, std::string &errstr )
+{
+    GPUVIS_TRACE_BLOCKF( "%s: %s", __func__, filename );
+
+    export_file_t file;
+
+    if ( !file.open( filename ) )
+    {
+        errstr = string_format( "Opening %s failed: %s", filename, strerror( errno ) );
+        return false;
+    }
+
+    if ( format == Export_ChromeJson )
+    {
+        ChromeJsonWriter writer( file );
+        TraceExporter exporter( trace_events, writer );
+
+        exporter.export_events();
+    }
+    else
+    {
+        PerfettoWriter writer( file, trace_events.m_strpool );
+        TraceExporter exporter( trace_events, writer );
+
+        exporter.export_events();
+    }
+
+    if ( !file.close() )
+    {
+        errstr = string_format( "Writing %s failed: %s", filename, strerror( errno ) );
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef GPUVIS_EXPORT_H_
+#define GPUVIS_EXPORT_H_
+
+#include <string>
+
+// Export loaded traces for Perfetto (protobuf trace packets) or chrome://tracing
+//  (Chrome trace event JSON). Sched slices, gpu timeline jobs, vblanks, ftrace
+//  print durations and plots become tracks and counters. Output is written in
+//  chunks as events are visited, so memory use doesn't grow with trace size.
+
+enum export_format_t
+{
+    Export_Perfetto,
+    Export_ChromeJson
+};
+
+// .json files are Chrome JSON, everything else is Perfetto
+export_format_t export_format_from_filename( const char *filename );
+
+// Write trace_events to filename. Returns false and sets errstr on failure.
+bool export_trace( class TraceEvents &trace_events, const char *filename,
+                   export_format_t format, std::string &errstr );
+
+#endif // GPUVIS_EXPORT_H_
@@ -23,6 +23,7 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #include <array>
 #include <vector>
@@ -86,8 +87,13 @@ void FrameMarkers::shutdown()
     }
 }
 
-void FrameMarkers::clear_dlg()
+void FrameMarkers::clear_dlg( TraceEvents &trace_events )
 {
+    // Cancel jobs for superseded filters
+    for ( const std::string &filter : dlg.m_pending_filters )
+        trace_events.cancel_tdopexpr_job( filter.c_str() );
+    dlg.m_pending_filters.clear();
+
     dlg.m_checked = false;
 
     dlg.m_left_filter_err_str.clear();
@@ -116,7 +122,7 @@ void FrameMarkers::set_tooltip()
 
 bool FrameMarkers::show_dlg( TraceEvents &trace_events, uint32_t eventid )
 {
-    clear_dlg();
+    clear_dlg( trace_events );
 
     if ( is_valid_id( eventid ) && ( eventid < trace_events.m_events.size() ) )
     {
@@ -166,7 +172,7 @@ bool FrameMarkers::render_dlg( TraceEvents &trace_events )
     // Left Frame Filter
     {
         if ( imgui_input_text( left_text, dlg.m_left_marker_buf, x, w ) )
-            clear_dlg();
+            clear_dlg( trace_events );
 
         if ( ImGui::IsWindowAppearing() )
             ImGui::SetKeyboardFocusHere( -1 );
@@ -185,7 +191,7 @@ bool FrameMarkers::render_dlg( TraceEvents &trace_events )
 
         if ( imgui_input_text( right_text, right_marker_buf, x, w ) )
         {
-            clear_dlg();
+            clear_dlg( trace_events );
             strcpy_safe( dlg.m_right_marker_buf, right_marker_buf );
         }
 
@@ -202,13 +208,22 @@ bool FrameMarkers::render_dlg( TraceEvents &trace_events )
 
     ImGui::Separator();
 
-    if ( dlg.m_checked && dlg.m_count )
+    if ( dlg.m_checked && dlg.m_stats.size() )
     {
-        ImGui::TextColored( ImVec4( 0, 1, 0, 1 ), "%u frames found", dlg.m_count );
+        const HdrHistogram &hist = dlg.m_stats.m_hist;
+
+        ImGui::TextColored( ImVec4( 0, 1, 0, 1 ), "%lu frames found", dlg.m_stats.size() );
         ImGui::Indent();
-        ImGui::Text( "Min frame time: %s", ts_to_timestr( dlg.m_min_ts, 4 ).c_str() );
-        ImGui::Text( "Max frame time: %s", ts_to_timestr( dlg.m_max_ts, 4 ).c_str() );
-        ImGui::Text( "Avg frame time: %s", ts_to_timestr( dlg.m_tot_ts / dlg.m_count, 4 ).c_str() );
+        ImGui::Text( "Min frame time: %s", ts_to_timestr( hist.m_min, 4 ).c_str() );
+        ImGui::Text( "Max frame time: %s", ts_to_timestr( hist.m_max, 4 ).c_str() );
+        ImGui::Text( "Avg frame time: %s", ts_to_timestr( hist.m_total / hist.m_count, 4 ).c_str() );
+        ImGui::Text( "p50 / p90 / p99 / p99.9: %s / %s / %s / %s",
+                     ts_to_timestr( hist.get_percentile( 50.0 ), 4 ).c_str(),
+                     ts_to_timestr( hist.get_percentile( 90.0 ), 4 ).c_str(),
+                     ts_to_timestr( hist.get_percentile( 99.0 ), 4 ).c_str(),
+                     ts_to_timestr( hist.get_percentile( 99.9 ), 4 ).c_str() );
+        ImGui::Text( "Stutters (> %s): %lu", ts_to_timestr( dlg.m_stats.m_stutter_len, 4 ).c_str(),
+                     dlg.m_stats.m_stutter_frames.size() );
         ImGui::Unindent();
 
         ImGui::Separator();
@@ -232,7 +247,7 @@ bool FrameMarkers::render_dlg( TraceEvents &trace_events )
 
             if ( ImGui::Selectable( str0, false, flags ) )
             {
-                clear_dlg();
+                clear_dlg( trace_events );
 
                 strcpy_safe( dlg.m_left_marker_buf, str0 );
                 strcpy_safe( dlg.m_right_marker_buf, str1 );
@@ -255,28 +270,53 @@ bool FrameMarkers::render_dlg( TraceEvents &trace_events )
     // "Check filters" or "Set Frame Markers" buttons
     if ( !dlg.m_checked )
     {
-        if ( ImGui::Button( "Check filters", button_size ) || s_actions().get( action_return ) )
+        bool check = ImGui::Button( "Check filters", button_size ) || s_actions().get( action_return );
+
+        if ( check || !dlg.m_pending_filters.empty() )
         {
-            dlg.m_left_plocs = trace_events.get_tdopexpr_locs( dlg.m_left_marker_buf, &dlg.m_left_filter_err_str );
-            dlg.m_right_plocs = trace_events.get_tdopexpr_locs( right_marker_buf, &dlg.m_right_filter_err_str );
+            bool left_pending;
+            bool right_pending;
 
-            if ( !dlg.m_left_plocs )
-            {
-                if ( dlg.m_left_filter_err_str.empty() )
-                    dlg.m_left_filter_err_str = "WARNING: No events found.";
-            }
-            if ( !dlg.m_right_plocs )
-            {
-                if ( dlg.m_right_filter_err_str.empty() )
-                    dlg.m_right_filter_err_str = "WARNING: No events found.";
-            }
+            dlg.m_left_plocs = trace_events.get_tdopexpr_locs( dlg.m_left_marker_buf, &dlg.m_left_filter_err_str, &left_pending );
+            dlg.m_right_plocs = trace_events.get_tdopexpr_locs( right_marker_buf, &dlg.m_right_filter_err_str, &right_pending );
+
+            dlg.m_pending_filters.clear();
+            if ( left_pending )
+                dlg.m_pending_filters.push_back( dlg.m_left_marker_buf );
+            if ( right_pending )
+                dlg.m_pending_filters.push_back( right_marker_buf );
 
-            if ( dlg.m_left_plocs && dlg.m_right_plocs )
+            if ( dlg.m_pending_filters.empty() )
             {
-                setup_frames( trace_events, false );
-                dlg.m_checked = true;
+                if ( !dlg.m_left_plocs )
+                {
+                    if ( dlg.m_left_filter_err_str.empty() )
+                        dlg.m_left_filter_err_str = "WARNING: No events found.";
+                }
+                if ( !dlg.m_right_plocs )
+                {
+                    if ( dlg.m_right_filter_err_str.empty() )
+                        dlg.m_right_filter_err_str = "WARNING: No events found.";
+                }
+
+                if ( dlg.m_left_plocs && dlg.m_right_plocs )
+                {
+                    setup_frames( trace_events, false );
+                    dlg.m_checked = true;
+                }
             }
         }
+
+        if ( !dlg.m_pending_filters.empty() )
+        {
+            float progress = 0.0f;
+
+            for ( const std::string &filter : dlg.m_pending_filters )
+                progress += trace_events.get_tdopexpr_progress( filter.c_str() );
+
+            ImGui::SameLine();
+            ImGui::Text( "Filtering... %.0f%%", 100.0f * progress / dlg.m_pending_filters.size() );
+        }
     }
     else if ( ImGui::Button( "Set Frame Markers", button_size ) || s_actions().get( action_return ) )
     {
@@ -329,23 +369,71 @@ int64_t FrameMarkers::get_frame_len( TraceEvents &trace_events, int frame )
     return 0;
 }
 
-void FrameMarkers::setup_frames( TraceEvents &trace_events, bool set_frames )
+void FrameMarkers::clear_frames()
 {
-    uint32_t idx = 0;
-    const std::vector< uint32_t > &locs_left = *dlg.m_left_plocs;
-    const std::vector< uint32_t > &locs_right = *dlg.m_right_plocs;
+    m_left_frames.clear();
+    m_right_frames.clear();
+    m_stats.clear();
+}
 
-    dlg.m_count = 0;
-    dlg.m_tot_ts = 0;
-    dlg.m_min_ts = INT64_MAX;
-    dlg.m_max_ts = INT64_MIN;
+bool FrameMarkers::get_frame_range( TraceEvents &trace_events, int frame, int64_t &ts0, int64_t &ts1 )
+{
+    if ( ( size_t )frame < m_left_frames.size() )
+    {
+        ts0 = trace_events.m_events[ m_left_frames[ frame ] ].ts;
+        ts1 = trace_events.m_events[ m_right_frames[ frame ] ].ts;
+        return true;
+    }
 
-    if ( set_frames )
+    return false;
+}
+
+bool FrameMarkers::set_frames( TraceEvents &trace_events, const char *left_filter,
+                               const char *right_filter, std::string &errstr )
+{
+    if ( !right_filter[ 0 ] )
+        right_filter = left_filter;
+
+    clear_dlg( trace_events );
+
+    dlg.m_left_plocs = trace_events.get_tdopexpr_locs( left_filter, &dlg.m_left_filter_err_str );
+    dlg.m_right_plocs = trace_events.get_tdopexpr_locs( right_filter, &dlg.m_right_filter_err_str );
+
+    if ( !dlg.m_left_plocs || !dlg.m_right_plocs )
     {
-        m_left_frames.clear();
-        m_right_frames.clear();
+        const char *filter = dlg.m_left_plocs ? right_filter : left_filter;
+        const std::string &err = dlg.m_left_plocs ? dlg.m_right_filter_err_str : dlg.m_left_filter_err_str;
+
+        errstr = err.empty() ? string_format( "No events found for \"%s\".", filter ) : err;
+        return false;
     }
 
+    setup_frames( trace_events, true );
+    return true;
+}
+
+void FrameMarkers::setup_frames( TraceEvents &trace_events, bool set_frames )
+{
+    std::vector< int64_t > ts0;
+    std::vector< int64_t > ts1;
+
+    if ( set_frames )
+        clear_frames();
+
+    find_frames( trace_events, set_frames, ts0, ts1 );
+
+    dlg.m_stats.init( ts0, ts1 );
+    if ( set_frames )
+        m_stats = dlg.m_stats;
+}
+
+void FrameMarkers::find_frames( TraceEvents &trace_events, bool set_frames,
+                                std::vector< int64_t > &ts0, std::vector< int64_t > &ts1 )
+{
+    uint32_t idx = 0;
+    const EventLocs &locs_left = *dlg.m_left_plocs;
+    const EventLocs &locs_right = *dlg.m_right_plocs;
+
     // Go through all the right eventids...
     for ( uint32_t right_eventid : locs_right )
     {
@@ -358,12 +446,9 @@ void FrameMarkers::setup_frames( TraceEvents &trace_events, bool set_frames )
             {
                 const trace_event_t &left_event = trace_events.m_events[ locs_left[ idx ] ];
                 const trace_event_t &right_event = trace_events.m_events[ right_eventid ];
-                int64_t ts = right_event.ts - left_event.ts;
 
-                dlg.m_count++;
-                dlg.m_tot_ts += ts;
-                dlg.m_min_ts = std::min< int64_t >( dlg.m_min_ts, ts );
-                dlg.m_max_ts = std::max< int64_t >( dlg.m_max_ts, ts );
+                ts0.push_back( left_event.ts );
+                ts1.push_back( right_event.ts );
 
                 if ( set_frames )
                 {
@@ -380,3 +465,167 @@ void FrameMarkers::setup_frames( TraceEvents &trace_events, bool set_frames )
         }
     }
 }
+
+void HdrHistogram::clear()
+{
+    m_count = 0;
+    m_total = 0;
+    m_min = INT64_MAX;
+    m_max = INT64_MIN;
+    m_buckets.clear();
+}
+
+// Values below 2 * sub-bucket count get their own bucket. Above that, each power
+//  of two is split into sub-bucket count buckets.
+uint32_t HdrHistogram::get_bucket( int64_t val )
+{
+    const uint32_t sub_count = 1 << s_sub_bits;
+
+    if ( val < 2 * sub_count )
+        return ( uint32_t )std::max< int64_t >( val, 0 );
+
+    uint32_t msb = 0;
+    for ( uint64_t v = val; v >>= 1; )
+        msb++;
+
+    uint32_t shift = msb - s_sub_bits;
+
+    return ( shift + 1 ) * sub_count + ( uint32_t )( ( val >> shift ) - sub_count );
+}
+
+// Middle of bucket's value range
+int64_t HdrHistogram::get_bucket_val( uint32_t bucket )
+{
+    const uint32_t sub_count = 1 << s_sub_bits;
+
+    if ( bucket < 2 * sub_count )
+        return bucket;
+
+    uint32_t shift = bucket / sub_count - 1;
+    int64_t sub = bucket % sub_count + sub_count;
+
+    return ( sub << shift ) + ( ( 1LL << shift ) >> 1 );
+}
+
+void HdrHistogram::add( int64_t val )
+{
+    uint32_t bucket = get_bucket( val );
+
+    if ( bucket >= m_buckets.size() )
+        m_buckets.resize( bucket + 1 );
+    m_buckets[ bucket ]++;
+
+    m_count++;
+    m_total += val;
+    m_min = std::min< int64_t >( m_min, val );
+    m_max = std::max< int64_t >( m_max, val );
+}
+
+void HdrHistogram::merge( const HdrHistogram &hist )
+{
+    if ( hist.m_buckets.size() > m_buckets.size() )
+        m_buckets.resize( hist.m_buckets.size() );
+    for ( size_t i = 0; i < hist.m_buckets.size(); i++ )
+        m_buckets[ i ] += hist.m_buckets[ i ];
+
+    m_count += hist.m_count;
+    m_total += hist.m_total;
+    m_min = std::min< int64_t >( m_min, hist.m_min );
+    m_max = std::max< int64_t >( m_max, hist.m_max );
+}
+
+int64_t HdrHistogram::get_percentile( double pct ) const
+{
+    if ( !m_count )
+        return 0;
+
+    // Nearest rank
+    uint64_t rank = std::max< uint64_t >( 1, ( uint64_t )ceil( pct / 100.0 * m_count ) );
+    uint64_t count = 0;
+
+    for ( uint32_t bucket = 0; bucket < m_buckets.size(); bucket++ )
+    {
+        count += m_buckets[ bucket ];
+        if ( count >= rank )
+            return std::min< int64_t >( std::max< int64_t >( get_bucket_val( bucket ), m_min ), m_max );
+    }
+
+    return m_max;
+}
+
+void FrameStats::clear()
+{
+    m_frame_ts.clear();
+    m_frame_len.clear();
+    m_blocks.clear();
+    m_hist.clear();
+    m_stutter_len = INT64_MAX;
+    m_stutter_frames.clear();
+}
+
+void FrameStats::init( const std::vector< int64_t > &ts0, const std::vector< int64_t > &ts1 )
+{
+    clear();
+
+    m_frame_ts = ts0;
+    m_frame_len.resize( ts0.size() );
+    m_blocks.resize( ( ts0.size() + s_block_size - 1 ) / s_block_size );
+
+    for ( size_t i = 0; i < ts0.size(); i++ )
+    {
+        m_frame_len[ i ] = ts1[ i ] - ts0[ i ];
+        m_blocks[ i / s_block_size ].add( m_frame_len[ i ] );
+    }
+
+    for ( const HdrHistogram &block : m_blocks )
+        m_hist.merge( block );
+
+    if ( m_hist.m_count )
+    {
+        m_stutter_len = m_hist.get_percentile( 50.0 ) * 3 / 2;
+
+        for ( size_t i = 0; i < m_frame_len.size(); i++ )
+        {
+            if ( m_frame_len[ i ] > m_stutter_len )
+                m_stutter_frames.push_back( i );
+        }
+    }
+}
+
+void FrameStats::get_frames( int64_t ts0, int64_t ts1, size_t &frame0, size_t &frame1 ) const
+{
+    frame0 = std::lower_bound( m_frame_ts.begin(), m_frame_ts.end(), ts0 ) - m_frame_ts.begin();
+    frame1 = std::lower_bound( m_frame_ts.begin(), m_frame_ts.end(), ts1 ) - m_frame_ts.begin();
+}
+
+void FrameStats::get_histogram( size_t frame0, size_t frame1, HdrHistogram &hist ) const
+{
+    hist.clear();
+
+    frame1 = std::min< size_t >( frame1, size() );
+
+    while ( frame0 < frame1 )
+    {
+        // Merge whole blocks, add frames from partial blocks
+        if ( !( frame0 % s_block_size ) && ( frame0 + s_block_size <= frame1 ) )
+        {
+            hist.merge( m_blocks[ frame0 / s_block_size ] );
+            frame0 += s_block_size;
+        }
+        else
+        {
+            hist.add( m_frame_len[ frame0++ ] );
+        }
+    }
+}
+
+size_t FrameStats::get_stutter_count( size_t frame0, size_t frame1 ) const
+{
+    if ( frame1 <= frame0 )
+        return 0;
+
+    auto it0 = std::lower_bound( m_stutter_frames.begin(), m_stutter_frames.end(), frame0 );
+    auto it1 = std::lower_bound( m_stutter_frames.begin(), m_stutter_frames.end(), frame1 );
+
+    return it1 - it0;
+}
@@ -31,6 +31,7 @@
 #include <unordered_set>
 #include <functional>
 #include <string>
+#include <thread>
 
 #include <cinder/app/App.h>
 
@@ -40,6 +41,8 @@
 #include "gpuvis_utils.h"
 #include "gpuvis.h"
 
+#include "MiniConfig.h"
+
 static const struct
 {
     const char *leftstr;
@@ -503,12 +506,14 @@ void TraceEvents::new_event_ftrace_print( trace_event_t &event )
         print_info.graph_row_id_pid = 0;
         print_info.graph_row_id_tgid = 0;
         print_info.buf = buf;
-        print_info.size = ImVec2( 0, 0 );
+        print_info.size = ImVec2( -1.0f, -1.0f );
 
         // If we have no text, try using the connected event's text
         if ( !buf[ 0 ] && is_valid_id( add_event->id_start ) )
             print_info.buf = get_event_field_val( m_events[ add_event->id ], "buf" );
 
+        m_ftrace.print_buf_len_max = std::max< size_t >( m_ftrace.print_buf_len_max, strlen( print_info.buf ) );
+
         // Add cached print info for this event
         m_ftrace.print_info.get_val( add_event->id, print_info );
 
@@ -519,21 +524,36 @@ void TraceEvents::new_event_ftrace_print( trace_event_t &event )
     }
 }
 
-// Called by TraceEvents::init() after m_events is filled for second initialization pass.
+// Called by TraceEvents::init() after m_events is filled for second initialization pass,
+//  and by append_events() to place print events added since the last call.
 void TraceEvents::calculate_event_print_info()
 {
-    if ( m_ftrace.print_locs.empty() )
+    if ( m_ftrace.print_locs.size() <= m_ftrace.print_locs_placed )
         return;
 
-    // Sort ftrace print event IDs based on ts start locations
-    auto cmp_ts = [&]( const uint32_t lx, const uint32_t rx )
-    {
-        const print_info_t *lval = m_ftrace.print_info.get_val( lx );
-        const print_info_t *rval = m_ftrace.print_info.get_val( rx );
+    // Sort ftrace print event IDs based on ts start locations. Pair each id with its
+    //  ts up front so the comparisons don't do print_info hash lookups.
+    std::vector< std::pair< int64_t, uint32_t > > ts_locs;
 
-        return ( lval->ts < rval->ts );
-    };
-    std::sort( m_ftrace.print_locs.begin(), m_ftrace.print_locs.end(), cmp_ts );
+    ts_locs.reserve( m_ftrace.print_locs.size() );
+    for ( uint32_t id : m_ftrace.print_locs )
+        ts_locs.push_back( { m_ftrace.print_info.get_val( id )->ts, id } );
+
+    auto placed_end = ts_locs.begin() + m_ftrace.print_locs_placed;
+    std::vector< uint32_t > locs_new;
+
+    locs_new.reserve( ts_locs.end() - placed_end );
+    for ( auto it = placed_end; it != ts_locs.end(); it++ )
+        locs_new.push_back( it->second );
+
+    std::sort( placed_end, ts_locs.end() );
+    std::inplace_merge( ts_locs.begin(), placed_end, ts_locs.end() );
+
+    std::vector< uint32_t > print_locs( ts_locs.size() );
+    for ( size_t i = 0; i < ts_locs.size(); i++ )
+        print_locs[ i ] = ts_locs[ i ].second;
+    m_ftrace.print_locs.assign( print_locs );
+    m_ftrace.print_locs_placed = print_locs.size();
 
     // Sort ftrace print event IDs based on duration
     auto cmp_dur = [&]( const uint32_t lx, const uint32_t rx )
@@ -543,53 +563,116 @@ void TraceEvents::calculate_event_print_info()
         int64_t ldur = lval.has_duration() ? lval.duration : 0;
         int64_t rdur = rval.has_duration() ? rval.duration : 0;
 
-        return ( ldur > rdur );
+        return ( ldur > rdur ) || ( ( ldur == rdur ) && ( lx < rx ) );
     };
-    std::vector< uint32_t > locs_duration = m_ftrace.print_locs;
+    std::vector< uint32_t > &locs_duration = locs_new;
     std::sort( locs_duration.begin(), locs_duration.end(), cmp_dur );
 
-    row_pos_t row_pos;
-    ftrace_row_info_t *row_info;
-    util_umap< int, row_pos_t > row_pos_pid;
-    util_umap< int, row_pos_t > row_pos_tgid;
+    // The global, per-pid, and per-tgid row packers are independent of each other.
+    //  Split the events (largest durations first) into one task per packer so they
+    //  can be placed in parallel. Each task sees its events in duration order, so
+    //  the resulting rows match a serial placement.
+    struct print_span_t
+    {
+        trace_event_t *event;
+        print_info_t *print_info;
+        int64_t min_ts;
+        int64_t max_ts;
+    };
+    struct row_task_t
+    {
+        row_pos_t *row_pos;
+        int pid;
+        int tgid;
+        std::vector< uint32_t > spans;
+    };
+    std::vector< print_span_t > spans;
+    std::vector< row_task_t > tasks;
+    util_umap< int, uint32_t > task_pid;
+    util_umap< int, uint32_t > task_tgid;
+
+    spans.reserve( locs_duration.size() );
+    tasks.push_back( { &m_ftrace.row_pos, -1, 0, {} } );
 
-    // Go through all the ftrace print events with largest durations first
     for ( uint32_t idx : locs_duration )
     {
-        row_pos_t *prow_pos;
         trace_event_t &event = m_events[ idx ];
         print_info_t *print_info = m_ftrace.print_info.get_val( event.id );
         int64_t min_ts = print_info->ts;
         int64_t duration = event.has_duration() ? event.duration : ( 1 * NSECS_PER_MSEC );
-        int64_t max_ts = min_ts + duration;
+        uint32_t span = spans.size();
+        uint32_t *ptask;
+
+        spans.push_back( { &event, print_info, min_ts, min_ts + duration } );
 
         // Global print row id
-        event.graph_row_id = row_pos.get_row( min_ts, max_ts );
+        tasks[ 0 ].spans.push_back( span );
 
         // Pid print row id
-        prow_pos = row_pos_pid.get_val_create( event.pid );
-        print_info->graph_row_id_pid = prow_pos->get_row( min_ts, max_ts );
-
-        row_info = get_ftrace_row_info_pid( event.pid, true );
-        row_info->rows = std::max< uint32_t >( row_info->rows, prow_pos->m_rows );
-        row_info->count++;
+        ptask = task_pid.get_val( event.pid );
+        if ( !ptask )
+        {
+            ptask = task_pid.get_val( event.pid, tasks.size() );
+            tasks.push_back( { m_ftrace.row_pos_pid.get_val_create( event.pid ), event.pid, 0, {} } );
+        }
+        tasks[ *ptask ].spans.push_back( span );
 
         if ( print_info->tgid )
         {
             // Tgid print row id
-            prow_pos = row_pos_tgid.get_val_create( print_info->tgid );
-            print_info->graph_row_id_tgid = prow_pos->get_row( min_ts, max_ts );
+            ptask = task_tgid.get_val( print_info->tgid );
+            if ( !ptask )
+            {
+                ptask = task_tgid.get_val( print_info->tgid, tasks.size() );
+                tasks.push_back( { m_ftrace.row_pos_tgid.get_val_create( print_info->tgid ), 0, print_info->tgid, {} } );
+            }
+            tasks[ *ptask ].spans.push_back( span );
+        }
+    }
+
+    // Each task only writes its own row id field, so no locking is needed
+    uint32_t thread_count = FilterThreads ? FilterThreads : std::thread::hardware_concurrency();
+
+    util_parallel_for( tasks.size(), std::max( 1u, thread_count ), [ & ]( size_t i )
+    {
+        row_task_t &task = tasks[ i ];
+
+        for ( uint32_t span : task.spans )
+        {
+            print_span_t &s = spans[ span ];
+            uint32_t row = task.row_pos->get_row( s.min_ts, s.max_ts );
 
-            row_info = get_ftrace_row_info_tgid( print_info->tgid, true );
-            row_info->rows = std::max< uint32_t >( row_info->rows, prow_pos->m_rows );
-            row_info->count++;
+            if ( task.tgid )
+                s.print_info->graph_row_id_tgid = row;
+            else if ( task.pid >= 0 )
+                s.print_info->graph_row_id_pid = row;
+            else
+                s.event->graph_row_id = row;
         }
+    } );
+
+    ftrace_row_info_t *row_info;
+
+    for ( size_t i = 1; i < tasks.size(); i++ )
+    {
+        const row_task_t &task = tasks[ i ];
+
+        if ( task.tgid )
+            row_info = get_ftrace_row_info_tgid( task.tgid, true );
+        else
+            row_info = get_ftrace_row_info_pid( task.pid, true );
+
+        row_info->rows = std::max< uint32_t >( row_info->rows, task.row_pos->m_rows );
+        row_info->count += task.spans.size();
     }
 
     // Add info for special pid=-1 (all ftrace print events)
     row_info = get_ftrace_row_info_pid( -1, true );
-    row_info->rows = row_pos.m_rows;
+    row_info->rows = m_ftrace.row_pos.m_rows;
     row_info->count = m_ftrace.print_locs.size();
+
+    // Recalc colors and text size bound for the new print events
+    invalidate_ftraceprint_colors();
 }
 
 void TraceEvents::invalidate_ftraceprint_colors()
@@ -597,22 +680,33 @@ void TraceEvents::invalidate_ftraceprint_colors()
     m_ftrace.text_size_max = -1.0f;
 }
 
-// Called by TraceWin::graph_render_print_timeline() to recalculate text sizes and colors
+// Called by TraceWin::graph_render_print_timeline() to recalculate text size bound and colors
 void TraceEvents::update_ftraceprint_colors()
 {
+    m_color_gen++;
+
     float label_sat = s_clrs().getalpha( col_Graph_PrintLabelSat );
     float label_alpha = s_clrs().getalpha( col_Graph_PrintLabelAlpha );
     ImU32 color = s_clrs().get( col_FtracePrintText, label_alpha * 255 );
 
-    m_ftrace.text_size_max = 0.0f;
+    // Labels are measured lazily by row_draw_info_t::render_text(). Bound the widest
+    //  label by its byte length times the widest ASCII advance: non-ASCII glyphs take
+    //  at least two utf8 bytes, which covers double width glyphs.
+    ImFont *font = ImGui::GetFont();
+    float advance_max = 0.0f;
+
+    for ( ImWchar c = 0x20; c < 0x7f; c++ )
+        advance_max = std::max< float >( advance_max, font->GetCharAdvance( c ) );
+
+    m_ftrace.text_size_max = advance_max * ( ImGui::GetFontSize() / font->FontSize ) * m_ftrace.print_buf_len_max;
 
     for ( auto &entry : m_ftrace.print_info.m_map )
     {
         trace_event_t &event = m_events[ entry.first ];
         print_info_t &print_info = entry.second;
 
-        print_info.size = ImGui::CalcTextSize( print_info.buf );
-        m_ftrace.text_size_max = std::max< float >( print_info.size.x, m_ftrace.text_size_max );
+        // Font may have changed, remeasure on next draw
+        print_info.size = ImVec2( -1.0f, -1.0f );
 
         // Mark this event as autogen'd color so it doesn't get overwritten
         event.flags |= TRACE_FLAG_AUTOGEN_COLOR;
@@ -23,6 +23,7 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include <array>
 #include <vector>
@@ -68,6 +69,8 @@ public:
     event_renderer_t( graph_info_t &gi, float y_in, float w_in, float h_in );
 
     void add_event( uint32_t eventid, float x, ImU32 color );
+    void add_events( float x0, float x1, uint32_t count, ImU32 color );
+    void add_event_marker( uint32_t eventid, float x );
     void done();
 
     void draw_event_markers();
@@ -75,6 +78,7 @@ public:
     void set_y( float y_in, float h_in );
 
     bool is_event_filtered( const trace_event_t &event );
+    bool has_event_filters() const { return m_row_filters || m_cpu_timeline_pids; }
 
 protected:
     void start( float x, ImU32 color );
@@ -113,7 +117,7 @@ struct row_info_t
     loc_type_t row_type;
     std::string row_name;
     std::string row_filter_expr;
-    const std::vector< uint32_t > *plocs;
+    const EventLocs *plocs;
 
     float scale_ts = 1.0f;
 
@@ -321,6 +325,43 @@ static void imgui_draw_textf( float x, float y, ImU32 color, const char *fmt, ..
     imgui_draw_text( x, y, color, buf );
 }
 
+const char *event_field_t::get_str( char ( &buf )[ 64 ] ) const
+{
+    switch ( type )
+    {
+    case EVENT_FIELD_STR:
+        return value;
+    case EVENT_FIELD_UINT:
+        snprintf_safe( buf, "%" PRIu64, val );
+        break;
+    case EVENT_FIELD_INT:
+        snprintf_safe( buf, "%" PRId64, ( int64_t )val );
+        break;
+    case EVENT_FIELD_INT16:
+        snprintf_safe( buf, "%2d", ( int )( int64_t )val );
+        break;
+    case EVENT_FIELD_HEX:
+        snprintf_safe( buf, "0x%" PRIx64, val );
+        break;
+    case EVENT_FIELD_HEX32:
+        snprintf_safe( buf, "0x%x", ( uint32_t )val );
+        break;
+    default:
+        buf[ 0 ] = 0;
+        break;
+    }
+
+    return buf;
+}
+
+int64_t event_field_t::get_int() const
+{
+    if ( type == EVENT_FIELD_STR )
+        return ( int64_t )strtoull( value, NULL, 0 );
+
+    return ( int64_t )val;
+}
+
 const char *get_event_field_val( const trace_event_t &event, const char *name, const char *defval )
 {
     for ( uint32_t i = 0; i < event.numfields; i++ )
@@ -328,7 +369,29 @@ const char *get_event_field_val( const trace_event_t &event, const char *name, c
         const event_field_t &field = event.fields[ i ];
 
         if ( !strcmp( field.key, name ) )
-            return field.value;
+        {
+            if ( field.is_str() )
+                return field.value;
+
+            // Callers hold on to a couple of these at most (pid + comm, etc.)
+            static thread_local char s_bufs[ 4 ][ 64 ];
+            static thread_local uint32_t s_index = 0;
+
+            return field.get_str( s_bufs[ s_index++ % ARRAY_SIZE( s_bufs ) ] );
+        }
+    }
+
+    return defval;
+}
+
+int64_t get_event_field_int( const trace_event_t &event, const char *name, int64_t defval )
+{
+    for ( uint32_t i = 0; i < event.numfields; i++ )
+    {
+        const event_field_t &field = event.fields[ i ];
+
+        if ( !strcmp( field.key, name ) )
+            return field.get_int();
     }
 
     return defval;
@@ -374,6 +437,10 @@ event_renderer_t::event_renderer_t( graph_info_t &gi, float y_in, float w_in, fl
         m_row_filters = gi.win.m_graph_row_filters.get_val( hashval );
         if ( m_row_filters && m_row_filters->filters.empty() )
             m_row_filters = NULL;
+
+        // Build row filter bitmask once background filter jobs are done
+        if ( m_row_filters && m_row_filters->pending )
+            RowFilters::update_bitvec( gi.win.m_trace_events, m_row_filters );
     }
 
     // Check if we're filtering specific pids
@@ -392,10 +459,8 @@ void event_renderer_t::set_y( float y_in, float h_in )
     }
 }
 
-void event_renderer_t::add_event( uint32_t eventid, float x, ImU32 color )
+void event_renderer_t::add_event_marker( uint32_t eventid, float x )
 {
-    m_num_events++;
-
     if ( ( eventid == m_gi.selected_eventid ) ||
          ( eventid == m_gi.hovered_eventid ) )
     {
@@ -407,6 +472,13 @@ void event_renderer_t::add_event( uint32_t eventid, float x, ImU32 color )
         m_markers.push_back( { ImVec2( x + width / 2, m_y + m_h / 2.0f ),
                                s_clrs().get( colidx ) } );
     }
+}
+
+void event_renderer_t::add_event( uint32_t eventid, float x, ImU32 color )
+{
+    m_num_events++;
+
+    add_event_marker( eventid, x );
 
     if ( m_x0 < 0.0f )
     {
@@ -429,6 +501,27 @@ void event_renderer_t::add_event( uint32_t eventid, float x, ImU32 color )
     }
 }
 
+// Add count events from x0 to x1 (an EventLOD bucket). Merged like add_event().
+void event_renderer_t::add_events( float x0, float x1, uint32_t count, ImU32 color )
+{
+    m_num_events += count;
+
+    if ( ( m_x0 < 0.0f ) || ( x0 - m_x1 > 1.0f ) || ( m_event_color != color ) )
+    {
+        if ( m_x0 >= 0.0f )
+            draw();
+
+        start( x0, color );
+        m_count = count - 1;
+    }
+    else
+    {
+        m_count += count;
+    }
+
+    m_x1 = std::max< float >( m_x1, x1 );
+}
+
 void event_renderer_t::done()
 {
     if ( m_x0 != -1.0f )
@@ -490,6 +583,167 @@ bool event_renderer_t::is_event_filtered( const trace_event_t &event )
     return filtered;
 }
 
+/*
+ * EventLOD
+ */
+void EventLOD::init( const std::vector< trace_event_t > &events, const EventLocs &locs,
+                     uint32_t key, uint32_t color_gen, bool durations,
+                     const std::function< bool ( const trace_event_t &event ) > &skip_func )
+{
+    struct start_t
+    {
+        int64_t ts;
+        uint32_t eventid;
+    };
+    std::vector< start_t > starts;
+    uint32_t shift = s_level0_shift;
+    level_t level;
+
+    m_levels.clear();
+    m_locs_size = locs.size();
+    m_key = key;
+    m_color_gen = color_gen;
+
+    starts.reserve( locs.size() );
+    for ( uint32_t eventid : locs )
+    {
+        const trace_event_t &event = events[ eventid ];
+
+        if ( !skip_func( event ) )
+        {
+            int64_t duration = ( durations && event.has_duration() ) ? event.duration : 0;
+
+            starts.push_back( { event.ts - duration, eventid } );
+        }
+    }
+
+    if ( durations )
+    {
+        std::stable_sort( starts.begin(), starts.end(),
+                          []( const start_t &lx, const start_t &rx ) { return lx.ts < rx.ts; } );
+    }
+
+    // Level 0 from events
+    level.bucket_ts = 1LL << shift;
+    for ( const start_t &start : starts )
+    {
+        const trace_event_t &event = events[ start.eventid ];
+
+        if ( durations && event.has_duration() && ( event.duration >= level.bucket_ts / 2 ) )
+        {
+            level.long_events.push_back( start.eventid );
+        }
+        else if ( level.buckets.empty() ||
+                  ( ( level.buckets.back().ts0 >> shift ) != ( start.ts >> shift ) ) )
+        {
+            level.buckets.push_back( { start.ts, start.ts, 1, event.color } );
+        }
+        else
+        {
+            bucket_t &bucket = level.buckets.back();
+
+            bucket.ts1 = start.ts;
+            bucket.count++;
+            bucket.color = event.color;
+        }
+    }
+    std::sort( level.long_events.begin(), level.long_events.end() );
+
+    // Each following level merges 4 buckets of the previous level
+    for ( ;; )
+    {
+        m_levels.push_back( level );
+
+        if ( ( level.buckets.size() <= 1 ) || ( shift >= 60 ) )
+            break;
+
+        shift += 2;
+
+        std::vector< bucket_t > items = level.buckets;
+
+        level.bucket_ts = 1LL << shift;
+        level.buckets.clear();
+
+        // Long events from previous level short enough to merge at this level
+        std::vector< uint32_t > long_events;
+        long_events.swap( level.long_events );
+
+        for ( uint32_t eventid : long_events )
+        {
+            const trace_event_t &event = events[ eventid ];
+
+            if ( event.duration >= level.bucket_ts / 2 )
+            {
+                level.long_events.push_back( eventid );
+            }
+            else
+            {
+                int64_t ts = event.ts - event.duration;
+
+                items.push_back( { ts, ts, 1, event.color } );
+            }
+        }
+
+        if ( items.size() > m_levels.back().buckets.size() )
+        {
+            std::stable_sort( items.begin(), items.end(),
+                              []( const bucket_t &lx, const bucket_t &rx ) { return lx.ts0 < rx.ts0; } );
+        }
+
+        for ( const bucket_t &item : items )
+        {
+            if ( level.buckets.empty() ||
+                 ( ( level.buckets.back().ts0 >> shift ) != ( item.ts0 >> shift ) ) )
+            {
+                level.buckets.push_back( item );
+            }
+            else
+            {
+                bucket_t &bucket = level.buckets.back();
+
+                bucket.ts1 = std::max< int64_t >( bucket.ts1, item.ts1 );
+                bucket.count += item.count;
+                bucket.color = item.color;
+            }
+        }
+    }
+}
+
+const EventLOD::level_t *EventLOD::get_level( double ts_per_pixel ) const
+{
+    const level_t *ret = NULL;
+
+    for ( const level_t &level : m_levels )
+    {
+        if ( level.bucket_ts > ts_per_pixel )
+            break;
+
+        ret = &level;
+    }
+
+    return ret;
+}
+
+// Get level of event summary to draw row locs with, or NULL if zoomed in enough
+//  to draw every event. Builds summary the first time a row is zoomed out.
+static const EventLOD::level_t *get_row_lod_level( graph_info_t &gi, const EventLocs &locs,
+                                                   uint32_t key, bool durations,
+                                                   const std::function< bool ( const trace_event_t &event ) > &skip_func )
+{
+    double ts_per_pixel = gi.tsdx / gi.rc.w;
+
+    if ( ( locs.size() < 1024 ) || ( ts_per_pixel < ( 1LL << EventLOD::s_level0_shift ) ) )
+        return NULL;
+
+    EventLOD *lod = gi.win.m_graph.row_lods.get_val_create( &locs );
+    uint32_t color_gen = gi.win.m_trace_events.m_color_gen;
+
+    if ( !lod->is_valid( locs, key, color_gen ) )
+        lod->init( gi.win.m_trace_events.m_events, locs, key, color_gen, durations, skip_func );
+
+    return lod->get_level( ts_per_pixel );
+}
+
 #if 0
 static option_id_t get_comm_option_id( const std::string &row_name, loc_type_t row_type )
 {
@@ -581,7 +835,7 @@ void graph_info_t::init_rows( const std::vector< GraphRows::graph_rows_info_t >
     for ( const GraphRows::graph_rows_info_t &grow : graph_rows )
     {
         row_info_t rinfo;
-        const std::vector< uint32_t > *plocs;
+        const EventLocs *plocs;
         const std::string &row_name = grow.row_name;
 
         if ( grow.hidden )
@@ -770,7 +1024,7 @@ void graph_info_t::init()
     {
         // Find the fence signaled event for this timeline
         uint32_t gfxcontext_hash = win.m_trace_events.get_event_gfxcontext_hash( events[ hovered_eventid ] );
-        const std::vector< uint32_t > *plocs = win.m_trace_events.get_gfxcontext_locs( gfxcontext_hash );
+        const EventLocs *plocs = win.m_trace_events.get_gfxcontext_locs( gfxcontext_hash );
 
         // Mark it as hovered so it'll have a selection rectangle
         hovered_fence_signaled = plocs->back();
@@ -1016,7 +1270,7 @@ bool CreateGraphRowDlg::render_dlg( TraceEvents &trace_events )
 
     if ( do_create && !disabled )
     {
-        const std::vector< uint32_t > *plocs = trace_events.get_locs(
+        const EventLocs *plocs = trace_events.get_locs(
                     m_filter_buf, NULL, &m_err_str );
 
         ret = !!plocs;
@@ -1157,7 +1411,7 @@ bool CreateRowFilterDlg::render_dlg( TraceEvents &trace_events )
 
     if ( do_create && !disabled )
     {
-        const std::vector< uint32_t > *plocs = trace_events.get_locs(
+        const EventLocs *plocs = trace_events.get_locs(
                     m_filter_buf, NULL, &m_err_str );
 
         ret = !!plocs;
@@ -1225,62 +1479,55 @@ void RowFilters::toggle_filter( TraceEvents &trace_events, size_t idx, const std
         m_row_filters->filters.erase( m_row_filters->filters.begin() + idx );
     }
 
+    update_bitvec( trace_events, m_row_filters );
+}
+
+void RowFilters::update_bitvec( TraceEvents &trace_events, row_filter_t *row_filters )
+{
     // Free old bitmask
-    delete m_row_filters->bitvec;
-    m_row_filters->bitvec = NULL;
+    delete row_filters->bitvec;
+    row_filters->bitvec = NULL;
+    row_filters->pending = false;
 
     // Create new bitmask of valid eventids
-    const std::vector< uint32_t > *plocs_smallest = NULL;
-    std::vector< const std::vector< uint32_t > * > locs;
+    std::vector< const EventLocs * > locs;
 
     // Go through all the filters
-    for ( const std::string &filterstr : m_row_filters->filters )
+    for ( const std::string &filterstr : row_filters->filters )
     {
+        bool pending;
+
         // Get events for this filter
-        const std::vector< uint32_t > *plocs = trace_events.get_tdopexpr_locs( filterstr.c_str() );
+        const EventLocs *plocs = trace_events.get_tdopexpr_locs( filterstr.c_str(), NULL, &pending );
 
-        if ( plocs )
-        {
-            if ( !plocs_smallest || ( plocs->size() < plocs_smallest->size() ) )
-                plocs_smallest = plocs;
+        // Filter is being evaluated on a background job - try again next frame
+        row_filters->pending |= pending;
 
+        if ( plocs )
             locs.push_back( plocs );
-        }
     }
 
-    if ( plocs_smallest )
-    {
-        // Remove plocs_smallest from array of filter locs
-        auto idx0 = std::find( locs.begin(), locs.end(), plocs_smallest );
-        locs.erase( idx0 );
+    if ( row_filters->pending )
+        return;
 
-        for ( auto it = plocs_smallest->rbegin(); it != plocs_smallest->rend(); it++ )
-        {
-            uint32_t eventid = *it;
-            bool set_in_all_filters = true;
+    if ( !locs.empty() )
+    {
+        // Events set in all the filters
+        EventLocs locs_all;
 
-            // Try to find this eventid in all the filters
-            for ( const std::vector< uint32_t > *plocs : locs )
-            {
-                if ( !std::binary_search( plocs->begin(), plocs->end(), eventid ) )
-                {
-                    set_in_all_filters = false;
-                    break;
-                }
-            }
+        EventLocs::intersect( locs, locs_all );
 
-            if ( set_in_all_filters )
-            {
-                if ( !m_row_filters->bitvec )
-                    m_row_filters->bitvec = new BitVec( eventid + 1 );
+        if ( !locs_all.empty() )
+        {
+            row_filters->bitvec = new BitVec( locs_all.back() + 1 );
 
-                m_row_filters->bitvec->set( eventid );
-            }
+            for ( uint32_t eventid : locs_all )
+                row_filters->bitvec->set( eventid );
         }
 
         // No events found - just make a small empty bitvec
-        if ( !m_row_filters->bitvec )
-            m_row_filters->bitvec = new BitVec( 1 );
+        if ( !row_filters->bitvec )
+            row_filters->bitvec = new BitVec( 1 );
     }
 }
 
@@ -1298,7 +1545,8 @@ uint32_t TraceWin::graph_render_plot( graph_info_t &gi )
     if ( index1 == ( uint32_t)-1 )
         index1 = plot.m_plotdata.size();
 
-    points.reserve( index1 - index0 + 10 );
+    // Zoomed out plots draw at most a couple points per pixel
+    points.reserve( std::min< size_t >( index1 - index0, ( size_t )( 4 * gi.rc.w ) ) + 10 );
 
     uint32_t idx0 = gi.prinfo_cur->plocs->front();
     ImU32 color_line = m_trace_events.m_events[ idx0 ].color ?
@@ -1306,7 +1554,8 @@ uint32_t TraceWin::graph_render_plot( graph_info_t &gi )
     ImU32 color_point = imgui_col_complement( color_line );
 
     float lastY = 0.0f;
-    for ( size_t idx = index0; idx < plot.m_plotdata.size(); idx++ )
+    bool first_point = true;
+    auto add_point = [ & ]( uint32_t idx )
     {
         GraphPlot::plotdata_t &data = plot.m_plotdata[ idx ];
         float x = gi.ts_to_screenx( data.ts );
@@ -1320,10 +1569,11 @@ uint32_t TraceWin::graph_render_plot( graph_info_t &gi )
 
         points.push_back( ImVec2( x, y ) );
 
-        if ( !plot.m_interpolation && idx != index0 )
+        if ( !plot.m_interpolation && !first_point )
             plotPoints.push_back( ImVec2( x, lastY ) );
 
         lastY = y;
+        first_point = false;
 
         plotPoints.push_back( ImVec2( x, y ) );
 
@@ -1334,8 +1584,44 @@ uint32_t TraceWin::graph_render_plot( graph_info_t &gi )
         if ( gi.mouse_over )
             gi.add_mouse_hovered_event( x, get_event( data.eventid ) );
 
-        if ( x >= gi.rc.x + gi.rc.w )
-            break;
+        return ( x < gi.rc.x + gi.rc.w );
+    };
+
+    const GraphPlot::plotlevel_t *level = plot.get_level( gi.tsdx / gi.rc.w );
+
+    if ( level && ( index0 != ( uint32_t )-1 ) )
+    {
+        // Zoomed out: draw min and max samples of each bucket in time order
+        const std::vector< GraphPlot::plotbucket_t > &buckets = level->buckets;
+        auto it = std::lower_bound( buckets.begin(), buckets.end(), gi.ts0,
+                                    []( const GraphPlot::plotbucket_t &bucket, int64_t ts ) { return bucket.ts < ts; } );
+        uint32_t lastidx = index0;
+
+        if ( it != buckets.begin() )
+            --it;
+
+        add_point( index0 );
+        for ( ; it != buckets.end(); ++it )
+        {
+            uint32_t first = std::min< uint32_t >( it->minidx, it->maxidx );
+            uint32_t second = std::max< uint32_t >( it->minidx, it->maxidx );
+
+            if ( ( first > lastidx ) && !add_point( first ) )
+                break;
+            lastidx = std::max< uint32_t >( lastidx, first );
+
+            if ( ( second > lastidx ) && !add_point( second ) )
+                break;
+            lastidx = std::max< uint32_t >( lastidx, second );
+        }
+    }
+    else
+    {
+        for ( size_t idx = index0; idx < plot.m_plotdata.size(); idx++ )
+        {
+            if ( !add_point( idx ) )
+                break;
+        }
     }
 
     if ( points.size() )
@@ -1379,18 +1665,22 @@ public:
     void set_event( graph_info_t &gi, float h,
                     float x2 = FLT_MAX, float y2 = FLT_MAX,
                     const trace_event_t *event = NULL,
-                    const print_info_t *print_info = NULL );
+                    print_info_t *print_info = NULL );
     void render_text( graph_info_t &gi, float w, float h );
 
 public:
     float m_x = 0.0f;
     float m_y = 0.0f;
     const trace_event_t *m_event = nullptr;
-    const print_info_t *m_print_info = nullptr;
+    print_info_t *m_print_info = nullptr;
 };
 
 void row_draw_info_t::render_text( graph_info_t &gi, float w, float h )
 {
+    // Measure text the first time this label is drawn
+    if ( m_print_info->size.x < 0.0f )
+        m_print_info->size = ImGui::CalcTextSize( m_print_info->buf );
+
     // Text size
     const ImVec2 &tsize = m_print_info->size;
 
@@ -1439,7 +1729,7 @@ void row_draw_info_t::render_text( graph_info_t &gi, float w, float h )
 void row_draw_info_t::set_event( graph_info_t &gi,
                                  float h, float x2, float y2,
                                  const trace_event_t *event,
-                                 const print_info_t *print_info )
+                                 print_info_t *print_info )
 {
     // Adding a new event at x2,y2. If we had a previous event and
     //   there is room for the label, draw it.
@@ -1467,7 +1757,7 @@ void row_draw_info_t::set_event( graph_info_t &gi,
 // Given an array of ftrace print event IDs, do a lower_bound binary search on
 //  m_ftrace.print_info ts values.
 // Note: locs is sorted by ts values in m_ftrace.print_info.
-uint32_t TraceEvents::ts_to_ftrace_print_info_idx( const std::vector< uint32_t > &locs, int64_t ts )
+uint32_t TraceEvents::ts_to_ftrace_print_info_idx( const EventLocs &locs, int64_t ts )
 {
     size_t first = 0;
     size_t count = locs.size();
@@ -1542,7 +1832,7 @@ uint32_t TraceWin::graph_render_cpus_timeline( graph_info_t &gi )
 
     for ( const auto &cpu_locs : m_trace_events.m_sched_switch_cpu_locs.m_locs.m_map )
     {
-        const std::vector< uint32_t > &locs = cpu_locs.second;
+        const EventLocs &locs = cpu_locs.second;
         uint32_t cpu = get_event( locs[ 0 ] ).cpu;
         float y = gi.rc.y + cpu * row_h;
 
@@ -1554,23 +1844,26 @@ uint32_t TraceWin::graph_render_cpus_timeline( graph_info_t &gi )
 
         event_renderer_t event_renderer( gi, y + imgui_scale( 2.0f ), gi.rc.w, row_h - imgui_scale( 3.0f ) );
 
-        for ( size_t idx = vec_find_eventid( locs, gi.eventstart );
-              idx < locs.size();
-              idx++ )
+        auto is_hidden = [ hide_system_events ]( const trace_event_t &sched_switch )
+        {
+            return hide_system_events && ( sched_switch.flags & TRACE_FLAG_SCHED_SWITCH_SYSTEM_EVENT );
+        };
+
+        // Draw a sched_switch event. Returns false once we're off the right side of the graph.
+        auto render_sched_switch = [ & ]( const trace_event_t &sched_switch )
         {
-            const trace_event_t &sched_switch = get_event( locs[ idx ] );
             float x0 = gi.ts_to_screenx( sched_switch.ts - sched_switch.duration );
             float x1 = gi.ts_to_screenx( sched_switch.ts );
 
             // Bail if we're off the right side of our graph
             if ( x0 > gi.rc.x + gi.rc.w )
-                break;
+                return false;
 
-            if ( hide_system_events && ( sched_switch.flags & TRACE_FLAG_SCHED_SWITCH_SYSTEM_EVENT ) )
-                continue;
+            if ( is_hidden( sched_switch ) )
+                return true;
 
             if ( event_renderer.is_event_filtered( sched_switch ) )
-                continue;
+                return true;
 
             count++;
             if ( ( x1 - x0 ) < imgui_scale( 3.0f ) )
@@ -1613,6 +1906,55 @@ uint32_t TraceWin::graph_render_cpus_timeline( graph_info_t &gi )
                                     s_clrs().get( col_Graph_BarSelRect ) );
                 }
             }
+
+            return true;
+        };
+
+        // Zoomed out: draw summary buckets of short events and long events one by one
+        const EventLOD::level_t *lod_level = event_renderer.has_event_filters() ? NULL :
+                    get_row_lod_level( gi, locs, hide_system_events, true, is_hidden );
+
+        if ( lod_level )
+        {
+            const std::vector< EventLOD::bucket_t > &buckets = lod_level->buckets;
+            const std::vector< uint32_t > &long_events = lod_level->long_events;
+            auto it = std::lower_bound( buckets.begin(), buckets.end(), gi.ts0,
+                                        []( const EventLOD::bucket_t &bucket, int64_t ts ) { return bucket.ts1 < ts; } );
+            size_t idx = vec_find_eventid( long_events, gi.eventstart );
+
+            for ( ;; )
+            {
+                bool have_bucket = ( it != buckets.end() ) && ( it->ts0 <= gi.ts1 );
+                bool have_long = ( idx < long_events.size() );
+
+                if ( have_long && ( !have_bucket ||
+                                    ( get_event( long_events[ idx ] ).ts - get_event( long_events[ idx ] ).duration < it->ts0 ) ) )
+                {
+                    if ( !render_sched_switch( get_event( long_events[ idx++ ] ) ) )
+                        idx = long_events.size();
+                }
+                else if ( have_bucket )
+                {
+                    count += it->count;
+                    event_renderer.add_events( gi.ts_to_screenx( it->ts0 ), gi.ts_to_screenx( it->ts1 ),
+                                               it->count, it->color );
+                    it++;
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+        else
+        {
+            for ( size_t idx = vec_find_eventid( locs, gi.eventstart );
+                  idx < locs.size();
+                  idx++ )
+            {
+                if ( !render_sched_switch( get_event( locs[ idx ] ) ) )
+                    break;
+            }
         }
 
         event_renderer.done();
@@ -1651,7 +1993,7 @@ uint32_t TraceWin::graph_render_print_timeline( graph_info_t &gi )
 
     imgui_push_smallfont();
 
-    // Recalc colors and sizes if font/colors have changed
+    // Recalc colors and text size bound if font/colors have changed
     if ( m_trace_events.m_ftrace.text_size_max == -1.0f )
         m_trace_events.update_ftraceprint_colors();
 
@@ -1680,10 +2022,14 @@ uint32_t TraceWin::graph_render_print_timeline( graph_info_t &gi )
     bool timeline_labels = PrintTimelineLabels &&
             !ImGui::GetIO().KeyAlt;
 
+    // text_size_max is a bound from the longest print buf. A label starting more
+    //  than a graph width left of view would have to be wider than the graph to
+    //  show, so don't walk back further than that.
+    float text_size_max = std::min< float >( m_trace_events.m_ftrace.text_size_max, gi.rc.w );
     int64_t ts_duration_max = m_trace_events.m_ftrace.print_ts_max;
-    int64_t ts_text_max = timeline_labels ? gi.dx_to_ts( m_trace_events.m_ftrace.text_size_max ) : 0;
+    int64_t ts_text_max = timeline_labels ? gi.dx_to_ts( text_size_max ) : 0;
     int64_t ts_offset = std::max< int64_t >( ts_duration_max, ts_text_max );
-    const std::vector< uint32_t > &locs = *gi.prinfo_cur->plocs;
+    const EventLocs &locs = *gi.prinfo_cur->plocs;
 
     uint32_t max_row_id = 1;
     for ( size_t idx = m_trace_events.ts_to_ftrace_print_info_idx( locs, gi.ts0 - ts_offset );
@@ -1723,7 +2069,7 @@ uint32_t TraceWin::graph_render_print_timeline( graph_info_t &gi )
     {
         uint32_t row_id;
         const trace_event_t &event = get_event( locs[ idx ] );
-        const print_info_t *print_info = m_trace_events.get_print_info( event.id );
+        print_info_t *print_info = m_trace_events.get_print_info( event.id );
 
         if ( !print_info )
             continue;
@@ -1841,14 +2187,11 @@ uint32_t TraceWin::graph_render_amdhw_timeline( graph_info_t &gi )
     float y = gi.rc.y;
     ImU32 last_color = 0;
     bool draw_label = !ImGui::GetIO().KeyAlt;
-    const std::vector< uint32_t > &locs = *gi.prinfo_cur->plocs;
+    const EventLocs &locs = *gi.prinfo_cur->plocs;
+    const TraceEvents::timeline_index_t *tindex = m_trace_events.m_amd_timeline_index.get_val( &locs );
 
-    for ( size_t idx = vec_find_eventid( locs, gi.eventstart );
-          idx < locs.size();
-          idx++ )
+    auto render_fence_signaled = [ & ]( const trace_event_t &fence_signaled )
     {
-        const trace_event_t &fence_signaled = get_event( locs.at( idx ) );
-
         if ( fence_signaled.is_fence_signaled() &&
              is_valid_id( fence_signaled.id_start ) &&
              ( fence_signaled.ts - fence_signaled.duration < gi.ts1 ) )
@@ -1910,6 +2253,25 @@ uint32_t TraceWin::graph_render_amdhw_timeline( graph_info_t &gi )
 
             num_events++;
         }
+    };
+
+    if ( tindex )
+    {
+        // Only visit jobs whose hw interval overlaps the visible range
+        tindex->hw.find( gi.ts0, gi.ts1, [ & ]( const IntervalIndex::interval_t &interval )
+        {
+            render_fence_signaled( get_event( interval.eventid ) );
+            return true;
+        } );
+    }
+    else
+    {
+        for ( size_t idx = vec_find_eventid( locs, gi.eventstart );
+              idx < locs.size();
+              idx++ )
+        {
+            render_fence_signaled( get_event( locs[ idx ] ) );
+        }
     }
 
     imgui_drawrect( hov_rect, s_clrs().get( col_Graph_BarSelRect ) );
@@ -1929,7 +2291,8 @@ uint32_t TraceWin::graph_render_amd_timeline( graph_info_t &gi )
     ImU32 col_hwrunning = s_clrs().get( col_Graph_BarHwRunning );
     ImU32 col_userspace = s_clrs().get( col_Graph_BarUserspace );
     ImU32 col_hwqueue = s_clrs().get( col_Graph_BarHwQueue );
-    const std::vector< uint32_t > &locs = *gi.prinfo_cur->plocs;
+    const EventLocs &locs = *gi.prinfo_cur->plocs;
+    const TraceEvents::timeline_index_t *tindex = m_trace_events.m_amd_timeline_index.get_val( &locs );
     bool render_timeline_events = TimelineEvents;
     bool render_timeline_labels = TimelineLabels &&
             !ImGui::GetIO().KeyAlt;
@@ -1938,23 +2301,17 @@ uint32_t TraceWin::graph_render_amd_timeline( graph_info_t &gi )
 
     event_renderer.m_maxwidth = 1.0f;
 
-    for ( size_t idx = vec_find_eventid( locs, gi.eventstart );
-          idx < locs.size();
-          idx++ )
+    auto render_fence_signaled = [ & ]( const trace_event_t &fence_signaled )
     {
-        const trace_event_t &fence_signaled = get_event( locs[ idx ] );
-
         if ( !fence_signaled.is_fence_signaled() || !is_valid_id( fence_signaled.id_start ) )
-            continue;
+            return;
 
         const trace_event_t &sched_run_job = get_event( fence_signaled.id_start );
         const trace_event_t &cs_ioctl = is_valid_id( sched_run_job.id_start ) ?
                     get_event( sched_run_job.id_start ) : sched_run_job;
 
-        //$ TODO mikesart: can we bail out of this loop at some point if
-        //  our start times for all the graphs are > gi.ts1?
         if ( cs_ioctl.ts >= gi.ts1 )
-            continue;
+            return;
 
         bool hovered = false;
         float y = gi.rc.y + ( fence_signaled.graph_row_id % timeline_row_count ) * gi.text_h;
@@ -2061,6 +2418,25 @@ uint32_t TraceWin::graph_render_amd_timeline( graph_info_t &gi )
         }
 
         num_events++;
+    };
+
+    if ( tindex )
+    {
+        // Only visit jobs whose cs_ioctl to fence_signaled interval overlaps the visible range
+        tindex->user.find( gi.ts0, gi.ts1, [ & ]( const IntervalIndex::interval_t &interval )
+        {
+            render_fence_signaled( get_event( interval.eventid ) );
+            return true;
+        } );
+    }
+    else
+    {
+        for ( size_t idx = vec_find_eventid( locs, gi.eventstart );
+              idx < locs.size();
+              idx++ )
+        {
+            render_fence_signaled( get_event( locs[ idx ] ) );
+        }
     }
 
     event_renderer.done();
@@ -2078,34 +2454,92 @@ uint32_t TraceWin::graph_render_row_events( graph_info_t &gi )
     if ( strstr( gi.prinfo_cur->row_name.c_str(), "(print)" ) )
         return graph_render_print_timeline( gi );
 
-    const std::vector< uint32_t > &locs = *gi.prinfo_cur->plocs;
+    const EventLocs &locs = *gi.prinfo_cur->plocs;
     event_renderer_t event_renderer( gi, gi.rc.y + 4, gi.rc.w, gi.rc.h - 8 );
     bool hide_sched_switch = HideSchedSwitchEvents;
-
-    for ( size_t idx = vec_find_eventid( locs, gi.eventstart );
-          idx < locs.size();
-          idx++ )
+    const EventLOD::level_t *lod_level = NULL;
+    auto is_hidden = [ hide_sched_switch ]( const trace_event_t &event )
     {
-        uint32_t eventid = locs[ idx ];
-        const trace_event_t &event = get_event( eventid );
+        return hide_sched_switch && event.is_sched_switch();
+    };
 
-        if ( eventid > gi.eventend )
-            break;
-        else if ( gi.graph_only_filtered && event.is_filtered_out )
-            continue;
-        else if ( hide_sched_switch && event.is_sched_switch() )
-            continue;
+    // Zoomed out: draw event summary buckets instead of every event
+    if ( !gi.graph_only_filtered && !event_renderer.has_event_filters() )
+        lod_level = get_row_lod_level( gi, locs, hide_sched_switch, false, is_hidden );
 
-        if ( event_renderer.is_event_filtered( event ) )
-            continue;
+    if ( lod_level )
+    {
+        const std::vector< EventLOD::bucket_t > &buckets = lod_level->buckets;
+        auto it = std::lower_bound( buckets.begin(), buckets.end(), gi.ts0,
+                                    []( const EventLOD::bucket_t &bucket, int64_t ts ) { return bucket.ts1 < ts; } );
 
-        float x = gi.ts_to_screenx( event.ts );
+        for ( ; ( it != buckets.end() ) && ( it->ts0 <= gi.ts1 ); it++ )
+        {
+            event_renderer.add_events( gi.ts_to_screenx( it->ts0 ), gi.ts_to_screenx( it->ts1 ),
+                                       it->count, it->color );
+        }
 
-        // Check if we're mouse hovering this event
+        // Check events close to the mouse for hovering
         if ( gi.mouse_over )
-            gi.add_mouse_hovered_event( x, event );
+        {
+            int64_t mouse_ts = gi.screenx_to_ts( gi.mouse_pos.x );
+            int64_t dist_ts = gi.dx_to_ts( imgui_scale( 8.0f ) );
+            auto idx = std::lower_bound( locs.begin(), locs.end(), mouse_ts - dist_ts,
+                                         [ & ]( uint32_t eventid, int64_t ts ) { return get_event( eventid ).ts < ts; } );
 
-        event_renderer.add_event( event.id, x, event.color );
+            for ( ; idx != locs.end(); idx++ )
+            {
+                const trace_event_t &event = get_event( *idx );
+
+                if ( event.ts > mouse_ts + dist_ts )
+                    break;
+                if ( !is_hidden( event ) )
+                    gi.add_mouse_hovered_event( gi.ts_to_screenx( event.ts ), event );
+            }
+        }
+
+        // Selected and hovered event markers
+        for ( uint32_t eventid : { gi.selected_eventid, gi.hovered_eventid } )
+        {
+            if ( is_valid_id( eventid ) &&
+                 ( eventid >= gi.eventstart ) && ( eventid <= gi.eventend ) &&
+                 std::binary_search( locs.begin(), locs.end(), eventid ) &&
+                 !is_hidden( get_event( eventid ) ) )
+            {
+                event_renderer.add_event_marker( eventid, gi.ts_to_screenx( get_event( eventid ).ts ) );
+            }
+
+            if ( gi.selected_eventid == gi.hovered_eventid )
+                break;
+        }
+    }
+    else
+    {
+        for ( size_t idx = vec_find_eventid( locs, gi.eventstart );
+              idx < locs.size();
+              idx++ )
+        {
+            uint32_t eventid = locs[ idx ];
+            const trace_event_t &event = get_event( eventid );
+
+            if ( eventid > gi.eventend )
+                break;
+            else if ( gi.graph_only_filtered && event.is_filtered_out )
+                continue;
+            else if ( is_hidden( event ) )
+                continue;
+
+            if ( event_renderer.is_event_filtered( event ) )
+                continue;
+
+            float x = gi.ts_to_screenx( event.ts );
+
+            // Check if we're mouse hovering this event
+            if ( gi.mouse_over )
+                gi.add_mouse_hovered_event( x, event );
+
+            event_renderer.add_event( event.id, x, event.color );
+        }
     }
 
     event_renderer.done();
@@ -2114,7 +2548,7 @@ uint32_t TraceWin::graph_render_row_events( graph_info_t &gi )
     if ( gi.prinfo_cur->pid >= 0 )
     {
         // Grab all the sched_switch events that have our comm listed as prev_comm
-        const std::vector< uint32_t > *plocs = m_trace_events.get_sched_switch_locs(
+        const EventLocs *plocs = m_trace_events.get_sched_switch_locs(
                     gi.prinfo_cur->pid, TraceEvents::SCHED_SWITCH_PREV );
 
         if ( plocs )
@@ -2130,7 +2564,7 @@ uint32_t TraceWin::graph_render_row_events( graph_info_t &gi )
                   idx < plocs->size();
                   idx++ )
             {
-                const trace_event_t &sched_switch = get_event( plocs->at( idx ) );
+                const trace_event_t &sched_switch = get_event( ( *plocs )[ idx ] );
 
                 if ( sched_switch.has_duration() )
                 {
@@ -2264,7 +2698,7 @@ void TraceWin::graph_render_time_ticks( graph_info_t &gi, float h0, float h1 )
     }
 }
 
-static float get_vblank_xdiffs( TraceWin &win, graph_info_t &gi, const std::vector< uint32_t > *vblank_locs )
+static float get_vblank_xdiffs( TraceWin &win, graph_info_t &gi, const EventLocs *vblank_locs )
 {
     float xdiff = 0.0f;
     float xlast = 0.0f;
@@ -2274,12 +2708,12 @@ static float get_vblank_xdiffs( TraceWin &win, graph_info_t &gi, const std::vect
           idx < vblank_locs->size();
           idx++ )
     {
-        uint32_t id = vblank_locs->at( idx );
+        uint32_t id = ( *vblank_locs )[ idx ];
         trace_event_t &event = win.get_event( id );
 
         if ( Opts::getcrtc( event.crtc ) )
         {
-            float x = gi.ts_to_screenx( event.get_vblank_ts( VBlankHighPrecTimestamps ) );
+            float x = gi.ts_to_screenx( win.m_trace_events.get_vblank_ts( event, VBlankHighPrecTimestamps ) );
 
             if ( xlast )
                 xdiff = std::max< float >( xdiff, x - xlast );
@@ -2296,7 +2730,7 @@ static float get_vblank_xdiffs( TraceWin &win, graph_info_t &gi, const std::vect
 void TraceWin::graph_render_vblanks( graph_info_t &gi )
 {
     // Draw vblank events on every graph.
-    const std::vector< uint32_t > *vblank_locs = m_trace_events.get_tdopexpr_locs( "$name=drm_vblank_event" );
+    const EventLocs *vblank_locs = m_trace_events.get_tdopexpr_locs( "$name=drm_vblank_event" );
 
     if ( vblank_locs )
     {
@@ -2315,7 +2749,7 @@ void TraceWin::graph_render_vblanks( graph_info_t &gi )
               idx < vblank_locs->size();
               idx++ )
         {
-            uint32_t id = vblank_locs->at( idx );
+            uint32_t id = ( *vblank_locs )[ idx ];
 
             if ( id > gi.eventend )
                 break;
@@ -2326,7 +2760,7 @@ void TraceWin::graph_render_vblanks( graph_info_t &gi )
             {
                 // Handle drm_vblank_event0 .. drm_vblank_event2
                 uint32_t col = Clamp< uint32_t >( col_VBlank0 + event.crtc, col_VBlank0, col_VBlank2 );
-                float x = gi.ts_to_screenx( event.get_vblank_ts( VBlankHighPrecTimestamps ) );
+                float x = gi.ts_to_screenx( m_trace_events.get_vblank_ts( event, VBlankHighPrecTimestamps ) );
 
                 imgui_drawrect_filled( x, gi.rc.y, imgui_scale( 1.0f ), gi.rc.h,
                                        s_clrs().get( col, alpha ) );
@@ -3680,8 +4114,7 @@ bool TraceWin::graph_render_popupmenu( graph_info_t &gi )
         if ( m_frame_markers.m_left_frames.size() &&
              ImGui::MenuItem( "Clear Frame Markers" ) )
         {
-            m_frame_markers.m_left_frames.clear();
-            m_frame_markers.m_right_frames.clear();
+            m_frame_markers.clear_frames();
         }
     }
 
@@ -3789,7 +4222,7 @@ void TraceWin::graph_mouse_tooltip_rowinfo( std::string &ttip, graph_info_t &gi,
 
 void TraceWin::graph_mouse_tooltip_vblanks( std::string &ttip, graph_info_t &gi, int64_t mouse_ts )
 {
-    const std::vector< uint32_t > *vblank_locs = m_trace_events.get_tdopexpr_locs( "$name=drm_vblank_event" );
+    const EventLocs *vblank_locs = m_trace_events.get_tdopexpr_locs( "$name=drm_vblank_event" );
 
     if ( vblank_locs )
     {
@@ -3801,19 +4234,21 @@ void TraceWin::graph_mouse_tooltip_vblanks( std::string &ttip, graph_info_t &gi,
 
         for ( idx = ( idx > 10 ) ? ( idx - 10 ) : 0; idx < idxmax; idx++ )
         {
-            trace_event_t &event = get_event( vblank_locs->at( idx ) );
+            trace_event_t &event = get_event( ( *vblank_locs )[ idx ] );
 
             if ( Opts::getcrtc( event.crtc ) )
             {
+                int64_t vblank_ts = m_trace_events.get_vblank_ts( event, VBlankHighPrecTimestamps );
+
                 if ( event.ts < mouse_ts )
                 {
-                    if ( mouse_ts - event.get_vblank_ts( VBlankHighPrecTimestamps ) < prev_vblank_ts )
-                        prev_vblank_ts = mouse_ts - event.get_vblank_ts( VBlankHighPrecTimestamps );
+                    if ( mouse_ts - vblank_ts < prev_vblank_ts )
+                        prev_vblank_ts = mouse_ts - vblank_ts;
                 }
-                if ( event.get_vblank_ts( VBlankHighPrecTimestamps ) > mouse_ts )
+                if ( vblank_ts > mouse_ts )
                 {
-                    if ( event.get_vblank_ts( VBlankHighPrecTimestamps ) - mouse_ts < next_vblank_ts )
-                        next_vblank_ts = event.get_vblank_ts( VBlankHighPrecTimestamps ) - mouse_ts;
+                    if ( vblank_ts - mouse_ts < next_vblank_ts )
+                        next_vblank_ts = vblank_ts - mouse_ts;
                 }
             }
         }
@@ -3838,6 +4273,69 @@ void TraceWin::graph_mouse_tooltip_markers( std::string &ttip, graph_info_t &gi,
 
         ttip += string_format( "\n\nFrame %d (", gi.hovered_framemarker_frame );
         ttip += ts_to_timestr( ts, 4 ) + ")";
+        if ( ts > m_frame_markers.m_stats.m_stutter_len )
+            ttip += " stutter";
+
+        graph_mouse_tooltip_frame_stats( ttip, gi );
+        graph_mouse_tooltip_frame_cpu( ttip, gi );
+    }
+}
+
+// Percentiles of frames starting in the visible range
+void TraceWin::graph_mouse_tooltip_frame_stats( std::string &ttip, graph_info_t &gi )
+{
+    size_t frame0, frame1;
+    HdrHistogram hist;
+    const FrameStats &stats = m_frame_markers.m_stats;
+
+    stats.get_frames( gi.ts0, gi.ts1, frame0, frame1 );
+    stats.get_histogram( frame0, frame1, hist );
+
+    if ( hist.m_count > 1 )
+    {
+        ttip += string_format( "\n%lu visible frames: p50 %s p90 %s p99 %s p99.9 %s, %lu stutters",
+                               hist.m_count,
+                               ts_to_timestr( hist.get_percentile( 50.0 ), 2 ).c_str(),
+                               ts_to_timestr( hist.get_percentile( 90.0 ), 2 ).c_str(),
+                               ts_to_timestr( hist.get_percentile( 99.0 ), 2 ).c_str(),
+                               ts_to_timestr( hist.get_percentile( 99.9 ), 2 ).c_str(),
+                               stats.get_stutter_count( frame0, frame1 ) );
+    }
+}
+
+void TraceWin::graph_mouse_tooltip_frame_cpu( std::string &ttip, graph_info_t &gi )
+{
+    int64_t ts0, ts1;
+    std::vector< TraceEvents::pid_runtime_t > pids;
+
+    if ( !m_frame_markers.get_frame_range( m_trace_events, gi.hovered_framemarker_frame, ts0, ts1 ) ||
+         ( ts1 <= ts0 ) || m_trace_events.m_sched_cpu_runtime.m_map.empty() )
+    {
+        return;
+    }
+
+    // Per cpu busy percentages, eight to a line
+    std::vector< uint32_t > cpus;
+    for ( const auto &it : m_trace_events.m_sched_cpu_runtime.m_map )
+        cpus.push_back( it.first );
+    std::sort( cpus.begin(), cpus.end() );
+
+    for ( size_t i = 0; i < cpus.size(); i++ )
+    {
+        int64_t runtime = m_trace_events.get_cpu_runtime( cpus[ i ], ts0, ts1 );
+
+        ttip += ( i % 8 ) ? "  " : "\n";
+        ttip += string_format( "%sCpu%u%s:%.0f%%", gi.clr_bright, cpus[ i ], gi.clr_def,
+                               runtime * 100.0 / ( ts1 - ts0 ) );
+    }
+
+    m_trace_events.get_top_pid_runtimes( ts0, ts1, 5, pids );
+
+    for ( const TraceEvents::pid_runtime_t &val : pids )
+    {
+        ttip += string_format( "\n  %s%s%s %s (%u runs)", gi.clr_brightcomp,
+                               m_trace_events.comm_from_pid( val.pid, "<...>" ), gi.clr_def,
+                               ts_to_timestr( val.runtime, 2 ).c_str(), val.count );
     }
 }
 
@@ -3856,7 +4354,7 @@ void TraceWin::graph_mouse_tooltip_sched_switch( std::string &ttip, graph_info_t
         if ( prev_comm )
         {
             int prev_pid = event.pid;
-            int prev_state = atoi( get_event_field_val( event, "prev_state" ) );
+            int prev_state = get_event_field_int( event, "prev_state" );
             int task_state = prev_state & ( TASK_REPORT_MAX - 1 );
             const std::string task_state_str = task_state_to_str( task_state );
             std::string timestr = ts_to_timestr( event.duration, 4 );
@@ -3885,7 +4383,7 @@ void TraceWin::graph_mouse_tooltip_hovered_amd_fence_signaled( std::string &ttip
 
     const trace_event_t &event_hov = get_event( gi.hovered_fence_signaled );
     uint32_t gfxcontext_hash = m_trace_events.get_event_gfxcontext_hash( event_hov );
-    const std::vector< uint32_t > *plocs = m_trace_events.get_gfxcontext_locs( gfxcontext_hash );
+    const EventLocs *plocs = m_trace_events.get_gfxcontext_locs( gfxcontext_hash );
 
     ttip += string_format( "\n\n%s",
                                m_trace_events.tgidcomm_from_commstr( event_hov.user_comm ) );
@@ -258,7 +258,7 @@ void GraphRows::init( TraceEvents &trace_events )
 
     // Order: gfx -> compute -> gfx hw -> compute hw -> sdma -> sdma hw
     loc_type_t type;
-    const std::vector< uint32_t > *plocs;
+    const EventLocs *plocs;
 
     // AMD gpu events
     {
@@ -421,8 +421,7 @@ void GraphRows::init( TraceEvents &trace_events )
     std::vector< graph_rows_info_t > comms;
     for ( auto item : trace_events.m_comm_locs.m_locs.m_map )
     {
-        uint32_t hashval = item.first;
-        const char *comm = trace_events.m_strpool.findstr( hashval );
+        const char *comm = trace_events.m_strpool.findid( item.first );
 
         comms.push_back( { false, LOC_TYPE_Comm, comm, comm, item.second.size() } );
     }
@@ -484,6 +483,35 @@ void GraphRows::init( TraceEvents &trace_events )
     }
 }
 
+void GraphRows::update( TraceEvents &trace_events )
+{
+    if ( m_graph_rows_list.empty() )
+        return;
+
+    for ( graph_rows_info_t &row_info : m_graph_rows_list )
+    {
+        const EventLocs *plocs = trace_events.get_locs( row_info.row_filter_expr.c_str() );
+
+        if ( plocs )
+            row_info.event_count = plocs->size();
+    }
+
+    // Add rows for comms we haven't seen before
+    std::vector< graph_rows_info_t > comms;
+    for ( const auto &item : trace_events.m_comm_locs.m_locs.m_map )
+    {
+        const char *comm = trace_events.m_strpool.findid( item.first );
+
+        if ( find_row( comm ) == ( size_t )-1 )
+            comms.push_back( { false, LOC_TYPE_Comm, comm, comm, item.second.size() } );
+    }
+
+    row_cmp_t row_cmp( trace_events );
+    std::sort( comms.begin(), comms.end(), row_cmp );
+
+    m_graph_rows_list.insert( m_graph_rows_list.end(), comms.begin(), comms.end() );
+}
+
 void GraphRows::shutdown()
 {
     for ( auto it = m_graph_rows_hide.begin(); it != m_graph_rows_hide.end(); )
@@ -517,7 +545,7 @@ void GraphRows::add_row( const std::string &name_in, const std::string &filter_e
 {
     loc_type_t type;
     std::string name = name_in;
-    const std::vector< uint32_t > *plocs = m_trace_events->get_locs( filter_expr.c_str(), &type );
+    const EventLocs *plocs = m_trace_events->get_locs( filter_expr.c_str(), &type );
     size_t event_count = plocs ? plocs->size() : 0;
 
     if ( type == LOC_TYPE_Tdopexpr )
@@ -28,6 +28,8 @@
 #define GPUVIS_TRACE_UTILS_DISABLE
 #include "gpuvis_trace_utils.h"
 
+#include <memory>
+
 #if defined( __APPLE__ )
 // https://android.googlesource.com/platform/system/core/+/master/base/include/android-base/macros.h
 #ifndef TEMP_FAILURE_RETRY
@@ -173,6 +175,96 @@ public:
     map_t m_map;
 };
 
+// Tournament (loser) tree for k-way merging sorted streams. Ties go to the
+//  lowest stream index. Pick a winner with top(), then replace_top() with that
+//  stream's next key or pop_top() when it runs dry: each step is log2(k).
+template < typename K >
+class util_merge_tree
+{
+public:
+    util_merge_tree( uint32_t count ) :
+        m_keys( count ), m_valid( count, false ), m_tree( std::max< uint32_t >( count, 1 ), 0 ) {}
+    ~util_merge_tree() {}
+
+    // Set first key for a stream. Streams without a key start out empty.
+    void set_key( uint32_t stream, const K &key )
+    {
+        m_keys[ stream ] = key;
+        m_valid[ stream ] = true;
+    }
+
+    // Play initial tournament after all keys have been set
+    void build()
+    {
+        uint32_t count = m_keys.size();
+        std::vector< uint32_t > winners( 2 * count );
+
+        if ( !count )
+            return;
+
+        for ( uint32_t i = 0; i < count; i++ )
+            winners[ count + i ] = i;
+
+        for ( uint32_t i = count - 1; i >= 1; i-- )
+        {
+            uint32_t lx = winners[ 2 * i ];
+            uint32_t rx = winners[ 2 * i + 1 ];
+            bool lwins = is_less( lx, rx );
+
+            winners[ i ] = lwins ? lx : rx;
+            m_tree[ i ] = lwins ? rx : lx;
+        }
+
+        m_tree[ 0 ] = ( count > 1 ) ? winners[ 1 ] : 0;
+    }
+
+    bool empty() const { return m_keys.empty() || !m_valid[ m_tree[ 0 ] ]; }
+    uint32_t top() const { return m_tree[ 0 ]; }
+    const K &top_key() const { return m_keys[ m_tree[ 0 ] ]; }
+
+    void replace_top( const K &key )
+    {
+        m_keys[ m_tree[ 0 ] ] = key;
+        replay( m_tree[ 0 ] );
+    }
+
+    void pop_top()
+    {
+        m_valid[ m_tree[ 0 ] ] = false;
+        replay( m_tree[ 0 ] );
+    }
+
+private:
+    bool is_less( uint32_t lx, uint32_t rx ) const
+    {
+        if ( !m_valid[ lx ] || !m_valid[ rx ] )
+            return m_valid[ lx ] || ( !m_valid[ rx ] && ( lx < rx ) );
+        if ( m_keys[ lx ] < m_keys[ rx ] )
+            return true;
+        if ( m_keys[ rx ] < m_keys[ lx ] )
+            return false;
+        return lx < rx;
+    }
+
+    void replay( uint32_t winner )
+    {
+        // Walk up from the leaf, swapping with any stored loser that beats us
+        for ( uint32_t node = ( m_keys.size() + winner ) / 2; node >= 1; node /= 2 )
+        {
+            if ( is_less( m_tree[ node ], winner ) )
+                std::swap( m_tree[ node ], winner );
+        }
+
+        m_tree[ 0 ] = winner;
+    }
+
+private:
+    std::vector< K > m_keys;
+    std::vector< bool > m_valid;
+    // m_tree[ 0 ] is the winner, m_tree[ 1..count-1 ] are the losers
+    std::vector< uint32_t > m_tree;
+};
+
 class StrAlloc
 {
 public:
@@ -189,22 +281,59 @@ public:
     std::vector< char * > m_chunks;
 };
 
+// Interned strings: equal strings always return the same pointer, which stays
+//  valid for the life of the pool. Safe to use from several threads: strings
+//  are sharded on a 64-bit hash, each shard with its own lock, arena and table,
+//  and lookups compare the full string so hash collisions can't alias strings.
 class StrPool
 {
 public:
-    StrPool() {}
-    ~StrPool() {}
+    StrPool();
+    ~StrPool();
+
+    StrPool( const StrPool & ) = delete;
+    StrPool &operator=( const StrPool & ) = delete;
 
     const char *getstr( const char *str, size_t len = ( size_t )-1 );
     const char *getstrf( const char *fmt, ... ) ATTRIBUTE_PRINTF( 2, 3 );
-    const char *findstr( uint32_t hashval );
 
-    uint32_t getu32( const char *str, size_t len = ( size_t )-1 );
-    uint32_t getu32f( const char *fmt, ... ) ATTRIBUTE_PRINTF( 2, 3 );
+    // Intern string and return a compact handle for it. Ids are stable for
+    //  the life of the pool and unique per string.
+    uint32_t getid( const char *str, size_t len = ( size_t )-1 );
+    uint32_t getidf( const char *fmt, ... ) ATTRIBUTE_PRINTF( 2, 3 );
+    // Get id of str if it's already interned, without adding it
+    bool lookupid( const char *str, uint32_t *id, size_t len = ( size_t )-1 );
+    // Return string for id from getid(), or NULL. Doesn't lock.
+    const char *findid( uint32_t id );
+
+    // Copy strings from pool into this pool and add them to remap (pool str -> our str)
+    void merge( StrPool &pool, util_umap< const char *, const char * > &remap );
+
+    // Bytes of string data and number of arena chunks
+    size_t get_totsize() const;
+    size_t get_chunk_count() const;
+
+    // Trace cache layout: entry counts of each shard, an { hashval, offset, len }
+    //  entry per string in id order, then the NUL terminated strings. save() appends
+    //  it to buf. load() fills an empty pool from it with the same ids, pointing
+    //  strings into data (kept alive by holder) instead of copying and rehashing them.
+    bool save( std::vector< char > &buf ) const;
+    bool load( const char *data, size_t size, const std::shared_ptr< void > &holder );
 
-public:
-    StrAlloc m_alloc;
-    util_umap< uint32_t, const char * > m_pool;
+protected:
+    struct shard_t;
+
+    const char *intern( const char *str, size_t len, uint32_t *id, bool create );
+
+private:
+    static const uint32_t s_shard_bits = 4;
+    static const uint32_t s_shard_count = 1 << s_shard_bits;
+
+    shard_t *m_shards = nullptr;
+
+    // Data strings from load() point into
+    std::shared_ptr< void > m_loaded;
+    size_t m_loaded_size = 0;
 };
 
 class BitVec
@@ -233,8 +362,175 @@ private:
     uint8_t *m_bits = nullptr;
 };
 
+// Compressed list of event ids (used for TraceLocations). Ids are packed in
+//  blocks of 128: each block stores its smallest id and the offsets from it at
+//  the bit width of the largest offset, so runs of nearby sorted ids cost a few
+//  bits each instead of 32. The last partial block is kept unpacked. Any id
+//  order works and operator[] is O(1); lower_bound() needs sorted ids.
+class EventLocs
+{
+public:
+    class const_iterator
+    {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef uint32_t value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const uint32_t *pointer;
+        typedef uint32_t reference;
+
+        const_iterator() {}
+        const_iterator( const EventLocs *locs, size_t index ) : m_locs( locs ), m_index( index ) {}
+
+        uint32_t operator*() const                          { return ( *m_locs )[ m_index ]; }
+        uint32_t operator[]( difference_type n ) const      { return ( *m_locs )[ m_index + n ]; }
+
+        const_iterator &operator++()                        { m_index++; return *this; }
+        const_iterator &operator--()                        { m_index--; return *this; }
+        const_iterator operator++( int )                    { const_iterator it = *this; m_index++; return it; }
+        const_iterator operator--( int )                    { const_iterator it = *this; m_index--; return it; }
+        const_iterator &operator+=( difference_type n )     { m_index += n; return *this; }
+        const_iterator &operator-=( difference_type n )     { m_index -= n; return *this; }
+        const_iterator operator+( difference_type n ) const { return const_iterator( m_locs, m_index + n ); }
+        const_iterator operator-( difference_type n ) const { return const_iterator( m_locs, m_index - n ); }
+        difference_type operator-( const const_iterator &it ) const { return ( difference_type )( m_index - it.m_index ); }
+
+        bool operator==( const const_iterator &it ) const   { return m_index == it.m_index; }
+        bool operator!=( const const_iterator &it ) const   { return m_index != it.m_index; }
+        bool operator<( const const_iterator &it ) const    { return m_index < it.m_index; }
+        bool operator>( const const_iterator &it ) const    { return m_index > it.m_index; }
+        bool operator<=( const const_iterator &it ) const   { return m_index <= it.m_index; }
+        bool operator>=( const const_iterator &it ) const   { return m_index >= it.m_index; }
+
+    private:
+        const EventLocs *m_locs = nullptr;
+        size_t m_index = 0;
+    };
+    typedef std::reverse_iterator< const_iterator > const_reverse_iterator;
+
+public:
+    EventLocs() {}
+    ~EventLocs() {}
+
+    size_t size() const                     { return m_size; }
+    bool empty() const                      { return !m_size; }
+
+    uint32_t operator[]( size_t index ) const
+    {
+        size_t block = index / s_block_size;
+
+        if ( block >= m_blocks.size() )
+            return m_tail[ index % s_block_size ];
+        return get_packed( m_blocks[ block ], index % s_block_size );
+    }
+    uint32_t front() const                  { return ( *this )[ 0 ]; }
+    uint32_t back() const                   { return m_tail.empty() ? ( *this )[ m_size - 1 ] : m_tail.back(); }
+
+    const_iterator begin() const            { return const_iterator( this, 0 ); }
+    const_iterator end() const              { return const_iterator( this, m_size ); }
+    const_reverse_iterator rbegin() const   { return const_reverse_iterator( end() ); }
+    const_reverse_iterator rend() const     { return const_reverse_iterator( begin() ); }
+
+    void push_back( uint32_t id )
+    {
+        m_tail.push_back( id );
+        m_size++;
+
+        if ( m_tail.size() == s_block_size )
+            pack_tail();
+    }
+    template < typename T >
+    void append( const T &ids )
+    {
+        for ( uint32_t id : ids )
+            push_back( id );
+    }
+
+    void clear();
+    void swap( EventLocs &locs );
+    void assign( const std::vector< uint32_t > &ids );
+    std::vector< uint32_t > to_vector() const;
+
+    // Remove all ids func returns true for
+    template < typename F >
+    void erase_if( F func )
+    {
+        EventLocs locs;
+
+        for ( uint32_t id : *this )
+        {
+            if ( !func( id ) )
+                locs.push_back( id );
+        }
+        swap( locs );
+    }
+
+    // Remove ids below count and shift the rest down by count. Used when the
+    //  oldest events are trimmed. List doesn't need to be sorted.
+    void trim( uint32_t count );
+
+    // Sorted lists: index of first id >= eventid, or size()
+    size_t lower_bound( uint32_t eventid ) const
+    {
+        return std::lower_bound( begin(), end(), eventid ) - begin();
+    }
+    bool contains( uint32_t eventid ) const
+    {
+        size_t idx = lower_bound( eventid );
+
+        return ( idx < m_size ) && ( ( *this )[ idx ] == eventid );
+    }
+
+    // Sorted lists: set out to ids found in all / any of lists
+    static void intersect( const std::vector< const EventLocs * > &lists, EventLocs &out );
+    static void unite( const std::vector< const EventLocs * > &lists, EventLocs &out );
+
+    // Bytes allocated by this list
+    size_t mem_size() const;
+
+    // Append the packed list to buf for the trace cache. load() reads one back
+    //  from ptr and advances it. Returns false if it's corrupt or runs past end.
+    void save( std::vector< char > &buf ) const;
+    bool load( const char *&ptr, const char *end );
+
+protected:
+    struct block_t
+    {
+        uint32_t base;  // smallest id in block
+        uint32_t word;  // index of first m_words entry
+        uint32_t bits;  // bits per packed offset
+    };
+
+    uint32_t get_packed( const block_t &block, size_t i ) const
+    {
+        if ( !block.bits )
+            return block.base;
+
+        size_t bit = i * block.bits;
+        size_t word = block.word + ( bit >> 6 );
+        uint32_t shift = bit & 63;
+        uint64_t val = m_words[ word ] >> shift;
+
+        if ( shift + block.bits > 64 )
+            val |= m_words[ word + 1 ] << ( 64 - shift );
+
+        return block.base + ( uint32_t )( val & ( ( 1ULL << block.bits ) - 1 ) );
+    }
+
+    void pack_tail();
+
+private:
+    static const size_t s_block_size = 128;
+
+    size_t m_size = 0;
+    std::vector< block_t > m_blocks;
+    std::vector< uint64_t > m_words;
+    std::vector< uint32_t > m_tail;
+};
+
 uint32_t hashstr32( const char *str, size_t len = ( size_t )-1, uint32_t hval = 0xB0F57EE3 );
 uint32_t hashstr32( const std::string &str, uint32_t hval = 0xB0F57EE3 );
+uint64_t hashstr64( const char *str, size_t len = ( size_t )-1, uint32_t hval = 0xB0F57EE3 );
 
 size_t get_file_size( const char *filename );
 const char *get_path_filename( const char *filename );
@@ -253,6 +549,9 @@ void string_replace_str( std::string &s, const std::string &search, const std::s
 
 std::string gen_random_str( size_t len );
 
+// Call func( 0 .. count - 1 ) from up to thread_count threads
+void util_parallel_for( size_t count, uint32_t thread_count, const std::function< void ( size_t ) > &func );
+
 // trim from start (in place)
 void string_ltrim( std::string &s );
 // trim from end (in place)
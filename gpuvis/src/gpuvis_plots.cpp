@@ -58,8 +58,9 @@ static std::string createEventString( const trace_event_t &event )
     std::string buf = "";
     for ( uint32_t i = 0; i < event.numfields; i++ )
     {
+        char valbuf[ 64 ];
         const event_field_t &field = event.fields[ i ];
-        buf += std::string( field.key ) + "=" + std::string( field.value ) + " ";
+        buf += std::string( field.key ) + "=" + std::string( field.get_str( valbuf ) ) + " ";
     }
     return buf;
 }
@@ -214,7 +215,9 @@ bool CreatePlotDlg::render_dlg( TraceEvents &trace_events )
 
     imgui_input_text( "Plot Filter:", m_plot_filter_buf, x, w );
 
-    if ( !m_plot_err_str.empty() )
+    if ( !m_plot_pending.empty() )
+        ImGui::Text( "Filtering... %.0f%%", 100.0f * trace_events.get_tdopexpr_progress( m_plot_pending.c_str() ) );
+    else if ( !m_plot_err_str.empty() )
         ImGui::TextColored( ImVec4( 1, 0, 0, 1), "%s", m_plot_err_str.c_str() );
 
     imgui_input_text( "Plot Scan Str:", m_plot_scanf_buf, x, w );
@@ -226,12 +229,28 @@ bool CreatePlotDlg::render_dlg( TraceEvents &trace_events )
     if ( disabled )
         ImGui::PushStyleColor( ImGuiCol_Text, ImGui::GetStyleColorVec4( ImGuiCol_TextDisabled ) );
 
-    if ( ImGui::Button( "Create", button_size ) && !disabled )
+    // Cancel filter job if filter was edited while it was running
+    if ( !m_plot_pending.empty() && ( m_plot_pending != m_plot_filter_buf ) )
     {
-        const std::vector< uint32_t > *plocs = trace_events.get_tdopexpr_locs(
-                    m_plot_filter_buf, &m_plot_err_str );
+        trace_events.cancel_tdopexpr_job( m_plot_pending.c_str() );
+        m_plot_pending.clear();
+    }
+
+    bool create = ImGui::Button( "Create", button_size ) && !disabled;
+
+    if ( create || !m_plot_pending.empty() )
+    {
+        bool pending;
+        const EventLocs *plocs = trace_events.get_tdopexpr_locs(
+                    m_plot_filter_buf, &m_plot_err_str, &pending );
+
+        m_plot_pending = pending ? m_plot_filter_buf : "";
 
-        if ( !plocs && m_plot_err_str.empty() )
+        if ( pending )
+        {
+            // Filter running on background job - check again next frame
+        }
+        else if ( !plocs && m_plot_err_str.empty() )
         {
             m_plot_err_str = "WARNING: No events found.";
         }
@@ -260,7 +279,13 @@ bool CreatePlotDlg::render_dlg( TraceEvents &trace_events )
 
     ImGui::SameLine();
     if ( ImGui::Button( "Cancel", button_size ) || s_actions().get( action_escape ) )
+    {
+        if ( !m_plot_pending.empty() )
+            trace_events.cancel_tdopexpr_job( m_plot_pending.c_str() );
+        m_plot_pending.clear();
+
         ImGui::CloseCurrentPopup();
+    }
 
     ImGui::EndPopup();
 
@@ -277,18 +302,29 @@ bool GraphPlot::init( TraceEvents &trace_events, const std::string &name,
     m_minval = FLT_MAX;
     m_maxval = FLT_MIN;
     m_plotdata.clear();
+    m_levels.clear();
+
+    add_events( trace_events, 0 );
+
+    return !m_plotdata.empty();
+}
 
+void GraphPlot::add_events( TraceEvents &trace_events, uint32_t first_eventid )
+{
     std::string errstr;
-    const std::vector< uint32_t > *plocs = trace_events.get_tdopexpr_locs( m_filter_str.c_str(), &errstr );
+    uint32_t first_idx = m_plotdata.size();
+    const EventLocs *plocs = trace_events.get_tdopexpr_locs( m_filter_str.c_str(), &errstr );
 
     if ( plocs )
     {
         const trace_event_t &event0 = trace_events.m_events[ ( *plocs )[ 0 ] ];
-        if ( scanf_str == "$duration" )
+        auto it_begin = plocs->begin() + vec_find_eventid( *plocs, first_eventid );
+
+        if ( m_scanf_str == "$duration" )
         {
-            for ( uint32_t idx : *plocs )
+            for ( auto it = it_begin; it != plocs->end(); it++ )
             {
-                const trace_event_t &event = trace_events.m_events[ idx ];
+                const trace_event_t &event = trace_events.m_events[ *it ];
 
                 if ( event.has_duration() )
                 {
@@ -307,9 +343,9 @@ bool GraphPlot::init( TraceEvents &trace_events, const std::string &name,
 
             if ( parse_plot_str.init( m_scanf_str.c_str() ) )
             {
-                for ( uint32_t idx : *plocs )
+                for ( auto it = it_begin; it != plocs->end(); it++ )
                 {
-                    const trace_event_t &event = trace_events.m_events[ idx ];
+                    const trace_event_t &event = trace_events.m_events[ *it ];
                     const char *buf = get_event_field_val( event, "buf" );
 
                     if ( parse_plot_str.parse( buf ) )
@@ -330,9 +366,9 @@ bool GraphPlot::init( TraceEvents &trace_events, const std::string &name,
 
             if ( parse_plot_str.init( m_scanf_str.c_str() ) )
             {
-                for ( uint32_t idx : *plocs )
+                for ( auto it = it_begin; it != plocs->end(); it++ )
                 {
-                    const trace_event_t &event = trace_events.m_events[ idx ];
+                    const trace_event_t &event = trace_events.m_events[ *it ];
                     std::string buf = createEventString( event );
 
                     if ( parse_plot_str.parse( buf.c_str() ) )
@@ -349,7 +385,118 @@ bool GraphPlot::init( TraceEvents &trace_events, const std::string &name,
         }
     }
 
-    return !m_plotdata.empty();
+    init_levels( first_idx );
+}
+
+void GraphPlot::trim( uint32_t count )
+{
+    std::vector< plotdata_t > plotdata;
+
+    m_minval = FLT_MAX;
+    m_maxval = FLT_MIN;
+
+    for ( const plotdata_t &data : m_plotdata )
+    {
+        if ( data.eventid >= count )
+        {
+            m_minval = std::min< float >( m_minval, data.valf );
+            m_maxval = std::max< float >( m_maxval, data.valf );
+
+            plotdata.push_back( { data.ts, data.eventid - count, data.valf } );
+        }
+    }
+
+    m_plotdata.swap( plotdata );
+    m_levels.clear();
+    init_levels( 0 );
+}
+
+void GraphPlot::init_levels( uint32_t first_idx )
+{
+    uint32_t shift = s_level0_shift;
+
+    // Small plots are cheap enough to always draw in full
+    if ( m_plotdata.size() < 1024 )
+    {
+        m_levels.clear();
+        return;
+    }
+
+    auto add_sample = [ this ]( plotbucket_t &bucket, uint32_t minidx, uint32_t maxidx )
+    {
+        if ( m_plotdata[ minidx ].valf < m_plotdata[ bucket.minidx ].valf )
+            bucket.minidx = minidx;
+        if ( m_plotdata[ maxidx ].valf > m_plotdata[ bucket.maxidx ].valf )
+            bucket.maxidx = maxidx;
+    };
+    auto add_bucket = [ &shift, &add_sample ]( plotlevel_t &level, int64_t ts, uint32_t minidx, uint32_t maxidx )
+    {
+        if ( level.buckets.empty() ||
+             ( ( level.buckets.back().ts >> shift ) != ( ts >> shift ) ) )
+        {
+            level.buckets.push_back( { ts, minidx, maxidx } );
+        }
+        else
+        {
+            add_sample( level.buckets.back(), minidx, maxidx );
+        }
+    };
+
+    // Plot just got big enough: add all its samples
+    if ( m_levels.empty() )
+    {
+        first_idx = 0;
+        m_levels.resize( 1 );
+        m_levels[ 0 ].bucket_ts = 1LL << shift;
+    }
+
+    // Samples are in ts order, so new ones can only change the last bucket of
+    //  each level. Buckets from first on get merged into the next level.
+    size_t first = m_levels[ 0 ].buckets.empty() ? 0 : ( m_levels[ 0 ].buckets.size() - 1 );
+
+    // Level 0 from samples
+    for ( uint32_t idx = first_idx; idx < m_plotdata.size(); idx++ )
+        add_bucket( m_levels[ 0 ], m_plotdata[ idx ].ts, idx, idx );
+
+    // Each following level merges 4 buckets of the previous level
+    for ( size_t i = 1; ; i++ )
+    {
+        if ( ( m_levels[ i - 1 ].buckets.size() <= 1 ) || ( shift >= 60 ) )
+            break;
+
+        shift += 2;
+
+        if ( i == m_levels.size() )
+        {
+            m_levels.resize( i + 1 );
+            m_levels[ i ].bucket_ts = 1LL << shift;
+            first = 0;
+        }
+
+        const std::vector< plotbucket_t > &items = m_levels[ i - 1 ].buckets;
+        plotlevel_t &level = m_levels[ i ];
+        size_t next_first = level.buckets.empty() ? 0 : ( level.buckets.size() - 1 );
+
+        for ( size_t j = first; j < items.size(); j++ )
+            add_bucket( level, items[ j ].ts, items[ j ].minidx, items[ j ].maxidx );
+
+        first = next_first;
+    }
+}
+
+const GraphPlot::plotlevel_t *GraphPlot::get_level( double ts_per_pixel ) const
+{
+    const plotlevel_t *ret = NULL;
+
+    for ( const plotlevel_t &level : m_levels )
+    {
+        if ( level.bucket_ts > ts_per_pixel )
+            break;
+
+        ret = &level;
+    }
+
+    return ret;
 }
 
 uint32_t GraphPlot::find_ts_index( int64_t ts0 )
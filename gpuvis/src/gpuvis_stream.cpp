@@ -0,0 +1,484 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "miniz.h"
+#include "gpuvis_stream.h"
+
+#if defined( USE_ZSTD )
+#include <zstd.h>
+#endif
+
+static TraceStream::format_t get_stream_format( const char *filename )
+{
+    uint8_t sig[ 4 ] = { 0 };
+    FILE *fp = fopen( filename, "rb" );
+
+    if ( !fp )
+        return TraceStream::Format_None;
+
+    size_t len = fread( sig, 1, sizeof( sig ), fp );
+    fclose( fp );
+
+    if ( ( len == 4 ) && ( sig[ 0 ] == 'P' ) && ( sig[ 1 ] == 'K' ) && ( sig[ 2 ] == 3 ) && ( sig[ 3 ] == 4 ) )
+        return TraceStream::Format_Zip;
+    if ( ( len >= 2 ) && ( sig[ 0 ] == 0x1f ) && ( sig[ 1 ] == 0x8b ) )
+        return TraceStream::Format_Gzip;
+    if ( ( len == 4 ) && ( sig[ 0 ] == 0x28 ) && ( sig[ 1 ] == 0xb5 ) && ( sig[ 2 ] == 0x2f ) && ( sig[ 3 ] == 0xfd ) )
+        return TraceStream::Format_Zstd;
+
+    return TraceStream::Format_None;
+}
+
+bool TraceStream::is_compressed( const char *filename )
+{
+    return ( get_stream_format( filename ) != Format_None );
+}
+
+bool TraceStream::open( const char *filename )
+{
+    close();
+
+    m_format = get_stream_format( filename );
+    if ( m_format == Format_None )
+        return false;
+
+    m_filename = filename;
+    m_quit = false;
+    m_avail = 0;
+    m_done = false;
+    m_errstr.clear();
+
+    m_thread = std::thread( &TraceStream::thread_func, this );
+    return true;
+}
+
+void TraceStream::close()
+{
+    if ( m_thread.joinable() )
+    {
+        m_quit = true;
+        m_thread.join();
+    }
+
+    for ( uint8_t *chunk : m_chunks )
+        free( chunk );
+    m_chunks.clear();
+
+    m_avail = 0;
+    m_done = false;
+}
+
+size_t TraceStream::read( uint64_t offset, void *data, size_t size )
+{
+    std::unique_lock< std::mutex > lock( m_mutex );
+
+    m_cond.wait( lock, [ & ]() { return m_done || ( m_avail >= offset + size ); } );
+
+    if ( offset >= m_avail )
+        return 0;
+
+    size = ( size_t )std::min< uint64_t >( size, m_avail - offset );
+
+    // Chunks are never moved or freed while the stream is open, so copying
+    //  under the lock only guards m_chunks against a concurrent push_back.
+    for ( size_t copied = 0; copied < size; )
+    {
+        uint64_t pos = offset + copied;
+        size_t chunk_offset = ( size_t )( pos % m_chunk_size );
+        size_t len = std::min< size_t >( size - copied, m_chunk_size - chunk_offset );
+
+        memcpy( ( uint8_t * )data + copied, m_chunks[ pos / m_chunk_size ] + chunk_offset, len );
+        copied += len;
+    }
+
+    return size;
+}
+
+std::string TraceStream::get_errstr()
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+
+    return m_errstr;
+}
+
+uint8_t *TraceStream::get_write_buf( size_t &size )
+{
+    // Only this thread modifies m_avail, so reading it unlocked is fine
+    if ( m_avail == m_chunks.size() * m_chunk_size )
+    {
+        uint8_t *chunk = ( uint8_t * )malloc( m_chunk_size );
+
+        if ( !chunk )
+            return NULL;
+
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_chunks.push_back( chunk );
+    }
+
+    size_t chunk_offset = ( size_t )( m_avail % m_chunk_size );
+
+    size = m_chunk_size - chunk_offset;
+    return m_chunks.back() + chunk_offset;
+}
+
+void TraceStream::commit( size_t size )
+{
+    if ( size )
+    {
+        {
+            std::lock_guard< std::mutex > lock( m_mutex );
+            m_avail += size;
+        }
+        m_cond.notify_all();
+    }
+}
+
+void TraceStream::thread_func()
+{
+    bool ret = false;
+    std::string errstr;
+
+    switch ( m_format )
+    {
+    case Format_Zip:
+        ret = decompress_zip( errstr );
+        break;
+    case Format_Gzip:
+        ret = decompress_gzip( errstr );
+        break;
+    case Format_Zstd:
+        ret = decompress_zstd( errstr );
+        break;
+    default:
+        break;
+    }
+
+    if ( m_quit )
+        errstr = "Decompression cancelled";
+    else if ( !ret && errstr.empty() )
+        errstr = "Decompression failed";
+
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        m_errstr = errstr;
+        m_done = true;
+    }
+    m_cond.notify_all();
+}
+
+bool TraceStream::decompress_zip( std::string &errstr )
+{
+    bool ret = false;
+    mz_zip_archive zip_archive;
+    mz_zip_reader_extract_iter_state *state = NULL;
+
+    memset( &zip_archive, 0, sizeof( zip_archive ) );
+    if ( !mz_zip_reader_init_file( &zip_archive, m_filename.c_str(), 0 ) )
+    {
+        errstr = "Failed to open zip archive";
+        return false;
+    }
+
+    // Stream the first file in the archive
+    for ( mz_uint i = 0; !state && ( i < mz_zip_reader_get_num_files( &zip_archive ) ); i++ )
+    {
+        if ( !mz_zip_reader_is_file_a_directory( &zip_archive, i ) )
+            state = mz_zip_reader_extract_iter_new( &zip_archive, i, 0 );
+    }
+
+    if ( !state )
+    {
+        errstr = "No file found in zip archive";
+    }
+    else
+    {
+        ret = true;
+        while ( !m_quit )
+        {
+            size_t size;
+            uint8_t *buf = get_write_buf( size );
+
+            if ( !buf )
+            {
+                errstr = "Out of memory";
+                ret = false;
+                break;
+            }
+
+            size_t len = mz_zip_reader_extract_iter_read( state, buf, size );
+            if ( !len )
+                break;
+
+            commit( len );
+        }
+
+        if ( !mz_zip_reader_extract_iter_free( state ) && ret )
+        {
+            errstr = "Zip decompression failed";
+            ret = false;
+        }
+    }
+
+    mz_zip_reader_end( &zip_archive );
+    return ret;
+}
+
+bool TraceStream::decompress_gzip( std::string &errstr )
+{
+    FILE *fp = fopen( m_filename.c_str(), "rb" );
+
+    if ( !fp )
+    {
+        errstr = strerror( errno );
+        return false;
+    }
+
+    bool ret = true;
+    uint32_t members = 0;
+    std::vector< uint8_t > inbuf( 256 * 1024 );
+    size_t inpos = 0;
+    size_t inlen = 0;
+
+    auto fill = [ & ]()
+    {
+        if ( inpos >= inlen )
+        {
+            inpos = 0;
+            inlen = fread( inbuf.data(), 1, inbuf.size(), fp );
+        }
+        return ( inpos < inlen );
+    };
+    auto getbyte = [ & ]()
+    {
+        return fill() ? inbuf[ inpos++ ] : -1;
+    };
+
+    // gzip files can be a series of concatenated members
+    while ( ret && !m_quit )
+    {
+        int id1 = getbyte();
+
+        if ( id1 < 0 )
+            break;
+
+        int id2 = getbyte();
+        int cm = getbyte();
+        if ( ( id1 != 0x1f ) || ( id2 != 0x8b ) || ( cm != 8 ) )
+        {
+            // Ignore trailing garbage after the first member like gzip does
+            if ( !members )
+            {
+                errstr = "Invalid gzip header";
+                ret = false;
+            }
+            break;
+        }
+
+        // Skip flags, mtime, xfl, os and optional header fields
+        int flags = getbyte();
+        for ( int i = 0; i < 6; i++ )
+            getbyte();
+        if ( flags & 0x04 )
+        {
+            int xlen = getbyte();
+
+            xlen |= getbyte() << 8;
+            while ( ( xlen-- > 0 ) && ( getbyte() >= 0 ) )
+                ;
+        }
+        if ( flags & 0x08 )
+        {
+            while ( getbyte() > 0 )
+                ;
+        }
+        if ( flags & 0x10 )
+        {
+            while ( getbyte() > 0 )
+                ;
+        }
+        if ( flags & 0x02 )
+        {
+            getbyte();
+            getbyte();
+        }
+
+        mz_stream stream;
+        mz_ulong crc = MZ_CRC32_INIT;
+        uint32_t isize = 0;
+        int status = MZ_OK;
+
+        memset( &stream, 0, sizeof( stream ) );
+        mz_inflateInit2( &stream, -MZ_DEFAULT_WINDOW_BITS );
+
+        while ( ( status == MZ_OK ) && !m_quit )
+        {
+            size_t size;
+            uint8_t *buf = get_write_buf( size );
+
+            if ( !buf )
+            {
+                errstr = "Out of memory";
+                break;
+            }
+            if ( !fill() )
+            {
+                errstr = "Unexpected end of gzip file";
+                break;
+            }
+
+            stream.next_in = &inbuf[ inpos ];
+            stream.avail_in = ( unsigned int )( inlen - inpos );
+            stream.next_out = buf;
+            stream.avail_out = ( unsigned int )size;
+
+            status = mz_inflate( &stream, MZ_NO_FLUSH );
+
+            size_t consumed = ( inlen - inpos ) - stream.avail_in;
+            size_t produced = size - stream.avail_out;
+
+            // No progress with input and output space available means bad data
+            if ( ( status == MZ_BUF_ERROR ) && ( consumed || produced ) )
+                status = MZ_OK;
+
+            inpos += consumed;
+            crc = mz_crc32( crc, buf, produced );
+            isize += ( uint32_t )produced;
+            commit( produced );
+        }
+
+        mz_inflateEnd( &stream );
+
+        if ( status != MZ_STREAM_END )
+        {
+            if ( errstr.empty() )
+                errstr = "gzip data is corrupt";
+            ret = false;
+            break;
+        }
+
+        // Trailer is little endian crc32 followed by uncompressed size mod 2^32
+        uint32_t trailer[ 2 ] = { 0, 0 };
+        for ( int i = 0; i < 8; i++ )
+        {
+            int c = getbyte();
+
+            trailer[ i / 4 ] |= ( uint32_t )( c & 0xff ) << ( 8 * ( i % 4 ) );
+        }
+
+        if ( ( trailer[ 0 ] != ( uint32_t )crc ) || ( trailer[ 1 ] != isize ) )
+        {
+            errstr = "gzip crc or length mismatch";
+            ret = false;
+        }
+
+        members++;
+    }
+
+    fclose( fp );
+    return ret;
+}
+
+bool TraceStream::decompress_zstd( std::string &errstr )
+{
+#if defined( USE_ZSTD )
+    FILE *fp = fopen( m_filename.c_str(), "rb" );
+
+    if ( !fp )
+    {
+        errstr = strerror( errno );
+        return false;
+    }
+
+    bool ret = true;
+    size_t hint = 1;
+    ZSTD_DStream *dstream = ZSTD_createDStream();
+    std::vector< uint8_t > inbuf( ZSTD_DStreamInSize() );
+
+    ZSTD_initDStream( dstream );
+
+    while ( ret && !m_quit )
+    {
+        size_t inlen = fread( inbuf.data(), 1, inbuf.size(), fp );
+        ZSTD_inBuffer input = { inbuf.data(), inlen, 0 };
+
+        if ( !inlen )
+            break;
+
+        // Keep going while there is input or the last call filled all output
+        bool output_full = true;
+        while ( ( ( input.pos < input.size ) || output_full ) && !m_quit )
+        {
+            size_t size;
+            uint8_t *buf = get_write_buf( size );
+
+            if ( !buf )
+            {
+                errstr = "Out of memory";
+                ret = false;
+                break;
+            }
+
+            ZSTD_outBuffer output = { buf, size, 0 };
+
+            hint = ZSTD_decompressStream( dstream, &output, &input );
+            if ( ZSTD_isError( hint ) )
+            {
+                errstr = ZSTD_getErrorName( hint );
+                ret = false;
+                break;
+            }
+
+            output_full = ( output.pos == output.size );
+            commit( output.pos );
+        }
+    }
+
+    if ( ret && hint && !m_quit )
+    {
+        errstr = "Unexpected end of zstd file";
+        ret = false;
+    }
+
+    ZSTD_freeDStream( dstream );
+    fclose( fp );
+    return ret;
+#else
+    errstr = "zstd traces require building with USE_ZSTD";
+    return false;
+#endif
+}
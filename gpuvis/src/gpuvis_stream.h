@@ -0,0 +1,90 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef GPUVIS_STREAM_H_
+#define GPUVIS_STREAM_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Decompresses a compressed trace (first file of a .zip, gzip, or zstd with
+//  USE_ZSTD) into memory on a background thread. Reads block until the bytes
+//  they want have been decompressed, so parsing overlaps decompression.
+class TraceStream
+{
+public:
+    TraceStream() {}
+    ~TraceStream() { close(); }
+
+    // Returns true if file starts with a zip, gzip, or zstd signature
+    static bool is_compressed( const char *filename );
+
+    bool open( const char *filename );
+    void close();
+
+    // Copy size bytes at offset into data. Returns count of bytes copied,
+    //  which is short only at the end of the data or on error.
+    size_t read( uint64_t offset, void *data, size_t size );
+
+    // Error string if decompression failed
+    std::string get_errstr();
+
+protected:
+    void thread_func();
+    bool decompress_zip( std::string &errstr );
+    bool decompress_gzip( std::string &errstr );
+    bool decompress_zstd( std::string &errstr );
+
+    // Space to decompress into: at least 1 byte past m_avail
+    uint8_t *get_write_buf( size_t &size );
+    // Make size more bytes at m_avail visible to readers
+    void commit( size_t size );
+
+public:
+    enum format_t { Format_None, Format_Zip, Format_Gzip, Format_Zstd };
+    format_t m_format = Format_None;
+    std::string m_filename;
+
+    std::thread m_thread;
+    std::atomic< bool > m_quit = { false };
+
+    // Decompressed data in m_chunk_size chunks
+    static const size_t m_chunk_size = 1024 * 1024;
+    std::vector< uint8_t * > m_chunks;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    // Count of decompressed bytes readers can see
+    uint64_t m_avail = 0;
+    // Set when all data is decompressed or decompression failed
+    bool m_done = false;
+    std::string m_errstr;
+};
+
+#endif // GPUVIS_STREAM_H_
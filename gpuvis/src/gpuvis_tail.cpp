@@ -0,0 +1,243 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <functional>
+#include <filesystem>
+
+#include "gpuvis_macros.h"
+#include "trace-cmd/trace-read.h"
+#include "gpuvis_tail.h"
+
+namespace fs = std::filesystem;
+
+void logf( const char *fmt, ... ) ATTRIBUTE_PRINTF( 1, 2 );
+
+trace_chunk_t::~trace_chunk_t()
+{
+    for ( trace_event_t &event : events )
+        delete [] event.fields;
+}
+
+// "glxgears_2017-10-13_17-52-56" -> "glxgears_", or "" if stem isn't a capture name
+static std::string get_capture_prefix( const std::string &stem )
+{
+    static const char pattern[] = "_0000-00-00_00-00-00";
+    size_t len = sizeof( pattern ) - 1;
+
+    if ( stem.size() <= len )
+        return "";
+
+    size_t start = stem.size() - len;
+    for ( size_t i = 0; i < len; i++ )
+    {
+        char c = stem[ start + i ];
+
+        if ( ( pattern[ i ] == '0' ) ? !isdigit( ( unsigned char )c ) : ( c != pattern[ i ] ) )
+            return "";
+    }
+
+    return stem.substr( 0, start + 1 );
+}
+
+static bool get_file_info( const std::string &filename, uint64_t &size, int64_t &mtime )
+{
+    struct stat st;
+
+    if ( stat( filename.c_str(), &st ) )
+        return false;
+
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+void TraceTail::start( const char *filename, StrPool *strpool, const std::vector< cpu_resume_t > &resume,
+                       uint32_t load_threads, uint32_t poll_ms )
+{
+    stop();
+
+    fs::path path( filename );
+
+    m_strpool = strpool;
+    m_resume = resume;
+    m_load_threads = load_threads;
+    m_poll_ms = poll_ms;
+    m_dir = path.parent_path().string();
+    m_ext = path.extension().string();
+    m_capture_prefix = get_capture_prefix( path.stem().string() );
+
+    m_last_file = filename;
+    get_file_info( m_last_file, m_last_size, m_last_mtime );
+    m_pending_file.clear();
+    m_pending_size = 0;
+
+    m_quit = false;
+    m_thread = std::thread( &TraceTail::thread_func, this );
+}
+
+void TraceTail::stop()
+{
+    if ( m_thread.joinable() )
+    {
+        m_quit = true;
+        m_thread.join();
+    }
+
+    std::lock_guard< std::mutex > lock( m_mutex );
+
+    for ( trace_chunk_t *chunk : m_chunks )
+        delete chunk;
+    m_chunks.clear();
+}
+
+trace_chunk_t *TraceTail::get_chunk()
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+
+    if ( m_chunks.empty() )
+        return NULL;
+
+    trace_chunk_t *chunk = m_chunks.front();
+
+    m_chunks.erase( m_chunks.begin() );
+    return chunk;
+}
+
+// Look for our file being rewritten or the next capture file. Only returns
+//  a file once its size is unchanged between two polls.
+bool TraceTail::find_new_file( std::string &filename )
+{
+    uint64_t size;
+    int64_t mtime;
+    std::string candidate;
+
+    if ( get_file_info( m_last_file, size, mtime ) &&
+         ( ( size != m_last_size ) || ( mtime != m_last_mtime ) ) )
+    {
+        candidate = m_last_file;
+    }
+    else if ( !m_capture_prefix.empty() )
+    {
+        std::error_code ec;
+        const std::string last_name = fs::path( m_last_file ).filename().string();
+
+        // Capture names sort by time, so the next file is the smallest name after ours
+        for ( const fs::directory_entry &entry : fs::directory_iterator( m_dir.empty() ? "." : m_dir, ec ) )
+        {
+            const fs::path &path = entry.path();
+            const std::string name = path.filename().string();
+
+            if ( ( path.extension().string() == m_ext ) &&
+                 !name.compare( 0, m_capture_prefix.size(), m_capture_prefix ) &&
+                 !get_capture_prefix( path.stem().string() ).empty() &&
+                 ( name > last_name ) &&
+                 ( candidate.empty() || ( path.string() < candidate ) ) )
+            {
+                candidate = path.string();
+            }
+        }
+
+        if ( candidate.empty() || !get_file_info( candidate, size, mtime ) )
+            return false;
+    }
+    else
+    {
+        return false;
+    }
+
+    if ( size && ( candidate == m_pending_file ) && ( size == m_pending_size ) )
+    {
+        filename = candidate;
+        m_pending_file.clear();
+        m_last_file = candidate;
+        m_last_size = size;
+        m_last_mtime = mtime;
+        return true;
+    }
+
+    m_pending_file = candidate;
+    m_pending_size = size;
+    return false;
+}
+
+void TraceTail::read_chunk( const std::string &filename )
+{
+    GPUVIS_TRACE_BLOCKF( "%s: %s", __func__, filename.c_str() );
+
+    trace_chunk_t *chunk = new trace_chunk_t;
+    EventCallback trace_cb = [ this, chunk ]( const trace_event_t &event )
+    {
+        chunk->events.push_back( event );
+
+        // Return 1 to cancel loading
+        return m_quit.load() ? 1 : 0;
+    };
+
+    chunk->filename = filename;
+    chunk->trace_info.trim_trace = false;
+    chunk->trace_info.m_load_threads = m_load_threads;
+    chunk->trace_info.m_resume = m_resume;
+
+    if ( ( read_trace_file( filename.c_str(), *m_strpool, chunk->trace_info, trace_cb ) < 0 ) ||
+         m_quit )
+    {
+        logf( "[Error] Tail: reading %s failed.", filename.c_str() );
+        delete chunk;
+        return;
+    }
+
+    m_resume = chunk->trace_info.m_resume;
+
+    // Binary marker events are decoded with their scope start times, which puts
+    //  them ahead of the raw_data event that carried them.
+    auto ts_cmp = []( const trace_event_t &lx, const trace_event_t &rx ) { return lx.ts < rx.ts; };
+    if ( !std::is_sorted( chunk->events.begin(), chunk->events.end(), ts_cmp ) )
+        std::stable_sort( chunk->events.begin(), chunk->events.end(), ts_cmp );
+
+    std::lock_guard< std::mutex > lock( m_mutex );
+    m_chunks.push_back( chunk );
+}
+
+void TraceTail::thread_func()
+{
+    const uint32_t sleep_ms = 50;
+
+    while ( !m_quit )
+    {
+        std::string filename;
+
+        for ( uint32_t ms = 0; ( ms < m_poll_ms ) && !m_quit; ms += sleep_ms )
+            std::this_thread::sleep_for( std::chrono::milliseconds( sleep_ms ) );
+
+        if ( !m_quit && find_new_file( filename ) )
+            read_chunk( filename );
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef GPUVIS_TAIL_H_
+#define GPUVIS_TAIL_H_
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+// Events read from a new or rewritten trace file. Strings are in the
+//  StrPool given to TraceTail::start().
+struct trace_chunk_t
+{
+    ~trace_chunk_t();
+
+    std::string filename;
+    trace_info_t trace_info;
+    std::vector< trace_event_t > events;
+};
+
+// Watch a loaded trace file for rewrites and for newer capture files written
+//  next to it by gpuvis_trigger_capture_and_keep_tracing() (exename_date_time.dat).
+//  Files are decoded on a background thread and handed back with get_chunk().
+//  Only records past where the last read stopped on each cpu are decoded.
+class TraceTail
+{
+public:
+    TraceTail() {}
+    ~TraceTail() { stop(); }
+
+    // strpool must be thread safe and outlive us (or our stop() call). resume is
+    //  where reading the loaded file stopped (see trace_info_t::m_resume).
+    void start( const char *filename, StrPool *strpool, const std::vector< cpu_resume_t > &resume,
+                uint32_t load_threads, uint32_t poll_ms );
+    void stop();
+    bool is_running() const { return m_thread.joinable(); }
+
+    // Returns oldest decoded chunk (caller deletes) or NULL
+    trace_chunk_t *get_chunk();
+
+protected:
+    void thread_func();
+    bool find_new_file( std::string &filename );
+    void read_chunk( const std::string &filename );
+
+public:
+    uint32_t m_load_threads = 1;
+    uint32_t m_poll_ms = 1000;
+
+    std::thread m_thread;
+    std::atomic< bool > m_quit = { false };
+
+    std::mutex m_mutex;
+    std::vector< trace_chunk_t * > m_chunks;
+
+    // Tail thread state
+    StrPool *m_strpool = nullptr;
+    // Where the last successful read stopped on each cpu. Kept across capture
+    //  files: newer files of the same session hold the same cpu streams.
+    std::vector< cpu_resume_t > m_resume;
+    std::string m_dir;
+    // "exename_" if we were loaded from a capture file, otherwise empty
+    std::string m_capture_prefix;
+    std::string m_ext;
+    // Newest file read and its size and mtime when we read it
+    std::string m_last_file;
+    uint64_t m_last_size = 0;
+    int64_t m_last_mtime = 0;
+    // New file waiting for its size to stop changing
+    std::string m_pending_file;
+    uint64_t m_pending_size = 0;
+};
+
+#endif // GPUVIS_TAIL_H_
@@ -0,0 +1,276 @@
+/*
+ * Copyright 2019 Valve Software
+ *
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <array>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+
+#include <cinder/app/App.h>
+
+#include "imgui/imgui.h"
+#include "gpuvis_macros.h"
+#include "trace-cmd/trace-read.h"
+#include "gpuvis_utils.h"
+#include "tdopexpr.h"
+#include "gpuvis.h"
+
+#include "MiniConfig.h"
+
+static uint32_t trigram_key( const char *str )
+{
+    return ( ( uint32_t )tolower( ( uint8_t )str[ 0 ] ) << 16 ) |
+           ( ( uint32_t )tolower( ( uint8_t )str[ 1 ] ) << 8 ) |
+           ( uint32_t )tolower( ( uint8_t )str[ 2 ] );
+}
+
+// Unique trigrams of str
+static void get_trigrams( const char *str, size_t len, std::vector< uint32_t > &trigrams )
+{
+    trigrams.clear();
+
+    for ( size_t i = 0; i + 3 <= len; i++ )
+        trigrams.push_back( trigram_key( str + i ) );
+
+    std::sort( trigrams.begin(), trigrams.end() );
+    trigrams.erase( std::unique( trigrams.begin(), trigrams.end() ), trigrams.end() );
+}
+
+// Returned by get_str() for fields with non string values
+static const char s_nonstr[] = "";
+
+const char *TextIndex::get_str( const trace_event_t &event ) const
+{
+    if ( !m_key )
+        return event.comm;
+
+    // We can compare pointers since they're from same string pool
+    for ( uint32_t i = 0; i < event.numfields; i++ )
+    {
+        const event_field_t &field = event.fields[ i ];
+
+        if ( field.key == m_key )
+            return field.is_str() ? field.value : s_nonstr;
+    }
+
+    return NULL;
+}
+
+void TextIndex::add_str_trigrams( const char *str, uint32_t stridx )
+{
+    std::vector< uint32_t > trigrams;
+
+    // Strings are added in index order, so the posting lists stay sorted
+    get_trigrams( str, strlen( str ), trigrams );
+    for ( uint32_t key : trigrams )
+        m_trigrams.get_val_create( key )->push_back( stridx );
+}
+
+bool TextIndex::add_events( const std::vector< trace_event_t > &events, const AsyncJob *job )
+{
+    while ( m_event_count < events.size() )
+    {
+        if ( job && job->is_cancelled() )
+            return false;
+
+        size_t last = std::min< size_t >( m_event_count + 64 * 1024, events.size() );
+
+        for ( size_t i = m_event_count; i < last; i++ )
+        {
+            const trace_event_t &event = events[ i ];
+            const char *str = get_str( event );
+
+            // Non string values are formatted when filtering, so we can't index them
+            if ( str == s_nonstr )
+                m_complete = false;
+            if ( !str || !str[ 0 ] )
+                continue;
+
+            uint32_t *pidx = m_str_idx.get_val( str );
+
+            if ( !pidx )
+            {
+                pidx = m_str_idx.get_val( str, m_strs.size() );
+
+                m_strs.push_back( str );
+                m_str_events.emplace_back();
+                add_str_trigrams( str, *pidx );
+            }
+
+            m_str_events[ *pidx ].push_back( event.id );
+        }
+
+        m_event_count = last;
+    }
+
+    return true;
+}
+
+bool TextIndex::find( const char *substr, std::vector< uint32_t > &locs ) const
+{
+    std::vector< uint32_t > trigrams;
+    std::vector< const EventLocs * > lists;
+
+    get_trigrams( substr, strlen( substr ), trigrams );
+    if ( trigrams.empty() || !m_complete )
+        return false;
+
+    locs.clear();
+
+    for ( uint32_t key : trigrams )
+    {
+        const EventLocs *plocs = m_trigrams.get_val( key );
+
+        // No string has this trigram, so nothing matches
+        if ( !plocs )
+            return true;
+        lists.push_back( plocs );
+    }
+
+    // Strings with all the trigrams, then check each for substr
+    EventLocs candidates;
+    EventLocs::intersect( lists, candidates );
+
+    lists.clear();
+    for ( uint32_t stridx : candidates )
+    {
+        if ( strcasestr( m_strs[ stridx ], substr ) )
+            lists.push_back( &m_str_events[ stridx ] );
+    }
+
+    EventLocs events;
+    EventLocs::unite( lists, events );
+
+    locs = events.to_vector();
+    return true;
+}
+
+void TextIndex::clear()
+{
+    m_event_count = 0;
+    m_complete = true;
+
+    m_strs.clear();
+    m_str_events.clear();
+    m_str_idx.m_map.clear();
+    m_trigrams.m_map.clear();
+}
+
+size_t TextIndex::mem_size() const
+{
+    size_t size = m_strs.capacity() * sizeof( const char * ) +
+            m_str_events.capacity() * sizeof( EventLocs ) +
+            m_str_idx.m_map.size() * ( sizeof( const char * ) + sizeof( uint32_t ) );
+
+    for ( const EventLocs &locs : m_str_events )
+        size += locs.mem_size();
+    for ( const auto &item : m_trigrams.m_map )
+        size += sizeof( item ) + item.second.mem_size();
+
+    return size;
+}
+
+void TraceEvents::start_text_index()
+{
+    if ( !BuildTextIndex )
+        return;
+
+    stop_text_index();
+
+    m_text_index.buf.m_key = m_strpool.getstr( "buf" );
+    m_text_index.ready = false;
+    m_text_index.job = new AsyncJob;
+    m_text_index.job->start( [ this ]()
+    {
+        GPUVIS_TRACE_BLOCK( "text_index" );
+        util_time_t t0 = util_get_time();
+
+        // Picks up after the events indexed last time
+        if ( m_text_index.comm.add_events( m_events, m_text_index.job ) &&
+             m_text_index.buf.add_events( m_events, m_text_index.job ) )
+        {
+            m_text_index.ready = true;
+
+            logf( "Text index: %lu events, %lu comm strings, %lu buf strings, %.2fMB in %.2fms",
+                  m_text_index.buf.m_event_count,
+                  m_text_index.comm.m_strs.size(), m_text_index.buf.m_strs.size(),
+                  ( m_text_index.comm.mem_size() + m_text_index.buf.mem_size() ) / ( 1024.0 * 1024.0 ),
+                  util_time_to_ms( t0, util_get_time() ) );
+        }
+    } );
+}
+
+void TraceEvents::stop_text_index()
+{
+    // AsyncJob destructor cancels and waits
+    delete m_text_index.job;
+    m_text_index.job = nullptr;
+}
+
+size_t TraceEvents::get_text_index_candidates( class TdopExpr *tdop_expr, std::vector< uint32_t > &locs )
+{
+    size_t count = 0;
+    bool found = false;
+
+    if ( !m_text_index.ready )
+        return 0;
+
+    const std::vector< const char * > &vars = tdopexpr_get_variables( tdop_expr );
+
+    for ( const tdop_contains_t &term : tdopexpr_get_required_contains( tdop_expr ) )
+    {
+        std::vector< uint32_t > termlocs;
+        const char *var = vars[ term.var ];
+        const TextIndex *index = !strcasecmp( var, "comm" ) ? &m_text_index.comm :
+                                 ( var == m_text_index.buf.m_key ) ? &m_text_index.buf : NULL;
+
+        if ( !index || !index->find( term.str, termlocs ) )
+            continue;
+
+        // Events must match every term
+        if ( !found )
+        {
+            locs.swap( termlocs );
+        }
+        else
+        {
+            std::vector< uint32_t > both;
+
+            std::set_intersection( locs.begin(), locs.end(), termlocs.begin(), termlocs.end(),
+                                   std::back_inserter( both ) );
+            locs.swap( both );
+        }
+
+        found = true;
+        count = index->m_event_count;
+    }
+
+    return found ? count : 0;
+}
@@ -33,6 +33,32 @@
 #define _GPUVIS_TRACE_UTILS_H_
 
 #include <stdarg.h>
+#include <stdint.h>
+
+// Binary marker batches written to trace_marker_raw. ftrace stores these as
+// ftrace:raw_data events with the first 4 bytes as the id field. A batch is:
+//   gpuvis_raw_batch_t header
+//   gpuvis_raw_rec_t recs[ num_recs ]
+//   num_strs * { uint32_t str_id; uint16_t len; char str[ len ]; } (unaligned)
+#define GPUVIS_RAW_BATCH_ID     0x62767067 // "gpvb"
+#define GPUVIS_RAW_BATCH_MAX    4000
+#define GPUVIS_RAW_STR_MAX      256
+
+typedef struct gpuvis_raw_batch
+{
+    uint32_t id;            // GPUVIS_RAW_BATCH_ID
+    uint16_t num_recs;
+    uint16_t num_strs;
+    uint64_t now;           // gpuvis_gettime_u64() when the batch was written
+} gpuvis_raw_batch_t;
+
+typedef struct gpuvis_raw_rec
+{
+    uint64_t t0;            // gpuvis_gettime_u64() at scope start
+    uint64_t duration;      // scope duration in ns
+    uint32_t str_id;
+    uint32_t tid;
+} gpuvis_raw_rec_t;
 
 #if !defined( __linux__ )
 #define GPUVIS_TRACE_UTILS_DISABLE
@@ -64,6 +90,7 @@
   #endif
 #else
   #define GPUVIS_EXTERN   extern
+  #define THREAD_LOCAL    __thread
 #endif
 
 // From kernel/trace/trace.h
@@ -92,6 +119,20 @@ GPUVIS_EXTERN int gpuvis_trace_begin_ctx_vprintf( unsigned int ctx, const char *
 GPUVIS_EXTERN int gpuvis_trace_end_ctx_printf( unsigned int ctx, const char *fmt, ... ) GPUVIS_ATTR_PRINTF( 2, 3 );
 GPUVIS_EXTERN int gpuvis_trace_end_ctx_vprintf( unsigned int ctx, const char *fmt, va_list ap ) GPUVIS_ATTR_PRINTF( 2, 0 );
 
+// Binary marker mode: GPUVIS_TRACE_BLOCK scopes are queued as gpuvis_raw_rec_t
+// records in per-thread lock-free rings instead of being printf'd. A background
+// thread writes them in batches to tracefs trace_marker_raw, or to fallback_file
+// if that isn't available. gpuvis decodes them back into ftrace print events.
+GPUVIS_EXTERN int gpuvis_trace_binary_init( const char *fallback_file );
+GPUVIS_EXTERN void gpuvis_trace_binary_shutdown( void );
+
+// Queue scope record. str is copied the first time it's seen, so it can be any
+// string. Returns -1 if binary marker mode is off.
+GPUVIS_EXTERN int gpuvis_trace_binary_scope( const char *str, uint64_t t0, uint64_t duration );
+
+// Time count scopes through the printf and binary paths and print ns per scope.
+GPUVIS_EXTERN void gpuvis_trace_benchmark( unsigned int count );
+
 // Execute "trace-cmd start -b 2000 -D -i -e sched:sched_switch -e ..."
 GPUVIS_EXTERN int gpuvis_start_tracing( unsigned int kbuffersize );
 // Execute "trace-cmd extract"
@@ -110,6 +151,10 @@ GPUVIS_EXTERN const char *gpuvis_get_tracefs_filename( char *buf, size_t buflen,
 
 // Internal function used by GPUVIS_COUNT_HOT_FUNC_CALLS macro
 GPUVIS_EXTERN void gpuvis_count_hot_func_calls_internal_( const char *func );
+// Write "func calls:N" summaries for GPUVIS_COUNT_HOT_FUNC_CALLS runs still going.
+// Safe to call from any thread: ie, once a frame. Runs that go idle are written
+// by a background thread, and a thread's runs are written when it exits.
+GPUVIS_EXTERN void gpuvis_flush_hot_func_calls( void );
 
 struct GpuvisTraceBlock;
 static inline void gpuvis_trace_block_begin( struct GpuvisTraceBlock *block, const char *str );
@@ -228,7 +273,9 @@ static inline void gpuvis_trace_block_begin( struct GpuvisTraceBlock* block, con
 
 static inline void gpuvis_trace_block_end( struct GpuvisTraceBlock *block )
 {
-    gpuvis_trace_block_finalize(block->m_t0, block->m_str);
+    // Constant scope strings can go through binary marker mode
+    if ( gpuvis_trace_binary_scope( block->m_str, block->m_t0, gpuvis_gettime_u64() - block->m_t0 ) < 0 )
+        gpuvis_trace_block_finalize( block->m_t0, block->m_str );
 }
 
 static inline void gpuvis_trace_blockf_vbegin( struct GpuvisTraceBlockf *block, const char *fmt, va_list ap)
@@ -270,6 +317,13 @@ static inline int gpuvis_trace_begin_ctx_vprintf( unsigned int ctx, const char *
 static inline int gpuvis_trace_end_ctx_printf( unsigned int ctx, const char *fmt, ... ) { return 0; }
 static inline int gpuvis_trace_end_ctx_vprintf( unsigned int ctx, const char *fmt, va_list ap ) { return 0; }
 
+static inline int gpuvis_trace_binary_init( const char *fallback_file ) { ( void )fallback_file; return -1; }
+static inline void gpuvis_trace_binary_shutdown() {}
+static inline int gpuvis_trace_binary_scope( const char *str, uint64_t t0, uint64_t duration ) { ( void )str; ( void )t0; ( void )duration; return -1; }
+static inline void gpuvis_trace_benchmark( unsigned int count ) { ( void )count; }
+
+static inline void gpuvis_flush_hot_func_calls() {}
+
 static inline int gpuvis_start_tracing( unsigned int kbuffersize ) { return 0; }
 static inline int gpuvis_trigger_capture_and_keep_tracing( char *filename, size_t size ) { return 0; }
 static inline int gpuvis_stop_tracing() { return 0; }
@@ -304,6 +358,7 @@ static inline void gpuvis_trace_blockf_end( struct GpuvisTraceBlockf *block ) {}
 
 #define _GNU_SOURCE 1
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -312,6 +367,7 @@ static inline void gpuvis_trace_blockf_end( struct GpuvisTraceBlockf *block ) {}
 #include <sys/vfs.h>
 #include <linux/magic.h>
 #include <sys/syscall.h>
+#include <pthread.h>
 
 #undef GPUVIS_EXTERN
 #ifdef __cplusplus
@@ -331,17 +387,68 @@ static int g_trace_fd = -2;
 static int g_tracefs_dir_inited = 0;
 static char g_tracefs_dir[ PATH_MAX ];
 
-#ifdef __cplusplus
-#include <unordered_map>
+// Records per thread ring, must be a power of 2
+#define GPUVIS_RING_SIZE 4096
+// Per thread string address to id cache entries, must be a power of 2
+#define GPUVIS_STR_CACHE_SIZE 256
+// Interned strings table slots, must be a power of 2
+#define GPUVIS_STR_TABLE_SIZE 4096
 
-struct funcinfo_t
+// Single producer (owning thread), single consumer (flush thread) ring
+typedef struct gpuvis_ring
 {
-    uint64_t tfirst = 0;
-    uint64_t tlast = 0;
-    uint32_t count = 0;
-};
-static std::unordered_map< pid_t, std::unordered_map< const char *, funcinfo_t > > g_hotfuncs;
-#endif // __cplusplus
+    uint32_t head;
+    uint32_t tail;
+    uint32_t tid;
+    uint32_t dropped;
+    int exited;
+    struct gpuvis_ring *next;
+    gpuvis_raw_rec_t recs[ GPUVIS_RING_SIZE ];
+} gpuvis_ring_t;
+
+static int g_binary_enabled = 0;
+static int g_binary_fd = -1;
+static uint32_t g_binary_dropped = 0;
+static pthread_t g_binary_thread;
+static pthread_key_t g_binary_ring_key;
+static pthread_once_t g_binary_once = PTHREAD_ONCE_INIT;
+// Guards adding and unlinking rings. Never held across I/O.
+static pthread_mutex_t g_binary_mutex = PTHREAD_MUTEX_INITIALIZER;
+static gpuvis_ring_t *g_binary_rings = NULL;
+// Interned string copies, open addressed on string hash. Slots are only ever
+// filled (with a CAS) so lookups and inserts don't lock. Id is slot + 1.
+static const char *g_binary_strs[ GPUVIS_STR_TABLE_SIZE ];
+
+// Hot func slots per thread, must be a power of 2
+#define GPUVIS_HOT_FUNCS_SIZE 256
+// Calls more than this far apart start a new run
+#define GPUVIS_HOT_FUNC_GAP_NS ( 3 * 1000000 )
+// How often the background thread looks for idle runs
+#define GPUVIS_HOT_FUNC_FLUSH_NS ( 50 * 1000000 )
+
+// Run of calls to func. Only the owning thread starts or extends runs, any
+// thread can take a run to report it by swapping count to 0.
+typedef struct gpuvis_hot_func
+{
+    const char *func;
+    uint64_t tfirst;
+    uint64_t tlast;
+    uint32_t count;
+} gpuvis_hot_func_t;
+
+// Per thread table, cache line aligned so threads don't share lines
+typedef struct gpuvis_hot_funcs
+{
+    gpuvis_hot_func_t funcs[ GPUVIS_HOT_FUNCS_SIZE ];
+    pid_t tid;
+    int in_use;
+    struct gpuvis_hot_funcs *next;
+} __attribute__( ( aligned( 64 ) ) ) gpuvis_hot_funcs_t;
+
+// Lock-free list of tables. Tables are never freed, exited threads' tables get reused.
+static gpuvis_hot_funcs_t *g_hot_funcs = NULL;
+static pthread_key_t g_hot_funcs_key;
+static pthread_once_t g_hot_funcs_once = PTHREAD_ONCE_INIT;
 
 static pid_t gpuvis_gettid()
 {
@@ -387,86 +494,233 @@ static int exec_tracecmd( const char *cmd )
 
 GPUVIS_EXTERN int gpuvis_trace_init()
 {
-    if ( g_trace_fd == -2 )
+    int fd = __atomic_load_n( &g_trace_fd, __ATOMIC_ACQUIRE );
+
+    // Hot func runs can be reported from several threads at once
+    if ( fd == -2 )
     {
-        char filename[ PATH_MAX ];
+        static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-        // The "trace_marker" file allows userspace to write into the ftrace buffer.
-        if ( !gpuvis_get_tracefs_filename( filename, sizeof( filename ), "trace_marker" ) )
-            g_trace_fd = -1;
-        else
-            g_trace_fd = open( filename, O_WRONLY );
+        pthread_mutex_lock( &s_mutex );
+
+        fd = __atomic_load_n( &g_trace_fd, __ATOMIC_ACQUIRE );
+        if ( fd == -2 )
+        {
+            char filename[ PATH_MAX ];
+
+            // The "trace_marker" file allows userspace to write into the ftrace buffer.
+            if ( !gpuvis_get_tracefs_filename( filename, sizeof( filename ), "trace_marker" ) )
+                fd = -1;
+            else
+                fd = open( filename, O_WRONLY );
+
+            __atomic_store_n( &g_trace_fd, fd, __ATOMIC_RELEASE );
+        }
+
+        pthread_mutex_unlock( &s_mutex );
     }
 
-    return g_trace_fd;
+    return fd;
 }
 
-#if !defined( __cplusplus )
-static void flush_hot_func_calls()
+// Take run from slot and write it out. Returns 0 if there was nothing to take.
+static int hot_func_report( gpuvis_hot_func_t *slot, pid_t tid, uint64_t t0 )
 {
-    //$ TODO: hot func calls for C
+    const char *func = __atomic_load_n( &slot->func, __ATOMIC_ACQUIRE );
+    uint64_t tfirst = __atomic_load_n( &slot->tfirst, __ATOMIC_RELAXED );
+    uint64_t tlast = __atomic_load_n( &slot->tlast, __ATOMIC_RELAXED );
+    uint32_t count = __atomic_exchange_n( &slot->count, 0, __ATOMIC_ACQ_REL );
+
+    if ( !count )
+        return 0;
+
+    gpuvis_trace_printf( "%s calls:%u (lduration=%lu tid=%d offset=-%lu)\n",
+                         func, count, tlast - tfirst, tid, t0 - tfirst );
+    return 1;
 }
-#else
-static void flush_hot_func_calls()
+
+// Report runs in table with no calls for min_idle ns, or all of them if min_idle is 0
+static void hot_funcs_flush_table( gpuvis_hot_funcs_t *table, uint64_t t0, uint64_t min_idle )
 {
-    if ( g_hotfuncs.empty() )
-        return;
+    size_t i;
+
+    for ( i = 0; i < GPUVIS_HOT_FUNCS_SIZE; i++ )
+    {
+        gpuvis_hot_func_t *slot = &table->funcs[ i ];
+
+        if ( !__atomic_load_n( &slot->count, __ATOMIC_RELAXED ) )
+            continue;
+
+        // Owner can be extending the run past t0, so compare signed
+        if ( min_idle && ( int64_t )( t0 - __atomic_load_n( &slot->tlast, __ATOMIC_RELAXED ) ) < ( int64_t )min_idle )
+            continue;
+
+        hot_func_report( slot, __atomic_load_n( &table->tid, __ATOMIC_RELAXED ), t0 );
+    }
+}
 
+static void hot_funcs_flush_all( uint64_t min_idle )
+{
+    gpuvis_hot_funcs_t *table;
     uint64_t t0 = gpuvis_gettime_u64();
 
-    for ( auto &x : g_hotfuncs )
+    for ( table = __atomic_load_n( &g_hot_funcs, __ATOMIC_ACQUIRE ); table; table = table->next )
+    {
+        if ( __atomic_load_n( &table->in_use, __ATOMIC_ACQUIRE ) )
+            hot_funcs_flush_table( table, t0, min_idle );
+    }
+}
+
+static void hot_funcs_thread_exited( void *data )
+{
+    gpuvis_hot_funcs_t *table = ( gpuvis_hot_funcs_t * )data;
+
+    hot_funcs_flush_table( table, gpuvis_gettime_u64(), 0 );
+    __atomic_store_n( &table->in_use, 0, __ATOMIC_RELEASE );
+}
+
+// Runs only end on the next call to their func, so a func that stops being
+// called would never be reported. Write those out once they've gone idle.
+static void *hot_funcs_flush_thread( void *data )
+{
+    ( void )data;
+
+    for ( ;; )
+    {
+        struct timespec ts = { 0, GPUVIS_HOT_FUNC_FLUSH_NS };
+
+        nanosleep( &ts, NULL );
+        hot_funcs_flush_all( GPUVIS_HOT_FUNC_GAP_NS );
+    }
+
+    return NULL;
+}
+
+static void hot_funcs_init_once( void )
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_key_create( &g_hot_funcs_key, hot_funcs_thread_exited );
+
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    pthread_create( &thread, &attr, hot_funcs_flush_thread, NULL );
+    pthread_attr_destroy( &attr );
+}
+
+static gpuvis_hot_funcs_t *hot_funcs_get_table( void )
+{
+    static THREAD_LOCAL gpuvis_hot_funcs_t *s_table = NULL;
+
+    if ( !s_table )
     {
-        for ( auto &y : x.second )
+        gpuvis_hot_funcs_t *table;
+
+        pthread_once( &g_hot_funcs_once, hot_funcs_init_once );
+
+        // Try to reuse a table from an exited thread
+        for ( table = __atomic_load_n( &g_hot_funcs, __ATOMIC_ACQUIRE ); table; table = table->next )
         {
-            if ( y.second.count )
-            {
-                pid_t tid = x.first;
-                const char *func = y.first;
-                uint64_t offset = t0 - y.second.tfirst;
-                uint64_t duration = y.second.tlast - y.second.tfirst;
+            int in_use = 0;
 
-                gpuvis_trace_printf( "%s calls:%u (lduration=%lu tid=%d offset=-%lu)\n",
-                                     func, y.second.count, duration, tid, offset );
-            }
+            // Exiting thread already reported its runs, we can keep its slots
+            if ( __atomic_compare_exchange_n( &table->in_use, &in_use, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
+                break;
+        }
+
+        if ( !table )
+        {
+            if ( posix_memalign( ( void ** )&table, 64, sizeof( *table ) ) )
+                return NULL;
+
+            memset( table, 0, sizeof( *table ) );
+            table->in_use = 1;
+
+            table->next = __atomic_load_n( &g_hot_funcs, __ATOMIC_RELAXED );
+            while ( !__atomic_compare_exchange_n( &g_hot_funcs, &table->next, table, 1,
+                                                  __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+                ;
         }
+
+        __atomic_store_n( &table->tid, gpuvis_gettid(), __ATOMIC_RELAXED );
+        pthread_setspecific( g_hot_funcs_key, table );
+
+        s_table = table;
     }
 
-    g_hotfuncs.clear();
+    return s_table;
 }
 
-GPUVIS_EXTERN void gpuvis_count_hot_func_calls_internal_( const char *func )
+static void flush_hot_func_calls()
 {
-    static THREAD_LOCAL pid_t s_tid = gpuvis_gettid();
+    hot_funcs_flush_all( 0 );
+}
+
+GPUVIS_EXTERN void gpuvis_flush_hot_func_calls()
+{
+    flush_hot_func_calls();
+}
 
+GPUVIS_EXTERN void gpuvis_count_hot_func_calls_internal_( const char *func )
+{
+    size_t i;
+    uint32_t count;
+    gpuvis_hot_func_t *slot = NULL;
+    gpuvis_hot_funcs_t *table = hot_funcs_get_table();
     uint64_t t0 = gpuvis_gettime_u64();
-    auto &x = g_hotfuncs[ s_tid ];
-    auto &y = x[ func ];
 
-    if ( !y.count )
+    if ( !table )
+        return;
+
+    // Find slot for func. Only this thread writes func so plain reads are fine here.
+    for ( i = 0; i < GPUVIS_HOT_FUNCS_SIZE; i++ )
     {
-        y.count = 1;
-        y.tfirst = t0;
-        y.tlast = t0 + 1;
+        gpuvis_hot_func_t *x = &table->funcs[ ( ( ( uintptr_t )func >> 3 ) + i ) & ( GPUVIS_HOT_FUNCS_SIZE - 1 ) ];
+
+        if ( x->func == func )
+        {
+            slot = x;
+            break;
+        }
+        if ( !x->func )
+        {
+            __atomic_store_n( &x->func, func, __ATOMIC_RELEASE );
+            slot = x;
+            break;
+        }
     }
-    else if ( t0 - y.tlast >= 3 * 1000000 ) // 3ms
+
+    // Table is full
+    if ( !slot )
+        return;
+
+    count = __atomic_load_n( &slot->count, __ATOMIC_ACQUIRE );
+
+    // Report run if it's been idle for a while
+    if ( count && ( t0 - __atomic_load_n( &slot->tlast, __ATOMIC_RELAXED ) >= GPUVIS_HOT_FUNC_GAP_NS ) )
     {
-        gpuvis_trace_printf( "%s calls:%u (lduration=%lu offset=-%lu)\n",
-                             func, y.count, y.tlast - y.tfirst, t0 - y.tfirst );
+        hot_func_report( slot, table->tid, t0 );
+        count = 0;
+    }
 
-        y.count = 1;
-        y.tfirst = t0;
-        y.tlast = t0 + 1;
+    // Extend current run, unless flush_hot_func_calls() just took it
+    if ( count && __atomic_compare_exchange_n( &slot->count, &count, count + 1, 0,
+                                               __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
+    {
+        __atomic_store_n( &slot->tlast, t0, __ATOMIC_RELAXED );
     }
     else
     {
-        y.tlast = t0;
-        y.count++;
+        __atomic_store_n( &slot->tfirst, t0, __ATOMIC_RELAXED );
+        __atomic_store_n( &slot->tlast, t0 + 1, __ATOMIC_RELAXED );
+        __atomic_store_n( &slot->count, 1, __ATOMIC_RELEASE );
     }
 }
-#endif // __cplusplus
 
 GPUVIS_EXTERN void gpuvis_trace_shutdown()
 {
+    gpuvis_trace_binary_shutdown();
     flush_hot_func_calls();
 
     if ( g_trace_fd >= 0 )
@@ -477,6 +731,379 @@ GPUVIS_EXTERN void gpuvis_trace_shutdown()
     g_tracefs_dir[ 0 ] = 0;
 }
 
+static void binary_ring_exited( void *data )
+{
+    gpuvis_ring_t *ring = ( gpuvis_ring_t * )data;
+
+    // Flush thread frees the ring once it's drained
+    __atomic_store_n( &ring->exited, 1, __ATOMIC_RELEASE );
+}
+
+static void binary_init_once( void )
+{
+    pthread_key_create( &g_binary_ring_key, binary_ring_exited );
+}
+
+static gpuvis_ring_t *binary_get_ring( void )
+{
+    static THREAD_LOCAL gpuvis_ring_t *s_ring = NULL;
+
+    if ( !s_ring )
+    {
+        gpuvis_ring_t *ring = ( gpuvis_ring_t * )calloc( 1, sizeof( *ring ) );
+
+        if ( !ring )
+            return NULL;
+
+        ring->tid = gpuvis_gettid();
+        pthread_setspecific( g_binary_ring_key, ring );
+
+        pthread_mutex_lock( &g_binary_mutex );
+        ring->next = g_binary_rings;
+        __atomic_store_n( &g_binary_rings, ring, __ATOMIC_RELEASE );
+        pthread_mutex_unlock( &g_binary_mutex );
+
+        s_ring = ring;
+    }
+
+    return s_ring;
+}
+
+static uint32_t binary_intern_str( const char *str )
+{
+    static THREAD_LOCAL struct
+    {
+        const char *str;
+        uint32_t id;
+    } s_cache[ GPUVIS_STR_CACHE_SIZE ];
+    uint32_t i;
+    uint32_t id = 0;
+    uint32_t hash = 2166136261u;
+    char *copy = NULL;
+    size_t len = strnlen( str, GPUVIS_RAW_STR_MAX );
+    size_t slot = ( ( uintptr_t )str >> 3 ) & ( GPUVIS_STR_CACHE_SIZE - 1 );
+
+    // Same address still has to be the same string: str may be a reused buffer
+    if ( ( s_cache[ slot ].str == str ) &&
+         !strncmp( __atomic_load_n( &g_binary_strs[ s_cache[ slot ].id - 1 ], __ATOMIC_RELAXED ), str, GPUVIS_RAW_STR_MAX ) )
+    {
+        return s_cache[ slot ].id;
+    }
+
+    for ( i = 0; i < len; i++ )
+        hash = ( hash ^ ( uint8_t )str[ i ] ) * 16777619u;
+
+    for ( i = 0; i < GPUVIS_STR_TABLE_SIZE; i++ )
+    {
+        uint32_t index = ( hash + i ) & ( GPUVIS_STR_TABLE_SIZE - 1 );
+        const char *slotstr = __atomic_load_n( &g_binary_strs[ index ], __ATOMIC_ACQUIRE );
+
+        if ( !slotstr )
+        {
+            if ( !copy )
+            {
+                copy = ( char * )malloc( len + 1 );
+                if ( !copy )
+                    break;
+
+                memcpy( copy, str, len );
+                copy[ len ] = 0;
+            }
+
+            if ( __atomic_compare_exchange_n( &g_binary_strs[ index ], &slotstr, copy, 0,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+            {
+                copy = NULL;
+                id = index + 1;
+                break;
+            }
+
+            // Another thread filled this slot, slotstr is now its string
+        }
+
+        if ( !strncmp( slotstr, str, GPUVIS_RAW_STR_MAX ) )
+        {
+            id = index + 1;
+            break;
+        }
+    }
+
+    free( copy );
+
+    if ( id )
+    {
+        s_cache[ slot ].str = str;
+        s_cache[ slot ].id = id;
+    }
+    return id;
+}
+
+GPUVIS_EXTERN int gpuvis_trace_binary_scope( const char *str, uint64_t t0, uint64_t duration )
+{
+    uint32_t head;
+    gpuvis_ring_t *ring;
+    gpuvis_raw_rec_t *rec;
+
+    if ( !__atomic_load_n( &g_binary_enabled, __ATOMIC_RELAXED ) )
+        return -1;
+
+    ring = binary_get_ring();
+    if ( !ring )
+        return -1;
+
+    head = ring->head;
+    if ( head - __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE ) >= GPUVIS_RING_SIZE )
+    {
+        // Full: flush thread is behind, drop this one
+        __atomic_fetch_add( &ring->dropped, 1, __ATOMIC_RELAXED );
+        return 0;
+    }
+
+    rec = &ring->recs[ head & ( GPUVIS_RING_SIZE - 1 ) ];
+    rec->t0 = t0;
+    rec->duration = duration;
+    rec->str_id = binary_intern_str( str );
+    rec->tid = ring->tid;
+
+    __atomic_store_n( &ring->head, head + 1, __ATOMIC_RELEASE );
+    return 0;
+}
+
+typedef struct gpuvis_batch_buf
+{
+    uint32_t num_recs;
+    uint32_t num_strs;
+    size_t size;
+    gpuvis_raw_rec_t recs[ GPUVIS_RAW_BATCH_MAX / sizeof( gpuvis_raw_rec_t ) ];
+    uint32_t str_ids[ GPUVIS_RAW_BATCH_MAX / 8 ];
+} gpuvis_batch_buf_t;
+
+static void binary_write_batch( gpuvis_batch_buf_t *batch )
+{
+    uint32_t i;
+    char buf[ GPUVIS_RAW_BATCH_MAX ];
+    char *dst = buf + sizeof( gpuvis_raw_batch_t );
+    gpuvis_raw_batch_t header;
+
+    if ( !batch->num_recs )
+        return;
+
+    header.id = GPUVIS_RAW_BATCH_ID;
+    header.num_recs = batch->num_recs;
+    header.num_strs = batch->num_strs;
+    header.now = gpuvis_gettime_u64();
+    memcpy( buf, &header, sizeof( header ) );
+
+    memcpy( dst, batch->recs, batch->num_recs * sizeof( gpuvis_raw_rec_t ) );
+    dst += batch->num_recs * sizeof( gpuvis_raw_rec_t );
+
+    for ( i = 0; i < batch->num_strs; i++ )
+    {
+        uint32_t id = batch->str_ids[ i ];
+        const char *str = __atomic_load_n( &g_binary_strs[ id - 1 ], __ATOMIC_ACQUIRE );
+        uint16_t len = strnlen( str, GPUVIS_RAW_STR_MAX );
+
+        memcpy( dst, &id, sizeof( id ) );
+        memcpy( dst + sizeof( id ), &len, sizeof( len ) );
+        memcpy( dst + sizeof( id ) + sizeof( len ), str, len );
+        dst += sizeof( id ) + sizeof( len ) + len;
+    }
+
+    if ( write( g_binary_fd, buf, dst - buf ) < 0 )
+        g_binary_dropped += batch->num_recs;
+
+    batch->num_recs = 0;
+    batch->num_strs = 0;
+    batch->size = sizeof( gpuvis_raw_batch_t );
+}
+
+static void binary_add_rec( gpuvis_batch_buf_t *batch, const gpuvis_raw_rec_t *rec )
+{
+    uint32_t i;
+    size_t size = sizeof( *rec );
+    int new_str = !!rec->str_id;
+
+    for ( i = 0; new_str && ( i < batch->num_strs ); i++ )
+    {
+        if ( batch->str_ids[ i ] == rec->str_id )
+            new_str = 0;
+    }
+
+    if ( new_str )
+        size += sizeof( uint32_t ) + sizeof( uint16_t ) + strnlen( __atomic_load_n( &g_binary_strs[ rec->str_id - 1 ], __ATOMIC_ACQUIRE ), GPUVIS_RAW_STR_MAX );
+
+    if ( batch->size + size > GPUVIS_RAW_BATCH_MAX )
+    {
+        binary_write_batch( batch );
+        binary_add_rec( batch, rec );
+        return;
+    }
+
+    if ( new_str )
+        batch->str_ids[ batch->num_strs++ ] = rec->str_id;
+    batch->recs[ batch->num_recs++ ] = *rec;
+    batch->size += size;
+}
+
+static void binary_unlink_ring( gpuvis_ring_t *ring )
+{
+    gpuvis_ring_t **link;
+
+    pthread_mutex_lock( &g_binary_mutex );
+
+    for ( link = &g_binary_rings; *link; link = &( *link )->next )
+    {
+        if ( *link == ring )
+        {
+            *link = ring->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &g_binary_mutex );
+}
+
+// Drain all thread rings into batches. Returns number of records written.
+static uint32_t binary_flush( gpuvis_batch_buf_t *batch )
+{
+    uint32_t count = 0;
+    gpuvis_ring_t *ring;
+    gpuvis_ring_t *next;
+
+    // Rings are only added at the head and only this thread unlinks them,
+    // so the list is walked and batches written without the lock.
+    for ( ring = __atomic_load_n( &g_binary_rings, __ATOMIC_ACQUIRE ); ring; ring = next )
+    {
+        int exited = __atomic_load_n( &ring->exited, __ATOMIC_ACQUIRE );
+        uint32_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+        uint32_t tail = ring->tail;
+
+        for ( ; tail != head; tail++ )
+            binary_add_rec( batch, &ring->recs[ tail & ( GPUVIS_RING_SIZE - 1 ) ] );
+
+        count += head - ring->tail;
+        __atomic_store_n( &ring->tail, tail, __ATOMIC_RELEASE );
+
+        g_binary_dropped += __atomic_exchange_n( &ring->dropped, 0, __ATOMIC_RELAXED );
+
+        next = ring->next;
+        if ( exited )
+        {
+            binary_unlink_ring( ring );
+            free( ring );
+        }
+    }
+
+    binary_write_batch( batch );
+    return count;
+}
+
+static void *binary_flush_thread( void *data )
+{
+    gpuvis_batch_buf_t *batch = ( gpuvis_batch_buf_t * )data;
+
+    while ( __atomic_load_n( &g_binary_enabled, __ATOMIC_ACQUIRE ) )
+    {
+        // Back off while there's nothing to write
+        if ( !binary_flush( batch ) )
+        {
+            struct timespec ts = { 0, 1000000 };
+            nanosleep( &ts, NULL );
+        }
+    }
+
+    binary_flush( batch );
+    return NULL;
+}
+
+GPUVIS_EXTERN int gpuvis_trace_binary_init( const char *fallback_file )
+{
+    char filename[ PATH_MAX ];
+    static gpuvis_batch_buf_t s_batch;
+
+    if ( g_binary_enabled )
+        return 0;
+
+    pthread_once( &g_binary_once, binary_init_once );
+
+    if ( gpuvis_get_tracefs_filename( filename, sizeof( filename ), "trace_marker_raw" ) )
+        g_binary_fd = open( filename, O_WRONLY );
+    if ( ( g_binary_fd < 0 ) && fallback_file )
+        g_binary_fd = open( fallback_file, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( g_binary_fd < 0 )
+        return -1;
+
+    s_batch.num_recs = 0;
+    s_batch.num_strs = 0;
+    s_batch.size = sizeof( gpuvis_raw_batch_t );
+
+    __atomic_store_n( &g_binary_enabled, 1, __ATOMIC_RELEASE );
+
+    if ( pthread_create( &g_binary_thread, NULL, binary_flush_thread, &s_batch ) )
+    {
+        __atomic_store_n( &g_binary_enabled, 0, __ATOMIC_RELEASE );
+
+        close( g_binary_fd );
+        g_binary_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+GPUVIS_EXTERN void gpuvis_trace_binary_shutdown()
+{
+    if ( !g_binary_enabled )
+        return;
+
+    __atomic_store_n( &g_binary_enabled, 0, __ATOMIC_RELEASE );
+    pthread_join( g_binary_thread, NULL );
+
+    if ( g_binary_dropped )
+        gpuvis_trace_printf( "gpuvis_trace_binary: dropped %u records\n", g_binary_dropped );
+    g_binary_dropped = 0;
+
+    close( g_binary_fd );
+    g_binary_fd = -1;
+}
+
+GPUVIS_EXTERN void gpuvis_trace_benchmark( unsigned int count )
+{
+    unsigned int i;
+    uint64_t t0;
+    double ns_printf;
+    double ns_binary;
+    int was_enabled = g_binary_enabled;
+
+    if ( !count )
+        count = 100000;
+
+    t0 = gpuvis_gettime_u64();
+    for ( i = 0; i < count; i++ )
+        gpuvis_trace_block_finalize( gpuvis_gettime_u64(), "gpuvis_trace_benchmark" );
+    ns_printf = ( double )( gpuvis_gettime_u64() - t0 ) / count;
+
+    if ( !was_enabled && ( gpuvis_trace_binary_init( NULL ) < 0 ) )
+    {
+        printf( "%s: printf: %.1fns/scope binary: unavailable\n", __func__, ns_printf );
+        return;
+    }
+
+    t0 = gpuvis_gettime_u64();
+    for ( i = 0; i < count; i++ )
+    {
+        uint64_t ts = gpuvis_gettime_u64();
+
+        gpuvis_trace_binary_scope( "gpuvis_trace_benchmark", ts, gpuvis_gettime_u64() - ts );
+    }
+    ns_binary = ( double )( gpuvis_gettime_u64() - t0 ) / count;
+
+    if ( !was_enabled )
+        gpuvis_trace_binary_shutdown();
+
+    printf( "%s: printf: %.1fns/scope binary: %.1fns/scope\n", __func__, ns_printf, ns_binary );
+}
+
 static int trace_printf_impl( const char *keystr, const char *fmt, va_list ap ) GPUVIS_ATTR_PRINTF( 2, 0 );
 static int trace_printf_impl( const char *keystr, const char *fmt, va_list ap )
 {
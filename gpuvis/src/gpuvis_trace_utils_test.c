@@ -0,0 +1,116 @@
+// Stress test for GPUVIS_COUNT_HOT_FUNC_CALLS. Not part of the gpuvis build,
+// compile it on its own, with -fsanitize=thread to check the counters too:
+//   gcc -O2 -pthread gpuvis_trace_utils_test.c -o gpuvis_trace_utils_test
+//
+// Threads count calls to two funcs while another thread flushes. Reports are
+// written to a temp file instead of trace_marker, then added back up.
+
+#define GPUVIS_TRACE_IMPLEMENTATION
+#include "gpuvis_trace_utils.h"
+
+#define NUM_THREADS 64
+#define NUM_CALLS   20000
+
+static int g_done = 0;
+
+static void hot_func_a( void )
+{
+    GPUVIS_COUNT_HOT_FUNC_CALLS();
+}
+
+static void hot_func_b( void )
+{
+    GPUVIS_COUNT_HOT_FUNC_CALLS();
+}
+
+static void *count_thread( void *data )
+{
+    int i;
+    intptr_t index = ( intptr_t )data;
+
+    for ( i = 0; i < NUM_CALLS; i++ )
+    {
+        hot_func_a();
+        if ( ( i + index ) & 1 )
+            hot_func_b();
+
+        // Leave gaps now and then so runs end on their own too
+        if ( !( ( i + index ) % 5000 ) )
+        {
+            struct timespec ts = { 0, 2 * GPUVIS_HOT_FUNC_GAP_NS };
+            nanosleep( &ts, NULL );
+        }
+    }
+
+    return NULL;
+}
+
+static void *flush_thread( void *data )
+{
+    ( void )data;
+
+    while ( !__atomic_load_n( &g_done, __ATOMIC_ACQUIRE ) )
+    {
+        struct timespec ts = { 0, 200 * 1000 };
+
+        gpuvis_flush_hot_func_calls();
+        nanosleep( &ts, NULL );
+    }
+
+    return NULL;
+}
+
+int main( void )
+{
+    intptr_t i;
+    char line[ 512 ];
+    char filename[] = "/tmp/gpuvis_trace_utils_testXXXXXX";
+    pthread_t flusher;
+    pthread_t threads[ NUM_THREADS ];
+    uint64_t calls_a = 0;
+    uint64_t calls_b = 0;
+    FILE *fh;
+    int fd = mkstemp( filename );
+
+    if ( fd < 0 )
+    {
+        printf( "mkstemp failed\n" );
+        return 1;
+    }
+    g_trace_fd = open( filename, O_WRONLY | O_APPEND );
+
+    pthread_create( &flusher, NULL, flush_thread, NULL );
+    for ( i = 0; i < NUM_THREADS; i++ )
+        pthread_create( &threads[ i ], NULL, count_thread, ( void * )i );
+
+    for ( i = 0; i < NUM_THREADS; i++ )
+        pthread_join( threads[ i ], NULL );
+
+    __atomic_store_n( &g_done, 1, __ATOMIC_RELEASE );
+    pthread_join( flusher, NULL );
+
+    // Exited threads reported their own runs, this gets what's left
+    gpuvis_flush_hot_func_calls();
+
+    fh = fdopen( fd, "r" );
+    while ( fgets( line, sizeof( line ), fh ) )
+    {
+        char func[ 64 ];
+        unsigned int count;
+
+        if ( sscanf( line, "%63s calls:%u", func, &count ) != 2 )
+            continue;
+        if ( !strcmp( func, "hot_func_a" ) )
+            calls_a += count;
+        else if ( !strcmp( func, "hot_func_b" ) )
+            calls_b += count;
+    }
+    fclose( fh );
+    unlink( filename );
+
+    // hot_func_b gets every other call
+    printf( "hot_func_a: %lu calls, expected %u\n", calls_a, NUM_THREADS * NUM_CALLS );
+    printf( "hot_func_b: %lu calls, expected %u\n", calls_b, NUM_THREADS * NUM_CALLS / 2 );
+
+    return ( calls_a == NUM_THREADS * NUM_CALLS && calls_b == NUM_THREADS * NUM_CALLS / 2 ) ? 0 : 1;
+}
@@ -26,9 +26,11 @@
 
 #ifndef WIN32
 #include <unistd.h>
+#include <sys/resource.h>
 #else
 #define WIN32_LEAN_AND_MEAN 1
 #include <windows.h>
+#include <psapi.h>
 #endif
 
 #include <string>
@@ -39,6 +41,9 @@
 #include <sstream>
 #include <unordered_map>
 #include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include <cinder/app/App.h>
 #include <cinder/gl/gl.h>
@@ -96,6 +101,43 @@ void logf_clear()
     g_log.clear();
 }
 
+void util_parallel_for( size_t count, uint32_t thread_count, const std::function< void ( size_t ) > &func )
+{
+    std::atomic< size_t > next( 0 );
+    std::vector< std::thread > threads;
+    auto worker = [ & ]()
+    {
+        for ( size_t i = next++; i < count; i = next++ )
+            func( i );
+    };
+
+    thread_count = std::min< size_t >( thread_count, count );
+    for ( uint32_t i = 1; i < thread_count; i++ )
+        threads.emplace_back( worker );
+
+    worker();
+
+    for ( std::thread &thread : threads )
+        thread.join();
+}
+
+size_t util_get_peak_rss()
+{
+#if defined( WIN32 )
+    PROCESS_MEMORY_COUNTERS counters;
+
+    if ( GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+        return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+
+    // ru_maxrss is in kilobytes on Linux
+    if ( !getrusage( RUSAGE_SELF, &usage ) )
+        return ( size_t )usage.ru_maxrss * 1024;
+#endif
+    return 0;
+}
+
 int64_t timestr_to_ts( const char *buf )
 {
     double val;
@@ -346,6 +388,234 @@ void remove_substrings( char *str, const char *fmt, ... )
         memmove( val, val + len, strlen( val + len ) + 1 );
 }
 
+void EventLocs::pack_tail()
+{
+    block_t block;
+    uint32_t maxval = m_tail[ 0 ];
+
+    block.base = m_tail[ 0 ];
+    for ( uint32_t id : m_tail )
+    {
+        block.base = std::min< uint32_t >( block.base, id );
+        maxval = std::max< uint32_t >( maxval, id );
+    }
+
+    block.bits = 0;
+    while ( block.bits < 32 && ( ( uint64_t )( maxval - block.base ) >> block.bits ) )
+        block.bits++;
+
+    block.word = m_words.size();
+    m_words.resize( m_words.size() + ( s_block_size * block.bits + 63 ) / 64, 0 );
+
+    for ( size_t i = 0; block.bits && ( i < m_tail.size() ); i++ )
+    {
+        uint64_t val = m_tail[ i ] - block.base;
+        size_t bit = i * block.bits;
+        size_t word = block.word + ( bit >> 6 );
+        uint32_t shift = bit & 63;
+
+        m_words[ word ] |= val << shift;
+        if ( shift + block.bits > 64 )
+            m_words[ word + 1 ] |= val >> ( 64 - shift );
+    }
+
+    m_blocks.push_back( block );
+    m_tail.clear();
+}
+
+void EventLocs::clear()
+{
+    m_size = 0;
+    m_blocks.clear();
+    m_words.clear();
+    m_tail.clear();
+}
+
+void EventLocs::swap( EventLocs &locs )
+{
+    std::swap( m_size, locs.m_size );
+    m_blocks.swap( locs.m_blocks );
+    m_words.swap( locs.m_words );
+    m_tail.swap( locs.m_tail );
+}
+
+void EventLocs::trim( uint32_t count )
+{
+    EventLocs locs;
+
+    for ( uint32_t id : *this )
+    {
+        if ( id >= count )
+            locs.push_back( id - count );
+    }
+    swap( locs );
+}
+
+void EventLocs::assign( const std::vector< uint32_t > &ids )
+{
+    clear();
+    append( ids );
+}
+
+std::vector< uint32_t > EventLocs::to_vector() const
+{
+    std::vector< uint32_t > ids;
+
+    ids.reserve( m_size );
+    for ( uint32_t id : *this )
+        ids.push_back( id );
+
+    return ids;
+}
+
+void EventLocs::intersect( const std::vector< const EventLocs * > &lists, EventLocs &out )
+{
+    EventLocs locs;
+    const EventLocs *smallest = nullptr;
+    std::vector< size_t > pos( lists.size(), 0 );
+
+    for ( const EventLocs *plocs : lists )
+    {
+        if ( !smallest || ( plocs->size() < smallest->size() ) )
+            smallest = plocs;
+    }
+
+    // Walk the smallest list and look for each id in the others,
+    //  searching from where the last id was found
+    bool done = !smallest;
+    for ( size_t i = 0; !done && ( i < smallest->size() ); i++ )
+    {
+        uint32_t id = ( *smallest )[ i ];
+        bool found = true;
+
+        for ( size_t j = 0; found && ( j < lists.size() ); j++ )
+        {
+            const EventLocs *plocs = lists[ j ];
+
+            if ( plocs == smallest )
+                continue;
+
+            pos[ j ] = std::lower_bound( plocs->begin() + pos[ j ], plocs->end(), id ) - plocs->begin();
+            done = ( pos[ j ] >= plocs->size() );
+            found = !done && ( ( *plocs )[ pos[ j ] ] == id );
+        }
+
+        if ( found )
+            locs.push_back( id );
+    }
+
+    out.swap( locs );
+}
+
+void EventLocs::unite( const std::vector< const EventLocs * > &lists, EventLocs &out )
+{
+    EventLocs locs;
+    std::vector< size_t > pos( lists.size(), 0 );
+    util_merge_tree< uint32_t > tree( lists.size() );
+
+    for ( size_t i = 0; i < lists.size(); i++ )
+    {
+        if ( !lists[ i ]->empty() )
+            tree.set_key( i, lists[ i ]->front() );
+    }
+    tree.build();
+
+    while ( !tree.empty() )
+    {
+        uint32_t i = tree.top();
+        uint32_t id = tree.top_key();
+
+        if ( locs.empty() || ( locs.back() != id ) )
+            locs.push_back( id );
+
+        if ( ++pos[ i ] < lists[ i ]->size() )
+            tree.replace_top( ( *lists[ i ] )[ pos[ i ] ] );
+        else
+            tree.pop_top();
+    }
+
+    out.swap( locs );
+}
+
+size_t EventLocs::mem_size() const
+{
+    return m_blocks.capacity() * sizeof( block_t ) +
+            m_words.capacity() * sizeof( uint64_t ) +
+            m_tail.capacity() * sizeof( uint32_t );
+}
+
+struct eventlocs_saved_t
+{
+    uint64_t size;
+    uint32_t blocks;
+    uint32_t words;
+    uint32_t tail;
+    uint32_t pad;
+};
+
+void EventLocs::save( std::vector< char > &buf ) const
+{
+    eventlocs_saved_t saved = { m_size, ( uint32_t )m_blocks.size(),
+                                ( uint32_t )m_words.size(), ( uint32_t )m_tail.size(), 0 };
+    const char *ptr = ( const char * )&saved;
+
+    // Blocks are stored as is
+    static_assert( sizeof( block_t ) == 12, "block_t has padding" );
+
+    buf.insert( buf.end(), ptr, ptr + sizeof( saved ) );
+    ptr = ( const char * )m_blocks.data();
+    buf.insert( buf.end(), ptr, ptr + m_blocks.size() * sizeof( block_t ) );
+    ptr = ( const char * )m_words.data();
+    buf.insert( buf.end(), ptr, ptr + m_words.size() * sizeof( uint64_t ) );
+    ptr = ( const char * )m_tail.data();
+    buf.insert( buf.end(), ptr, ptr + m_tail.size() * sizeof( uint32_t ) );
+}
+
+bool EventLocs::load( const char *&ptr, const char *end )
+{
+    eventlocs_saved_t saved;
+
+    if ( ( size_t )( end - ptr ) < sizeof( saved ) )
+        return false;
+    memcpy( &saved, ptr, sizeof( saved ) );
+
+    size_t size = ( size_t )saved.blocks * sizeof( block_t ) +
+            ( size_t )saved.words * sizeof( uint64_t ) +
+            ( size_t )saved.tail * sizeof( uint32_t );
+
+    if ( ( saved.tail >= s_block_size ) ||
+         ( saved.size != ( uint64_t )saved.blocks * s_block_size + saved.tail ) ||
+         ( ( size_t )( end - ptr ) - sizeof( saved ) < size ) )
+        return false;
+    ptr += sizeof( saved );
+
+    clear();
+    m_size = saved.size;
+    m_blocks.resize( saved.blocks );
+    m_words.resize( saved.words );
+    m_tail.resize( saved.tail );
+
+    memcpy( m_blocks.data(), ptr, m_blocks.size() * sizeof( block_t ) );
+    ptr += m_blocks.size() * sizeof( block_t );
+    memcpy( m_words.data(), ptr, m_words.size() * sizeof( uint64_t ) );
+    ptr += m_words.size() * sizeof( uint64_t );
+    memcpy( m_tail.data(), ptr, m_tail.size() * sizeof( uint32_t ) );
+    ptr += m_tail.size() * sizeof( uint32_t );
+
+    // Packed offsets of every block have to be in m_words
+    for ( const block_t &block : m_blocks )
+    {
+        if ( ( block.bits > 32 ) ||
+             ( ( size_t )block.word + ( s_block_size * block.bits + 63 ) / 64 > m_words.size() ) )
+        {
+            clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
 size_t get_file_size( const char *filename )
 {
     struct stat st;
@@ -1280,22 +1550,122 @@ StrAlloc::~StrAlloc()
 /*
  * StrPool
  */
-const char *StrPool::getstr( const char *str, size_t len )
+struct StrPool::shard_t
+{
+    struct entry_t
+    {
+        const char *str;
+        uint32_t len;
+        // Next entry with the same 64-bit hash or s_end
+        uint32_t next;
+    };
+    static const uint32_t s_end = ( uint32_t )-1;
+
+    // Entries are stored in blocks that never move: block b holds
+    //  s_block0_size << b entries. Ids use the top 28 bits for the index.
+    static const uint32_t s_block0_bits = 8;
+    static const uint32_t s_block0_size = 1 << s_block0_bits;
+    static const uint32_t s_max_blocks = 32 - s_block0_bits;
+
+    ~shard_t()
+    {
+        for ( entry_t *block : blocks )
+            delete [] block;
+    }
+
+    // Blocks before block b hold ( ( 1 << b ) - 1 ) << s_block0_bits entries
+    static uint32_t get_block( uint32_t index )
+    {
+        uint32_t v = ( index >> s_block0_bits ) + 1;
+        uint32_t block = 0;
+
+        while ( v >>= 1 )
+            block++;
+        return block;
+    }
+
+    entry_t &get_entry( uint32_t index ) const
+    {
+        uint32_t block = get_block( index );
+
+        return blocks[ block ][ index - ( ( ( 1 << block ) - 1 ) << s_block0_bits ) ];
+    }
+
+    // Called with lock held. Entry is published to findid() by count.
+    uint32_t add_entry( const entry_t &entry )
+    {
+        uint32_t index = count.load( std::memory_order_relaxed );
+        uint32_t block = get_block( index );
+
+        if ( !blocks[ block ] )
+            blocks[ block ] = new entry_t[ s_block0_size << block ];
+
+        get_entry( index ) = entry;
+        count.store( index + 1, std::memory_order_release );
+        return index;
+    }
+
+    std::mutex lock;
+    StrAlloc alloc;
+    // 64-bit hash -> most recent entry with that hash
+    std::unordered_map< uint64_t, uint32_t > map;
+    // Entry index is the string id
+    entry_t *blocks[ s_max_blocks ] = {};
+    std::atomic< uint32_t > count = { 0 };
+};
+
+StrPool::StrPool()
+{
+    m_shards = new shard_t[ s_shard_count ];
+}
+
+StrPool::~StrPool()
+{
+    delete [] m_shards;
+}
+
+const char *StrPool::intern( const char *str, size_t len, uint32_t *id, bool create )
 {
     if ( len == ( size_t )-1 )
         len = strlen( str );
 
-    uint32_t hashval = hashstr32( str, len );
-    const char **ret = m_pool.get_val( hashval );
+    uint64_t hashval = hashstr64( str, len );
+    uint32_t shardidx = ( uint32_t )( hashval >> ( 64 - s_shard_bits ) );
+    shard_t &shard = m_shards[ shardidx ];
+    std::lock_guard< std::mutex > lock( shard.lock );
+
+    auto it = shard.map.find( hashval );
+    uint32_t first = ( it != shard.map.end() ) ? it->second : shard_t::s_end;
+    uint32_t index;
+
+    // Compare against every string with this hash
+    for ( index = first; index != shard_t::s_end; index = shard.get_entry( index ).next )
+    {
+        const shard_t::entry_t &entry = shard.get_entry( index );
+
+        if ( ( entry.len == len ) && !memcmp( entry.str, str, len ) )
+            break;
+    }
 
-    if ( !ret )
+    if ( index == shard_t::s_end )
     {
-        char *str2 = m_alloc.dupestr( str, len );
+        if ( !create )
+            return NULL;
 
-        ret = m_pool.get_val( hashval, str2 );
+        const char *newstr = shard.alloc.dupestr( str, len );
+
+        index = shard.add_entry( { newstr, ( uint32_t )len, first } );
+        shard.map[ hashval ] = index;
     }
 
-    return *ret;
+    if ( id )
+        *id = ( index << s_shard_bits ) | shardidx;
+    return shard.get_entry( index ).str;
+}
+
+const char *StrPool::getstr( const char *str, size_t len )
+{
+    return intern( str, len, NULL, true );
 }
 
 const char *StrPool::getstrf( const char *fmt, ... )
@@ -1310,25 +1680,15 @@ const char *StrPool::getstrf( const char *fmt, ... )
     return getstr( buf );
 }
 
-uint32_t StrPool::getu32( const char *str, size_t len )
+uint32_t StrPool::getid( const char *str, size_t len )
 {
-    if ( len == ( size_t )-1 )
-        len = strlen( str );
+    uint32_t id;
 
-    uint32_t hashval = hashstr32( str, len );
-    const char **ret = m_pool.get_val( hashval );
-
-    if ( !ret )
-    {
-        char *str2 = m_alloc.dupestr( str, len );
-
-        m_pool.get_val( hashval, str2 );
-    }
-
-    return hashval;
+    intern( str, len, &id, true );
+    return id;
 }
 
-uint32_t StrPool::getu32f( const char *fmt, ... )
+uint32_t StrPool::getidf( const char *fmt, ... )
 {
     va_list args;
     char buf[ 512 ];
@@ -1337,14 +1697,172 @@ uint32_t StrPool::getu32f( const char *fmt, ... )
     vsnprintf_safe( buf, fmt, args );
     va_end( args );
 
-    return getu32( buf );
+    return getid( buf );
+}
+
+bool StrPool::lookupid( const char *str, uint32_t *id, size_t len )
+{
+    return !!intern( str, len, id, false );
+}
+
+const char *StrPool::findid( uint32_t id )
+{
+    // No lock: entries below count are written and never move
+    const shard_t &shard = m_shards[ id & ( s_shard_count - 1 ) ];
+    uint32_t index = id >> s_shard_bits;
+
+    return ( index < shard.count.load( std::memory_order_acquire ) ) ? shard.get_entry( index ).str : NULL;
+}
+
+void StrPool::merge( StrPool &pool, util_umap< const char *, const char * > &remap )
+{
+    for ( uint32_t i = 0; i < s_shard_count; i++ )
+    {
+        shard_t &shard = pool.m_shards[ i ];
+        std::lock_guard< std::mutex > lock( shard.lock );
+
+        for ( uint32_t index = 0; index < shard.count; index++ )
+        {
+            const shard_t::entry_t &entry = shard.get_entry( index );
+
+            remap.set_val( entry.str, intern( entry.str, entry.len, NULL, true ) );
+        }
+    }
+}
+
+size_t StrPool::get_totsize() const
+{
+    size_t totsize = 0;
+
+    for ( uint32_t i = 0; i < s_shard_count; i++ )
+    {
+        std::lock_guard< std::mutex > lock( m_shards[ i ].lock );
+
+        totsize += m_shards[ i ].alloc.m_totsize;
+    }
+    return totsize + m_loaded_size;
+}
+
+size_t StrPool::get_chunk_count() const
+{
+    size_t count = 0;
+
+    for ( uint32_t i = 0; i < s_shard_count; i++ )
+    {
+        std::lock_guard< std::mutex > lock( m_shards[ i ].lock );
+
+        count += m_shards[ i ].alloc.m_chunks.size();
+    }
+    return count;
+}
+
+struct strpool_saved_entry_t
+{
+    uint64_t hashval;
+    uint32_t offset;
+    uint32_t len;
+};
+
+bool StrPool::save( std::vector< char > &buf ) const
+{
+    uint32_t counts[ s_shard_count ];
+    std::vector< strpool_saved_entry_t > entries;
+    std::vector< char > strs;
+
+    for ( uint32_t i = 0; i < s_shard_count; i++ )
+    {
+        shard_t &shard = m_shards[ i ];
+        std::lock_guard< std::mutex > lock( shard.lock );
+
+        counts[ i ] = shard.count.load();
+        for ( uint32_t index = 0; index < counts[ i ]; index++ )
+        {
+            const shard_t::entry_t &entry = shard.get_entry( index );
+
+            if ( strs.size() + entry.len >= UINT32_MAX )
+                return false;
+
+            entries.push_back( { hashstr64( entry.str, entry.len ), ( uint32_t )strs.size(), entry.len } );
+            strs.insert( strs.end(), entry.str, entry.str + entry.len );
+            strs.push_back( 0 );
+        }
+    }
+
+    const char *ptr = ( const char * )counts;
+    buf.insert( buf.end(), ptr, ptr + sizeof( counts ) );
+    ptr = ( const char * )entries.data();
+    buf.insert( buf.end(), ptr, ptr + entries.size() * sizeof( strpool_saved_entry_t ) );
+    buf.insert( buf.end(), strs.begin(), strs.end() );
+    return true;
 }
 
-const char *StrPool::findstr( uint32_t hashval )
+bool StrPool::load( const char *data, size_t size, const std::shared_ptr< void > &holder )
 {
-    const char **str = m_pool.get_val( hashval );
+    uint32_t counts[ s_shard_count ];
+    size_t count = 0;
+
+    if ( size < sizeof( counts ) )
+        return false;
+    memcpy( counts, data, sizeof( counts ) );
+
+    for ( uint32_t i = 0; i < s_shard_count; i++ )
+    {
+        // Ids have to fit in 32 bits, and the pool has to be empty
+        if ( ( counts[ i ] > ( UINT32_MAX >> s_shard_bits ) ) || m_shards[ i ].count.load() )
+            return false;
+        count += counts[ i ];
+    }
+
+    size_t entries_size = count * sizeof( strpool_saved_entry_t );
+    if ( size - sizeof( counts ) < entries_size )
+        return false;
+
+    const char *entries = data + sizeof( counts );
+    const char *strs = entries + entries_size;
+    size_t strs_size = size - sizeof( counts ) - entries_size;
+
+    // Check every entry before the pool is touched
+    for ( size_t i = 0, shardidx = 0, index = 0; i < count; i++, index++ )
+    {
+        strpool_saved_entry_t entry;
+
+        while ( index >= counts[ shardidx ] )
+        {
+            shardidx++;
+            index = 0;
+        }
+
+        memcpy( &entry, entries + i * sizeof( entry ), sizeof( entry ) );
+        if ( ( entry.offset >= strs_size ) ||
+             ( entry.len >= strs_size - entry.offset ) ||
+             strs[ entry.offset + entry.len ] ||
+             ( ( entry.hashval >> ( 64 - s_shard_bits ) ) != shardidx ) )
+            return false;
+    }
+
+    for ( uint32_t i = 0; i < s_shard_count; i++ )
+    {
+        shard_t &shard = m_shards[ i ];
+        std::lock_guard< std::mutex > lock( shard.lock );
+
+        shard.map.reserve( counts[ i ] );
+        for ( uint32_t index = 0; index < counts[ i ]; index++ )
+        {
+            strpool_saved_entry_t entry;
+
+            memcpy( &entry, entries, sizeof( entry ) );
+            entries += sizeof( entry );
+
+            auto it = shard.map.find( entry.hashval );
+            uint32_t next = ( it != shard.map.end() ) ? it->second : shard_t::s_end;
+
+            shard.map[ entry.hashval ] = shard.add_entry( { strs + entry.offset, entry.len, next } );
+        }
+    }
 
-    return str ? *str : NULL;
+    m_loaded = holder;
+    m_loaded_size = strs_size;
+    return true;
 }
 
 #if defined( WIN32 )
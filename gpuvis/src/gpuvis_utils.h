@@ -26,6 +26,7 @@
 #define GPUVIS_UTILS_H_
 
 #include <future>
+#include <atomic>
 
 #include "imgui/imgui.h"          // BeginColumns(), EndColumns() WIP
 #include "imgui/imgui_internal.h" // BeginColumns(), EndColumns() WIP
@@ -63,6 +64,44 @@ inline float util_time_to_ms( util_time_t start, util_time_t end )
     return ( float )std::chrono::duration< double, std::milli >( diff ).count();
 }
 
+// Function run on a background thread. Owner polls is_done() from the main thread.
+//  Job functions should check is_cancelled() and call set_progress() as they run.
+class AsyncJob
+{
+public:
+    AsyncJob() {}
+    ~AsyncJob() { cancel(); wait(); }
+
+    void start( const std::function< void () > &func )
+    {
+        m_future = std::async( std::launch::async, func );
+    }
+    void wait()
+    {
+        if ( m_future.valid() )
+            m_future.wait();
+    }
+    bool is_done() const
+    {
+        return !m_future.valid() ||
+                ( m_future.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready );
+    }
+
+    void cancel() { m_cancel = true; }
+    bool is_cancelled() const { return m_cancel; }
+
+    void set_progress( float progress ) { m_progress = progress; }
+    float get_progress() const { return m_progress; }
+
+protected:
+    std::atomic< bool > m_cancel = { false };
+    std::atomic< float > m_progress = { 0.0f };
+    std::future< void > m_future;
+};
+
+// Peak resident set size of this process in bytes (0 if unknown)
+size_t util_get_peak_rss();
+
 inline const char *util_basename( const char *s )
 {
     const char *slash = strrchr( s, '/' );
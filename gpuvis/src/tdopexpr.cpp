@@ -319,6 +319,46 @@ static void next_token( tdop_state *s )
     }
 }
 
+enum tdop_op_type_t
+{
+    OP_PUSH_VALUE,      // Push m_vec_tokens[ arg ].value_buf
+    OP_PUSH_VARIABLE,   // Push value of m_variables[ arg ]
+    OP_INFIX,           // Pop two values, push function( a, b )
+    OP_JUMP_IF_FALSE,   // &&: If top is false, jump to arg. Else pop.
+    OP_JUMP_IF_TRUE,    // ||: If top is true, set to "1" and jump to arg. Else pop.
+    OP_BOOL,            // Convert top to "1" or ""
+    OP_NUM_COMPARE,     // Push function( variable, number ) for m_num_compares[ arg ]
+};
+
+struct tdop_value_buf_t
+{
+    char value_buf[ 64 ];
+};
+
+struct tdop_op_t
+{
+    tdop_op_type_t type;
+    uint32_t arg;
+    TDOP_INFIX_FUNC *function;
+};
+
+// "$var op number" term, with the number parsed the ways num_compare() would
+struct tdop_num_compare_t
+{
+    uint32_t var;           // m_variables index
+    uint32_t token;         // m_vec_tokens index of the number
+    bool swapped;           // Number is the left operand
+
+    bool is_float;          // num_compare() compares as doubles
+    double d;
+    uint64_t u;
+
+    // Number is plain decimal ("0", "12", "-34"), so equal strings means equal values
+    bool is_decimal;
+    bool neg;
+    uint64_t mag;
+};
+
 class TdopExpr
 {
 public:
@@ -327,18 +367,30 @@ public:
 
     int compile( const char *expression, tdop_get_key_func &get_key_func, std::string &errstr );
     const char *exec( tdop_get_keyval_func &get_keyval_func );
+    const char *exec_vars( tdop_get_var_func &get_var_func, tdop_get_var_num_func *get_var_num_func );
 
 protected:
     tdop_state_token *get_next_token();
-    const char *tdop_infix( tdop_state_token *self, const char *left );
-    const char *tdop_expression( int rbp );
+    void tdop_expression( int rbp );
+    void add_op( tdop_op_type_t type, uint32_t arg, TDOP_INFIX_FUNC *function = nullptr );
+    bool add_num_compare( TDOP_INFIX_FUNC *function );
 
 public:
-    tdop_get_keyval_func m_get_keyval_func;
     tdop_state_token *m_token = nullptr;
 
     size_t m_token_index = 0;
     std::vector< tdop_state_token > m_vec_tokens;
+
+    // Flat postfix program built from m_vec_tokens by compile()
+    std::vector< tdop_op_t > m_ops;
+    // Unique variable names (from get_key_func) referenced by m_ops
+    std::vector< const char * > m_variables;
+    // OP_NUM_COMPARE terms
+    std::vector< tdop_num_compare_t > m_num_compares;
+
+    // Exec scratch: value stack and a value buffer per op
+    std::vector< const char * > m_stack;
+    std::vector< tdop_value_buf_t > m_bufs;
 };
 
 class TdopExpr *tdopexpr_compile( const char *expression, tdop_get_key_func &get_key_func, std::string &errstr )
@@ -359,11 +411,104 @@ const char *tdopexpr_exec( class TdopExpr *tdop_expr, tdop_get_keyval_func &get_
     return tdop_expr ? tdop_expr->exec( get_keyval_func ) : "";
 }
 
+const char *tdopexpr_exec_vars( class TdopExpr *tdop_expr, tdop_get_var_func &get_var_func,
+                                tdop_get_var_num_func *get_var_num_func )
+{
+    return tdop_expr ? tdop_expr->exec_vars( get_var_func, get_var_num_func ) : "";
+}
+
+const std::vector< const char * > &tdopexpr_get_variables( class TdopExpr *tdop_expr )
+{
+    return tdop_expr->m_variables;
+}
+
+class TdopExpr *tdopexpr_clone( class TdopExpr *tdop_expr )
+{
+    return tdop_expr ? new TdopExpr( *tdop_expr ) : NULL;
+}
+
 void tdopexpr_delete( TdopExpr *tdop_expr )
 {
     delete tdop_expr;
 }
 
+std::vector< tdop_contains_t > tdopexpr_get_required_contains( class TdopExpr *tdop_expr )
+{
+    // Walk the postfix ops keeping, for each stack value, the contains terms
+    //  that must hold for that value to be true.
+    struct value_t
+    {
+        const tdop_op_t *op;
+        std::vector< tdop_contains_t > terms;
+    };
+    std::vector< value_t > stack;
+    // Left sides of && and || waiting for their OP_BOOL
+    std::vector< std::pair< tdop_op_type_t, value_t > > pending;
+
+    if ( !tdop_expr )
+        return {};
+
+    for ( const tdop_op_t &op : tdop_expr->m_ops )
+    {
+        switch ( op.type )
+        {
+        case OP_PUSH_VALUE:
+        case OP_PUSH_VARIABLE:
+            stack.push_back( { &op, {} } );
+            break;
+        case OP_NUM_COMPARE:
+            stack.push_back( { nullptr, {} } );
+            break;
+        case OP_INFIX:
+        {
+            value_t b = stack.back();
+            stack.pop_back();
+            value_t &a = stack.back();
+
+            // Only "$var =~ literal" says anything about the variable
+            if ( ( op.function == func_contains ) &&
+                 a.op && ( a.op->type == OP_PUSH_VARIABLE ) &&
+                 b.op && ( b.op->type == OP_PUSH_VALUE ) )
+            {
+                a.terms = { { a.op->arg, tdop_expr->m_vec_tokens[ b.op->arg ].value_buf } };
+            }
+            else
+            {
+                a.terms.clear();
+            }
+            a.op = nullptr;
+            break;
+        }
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            pending.push_back( { op.type, stack.back() } );
+            stack.pop_back();
+            break;
+        case OP_BOOL:
+        {
+            value_t &b = stack.back();
+
+            // a && b needs both sides, a || b needs neither side in particular
+            if ( pending.back().first == OP_JUMP_IF_FALSE )
+            {
+                const std::vector< tdop_contains_t > &terms = pending.back().second.terms;
+
+                b.terms.insert( b.terms.end(), terms.begin(), terms.end() );
+            }
+            else
+            {
+                b.terms.clear();
+            }
+            b.op = nullptr;
+            pending.pop_back();
+            break;
+        }
+        }
+    }
+
+    return stack.empty() ? std::vector< tdop_contains_t >() : stack.back().terms;
+}
+
 tdop_state_token *TdopExpr::get_next_token()
 {
     if ( m_token_index >= m_vec_tokens.size() )
@@ -372,32 +517,35 @@ tdop_state_token *TdopExpr::get_next_token()
     return &m_vec_tokens[ m_token_index++ ];
 }
 
-const char *TdopExpr::tdop_infix( tdop_state_token *self, const char *left )
+void TdopExpr::add_op( tdop_op_type_t type, uint32_t arg, TDOP_INFIX_FUNC *function )
 {
-    const char *right = tdop_expression( self->lbp );
-
-    return self->function( left, right );
+    m_ops.push_back( { type, arg, function } );
 }
 
-const char *TdopExpr::tdop_expression( int rbp )
+// Walk tokens in the same order the tdop parser evaluates them and
+//  emit the equivalent postfix ops.
+void TdopExpr::tdop_expression( int rbp )
 {
-    const char *left;
-
     if ( m_token->type == TOK_LPAREN )
     {
         m_token = get_next_token();
-        left = tdop_expression( 0 );
+        tdop_expression( 0 );
 
         // m_token should be TOK_RPAREN right now
     }
     else if ( m_token->type == TOK_VARIABLE )
     {
-        left = m_get_keyval_func( m_token->variable, m_token->value_buf );
+        auto it = std::find( m_variables.begin(), m_variables.end(), m_token->variable );
+
+        if ( it == m_variables.end() )
+            it = m_variables.insert( it, m_token->variable );
+
+        add_op( OP_PUSH_VARIABLE, it - m_variables.begin() );
     }
     else
     {
         // m_token should be TOK_STRING / TOK_NUMBER
-        left = m_token->value_buf;
+        add_op( OP_PUSH_VALUE, m_token - m_vec_tokens.data() );
     }
 
     m_token = get_next_token();
@@ -409,20 +557,203 @@ const char *TdopExpr::tdop_expression( int rbp )
 
         m_token = get_next_token();
 
-        left = tdop_infix( tok, left );
+        if ( ( tok->function == func_and ) || ( tok->function == func_or ) )
+        {
+            // Short circuit: skip right side if left side decides result
+            size_t jump = m_ops.size();
+
+            add_op( ( tok->function == func_and ) ? OP_JUMP_IF_FALSE : OP_JUMP_IF_TRUE, 0 );
+            tdop_expression( tok->lbp );
+            add_op( OP_BOOL, 0 );
+
+            m_ops[ jump ].arg = m_ops.size();
+        }
+        else
+        {
+            tdop_expression( tok->lbp );
+            if ( !add_num_compare( tok->function ) )
+                add_op( OP_INFIX, 0, tok->function );
+        }
+    }
+}
+
+// If the ops just added are "push variable, push number" (either order) for a
+//  comparison, replace them with an OP_NUM_COMPARE.
+bool TdopExpr::add_num_compare( TDOP_INFIX_FUNC *function )
+{
+    size_t count = m_ops.size();
+    bool ordered = ( function == func_gt ) || ( function == func_ge ) ||
+            ( function == func_lt ) || ( function == func_le );
+
+    if ( ( count < 2 ) || ( !ordered && ( function != func_equal ) && ( function != func_notequal ) ) )
+        return false;
+
+    const tdop_op_t &a = m_ops[ count - 2 ];
+    const tdop_op_t &b = m_ops[ count - 1 ];
+    tdop_num_compare_t cmp;
+
+    if ( ( a.type == OP_PUSH_VARIABLE ) && ( b.type == OP_PUSH_VALUE ) )
+        cmp.swapped = false;
+    else if ( ( a.type == OP_PUSH_VALUE ) && ( b.type == OP_PUSH_VARIABLE ) )
+        cmp.swapped = true;
+    else
+        return false;
+
+    cmp.var = cmp.swapped ? b.arg : a.arg;
+    cmp.token = cmp.swapped ? a.arg : b.arg;
+
+    const tdop_state_token &tok = m_vec_tokens[ cmp.token ];
+    const char *val = tok.value_buf;
+
+    if ( tok.type != TOK_NUMBER )
+        return false;
+
+    cmp.is_float = ( val[ 0 ] == '-' ) || strchr( val, '.' );
+    cmp.d = strtod( val, NULL );
+    cmp.u = strtoull( val, NULL, ( val[ 0 ] == '0' && val[ 1 ] == 'x' ) ? 16 : 10 );
+
+    const char *digits = val + ( val[ 0 ] == '-' );
+    size_t len = strspn( digits, "0123456789" );
+
+    cmp.neg = ( val[ 0 ] == '-' );
+    cmp.mag = strtoull( digits, NULL, 10 );
+    cmp.is_decimal = len && !digits[ len ] && ( len <= 19 ) &&
+            ( ( digits[ 0 ] != '0' ) || ( ( len == 1 ) && !cmp.neg ) );
+
+    // Otherwise == and != have to compare strings
+    if ( !ordered && !cmp.is_decimal )
+        return false;
+
+    m_ops.resize( count - 2 );
+    add_op( OP_NUM_COMPARE, m_num_compares.size(), function );
+    m_num_compares.push_back( cmp );
+    return true;
+}
+
+template < typename T >
+static int val_compare( T a, T b )
+{
+    if ( a == b )
+        return 0;
+    else if ( a < b )
+        return -1;
+    return 1;
+}
+
+// Same result as function( var string, number string ) for a number var
+static const char *num_compare_op( TDOP_INFIX_FUNC *function, const tdop_num_compare_t &cmp, const tdop_num_t &num )
+{
+    if ( ( function == func_equal ) || ( function == func_notequal ) )
+    {
+        bool neg = ( num.type == tdop_num_t::TDOP_NUM_INT ) && ( num.i < 0 );
+        uint64_t mag = ( num.type == tdop_num_t::TDOP_NUM_UINT ) ? num.u :
+                neg ? 0 - ( uint64_t )num.i : ( uint64_t )num.i;
+        bool equal = ( neg == cmp.neg ) && ( mag == cmp.mag );
+
+        return ( equal == ( function == func_equal ) ) ? "1" : "";
     }
 
-    return left;
+    int ret;
+    bool is_float = ( num.type == tdop_num_t::TDOP_NUM_FLOAT ) ||
+            ( ( num.type == tdop_num_t::TDOP_NUM_INT ) && ( num.i < 0 ) );
+
+    if ( is_float || cmp.is_float )
+    {
+        double d = ( num.type == tdop_num_t::TDOP_NUM_FLOAT ) ? num.d :
+                ( num.type == tdop_num_t::TDOP_NUM_INT ) ? ( double )num.i : ( double )num.u;
+
+        ret = cmp.swapped ? val_compare( cmp.d, d ) : val_compare( d, cmp.d );
+    }
+    else
+    {
+        uint64_t u = ( num.type == tdop_num_t::TDOP_NUM_INT ) ? ( uint64_t )num.i : num.u;
+
+        ret = cmp.swapped ? val_compare( cmp.u, u ) : val_compare( u, cmp.u );
+    }
+
+    if ( function == func_gt )
+        return ( ret > 0 ) ? "1" : "";
+    else if ( function == func_ge )
+        return ( ret >= 0 ) ? "1" : "";
+    else if ( function == func_lt )
+        return ( ret < 0 ) ? "1" : "";
+    return ( ret <= 0 ) ? "1" : "";
 }
 
-const char *TdopExpr::exec( tdop_get_keyval_func &get_keyval_func )
+const char *TdopExpr::exec_vars( tdop_get_var_func &get_var_func, tdop_get_var_num_func *get_var_num_func )
 {
-    m_get_keyval_func = get_keyval_func;
+    size_t sp = 0;
+    const char **stack = m_stack.data();
 
-    m_token_index = 0;
-    m_token = get_next_token();
+    for ( size_t i = 0; i < m_ops.size(); i++ )
+    {
+        const tdop_op_t &op = m_ops[ i ];
 
-    return tdop_expression( 0 );
+        switch ( op.type )
+        {
+        case OP_PUSH_VALUE:
+            stack[ sp++ ] = m_vec_tokens[ op.arg ].value_buf;
+            break;
+        case OP_PUSH_VARIABLE:
+            stack[ sp++ ] = get_var_func( op.arg, m_bufs[ i ].value_buf );
+            break;
+        case OP_INFIX:
+            sp--;
+            stack[ sp - 1 ] = op.function( stack[ sp - 1 ], stack[ sp ] );
+            break;
+        case OP_JUMP_IF_FALSE:
+            if ( !stack[ sp - 1 ][ 0 ] )
+                i = op.arg - 1;
+            else
+                sp--;
+            break;
+        case OP_JUMP_IF_TRUE:
+            if ( stack[ sp - 1 ][ 0 ] )
+            {
+                stack[ sp - 1 ] = "1";
+                i = op.arg - 1;
+            }
+            else
+            {
+                sp--;
+            }
+            break;
+        case OP_BOOL:
+            stack[ sp - 1 ] = stack[ sp - 1 ][ 0 ] ? "1" : "";
+            break;
+        case OP_NUM_COMPARE:
+        {
+            tdop_num_t num;
+            const tdop_num_compare_t &cmp = m_num_compares[ op.arg ];
+
+            if ( get_var_num_func && ( *get_var_num_func )( cmp.var, num ) &&
+                 ( num.decimal || ( ( op.function != func_equal ) && ( op.function != func_notequal ) ) ) )
+            {
+                stack[ sp++ ] = num_compare_op( op.function, cmp, num );
+            }
+            else
+            {
+                const char *var = get_var_func( cmp.var, m_bufs[ i ].value_buf );
+                const char *val = m_vec_tokens[ cmp.token ].value_buf;
+
+                stack[ sp++ ] = cmp.swapped ? op.function( val, var ) : op.function( var, val );
+            }
+            break;
+        }
+        }
+    }
+
+    return sp ? stack[ 0 ] : "";
+}
+
+const char *TdopExpr::exec( tdop_get_keyval_func &get_keyval_func )
+{
+    tdop_get_var_func get_var_func = [ & ]( uint32_t var, char ( &buf )[ 64 ] )
+    {
+        return get_keyval_func( m_variables[ var ], buf );
+    };
+
+    return exec_vars( get_var_func, nullptr );
 }
 
 static bool is_arg( tdop_tok_type_t type )
@@ -527,6 +858,18 @@ int TdopExpr::compile( const char *expression, tdop_get_key_func &get_key_func,
     }
 
     errstr = validate_info_tokens( m_vec_tokens );
+    if ( !errstr.empty() )
+        return -1;
+
+    // Flatten into postfix ops
+    m_ops.clear();
+    m_variables.clear();
+    m_num_compares.clear();
+    m_token_index = 0;
+    m_token = get_next_token();
+    tdop_expression( 0 );
 
-    return errstr.empty() ? 0 : -1;
+    m_stack.resize( m_ops.size() + 1 );
+    m_bufs.resize( m_ops.size() );
+    return 0;
 }
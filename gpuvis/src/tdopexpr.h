@@ -26,9 +26,45 @@
 
 typedef std::function< const char * ( const char *name, size_t len ) > tdop_get_key_func;
 typedef std::function< const char * ( const char *name, char ( &buf )[ 64 ] ) > tdop_get_keyval_func;
+// var is an index into tdopexpr_get_variables()
+typedef std::function< const char * ( uint32_t var, char ( &buf )[ 64 ] ) > tdop_get_var_func;
+
+// Numeric value of a variable, so terms like "$pid > 1000" can compare it
+//  with the number directly instead of formatting it as a string first.
+struct tdop_num_t
+{
+    enum type_t { TDOP_NUM_UINT, TDOP_NUM_INT, TDOP_NUM_FLOAT } type;
+    // String value is plain %llu / %lld, so == and != can compare numbers too
+    bool decimal;
+    union
+    {
+        uint64_t u;
+        int64_t i;
+        double d;
+    };
+};
+// Return false to have var formatted by tdop_get_var_func instead
+typedef std::function< bool ( uint32_t var, tdop_num_t &num ) > tdop_get_var_num_func;
 
 class TdopExpr *tdopexpr_compile( const char *expression, tdop_get_key_func &get_key_func, std::string &errstr );
 const char *tdopexpr_exec( class TdopExpr *tdop_expr, tdop_get_keyval_func &get_keyval_func );
+const char *tdopexpr_exec_vars( class TdopExpr *tdop_expr, tdop_get_var_func &get_var_func,
+                                tdop_get_var_num_func *get_var_num_func = nullptr );
 void tdopexpr_delete( class TdopExpr *tdop_expr );
 
+// Variable names (from get_key_func) referenced by a compiled expression
+const std::vector< const char * > &tdopexpr_get_variables( class TdopExpr *tdop_expr );
+// Expressions keep exec scratch space, so use a clone per thread
+class TdopExpr *tdopexpr_clone( class TdopExpr *tdop_expr );
+
+// "$var =~ str" terms an expression needs to be true: events that match the
+//  expression have variable var (index into tdopexpr_get_variables()) containing
+//  str, ignoring case. Lets callers prefilter events with a text index.
+struct tdop_contains_t
+{
+    uint32_t var;
+    const char *str;
+};
+std::vector< tdop_contains_t > tdopexpr_get_required_contains( class TdopExpr *tdop_expr );
+
 #endif // TDOPEXPR_H_
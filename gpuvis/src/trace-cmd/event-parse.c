@@ -803,6 +803,101 @@ void pevent_print_printk(struct pevent *pevent)
 	}
 }
 
+/*
+ * Resolve the fields of @arg and everything nested in it, the same
+ * lookups eval_num_arg() and print_str_arg() do on first use.
+ */
+static void resolve_print_arg_fields(struct event_format *event,
+				     struct print_arg *arg)
+{
+	struct format_field *f;
+
+	if (!arg)
+		return;
+
+	switch (arg->type) {
+	case PRINT_FIELD:
+		if (!arg->field.field)
+			arg->field.field = pevent_find_any_field(event, arg->field.name);
+		break;
+	case PRINT_FLAGS:
+		resolve_print_arg_fields(event, arg->flags.field);
+		break;
+	case PRINT_SYMBOL:
+		resolve_print_arg_fields(event, arg->symbol.field);
+		break;
+	case PRINT_HEX:
+	case PRINT_HEX_STR:
+		resolve_print_arg_fields(event, arg->hex.field);
+		resolve_print_arg_fields(event, arg->hex.size);
+		break;
+	case PRINT_INT_ARRAY:
+		resolve_print_arg_fields(event, arg->int_array.field);
+		resolve_print_arg_fields(event, arg->int_array.count);
+		resolve_print_arg_fields(event, arg->int_array.el_size);
+		break;
+	case PRINT_TYPE:
+		resolve_print_arg_fields(event, arg->typecast.item);
+		break;
+	case PRINT_STRING:
+		if (arg->string.offset == -1) {
+			f = pevent_find_any_field(event, arg->string.string);
+			if (f)
+				arg->string.offset = f->offset;
+		}
+		break;
+	case PRINT_BITMASK:
+		if (arg->bitmask.offset == -1) {
+			f = pevent_find_any_field(event, arg->bitmask.bitmask);
+			if (f)
+				arg->bitmask.offset = f->offset;
+		}
+		break;
+	case PRINT_DYNAMIC_ARRAY:
+		resolve_print_arg_fields(event, arg->dynarray.index);
+		break;
+	case PRINT_OP:
+		resolve_print_arg_fields(event, arg->op.left);
+		resolve_print_arg_fields(event, arg->op.right);
+		break;
+	case PRINT_FUNC:
+		for (arg = arg->func.args; arg; arg = arg->next)
+			resolve_print_arg_fields(event, arg);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * pevent_init_lookup_maps - build the lazily initialized lookup tables
+ * @pevent: handle for the pevent
+ *
+ * The cmdline, function and printk maps (and the print_fmt field
+ * pointers, nested args included) are normally built on first use.
+ * Build them up front so several threads can parse records with
+ * @pevent at the same time.
+ */
+void pevent_init_lookup_maps(struct pevent *pevent)
+{
+	struct print_arg *arg;
+	int i;
+
+	if (!pevent->cmdlines)
+		cmdline_init(pevent);
+	if (!pevent->func_map)
+		func_map_init(pevent);
+	if (!pevent->printk_map)
+		printk_map_init(pevent);
+
+	for (i = 0; i < pevent->nr_events; i++) {
+		struct event_format *event = pevent->events[i];
+
+		for (arg = event->print_fmt.args; arg; arg = arg->next)
+			resolve_print_arg_fields(event, arg);
+	}
+}
+
 /**
  * pevent_print_tgids - print out the tgids
  * @pevent: handle for the pevent
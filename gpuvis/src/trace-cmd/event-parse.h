@@ -651,6 +651,7 @@ int pevent_data_pc(struct pevent *pevent, struct pevent_record *rec);
 int pevent_data_flags(struct pevent *pevent, struct pevent_record *rec);
 int pevent_data_tgid_from_pid(struct pevent *pevent, int pid);
 const char *pevent_data_comm_from_pid(struct pevent *pevent, int pid);
+void pevent_init_lookup_maps(struct pevent *pevent);
 struct cmdline;
 struct cmdline *pevent_data_pid_from_comm(struct pevent *pevent, const char *comm,
 					  struct cmdline *next);
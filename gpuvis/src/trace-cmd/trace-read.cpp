@@ -32,6 +32,9 @@
 #include <unordered_set>
 #include <algorithm>
 #include <future>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #ifdef WIN32
 #include <io.h>
@@ -62,6 +65,7 @@ extern "C"
 }
 
 #include "../gpuvis_macros.h"
+#include "../gpuvis_stream.h"
 
 #include "trace-read.h"
 
@@ -121,6 +125,11 @@ typedef struct cpu_data
     page_t *page = nullptr;
     kbuffer_t *kbuf = nullptr;
 
+    /* whole cpu data section mapping, pages are views into it */
+    void *map = nullptr;
+    unsigned long long map_offset = 0;
+    size_t map_size = 0;
+
     pevent_record_t event_record;
 } cpu_data_t;
 
@@ -136,6 +145,9 @@ typedef struct tracecmd_input
     tracecmd_input_t *parent = nullptr;
     unsigned long flags = 0;
     int fd = -1;
+    /* compressed traces are read from a stream instead of fd */
+    TraceStream *stream = nullptr;
+    uint64_t stream_pos = 0;
     int long_size = 0;
     unsigned long page_size = 0;
     int cpus = 0;
@@ -144,6 +156,7 @@ typedef struct tracecmd_input
     bool use_trace_clock = false;
 #ifdef USE_MMAP
     bool read_page = false;
+    bool map_cpu_data = false;
 #endif
     cpu_data_t *cpu_data = nullptr;
     unsigned long long ts_offset = 0;
@@ -207,6 +220,22 @@ static size_t do_read( tracecmd_input_t *handle, void *data, size_t size )
 {
     ssize_t ret;
 
+    if ( handle->stream )
+    {
+        size_t len = handle->stream->read( handle->stream_pos, data, size );
+
+        if ( len < size )
+        {
+            std::string errstr = handle->stream->get_errstr();
+
+            if ( !errstr.empty() )
+                die( handle, "%s(\"%s\") failed: %s\n", __func__, handle->file.c_str(), errstr.c_str() );
+        }
+
+        handle->stream_pos += len;
+        return len;
+    }
+
     ret = TEMP_FAILURE_RETRY( read( handle->fd, data, size ) );
     if ( ret < 0 )
     {
@@ -217,6 +246,25 @@ static size_t do_read( tracecmd_input_t *handle, void *data, size_t size )
     return ret;
 }
 
+static off64_t do_seek( tracecmd_input_t *handle, off64_t offset, int whence )
+{
+    if ( handle->stream )
+    {
+        if ( whence == SEEK_CUR )
+            offset += handle->stream_pos;
+        else if ( whence != SEEK_SET )
+            return -1;
+
+        if ( offset < 0 )
+            return -1;
+
+        handle->stream_pos = offset;
+        return offset;
+    }
+
+    return lseek64( handle->fd, offset, whence );
+}
+
 static void do_read_check( tracecmd_input_t *handle, void *data, size_t size )
 {
     size_t ret;
@@ -266,7 +314,7 @@ static char *read_string( tracecmd_input_t *handle )
 
     /* move the file descriptor to the end of the string */
     off64_t val;
-    val = lseek64( handle->fd, -( int )( r - ( i + 1 ) ), SEEK_CUR );
+    val = do_seek( handle, -( int )( r - ( i + 1 ) ), SEEK_CUR );
     if ( val < 0 )
         goto fail;
 
@@ -362,7 +410,7 @@ static void read_header_files( tracecmd_input_t *handle )
 
     free( header );
 
-    handle->ftrace_files_start = lseek64( handle->fd, 0, SEEK_CUR );
+    handle->ftrace_files_start = do_seek( handle, 0, SEEK_CUR );
 }
 
 static void read_ftrace_file( tracecmd_input_t *handle,
@@ -411,7 +459,7 @@ static void read_ftrace_files( tracecmd_input_t *handle )
         read_ftrace_file( handle, size );
     }
 
-    handle->event_files_start = lseek64( handle->fd, 0, SEEK_CUR );
+    handle->event_files_start = do_seek( handle, 0, SEEK_CUR );
 }
 
 static void read_event_files( tracecmd_input_t *handle )
@@ -645,6 +693,22 @@ static int read_page( tracecmd_input_t *handle, off64_t offset,
 {
     off64_t ret;
     off64_t save_seek;
+    static std::mutex s_mutex;
+
+    if ( handle->stream )
+    {
+        /* streams take an offset, so there is no file pointer to share */
+        size_t len = handle->stream->read( offset, map, handle->page_size );
+
+        if ( !len || ( ( len < handle->page_size ) && !handle->stream->get_errstr().empty() ) )
+            return -1;
+
+        memset( ( char * )map + len, 0, handle->page_size - len );
+        return 0;
+    }
+
+    /* cpus may be read from multiple threads and share the file pointer */
+    std::lock_guard< std::mutex > lock( s_mutex );
 
     /* other parts of the code may expect the pointer to not move */
     save_seek = lseek64( handle->fd, 0, SEEK_CUR );
@@ -684,7 +748,11 @@ static page_t *allocate_page( tracecmd_input_t *handle, int cpu, off64_t offset
     page->handle = handle;
 
 #ifdef USE_MMAP
-    if ( handle->read_page )
+    if ( cpu_data->map )
+    {
+        page->map = ( char * )cpu_data->map + ( offset - cpu_data->map_offset );
+    }
+    else if ( handle->read_page )
 #endif
     {
         page->map = trace_malloc( handle, handle->page_size );
@@ -728,7 +796,9 @@ static void __free_page( tracecmd_input_t *handle, int cpu, page_t *page )
         return;
 
 #ifdef USE_MMAP
-    if ( handle->read_page )
+    if ( handle->cpu_data[ cpu ].map )
+        page->map = NULL; /* view into cpu data mapping */
+    else if ( handle->read_page )
 #endif
         free( page->map );
 #ifdef USE_MMAP
@@ -1065,6 +1135,45 @@ static pevent_record_t *tracecmd_read_next_data( tracecmd_input_t *handle, int *
     return tracecmd_read_data( handle, next_cpu );
 }
 
+#ifdef USE_MMAP
+/*
+ * Map the entire cpu data section up front. Pages then become views into
+ * this mapping: no syscalls per page, and the kernel can read ahead.
+ */
+static void map_cpu_data( tracecmd_input_t *handle, int cpu )
+{
+    cpu_data_t *cpu_data = &handle->cpu_data[ cpu ];
+    unsigned long long align = sysconf( _SC_PAGESIZE );
+    unsigned long long offset = cpu_data->file_offset & ~( align - 1 );
+    unsigned long long file_size = ( cpu_data->file_size + handle->page_size - 1 ) & ~( handle->page_size - 1ULL );
+    size_t size = cpu_data->file_offset + file_size - offset;
+
+    void *map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, handle->fd, offset );
+    if ( map == MAP_FAILED )
+        return;
+
+    madvise( map, size, MADV_SEQUENTIAL );
+    madvise( map, size, MADV_WILLNEED );
+
+    cpu_data->map = map;
+    cpu_data->map_offset = offset;
+    cpu_data->map_size = size;
+}
+
+static void unmap_cpu_data( tracecmd_input_t *handle, int cpu )
+{
+    cpu_data_t *cpu_data = &handle->cpu_data[ cpu ];
+
+    if ( cpu_data->map )
+    {
+        munmap( cpu_data->map, cpu_data->map_size );
+
+        cpu_data->map = nullptr;
+        cpu_data->map_size = 0;
+    }
+}
+#endif
+
 static int init_cpu( tracecmd_input_t *handle, int cpu )
 {
     cpu_data_t *cpu_data = &handle->cpu_data[ cpu ];
@@ -1079,6 +1188,11 @@ static int init_cpu( tracecmd_input_t *handle, int cpu )
         return 0;
     }
 
+#ifdef USE_MMAP
+    if ( handle->map_cpu_data && !handle->read_page )
+        map_cpu_data( handle, cpu );
+#endif
+
     cpu_data->page = allocate_page( handle, cpu, cpu_data->offset );
 #ifdef USE_MMAP
     if ( !cpu_data->page && !handle->read_page )
@@ -1287,7 +1401,8 @@ static void read_cpu_data( tracecmd_input_t *handle )
         handle->cpu_data[ cpu ].file_offset = offset;
         handle->cpu_data[ cpu ].file_size = size;
 
-        if ( size && ( offset + size > handle->total_file_size ) )
+        /* streams don't know their size until fully decompressed */
+        if ( size && !handle->stream && ( offset + size > handle->total_file_size ) )
         {
             /* this happens if the file got truncated */
             die( handle, "%s: File possibly truncated. "
@@ -1401,9 +1516,12 @@ static void tracecmd_alloc_fd( tracecmd_input_t *handle, const char *file, int f
 
     handle->page_size = read4( handle );
 
-    handle->header_files_start = lseek64( handle->fd, 0, SEEK_CUR );
-    handle->total_file_size = lseek64( handle->fd, 0, SEEK_END );
-    handle->header_files_start = lseek64( handle->fd, handle->header_files_start, SEEK_SET );
+    handle->header_files_start = do_seek( handle, 0, SEEK_CUR );
+    if ( !handle->stream )
+    {
+        handle->total_file_size = lseek64( handle->fd, 0, SEEK_END );
+        handle->header_files_start = lseek64( handle->fd, handle->header_files_start, SEEK_SET );
+    }
 }
 
 /**
@@ -1421,6 +1539,23 @@ static void tracecmd_alloc( tracecmd_input_t *handle, const char *file )
 {
     int fd;
 
+    if ( TraceStream::is_compressed( file ) )
+    {
+        /* decompress on another thread while we parse */
+        handle->stream = new TraceStream;
+        if ( !handle->stream->open( file ) )
+        {
+            logf( "[Error] %s: open(\"%s\") failed.\n", __func__, file );
+            return;
+        }
+
+#ifdef USE_MMAP
+        handle->read_page = true;
+#endif
+        tracecmd_alloc_fd( handle, file, -1 );
+        return;
+    }
+
     fd = TEMP_FAILURE_RETRY( open( file, O_RDONLY ) );
     if ( fd < 0 )
     {
@@ -1468,6 +1603,11 @@ static void tracecmd_close( tracecmd_input_t *handle )
             if ( !handle->cpu_data[ cpu ].pages.empty() )
                 die( handle, "%s: pages still allocated on cpu %d\n", __func__, cpu );
         }
+
+#ifdef USE_MMAP
+        if ( handle->cpu_data )
+            unmap_cpu_data( handle, cpu );
+#endif
     }
 
     if ( handle->fd >= 0 )
@@ -1484,8 +1624,9 @@ static void tracecmd_close( tracecmd_input_t *handle )
     }
     else
     {
-        /* Only main handle frees pevent */
+        /* Only main handle frees pevent and stream */
         pevent_free( handle->pevent );
+        delete handle->stream;
     }
 
     delete handle;
@@ -1516,23 +1657,26 @@ static tracecmd_input_t *tracecmd_buffer_instance_handle( tracecmd_input_t *hand
 
     handle->ref++;
 
-    new_handle->fd = dup( handle->fd );
+    new_handle->fd = ( handle->fd >= 0 ) ? dup( handle->fd ) : -1;
 
     new_handle->flags |= TRACECMD_FL_BUFFER_INSTANCE;
 
     /* Save where we currently are */
-    offset = lseek64( handle->fd, 0, SEEK_CUR );
+    offset = do_seek( handle, 0, SEEK_CUR );
 
-    ret = lseek64( handle->fd, buffer->offset, SEEK_SET );
+    ret = do_seek( handle, buffer->offset, SEEK_SET );
     if ( ret < 0 )
     {
         die( handle, "%s: could not seek to buffer %s offset %lu.\n",
                  __func__, buffer->name, buffer->offset );
     }
 
+    /* dup'd fds share the file pointer, stream positions are per handle */
+    new_handle->stream_pos = handle->stream_pos;
+
     read_cpu_data( new_handle );
 
-    ret = lseek64( handle->fd, offset, SEEK_SET );
+    ret = do_seek( handle, offset, SEEK_SET );
     if ( ret < 0 )
         die( handle, "%s: could not seek to back to offset %ld\n", __func__, offset );
 
@@ -1576,8 +1720,6 @@ public:
         ftrace_function_str = strpool.getstr( "ftrace-function" );
         drm_vblank_event_str = strpool.getstr( "drm_vblank_event" );
         sched_switch_str = strpool.getstr( "sched_switch" );
-        time_str = strpool.getstr( "time" );
-        high_prec_str = strpool.getstr( "high_prec" );
     }
 
 public:
@@ -1595,8 +1737,9 @@ public:
     const char *ftrace_function_str;
     const char *drm_vblank_event_str;
     const char *sched_switch_str;
-    const char *time_str;
-    const char *high_prec_str;
+
+    // Last event format we looked up
+    event_format_t *last_event = nullptr;
 };
 
 static void init_event_flags( trace_data_t &trace_data, trace_event_t &event )
@@ -1627,6 +1770,195 @@ static void init_event_flags( trace_data_t &trace_data, trace_event_t &event )
         event.flags |= TRACE_FLAG_HW_QUEUE;
 }
 
+// Get type we store field values as. Mirrors pevent_print_field() formatting.
+static uint32_t get_field_type( const struct format_field *format )
+{
+    if ( format->flags & FIELD_IS_ARRAY )
+        return EVENT_FIELD_STR;
+    if ( format->flags & FIELD_IS_POINTER )
+        return EVENT_FIELD_HEX;
+
+    if ( format->flags & FIELD_IS_SIGNED )
+    {
+        // Signed longs usually store pointers
+        if ( ( format->size == 4 ) && ( format->flags & FIELD_IS_LONG ) )
+            return EVENT_FIELD_HEX32;
+        if ( format->size == 2 )
+            return EVENT_FIELD_INT16;
+        return EVENT_FIELD_INT;
+    }
+
+    if ( format->flags & FIELD_IS_LONG )
+        return EVENT_FIELD_HEX;
+    return EVENT_FIELD_UINT;
+}
+
+static bool is_printable_array( const char *p, unsigned int len )
+{
+    for ( unsigned int i = 0; ( i < len ) && p[ i ]; i++ )
+    {
+        if ( !isprint( ( unsigned char )p[ i ] ) && !isspace( ( unsigned char )p[ i ] ) )
+            return false;
+    }
+    return true;
+}
+
+// Print array field like pevent_print_field(). That clears FIELD_IS_STRING in the
+//  shared format the first time an array isn't printable, which races when cpus are
+//  decoded on multiple threads. Decide per record instead and leave format alone.
+static void print_array_field( struct trace_seq *seq, pevent_t *pevent, void *data,
+                               const struct format_field *format )
+{
+    unsigned int offset = format->offset;
+    unsigned int len = format->size;
+
+    if ( format->flags & FIELD_IS_DYNAMIC )
+    {
+        unsigned long long val = pevent_read_number( pevent, ( char * )data + offset, len );
+
+        offset = val & 0xffff;
+        len = ( val >> 16 ) & 0xffff;
+    }
+
+    if ( ( format->flags & FIELD_IS_STRING ) &&
+         is_printable_array( ( char * )data + offset, len ) )
+    {
+        trace_seq_puts( seq, ( char * )data + offset );
+        return;
+    }
+
+    trace_seq_puts( seq, "ARRAY[" );
+    for ( unsigned int i = 0; i < len; i++ )
+    {
+        if ( i )
+            trace_seq_puts( seq, ", " );
+        trace_seq_printf( seq, "%02x", *( ( unsigned char * )data + offset + i ) );
+    }
+    trace_seq_putc( seq, ']' );
+}
+
+// Trim trailing whitespace from seq and add it to the string pool
+static const char *get_seq_str( StrPool &strpool, struct trace_seq &seq )
+{
+    while ( ( seq.len > 0 ) &&
+            isspace( (unsigned char)seq.buffer[ seq.len - 1 ] ) )
+    {
+        seq.len--;
+    }
+
+    trace_seq_terminate( &seq );
+
+    return strpool.getstr( seq.buffer, seq.len );
+}
+
+// pevent_find_event_by_record() caches the last event in pevent, which isn't
+//  safe when cpus are being decoded on multiple threads. Keep the cache in trace_data.
+static event_format_t *find_event_by_record( trace_data_t &trace_data, pevent_t *pevent, pevent_record_t *record )
+{
+    int type = pevent_data_type( pevent, record );
+
+    if ( !trace_data.last_event || ( trace_data.last_event->id != type ) )
+    {
+        event_format_t **events_end = pevent->events + pevent->nr_events;
+        event_format_t **eventptr = std::lower_bound( pevent->events, events_end, type,
+            []( const event_format_t *event, int id ) { return event->id < id; } );
+
+        if ( ( eventptr == events_end ) || ( ( *eventptr )->id != type ) )
+            return NULL;
+
+        trace_data.last_event = *eventptr;
+    }
+
+    return trace_data.last_event;
+}
+
+// Decode gpuvis binary marker batch (see gpuvis_trace_utils.h) into ftrace print events.
+//  Returns -1 if this raw_data event isn't one of ours.
+static int trace_enum_raw_batch( trace_data_t &trace_data, tracecmd_input_t *handle,
+                                 pevent_record_t *record, event_format_t *event )
+{
+    int ret = 0;
+    gpuvis_raw_batch_t batch;
+    pevent_t *pevent = handle->pevent;
+    StrPool &strpool = trace_data.strpool;
+    struct format_field *format = pevent_find_field( event, "id" );
+    const char *data = format ? ( const char * )record->data + format->offset : NULL;
+    const char *end = ( const char * )record->data + record->size;
+
+    if ( !data || ( data + sizeof( batch ) > end ) )
+        return -1;
+
+    memcpy( &batch, data, sizeof( batch ) );
+    if ( batch.id != GPUVIS_RAW_BATCH_ID )
+        return -1;
+
+    const char *recs = data + sizeof( batch );
+    const char *strs = recs + batch.num_recs * sizeof( gpuvis_raw_rec_t );
+    util_umap< uint32_t, const char * > strmap;
+
+    if ( strs > end )
+        return 0;
+
+    for ( uint32_t i = 0; i < batch.num_strs; i++ )
+    {
+        uint32_t str_id;
+        uint16_t len;
+
+        if ( strs + sizeof( str_id ) + sizeof( len ) > end )
+            break;
+
+        memcpy( &str_id, strs, sizeof( str_id ) );
+        memcpy( &len, strs + sizeof( str_id ), sizeof( len ) );
+        strs += sizeof( str_id ) + sizeof( len );
+
+        if ( strs + len > end )
+            break;
+
+        strmap.set_val( str_id, strpool.getstr( strs, len ) );
+        strs += len;
+    }
+
+    for ( uint32_t i = 0; ( i < batch.num_recs ) && !ret; i++ )
+    {
+        gpuvis_raw_rec_t rec;
+        trace_event_t trace_event;
+
+        memcpy( &rec, recs + i * sizeof( rec ), sizeof( rec ) );
+
+        const char **str = strmap.get_val( rec.str_id );
+        const char *comm = pevent_data_comm_from_pid( pevent, rec.tid );
+        // Record times are from when the scope started, batch.now is when ftrace got it
+        unsigned long long offset = ( batch.now > rec.t0 ) ? ( batch.now - rec.t0 ) : 0;
+
+        trace_event.pid = rec.tid;
+        trace_event.cpu = record->cpu;
+        trace_event.ts = ( record->ts > offset ) ? ( record->ts - offset ) : 0;
+
+        trace_event.comm = strpool.getstrf( "%s-%u", comm, rec.tid );
+        trace_event.system = trace_data.ftrace_print_str;
+        trace_event.name = strpool.getstr( "print" );
+        trace_event.user_comm = trace_event.comm;
+
+        trace_event.numfields = 2;
+        trace_event.fields = new event_field_t[ 2 ];
+
+        trace_event.fields[ 0 ].key = trace_data.ip_str;
+        trace_event.fields[ 0 ].type = EVENT_FIELD_HEX;
+        trace_event.fields[ 0 ].val = 0;
+
+        // Same buf the printf path writes for a GPUVIS_TRACE_BLOCK, but from the scope start
+        trace_event.fields[ 1 ].key = trace_data.buf_str;
+        trace_event.fields[ 1 ].value = strpool.getstrf( "%s (lduration=%llu)",
+                                                         str ? *str : "", ( unsigned long long )rec.duration );
+
+        init_event_flags( trace_data, trace_event );
+
+        ret = trace_data.cb( trace_event );
+    }
+
+    return ret;
+}
+
 static int trace_enum_events( trace_data_t &trace_data, tracecmd_input_t *handle, pevent_record_t *record )
 {
     int ret = 0;
@@ -1634,7 +1966,16 @@ static int trace_enum_events( trace_data_t &trace_data, tracecmd_input_t *handle
     pevent_t *pevent = handle->pevent;
     StrPool &strpool = trace_data.strpool;
 
-    event = pevent_find_event_by_record( pevent, record );
+    event = find_event_by_record( trace_data, pevent, record );
+
+    if ( event && !strcmp( "ftrace", event->system ) && !strcmp( "raw_data", event->name ) )
+    {
+        ret = trace_enum_raw_batch( trace_data, handle, record, event );
+        if ( ret >= 0 )
+            return ret;
+        ret = 0;
+    }
+
     if ( event )
     {
         struct trace_seq seq;
@@ -1685,13 +2026,17 @@ static int trace_enum_events( trace_data_t &trace_data, tracecmd_input_t *handle
         for ( ; format; format = format->next )
         {
             const char *format_name = strpool.getstr( format->name );
+            event_field_t &field = trace_event.fields[ trace_event.numfields++ ];
+            uint32_t type = get_field_type( format );
 
-            trace_seq_reset( &seq );
+            field.key = format_name;
 
             if ( is_printk_function && ( format_name == trace_data.buf_str ) )
             {
                 struct print_arg *args = event->print_fmt.args;
 
+                trace_seq_reset( &seq );
+
                 // We are assuming print_fmt for ftrace/print function is:
                 //   print fmt: "%ps: %s", (void *)REC->ip, REC->buf
                 if ( args->type != PRINT_FIELD )
@@ -1711,62 +2056,62 @@ static int trace_enum_events( trace_data_t &trace_data, tracecmd_input_t *handle
                     if ( seq.buffer[ i ] == '\n' )
                         seq.buffer[ i ] = ' ';
                 }
+
+                field.value = get_seq_str( strpool, seq );
+            }
+            else if ( type == EVENT_FIELD_STR )
+            {
+                // Arrays and strings
+                trace_seq_reset( &seq );
+                print_array_field( &seq, pevent, record->data, format );
+
+                field.value = get_seq_str( strpool, seq );
             }
             else
             {
-                pevent_print_field( &seq, record->data, format );
+                unsigned long long val = pevent_read_number( pevent,
+                        ( char * )record->data + format->offset, format->size );
 
-                if ( format_name == trace_data.seqno_str )
+                // Keep the raw value, it gets formatted when someone asks for it
+                field.type = type;
+                field.val = val;
+
+                if ( ( type == EVENT_FIELD_INT ) || ( type == EVENT_FIELD_INT16 ) )
                 {
-                    unsigned long long val = pevent_read_number( pevent,
-                               ( char * )record->data + format->offset, format->size );
+                    if ( format->size == 4 )
+                        field.val = ( int64_t )( int32_t )val;
+                    else if ( format->size == 2 )
+                        field.val = ( int64_t )( int16_t )val;
+                    else if ( format->size == 1 )
+                        field.val = ( int64_t )( int8_t )val;
+                }
 
+                if ( format_name == trace_data.seqno_str )
+                {
                     trace_event.seqno = val;
                 }
                 else if ( format_name == trace_data.crtc_str )
                 {
-                    unsigned long long val = pevent_read_number( pevent,
-                               ( char * )record->data + format->offset, format->size );
-
                     trace_event.crtc = val;
                 }
-                else if ( trace_event.name == trace_data.drm_vblank_event_str &&
-                          format_name == trace_data.time_str &&
-                          !strcmp(handle->pevent->trace_clock, "mono"))
-                {
-                    // for drm_vblank_event, if "time" field is available,
-                    // and the trace-clock is monotonic, store the timestamp
-                    // passed along with the vblank event
-                    unsigned long long val = pevent_read_number( pevent,
-                               ( char * )record->data + format->offset, format->size );
-
-                    trace_event.vblank_ts = val - trace_data.trace_info.min_file_ts;
-                }
-                else if ( trace_event.name == trace_data.drm_vblank_event_str &&
-                          format_name == trace_data.high_prec_str &&
-                          !strcmp(handle->pevent->trace_clock, "mono"))
-                {
-                    // for drm_vblank_event, if "high_prec" field is available,
-                    // and the trace-lock is monotonic, store the field whether or not
-                    // the passed timestamp is actually from a high-precision source
-                    unsigned long long val = pevent_read_number( pevent,
-                               ( char * )record->data + format->offset, format->size );
-
-                    trace_event.vblank_ts_high_prec = val != 0;
-                }
                 else if ( is_ftrace_function )
                 {
                     bool is_ip = ( format_name == trace_data.ip_str );
 
                     if ( is_ip || ( format_name == trace_data.parent_ip_str ) )
                     {
-                        unsigned long long val = pevent_read_number( pevent,
-                                ( char * )record->data + format->offset, format->size );
                         const char *func = pevent_find_function( pevent, val );
 
                         if ( func )
                         {
-                            trace_seq_printf( &seq, " (%s)", func );
+                            char buf[ 64 ];
+
+                            // Store as "0xaddr (func)" string
+                            trace_seq_reset( &seq );
+                            trace_seq_printf( &seq, "%s (%s)", field.get_str( buf ), func );
+
+                            field.type = EVENT_FIELD_STR;
+                            field.value = get_seq_str( strpool, seq );
 
                             if ( is_ip )
                             {
@@ -1779,19 +2124,6 @@ static int trace_enum_events( trace_data_t &trace_data, tracecmd_input_t *handle
                     }
                 }
             }
-
-            // Trim trailing whitespace
-            while ( ( seq.len > 0 ) &&
-                    isspace( (unsigned char)seq.buffer[ seq.len - 1 ] ) )
-            {
-                seq.len--;
-            }
-
-            trace_seq_terminate( &seq );
-
-            trace_event.fields[ trace_event.numfields ].key = format_name;
-            trace_event.fields[ trace_event.numfields ].value = strpool.getstr( seq.buffer, seq.len );
-            trace_event.numfields++;
         }
 
         init_event_flags( trace_data, trace_event );
@@ -1804,21 +2136,6 @@ static int trace_enum_events( trace_data_t &trace_data, tracecmd_input_t *handle
     return ret;
 }
 
-static pevent_record_t *get_next_record( file_info_t *file_info )
-{
-    if ( file_info->record )
-        return file_info->record;
-
-    if ( file_info->done )
-        return NULL;
-
-    file_info->record = tracecmd_read_next_data( file_info->handle, NULL );
-    if ( !file_info->record )
-        file_info->done = 1;
-
-    return file_info->record;
-}
-
 static void add_file( std::vector< file_info_t * > &file_list, tracecmd_input_t *handle, const char *file )
 {
     file_info_t *item = ( file_info_t * )trace_malloc( handle, sizeof( *item ) );
@@ -1863,6 +2180,271 @@ static int64_t getf64( const char *str, const char *var )
     return 0;
 }
 
+// Move cpu to the last page that starts before ts, so pages before it
+//  only hold records before ts. Page start times only go up.
+static void seek_cpu_page( tracecmd_input_t *handle, int cpu, unsigned long long ts )
+{
+    cpu_data_t *cpu_data = &handle->cpu_data[ cpu ];
+    unsigned long long lo = 0;
+    unsigned long long hi = ( cpu_data->file_size + handle->page_size - 1 ) / handle->page_size;
+
+    free_next( handle, cpu );
+
+    while ( hi - lo > 1 )
+    {
+        unsigned long long mid = lo + ( hi - lo ) / 2;
+
+        if ( get_page( handle, cpu, cpu_data->file_offset + mid * handle->page_size ) < 0 )
+            break;
+
+        if ( cpu_data->timestamp < ts )
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    // get_page() doesn't reload a page we're on, so rewind it by hand
+    if ( get_page( handle, cpu, cpu_data->file_offset + lo * handle->page_size ) >= 0 )
+        update_page_info( handle, cpu );
+}
+
+// Skip the records of a cpu that a previous read returned
+static void resume_cpu( tracecmd_input_t *handle, int cpu, const cpu_resume_t &resume )
+{
+    uint32_t skip = resume.ts_count;
+
+    if ( !handle->cpu_data[ cpu ].page || !resume.ts )
+        return;
+
+    seek_cpu_page( handle, cpu, resume.ts );
+
+    for ( ;; )
+    {
+        pevent_record_t *record = tracecmd_peek_data( handle, cpu );
+
+        if ( !record || ( record->ts > resume.ts ) )
+            break;
+        if ( record->ts == resume.ts )
+        {
+            if ( !skip )
+                break;
+            skip--;
+        }
+
+        free_record( handle, tracecmd_read_data( handle, cpu ) );
+    }
+}
+
+static void update_resume( cpu_resume_t &resume, unsigned long long ts )
+{
+    if ( resume.ts == ts )
+    {
+        resume.ts_count++;
+    }
+    else
+    {
+        resume.ts = ts;
+        resume.ts_count = 1;
+    }
+}
+
+/*
+ * Multithreaded loading: each cpu buffer is decoded on a worker thread into
+ *  its own event array and string pool. The cpu streams are then merged by
+ *  timestamp in the same order the single threaded loop below reads them.
+ */
+class cpu_stream_t
+{
+public:
+    tracecmd_input_t *handle = nullptr;
+    int cpu = 0;
+    bool error = false;
+
+    // ts of every record read from this cpu
+    std::vector< unsigned long long > record_ts;
+    // End of each record's events in events. Binary marker batches add several.
+    std::vector< size_t > record_events_end;
+
+    // Events for records with ts >= trim_ts
+    std::vector< trace_event_t > events;
+
+    // Merge position
+    size_t record_idx = 0;
+    size_t event_idx = 0;
+};
+
+static void set_cpu_pages_handle( tracecmd_input_t *handle, int cpu )
+{
+    for ( page_t *page : handle->cpu_data[ cpu ].pages )
+        page->handle = handle;
+}
+
+static void read_cpu_stream_records( tracecmd_input_t *handle, cpu_stream_t &stream, StrPool &strpool,
+                                     trace_info_t &trace_info, unsigned long long trim_ts )
+{
+    EventCallback cb = [ &stream ]( const trace_event_t &event )
+    {
+        stream.events.push_back( event );
+        return 0;
+    };
+    trace_data_t trace_data( cb, trace_info, strpool );
+
+    for ( ;; )
+    {
+        pevent_record_t *record = tracecmd_read_data( handle, stream.cpu );
+
+        if ( !record )
+            break;
+
+        unsigned long long ts = record->ts;
+
+        if ( ts >= trim_ts )
+            trace_enum_events( trace_data, handle, record );
+
+        stream.record_ts.push_back( ts );
+        stream.record_events_end.push_back( stream.events.size() );
+
+        free_record( handle, record );
+
+        // The merge stops at the first record past tracelen, nothing after it is used
+        if ( ( ts >= trim_ts ) && trace_info.m_tracelen && ( ts - trim_ts > trace_info.m_tracelen ) )
+            break;
+    }
+}
+
+static void read_cpu_stream( cpu_stream_t &stream, StrPool &strpool,
+                             trace_info_t &trace_info, unsigned long long trim_ts )
+{
+    // Use our own copy of the handle so die() longjmps back to this thread
+    tracecmd_input_t handle = *stream.handle;
+
+    set_cpu_pages_handle( &handle, stream.cpu );
+
+    if ( setjmp( handle.jump_buffer ) )
+        stream.error = true;
+    else
+        read_cpu_stream_records( &handle, stream, strpool, trace_info, trim_ts );
+
+    set_cpu_pages_handle( stream.handle, stream.cpu );
+}
+
+static int read_trace_records_mt( std::vector< file_info_t * > &file_list, trace_data_t &trace_data,
+                                  unsigned long long trim_ts, uint32_t thread_count )
+{
+    int ret = 0;
+    size_t count = 0;
+    trace_info_t &trace_info = trace_data.trace_info;
+
+    for ( file_info_t *file_info : file_list )
+        count += file_info->handle->cpus;
+
+    // One stream per cpu for each file. Stream index breaks ts ties the same
+    //  way the single threaded loop does: lowest file, then lowest cpu.
+    std::vector< cpu_stream_t > streams( count );
+
+    count = 0;
+    for ( file_info_t *file_info : file_list )
+    {
+        for ( int cpu = 0; cpu < file_info->handle->cpus; cpu++ )
+        {
+            streams[ count ].handle = file_info->handle;
+            streams[ count ].cpu = cpu;
+            count++;
+        }
+    }
+
+    // Build the pevent lookup tables and resolve print arg fields up front
+    //  so the workers only read from pevent.
+    for ( file_info_t *file_info : file_list )
+        pevent_init_lookup_maps( file_info->handle->pevent );
+
+    for ( cpu_stream_t &stream : streams )
+    {
+        pevent_record_t *record = tracecmd_peek_data( stream.handle, stream.cpu );
+
+        if ( record )
+        {
+            pevent_data_type( stream.handle->pevent, record );
+            pevent_data_pid( stream.handle->pevent, record );
+            break;
+        }
+    }
+
+    // Decode all the cpus. Workers intern strings straight into the main pool.
+    util_parallel_for( streams.size(), thread_count, [ & ]( size_t i ) {
+        read_cpu_stream( streams[ i ], trace_data.strpool, trace_info, trim_ts );
+    } );
+
+    for ( cpu_stream_t &stream : streams )
+    {
+        if ( stream.error )
+        {
+            logf( "[Error] %s: reading cpu %d failed.\n", __func__, stream.cpu );
+            ret = -1;
+        }
+    }
+
+    if ( !ret )
+    {
+        util_merge_tree< unsigned long long > tree( streams.size() );
+
+        for ( uint32_t i = 0; i < streams.size(); i++ )
+        {
+            if ( !streams[ i ].record_ts.empty() )
+                tree.set_key( i, streams[ i ].record_ts[ 0 ] );
+        }
+        tree.build();
+
+        while ( !tree.empty() )
+        {
+            bool done = false;
+            unsigned long long ts = tree.top_key();
+            cpu_stream_t &stream = streams[ tree.top() ];
+            cpu_info_t &cpu_info = trace_info.cpu_info[ stream.cpu ];
+
+            update_resume( trace_info.m_resume[ tree.top() ], ts );
+
+            // Bump up total event count for this cpu
+            cpu_info.tot_events++;
+
+            // Store the max ts value we've seen for this cpu
+            cpu_info.max_ts = ts - trace_info.min_file_ts;
+
+            // If this ts is greater than our trim value, add it.
+            if ( ts >= trim_ts )
+            {
+                cpu_info.events++;
+
+                while ( !ret && ( stream.event_idx < stream.record_events_end[ stream.record_idx ] ) )
+                    ret = trace_data.cb( stream.events[ stream.event_idx++ ] );
+
+                // Bail if user specified read length and we hit it
+                if ( trace_info.m_tracelen && ( ts - trim_ts > trace_info.m_tracelen ) )
+                    done = true;
+            }
+
+            if ( ++stream.record_idx < stream.record_ts.size() )
+                tree.replace_top( stream.record_ts[ stream.record_idx ] );
+            else
+                tree.pop_top();
+
+            if ( done || ret )
+                break;
+        }
+
+        ret = 0;
+    }
+
+    // Free events that didn't make it to the callback
+    for ( cpu_stream_t &stream : streams )
+    {
+        for ( size_t i = stream.event_idx; i < stream.events.size(); i++ )
+            delete [] stream.events[ i ].fields;
+    }
+
+    return ret;
+}
+
 int read_trace_file( const char *file, StrPool &strpool, trace_info_t &trace_info, EventCallback &cb )
 {
     GPUVIS_TRACE_BLOCK( __func__ );
@@ -1891,6 +2473,10 @@ int read_trace_file( const char *file, StrPool &strpool, trace_info_t &trace_inf
 
     add_file( file_list, handle, file );
 
+#ifdef USE_MMAP
+    handle->map_cpu_data = trace_info.m_map_cpu_data;
+#endif
+
     // Read header information from trace.dat file.
     tracecmd_read_headers( handle );
 
@@ -1955,6 +2541,9 @@ int read_trace_file( const char *file, StrPool &strpool, trace_info_t &trace_inf
         }
     }
 
+    // drm_vblank_event "time" fields are only usable with the monotonic clock
+    trace_info.mono_trace_clock = handle->pevent->trace_clock && !strcmp( handle->pevent->trace_clock, "mono" );
+
     // Find the lowest ts value in the trace file
     for ( size_t cpu = 0; cpu < ( size_t )handle->cpus; cpu++ )
     {
@@ -2004,53 +2593,108 @@ int read_trace_file( const char *file, StrPool &strpool, trace_info_t &trace_inf
     // Scoot to tracestart time if it was set
     trim_ts = std::max< unsigned long long >( trim_ts, trace_info.min_file_ts + trace_info.m_tracestart );
 
+    size_t stream_count = 0;
+    for ( file_info_t *file_info : file_list )
+        stream_count += file_info->handle->cpus;
+
+    // Skip what an earlier read of this file returned
+    if ( !trace_info.m_resume.empty() )
+    {
+        if ( trace_info.m_resume.size() != stream_count )
+        {
+            cpu_resume_t resume;
+
+            for ( const cpu_resume_t &it : trace_info.m_resume )
+                resume.ts = std::max( resume.ts, it.ts );
+            resume.ts_count = UINT32_MAX;
+
+            trace_info.m_resume.assign( stream_count, resume );
+        }
+
+        size_t i = 0;
+        for ( file_info_t *file_info : file_list )
+        {
+            for ( int cpu = 0; cpu < file_info->handle->cpus; cpu++ )
+                resume_cpu( file_info->handle, cpu, trace_info.m_resume[ i++ ] );
+        }
+    }
+    trace_info.m_resume.resize( stream_count );
+
     trace_data_t trace_data( cb, trace_info, strpool );
 
-    for ( ;; )
+    uint32_t load_threads = trace_info.m_load_threads ?
+                trace_info.m_load_threads : std::thread::hardware_concurrency();
+
+    if ( load_threads > 1 )
     {
-        int ret = 0;
-        file_info_t *last_file_info = NULL;
-        pevent_record_t *last_record = NULL;
+        if ( read_trace_records_mt( file_list, trace_data, trim_ts, load_threads ) < 0 )
+            die( handle, "%s: reading %s failed.\n", __func__, file );
+    }
+    else
+    {
+        struct cpu_handle_t
+        {
+            tracecmd_input_t *handle;
+            int cpu;
+        };
+        std::vector< cpu_handle_t > streams;
 
+        // One stream per cpu for each file, ties go to lowest file then lowest cpu
         for ( file_info_t *file_info : file_list )
         {
-            pevent_record_t *record = get_next_record( file_info );
+            for ( int cpu = 0; cpu < file_info->handle->cpus; cpu++ )
+                streams.push_back( { file_info->handle, cpu } );
+        }
 
-            if ( !last_record ||
-                 ( record && record->ts < last_record->ts ) )
-            {
-                last_record = record;
-                last_file_info = file_info;
-            }
+        util_merge_tree< unsigned long long > tree( streams.size() );
+
+        for ( uint32_t i = 0; i < streams.size(); i++ )
+        {
+            pevent_record_t *record = tracecmd_peek_data( streams[ i ].handle, streams[ i ].cpu );
+
+            if ( record )
+                tree.set_key( i, record->ts );
         }
+        tree.build();
 
-        if ( last_record )
+        while ( !tree.empty() )
         {
-            cpu_info_t &cpu_info = trace_info.cpu_info[ last_record->cpu ];
+            int ret = 0;
+            bool done = false;
+            cpu_handle_t &stream = streams[ tree.top() ];
+            pevent_record_t *record = tracecmd_read_data( stream.handle, stream.cpu );
+            cpu_info_t &cpu_info = trace_info.cpu_info[ record->cpu ];
+
+            update_resume( trace_info.m_resume[ tree.top() ], record->ts );
 
             // Bump up total event count for this cpu
             cpu_info.tot_events++;
 
             // Store the max ts value we've seen for this cpu
-            cpu_info.max_ts = last_record->ts - trace_info.min_file_ts;
+            cpu_info.max_ts = record->ts - trace_info.min_file_ts;
 
             // If this ts is greater than our trim value, add it.
-            if ( last_record->ts >= trim_ts )
+            if ( record->ts >= trim_ts )
             {
                 cpu_info.events++;
-                ret = trace_enum_events( trace_data, last_file_info->handle, last_record );
+                ret = trace_enum_events( trace_data, stream.handle, record );
 
                 // Bail if user specified read length and we hit it
-                if ( trace_info.m_tracelen && ( last_record->ts - trim_ts > trace_info.m_tracelen ) )
-                    last_record = NULL;
+                if ( trace_info.m_tracelen && ( record->ts - trim_ts > trace_info.m_tracelen ) )
+                    done = true;
             }
 
-            free_record( last_file_info->handle, last_file_info->record );
-            last_file_info->record = NULL;
-        }
+            free_record( stream.handle, record );
 
-        if ( !last_record || ret )
-            break;
+            record = tracecmd_peek_data( stream.handle, stream.cpu );
+            if ( record )
+                tree.replace_top( record->ts );
+            else
+                tree.pop_top();
+
+            if ( done || ret )
+                break;
+        }
     }
 
     if ( trim_ts )
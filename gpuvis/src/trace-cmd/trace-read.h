@@ -118,6 +118,14 @@ struct cpu_info_t
     uint64_t tot_events = 0;
 };
 
+// Where a read of a growing or rewritten trace file picks up on a cpu buffer
+//  stream. Records before ts and the first ts_count records at ts were read.
+struct cpu_resume_t
+{
+    unsigned long long ts = 0;
+    uint32_t ts_count = 0;
+};
+
 struct trace_info_t
 {
     uint32_t cpus = 0;
@@ -130,6 +138,8 @@ struct trace_info_t
 
     // ts of the first event in the file
     int64_t min_file_ts = INT64_MAX;
+    // Trace clock is "mono", so drm_vblank_event time fields match event timestamps
+    bool mono_trace_clock = false;
 
     // ts where we trimmed from
     bool trim_trace = false;
@@ -139,6 +149,17 @@ struct trace_info_t
     uint64_t m_tracestart = 0;
     uint64_t m_tracelen = 0;
 
+    // Threads used to decode cpu buffers (1: single threaded, 0: one per hardware thread)
+    uint32_t m_load_threads = 1;
+    // Map each cpu's data section once instead of a page at a time
+    bool m_map_cpu_data = true;
+
+    // Resume point for each cpu stream (cpus of the file, then of each buffer
+    //  instance). If set on input, records they cover are skipped, seeking past
+    //  whole pages. If the stream layout changed, everything up to the newest
+    //  point is skipped. Set to where this read stopped.
+    std::vector< cpu_resume_t > m_resume;
+
     // Map tgid to vector of child pids and color
     util_umap< int, tgid_info_t > tgid_pids;
     // Map pid to tgid
@@ -149,10 +170,32 @@ struct trace_info_t
     util_umap< int, const char * > sched_switch_pid_comm_map;
 };
 
+enum event_field_type_t
+{
+    EVENT_FIELD_STR = 0,    // value is a StrPool string
+    EVENT_FIELD_UINT,       // val printed as %llu
+    EVENT_FIELD_INT,        // val (sign extended) printed as %lld
+    EVENT_FIELD_INT16,      // val (sign extended) printed as %2d
+    EVENT_FIELD_HEX,        // val printed as 0x%llx
+    EVENT_FIELD_HEX32,      // val printed as 0x%x
+};
+
 struct event_field_t
 {
     const char *key;
-    const char *value;
+    union
+    {
+        const char *value;  // EVENT_FIELD_STR
+        uint64_t val;       // Raw value of numeric fields, formatted on demand
+    };
+    uint32_t type = EVENT_FIELD_STR;
+
+    bool is_str() const { return ( type == EVENT_FIELD_STR ); }
+
+    // Get value as a string. Numeric values are formatted into buf.
+    const char *get_str( char ( &buf )[ 64 ] ) const;
+    // Get value as a number. String values are parsed with strtoull.
+    int64_t get_int() const;
 };
 
 enum trace_flag_type_t {
@@ -174,40 +217,44 @@ enum trace_flag_type_t {
     TRACE_FLAG_AUTOGEN_COLOR                = 0x20000,
 };
 
+// Members are ordered by size to avoid padding: this is 96 bytes on 64-bit
+//  builds (was 128). The vblank timestamp is read from drm_vblank_event fields
+//  when it's needed, see TraceEvents::get_vblank_ts().
 struct trace_event_t
 {
 public:
-    bool is_filtered_out = false;
+    trace_event_t() : flags( 0 ), crtc( -1 ) {}
 
-    int pid;                          // event process id
-    uint32_t id;                      // event id
-    uint32_t cpu;                     // cpu this event was hit on
     int64_t ts;                       // timestamp
+    int64_t duration = INT64_MAX;     // how long this timeline event took (or INT64_MAX for not set)
+
+    const char *comm;                 // command name
+    const char *system;               // event system (ftrace-print, etc.)
+    const char *name;                 // event name
+    const char *user_comm;            // User space comm (if we can figure this out)
+
+    event_field_t *fields = nullptr;
 
-    uint32_t flags = 0;               // TRACE_FLAGS_IRQS_OFF, TRACE_FLAG_HARDIRQ, TRACE_FLAG_SOFTIRQ
+    int pid;                          // event process id
+    uint32_t id;                      // event id
     uint32_t seqno = 0;               // event seqno (from fields)
     uint32_t id_start = INVALID_ID;   // start event if this is a graph sequence event (ie amdgpu_sched_run_job, fence_signaled)
     uint32_t graph_row_id = 0;
-    int crtc = -1;                    // drm_vblank_event crtc (or -1)
-    int64_t vblank_ts = INT64_MAX;    // time-stamp that is passed with the drm_event_vblank event
-    bool vblank_ts_high_prec = false; // denotes whether or not the hardware timestamp is high-precision
 
-    uint32_t color = 0;             // color of the event (or 0 for default)
+    uint32_t color = 0;               // color of the event (or 0 for default)
 
     // i915 events: col_Graph_Bari915SubmitDelay, etc
     // ftrace print events: buf hashval for colors
     // otherwise: -1
     uint32_t color_index = ( uint32_t )-1;
 
-    int64_t duration = INT64_MAX;   // how long this timeline event took (or INT64_MAX for not set)
+    uint32_t flags : 24;              // TRACE_FLAGS_IRQS_OFF, TRACE_FLAG_HARDIRQ, TRACE_FLAG_SOFTIRQ
+    int32_t crtc : 8;                 // drm_vblank_event crtc (or -1)
 
-    const char *comm;               // command name
-    const char *system;             // event system (ftrace-print, etc.)
-    const char *name;               // event name
-    const char *user_comm;          // User space comm (if we can figure this out)
+    uint16_t cpu;                     // cpu this event was hit on
+    uint16_t numfields = 0;
 
-    uint32_t numfields = 0;
-    event_field_t *fields = nullptr;
+    bool is_filtered_out = false;
 
 public:
     bool is_fence_signaled() const             { return !!( flags & TRACE_FLAG_FENCE_SIGNALED ); }
@@ -217,7 +264,6 @@ public:
     bool is_sched_switch() const               { return !!( flags & TRACE_FLAG_SCHED_SWITCH ); }
 
     bool has_duration() const                  { return duration != INT64_MAX; }
-    int64_t get_vblank_ts(bool want_high_prec) const { return want_high_prec && (vblank_ts != INT64_MAX) && vblank_ts_high_prec ? vblank_ts : ts; }
 
     const char *get_timeline_name( const char *def = NULL ) const
     {
@@ -232,7 +278,10 @@ public:
     }
 };
 
+// Numeric field values are formatted into a small set of rotating buffers, so
+//  returned strings for those are only good for the next few calls.
 const char *get_event_field_val( const trace_event_t &event, const char *name, const char *defval = "" );
+int64_t get_event_field_int( const trace_event_t &event, const char *name, int64_t defval = 0 );
 event_field_t *get_event_field( trace_event_t &event, const char *name );
 
 typedef std::function< int ( const trace_event_t &event ) > EventCallback;
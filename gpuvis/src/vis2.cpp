@@ -1,6 +1,8 @@
 #include "LightSpeedApp.h"
 #include "gpuvis.h"
 #include "gpuvis_etl.h"
+#include "gpuvis_cache.h"
+#include "gpuvis_export.h"
 #include "ya_getopt.h"
 
 #include "MiniConfig.h"
@@ -62,63 +64,10 @@ void LightSpeedApp::cancel_load_file()
     //m_loading_info.state.compare_exchange_weak( State_Loading, State_CancelLoading );
 }
 
-static std::string unzip_first_file( const char *zipfile )
-{
-    std::string ret;
-#if 0
-    mz_zip_archive zip_archive;
-
-    memset( &zip_archive, 0, sizeof( zip_archive ) );
-
-    if ( mz_zip_reader_init_file( &zip_archive, zipfile, 0 ) )
-    {
-        mz_uint fileCount = mz_zip_reader_get_num_files( &zip_archive );
-
-        if ( fileCount )
-        {
-            mz_zip_archive_file_stat file_stat;
-
-            if ( mz_zip_reader_file_stat( &zip_archive, 0, &file_stat ) )
-            {
-                for ( mz_uint i = 0; i < fileCount; i++ )
-                {
-                    if ( !mz_zip_reader_file_stat( &zip_archive, i, &file_stat ) )
-                        continue;
-
-                    if ( file_stat.m_is_directory )
-                        continue;
-
-#if defined( _WIN32 )
-                    const char *filename = util_basename( file_stat.m_filename );
-
-                    ret = string_format( "%s_%s", std::tmpnam( NULL ), filename );
-#else
-                    const std::string tstr = string_strftime();
-                    const char *filename = util_basename( file_stat.m_filename );
-                    const char *dot = strrchr( filename, '.' );
-                    int len = dot ? ( dot - filename ) : strlen( filename );
-
-                    ret = string_format( "%s/%.*s_%s.dat", P_tmpdir, len, filename, tstr.c_str() );
-#endif
-                    if ( mz_zip_reader_extract_to_file( &zip_archive, i, ret.c_str(), 0 ) )
-                        break;
-
-                    ret.clear();
-                }
-            }
-        }
-
-        mz_zip_reader_end( &zip_archive );
-    }
-#endif
-    return ret;
-}
-
 bool LightSpeedApp::load_file( const char *filename, bool last )
 {
     GPUVIS_TRACE_BLOCKF( "%s: %s", __func__, filename );
 
-    std::string tmpfile;
     const char *ext = strrchr( filename, '.' );
 
     if ( get_state() != State_Idle )
@@ -127,21 +76,17 @@ bool LightSpeedApp::load_file( const char *filename, bool last )
         return false;
     }
 
-    if ( ext && !strcmp( ext, ".zip" ) )
+    if ( ext && !strcmp( ext, ".etl" ) )
     {
-        tmpfile = unzip_first_file( filename );
-
-        if ( !tmpfile.empty() )
-            filename = tmpfile.c_str();
+        m_trace_type = trace_type_etl;
     }
-
-    const char *real_ext = strrchr( filename, '.' );
-    if ( real_ext && !strcmp( real_ext, ".etl" ) )
+    else if ( ext && ( !strcmp( ext, ".dat" ) || !strcmp( ext, ".trace" ) ) )
     {
-        m_trace_type = trace_type_etl;
+        m_trace_type = trace_type_trace;
     }
-    else if ( real_ext && ( !strcmp( real_ext, ".dat" ) || !strcmp( real_ext, ".trace" ) ) )
+    else if ( ext && ( !strcmp( ext, ".zip" ) || !strcmp( ext, ".gz" ) || !strcmp( ext, ".zst" ) ) )
     {
+        // Compressed trace-cmd files are decompressed as they're read
         m_trace_type = trace_type_trace;
     }
 
@@ -152,6 +97,9 @@ bool LightSpeedApp::load_file( const char *filename, bool last )
         return false;
     }
 
+    // Finish tail jobs before loading more events into m_trace_win
+    stop_tail();
+
     set_state( State_Loading, filename );
 
     // delete m_trace_win;
@@ -178,7 +126,23 @@ bool LightSpeedApp::load_file( const char *filename, bool last )
 
 int LightSpeedApp::load_trace_file( loading_info_t *loading_info, TraceEvents &trace_events, EventCallback trace_cb )
 {
-    return read_trace_file( loading_info->filename.c_str(), trace_events.m_strpool,
+    const char *filename = loading_info->filename.c_str();
+
+    if ( loading_info->use_cache )
+    {
+        util_time_t t0 = util_get_time();
+
+        if ( read_trace_cache( filename, trace_events ) >= 0 )
+        {
+            logf( "Read %lu initialized events from trace cache (%.2fms)",
+                  trace_events.m_events.size(), util_time_to_ms( t0, util_get_time() ) );
+
+            loading_info->from_cache = true;
+            return 0;
+        }
+    }
+
+    return read_trace_file( filename, trace_events.m_strpool,
                             trace_events.m_trace_info, trace_cb );
 }
 
@@ -188,6 +152,68 @@ int LightSpeedApp::load_etl_file( loading_info_t *loading_info, TraceEvents &tra
                           trace_events.m_trace_info, trace_cb );
 }
 
+// Time reading a trace file with 1, 4 and one thread per hardware thread,
+//  then restoring initialized events from its trace cache if there is one
+//  (threads 0 below). Events are thrown away, only counts and timings are logged.
+static void benchmark_trace_file( const char *filename, bool trim_trace )
+{
+    uint32_t thread_counts[] = { 1, 4, std::max( 1u, std::thread::hardware_concurrency() ), 0 };
+    bool have_cache = !!get_file_size( get_trace_cache_filename( filename ).c_str() );
+
+    for ( uint32_t threads : thread_counts )
+    {
+        for ( bool map_cpu_data : { true, false } )
+        {
+            // Cache reads don't touch cpu data
+            if ( !threads && ( !have_cache || !map_cpu_data ) )
+                continue;
+
+            StrPool strpool;
+            trace_info_t trace_info;
+            size_t events = 0;
+            EventCallback trace_cb = [ &events ]( const trace_event_t &event )
+            {
+                events++;
+                delete [] event.fields;
+                return 0;
+            };
+
+            trace_info.trim_trace = trim_trace;
+            trace_info.m_load_threads = threads;
+            trace_info.m_map_cpu_data = map_cpu_data;
+
+            util_time_t t0 = util_get_time();
+            int ret;
+
+            if ( threads )
+            {
+                ret = read_trace_file( filename, strpool, trace_info, trace_cb );
+            }
+            else
+            {
+                TraceEvents cache_events;
+
+                cache_events.m_trace_info.trim_trace = trim_trace;
+                ret = read_trace_cache( filename, cache_events );
+                events = cache_events.m_events.size();
+            }
+
+            float time_load = util_time_to_ms( t0, util_get_time() );
+
+            const std::string source = threads ?
+                        string_format( "%u threads%s", threads, map_cpu_data ? "" : " (per page mmap)" ) : "cache";
+            const std::string str = string_format(
+                "Load benchmark: %s: %lu events %.2fms%s",
+                source.c_str(), events, time_load, ( ret < 0 ) ? " (failed)" : "" );
+            logf( "%s", str.c_str() );
+
+#if !defined( GPUVIS_TRACE_UTILS_DISABLE )
+            printf( "%s\n", str.c_str() );
+#endif
+        }
+    }
+}
+
 int LightSpeedApp::thread_func( void *data )
 {
     util_time_t t0 = util_get_time();
@@ -200,13 +226,25 @@ int LightSpeedApp::thread_func( void *data )
 
         logf( "Reading trace file %s...", filename );
 
+        if ( LoadBenchmark && ( loading_info->type == trace_type_trace ) )
+            benchmark_trace_file( filename, TrimTrace );
+
         EventCallback trace_cb = std::bind( &TraceEvents::new_event_cb, &trace_events, _1 );
         trace_events.m_trace_info.trim_trace = TrimTrace;
         trace_events.m_trace_info.m_tracestart = loading_info->tracestart;
         trace_events.m_trace_info.m_tracelen = loading_info->tracelen;
+        trace_events.m_trace_info.m_load_threads = LoadThreads;
+        trace_events.m_trace_info.m_map_cpu_data = MapTraceData;
+        trace_events.m_trace_info.m_resume.clear();
         loading_info->tracestart = 0;
         loading_info->tracelen = 0;
 
+        trace_events.m_event_runs.push_back( trace_events.m_events.size() );
+
+        loading_info->use_cache = UseTraceCache && ( loading_info->type == trace_type_trace ) &&
+                                  loading_info->last && trace_events.m_events.empty();
+        loading_info->from_cache = false;
+
         int ret = 0;
         switch ( loading_info->type )
         {
@@ -221,6 +259,10 @@ int LightSpeedApp::thread_func( void *data )
             break;
         }
 
+        // Resume points are only good for tailing a file loaded on its own
+        if ( trace_events.m_event_runs.size() > 1 )
+            trace_events.m_trace_info.m_resume.clear();
+
         if ( ret < 0 )
         {
             logf( "[Error] load_trace_file(%s) failed.", filename );
@@ -236,49 +278,76 @@ int LightSpeedApp::thread_func( void *data )
     {
         GPUVIS_TRACE_BLOCK( "trace_init" );
 
-        // Sort events (with multiple files, events are added out of order)
-        std::sort( trace_events.m_events.begin(), trace_events.m_events.end(),
-                   [ = ]( const trace_event_t &lx, const trace_event_t &rx ) {
-                       return lx.ts < rx.ts;
-                   } );
-
-        // Assign event ids
-        for ( uint32_t i = 0; i < trace_events.m_events.size(); i++ )
-        {
-            trace_event_t &event = trace_events.m_events[ i ];
+        // Merge loaded files, assign event ids, collect comm and print info
+        if ( !loading_info->from_cache )
+            trace_events.prepare_events();
 
-            event.id = i;
+        float time_load = util_time_to_ms( t0, util_get_time() );
 
-            // If this is a sched_switch event, see if it has comm info we don't know about.
-            // This is the reason we're initializing events in two passes to collect all this data.
-            if ( event.is_sched_switch() )
-            {
-                add_sched_switch_pid_comm( trace_events.m_trace_info, event, "prev_pid", "prev_comm" );
-                add_sched_switch_pid_comm( trace_events.m_trace_info, event, "next_pid", "next_comm" );
-            }
-            else if ( event.is_ftrace_print() )
-            {
-                trace_events.new_event_ftrace_print( event );
-            }
+        if ( loading_info->from_cache )
+        {
+            // Restored events are already initialized, only the text index is left
+            trace_events.start_text_index();
+        }
+        else
+        {
+            // Call TraceEvents::init() to initialize all events, etc.
+            trace_events.init();
         }
 
-        float time_load = util_time_to_ms( t0, util_get_time() );
-
-        // Call TraceEvents::init() to initialize all events, etc.
-        trace_events.init();
+        if ( FilterBenchmark )
+            trace_events.benchmark_filters();
 
         float time_init = util_time_to_ms( t0, util_get_time() ) - time_load;
 
+        // Don't cache partial loads
+        if ( loading_info->use_cache && !loading_info->from_cache &&
+             ( s_app().get_state() != State_CancelLoading ) )
+        {
+            const std::string cachefile = get_trace_cache_filename( filename );
+
+            if ( write_trace_cache( filename, trace_events ) )
+                logf( "Wrote trace cache %s", cachefile.c_str() );
+            else
+                logf( "[Error] Writing trace cache %s failed", cachefile.c_str() );
+        }
+
+        size_t strsize = trace_events.m_strpool.get_totsize();
         const std::string str = string_format(
-            "Events read: %lu (Load:%.2fms Init:%.2fms) (string chunks:%lu size:%lu)",
-            trace_events.m_events.size(), time_load, time_init,
-            trace_events.m_strpool.m_alloc.m_chunks.size(), trace_events.m_strpool.m_alloc.m_totsize );
+            "Events read: %lu (Load:%.2fms Init:%.2fms Threads:%u) (string chunks:%lu size:%lu)",
+            trace_events.m_events.size(), time_load, time_init, trace_events.m_trace_info.m_load_threads,
+            trace_events.m_strpool.get_chunk_count(), strsize );
         logf( "%s", str.c_str() );
 
 #if !defined( GPUVIS_TRACE_UTILS_DISABLE )
         printf( "%s\n", str.c_str() );
 #endif
 
+        // Report memory used per event: event structs, fields and pooled strings
+        size_t numfields = 0;
+        size_t numevents = std::max< size_t >( 1, trace_events.m_events.size() );
+
+        for ( const trace_event_t &event : trace_events.m_events )
+            numfields += event.numfields;
+
+        size_t locssize = trace_events.m_comm_locs.mem_size() +
+                trace_events.m_eventnames_locs.mem_size() +
+                trace_events.m_sched_switch_prev_locs.mem_size() +
+                trace_events.m_sched_switch_next_locs.mem_size() +
+                trace_events.m_sched_switch_cpu_locs.mem_size() +
+                trace_events.m_tdopexpr_locs.mem_size();
+
+        const std::string memstr = string_format(
+            "Event memory: %.1f bytes/event (event:%lu fields:%.1f strings:%.1f locations:%.1f) peak RSS:%.1fMB",
+            ( double )( trace_events.m_events.capacity() * sizeof( trace_event_t ) +
+                        numfields * sizeof( event_field_t ) + strsize + locssize ) / numevents,
+            sizeof( trace_event_t ),
+            ( double )( numfields * sizeof( event_field_t ) ) / numevents,
+            ( double )strsize / numevents,
+            ( double )locssize / numevents,
+            util_get_peak_rss() / ( 1024.0 * 1024.0 ) );
+        logf( "%s", memstr.c_str() );
+
         // 0 means events have all all been loaded
         trace_events.m_eventsloaded.store( 0 );
     }
@@ -331,6 +400,8 @@ void LightSpeedApp::shutdown()
 
     set_state( State_Idle );
 
+    stop_tail();
+
     delete m_trace_win;
     m_trace_win = NULL;
 }
@@ -454,6 +525,8 @@ void LightSpeedApp::render()
     }
     else if ( m_trace_win )
     {
+        stop_tail();
+
         delete m_trace_win;
         m_trace_win = NULL;
     }
@@ -631,6 +704,121 @@ void LightSpeedApp::update()
 
         m_loading_info.inputfiles.erase( m_loading_info.inputfiles.begin() );
     }
+
+    update_tail();
+}
+
+void LightSpeedApp::update_tail()
+{
+    // Trim job owns the trace events until it's done
+    if ( m_tail.trim_job )
+    {
+        if ( !m_tail.trim_job->is_done() )
+            return;
+
+        finish_tail_trim();
+    }
+
+    bool tail = TailTrace && is_trace_loaded() &&
+                ( m_trace_type == trace_type_trace ) && ( get_state() == State_Idle );
+
+    if ( !tail || ( m_tail.win != m_trace_win ) )
+    {
+        stop_tail();
+
+        if ( !tail )
+            return;
+    }
+
+    TraceEvents &trace_events = m_trace_win->m_trace_events;
+
+    if ( !m_tail.tail.is_running() )
+    {
+        std::vector< cpu_resume_t > resume = trace_events.m_trace_info.m_resume;
+
+        // Cache and multiple file loads don't leave resume points for our
+        //  file: pick up after our last event on every cpu.
+        if ( resume.empty() && !trace_events.m_events.empty() )
+        {
+            cpu_resume_t last;
+
+            last.ts = trace_events.m_trace_info.min_file_ts + trace_events.m_events.back().ts;
+            last.ts_count = UINT32_MAX;
+            resume.assign( 1, last );
+        }
+
+        m_tail.win = m_trace_win;
+
+        m_tail.tail.start( trace_events.m_filename.c_str(), &trace_events.m_strpool, resume,
+                           LoadThreads, TailPollMs );
+        logf( "Tailing %s", trace_events.m_filename.c_str() );
+    }
+
+    while ( trace_chunk_t *chunk = m_tail.tail.get_chunk() )
+    {
+        util_time_t t0 = util_get_time();
+        size_t count = m_trace_win->append_events( chunk->trace_info, chunk->events );
+        float time_append = util_time_to_ms( t0, util_get_time() );
+
+        logf( "Tail: added %lu events from %s (%.2fms)", count, chunk->filename.c_str(), time_append );
+
+        delete chunk;
+    }
+
+    // Keep a window of the newest events: once over TailMaxEvents, drop the
+    //  oldest ones down to half of it so trims don't happen on every append.
+    size_t max_events = TailMaxEvents;
+    size_t num_events = trace_events.m_events.size();
+
+    if ( max_events && ( num_events > max_events ) )
+    {
+        uint32_t count = num_events - max_events / 2;
+
+        m_tail.trim_count = count;
+        m_tail.trim_t0 = util_get_time();
+
+        // Show as initializing so nothing reads the events while they're shifted
+        trace_events.m_eventsloaded.store( 0x40000000 | count );
+
+        m_tail.trim_job = new AsyncJob;
+        m_tail.trim_job->start( [ &trace_events, count ]()
+        {
+            trace_events.trim_events( count );
+        } );
+    }
+}
+
+void LightSpeedApp::finish_tail_trim()
+{
+    TraceWin *win = m_tail.win;
+
+    m_tail.trim_job->wait();
+    delete m_tail.trim_job;
+    m_tail.trim_job = NULL;
+
+    size_t num_events = win->m_trace_events.m_events.size() + m_tail.trim_count;
+
+    win->m_trace_events.m_eventsloaded.store( 0 );
+    win->events_trimmed( m_tail.trim_count );
+
+    logf( "Tail: %lu events is over TailMaxEvents, trimmed oldest %u (%.2fms)",
+          num_events, m_tail.trim_count, util_time_to_ms( m_tail.trim_t0, util_get_time() ) );
+}
+
+void LightSpeedApp::stop_tail()
+{
+    m_tail.tail.stop();
+
+    if ( m_tail.win )
+    {
+        if ( m_tail.trim_job )
+            finish_tail_trim();
+
+        // Add matches for the events we appended
+        m_tail.win->update_tdopexpr_append( true );
+    }
+
+    m_tail.win = NULL;
 }
 
 static const std::string trace_info_label( TraceEvents &trace_events )
@@ -749,8 +937,8 @@ static void render_color_items( colors_t i0, colors_t i1,
 static trace_event_t *get_first_colorable_event(
     TraceEvents &trace_events, const char *eventname )
 {
-    const std::vector< uint32_t > *plocs =
-        trace_events.m_eventnames_locs.get_locations_str( eventname );
+    const EventLocs *plocs =
+        trace_events.m_eventnames_locs.get_locations_str( trace_events.m_strpool, eventname );
 
     if ( plocs )
     {
@@ -777,7 +965,7 @@ static void render_color_event_items( TraceEvents &trace_events,
     // Iterate through all the event names
     for ( auto item : trace_events.m_eventnames_locs.m_locs.m_map )
     {
-        const char *eventname = trace_events.m_strpool.findstr( item.first );
+        const char *eventname = trace_events.m_strpool.findid( item.first );
         const trace_event_t *event = get_first_colorable_event( trace_events, eventname );
 
         if ( event )
@@ -915,6 +1103,7 @@ static void reset_event_colors_to_default( TraceWin *win )
             if ( !( event.flags & TRACE_FLAG_AUTOGEN_COLOR ) )
                 event.color = 0;
         }
+        win->m_trace_events.m_color_gen++;
     }
 }
 
@@ -1118,7 +1307,7 @@ void LightSpeedApp::open_trace_dialog()
     else
     {
         const char *file = noc_file_dialog_open( NOC_FILE_DIALOG_OPEN,
-                                                 "trace-cmd files (*.dat;*.trace;*.etl;*.zip)\0*.dat;*.trace;*.etl;*.zip\0",
+                                                 "trace-cmd files (*.dat;*.trace;*.etl;*.zip;*.gz;*.zst)\0*.dat;*.trace;*.etl;*.zip;*.gz;*.zst\0",
                                                  NULL, "trace.dat" );
 
         if ( file && file[ 0 ] )
@@ -1178,6 +1367,29 @@ void LightSpeedApp::render_menu( const char *str_id )
                     return close_popup;
                 };
             }
+
+            label = string_format( "Export '%s' for Perfetto / Chrome...", basename );
+            if ( ImGui::MenuItem( label.c_str() ) )
+            {
+                std::string exportname = basename;
+                size_t dot = exportname.rfind( '.' );
+
+                if ( dot != std::string::npos )
+                    exportname.erase( dot );
+                exportname += ".perfetto-trace";
+
+                m_saving_info.filename_orig = get_realpath( filename.c_str() );
+                m_saving_info.title = "Export trace as (.json for Chrome JSON, otherwise Perfetto):";
+                strcpy_safe( m_saving_info.filename_buf, exportname.c_str() );
+
+                // Lambda for exporting loaded trace to filename_new
+                m_saving_info.save_cb = [ & ]( save_info_t &save_info ) {
+                    const char *filename_new = save_info.filename_new.c_str();
+
+                    return export_trace( m_trace_win->m_trace_events, filename_new,
+                                         export_format_from_filename( filename_new ), save_info.errstr );
+                };
+            }
         }
 
         if ( ImGui::MenuItem( "Quit", s_actions().hotkey_str( action_quit ).c_str() ) )